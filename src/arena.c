@@ -0,0 +1,173 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file arena.c
+ * Arena allocator for jobs and their buffers.
+ *
+ * An arena hands out memory from big chunks allocated from the heap. Sizes
+ * are rounded up to a power of two, and freed memory is kept in a free list
+ * for its size class, so workloads that repeatedly create and free jobs of
+ * similar sizes quickly stop needing new chunks. Resetting an arena empties
+ * the free lists and rewinds the chunks, releasing everything at once. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdlib.h>
+#include "librsync.h"
+#include "trace.h"
+#include "util.h"
+
+/** Log2 of the smallest size class, which must fit a pointer. */
+#define RS_ARENA_MIN_CLASS 5
+
+/** The number of size classes, enough for any size_t. */
+#define RS_ARENA_CLASSES (8 * sizeof(size_t))
+
+/** Default arena chunk size. */
+#define RS_ARENA_CHUNK_SIZE ((size_t)1 << 20)
+
+/** A chunk of memory allocated from the heap. */
+typedef union rs_arena_chunk {
+    struct {
+        union rs_arena_chunk *next;
+        size_t size;            /**< Size of the chunk data. */
+        size_t used;            /**< Bytes of the data allocated. */
+    } h;
+    long double align;
+} rs_arena_chunk_t;
+
+struct rs_arena {
+    rs_allocator_t allocator;
+    size_t chunk_size;
+    rs_arena_chunk_t *chunks;   /**< Chunks in use, current one first. */
+    rs_arena_chunk_t *spare;    /**< Empty chunks kept after a reset. */
+    void *free_list[RS_ARENA_CLASSES];  /**< Freed blocks for each class. */
+};
+
+/** Get the size class for a size, or the largest class if it's too big. */
+static int rs_arena_class(size_t size)
+{
+    int c = RS_ARENA_MIN_CLASS;
+
+    while (c < (int)RS_ARENA_CLASSES - 1 && ((size_t)1 << c) < size)
+        c++;
+    return c;
+}
+
+/** Get a chunk with at least size bytes of data. */
+static rs_arena_chunk_t *rs_arena_chunk(rs_arena_t *arena, size_t size)
+{
+    rs_arena_chunk_t *c, **p;
+
+    /* Use a spare chunk if there is one big enough. */
+    for (p = &arena->spare; (c = *p); p = &c->h.next) {
+        if (c->h.size >= size) {
+            *p = c->h.next;
+            return c;
+        }
+    }
+    if (size < arena->chunk_size)
+        size = arena->chunk_size;
+    if (!(c = malloc(sizeof(*c) + size)))
+        return NULL;
+    rs_trace("allocated arena chunk of " FMT_SIZE " bytes", size);
+    c->h.size = size;
+    c->h.used = 0;
+    return c;
+}
+
+static void *rs_arena_alloc(void *opaque, size_t size)
+{
+    rs_arena_t *arena = opaque;
+    rs_arena_chunk_t *c = arena->chunks;
+    int class = rs_arena_class(size);
+    void *p;
+
+    /* Sizes bigger than the largest class can't be allocated. */
+    if (size > (size_t)1 << class)
+        return NULL;
+    size = (size_t)1 << class;
+    if ((p = arena->free_list[class])) {
+        arena->free_list[class] = *(void **)p;
+        return p;
+    }
+    if (!c || c->h.size - c->h.used < size) {
+        /* The rest of the current chunk is wasted until the next reset. */
+        if (!(c = rs_arena_chunk(arena, size)))
+            return NULL;
+        c->h.next = arena->chunks;
+        arena->chunks = c;
+    }
+    p = (char *)(c + 1) + c->h.used;
+    c->h.used += size;
+    return p;
+}
+
+static void rs_arena_release(void *opaque, void *ptr, size_t size)
+{
+    rs_arena_t *arena = opaque;
+    int class = rs_arena_class(size);
+
+    *(void **)ptr = arena->free_list[class];
+    arena->free_list[class] = ptr;
+}
+
+rs_arena_t *rs_arena_new(size_t chunk_size)
+{
+    rs_arena_t *arena;
+
+    /* The arena itself always comes from the heap. */
+    if (!(arena = calloc(1, sizeof(*arena)))) {
+        rs_fatal("couldn't allocate instance of rs_arena_t");
+    }
+    arena->allocator.alloc = rs_arena_alloc;
+    arena->allocator.free = rs_arena_release;
+    arena->allocator.opaque = arena;
+    arena->chunk_size = chunk_size ? chunk_size : RS_ARENA_CHUNK_SIZE;
+    return arena;
+}
+
+rs_allocator_t const *rs_arena_allocator(rs_arena_t *arena)
+{
+    return &arena->allocator;
+}
+
+void rs_arena_reset(rs_arena_t *arena)
+{
+    rs_arena_chunk_t *c;
+
+    while ((c = arena->chunks)) {
+        arena->chunks = c->h.next;
+        c->h.used = 0;
+        c->h.next = arena->spare;
+        arena->spare = c;
+    }
+    rs_bzero(arena->free_list, sizeof(arena->free_list));
+}
+
+void rs_arena_free(rs_arena_t *arena)
+{
+    rs_arena_chunk_t *c;
+
+    rs_arena_reset(arena);
+    while ((c = arena->spare)) {
+        arena->spare = c->h.next;
+        free(c);
+    }
+    free(arena);
+}
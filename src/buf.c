@@ -38,6 +38,7 @@ struct rs_filebuf {
     FILE *f;
     char *buf;
     size_t buf_len;
+    rs_long_t left;             /**< Bytes left to read, or -1 for all. */
 };
 
 rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len)
@@ -47,14 +48,20 @@ rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len)
     pf->buf = rs_alloc(buf_len, "file buffer");
     pf->buf_len = buf_len;
     pf->f = f;
+    pf->left = -1;
     return pf;
 }
 
+void rs_filebuf_limit(rs_filebuf_t *fb, rs_long_t len)
+{
+    fb->left = len;
+}
+
 void rs_filebuf_free(rs_filebuf_t *fb)
 {
-    free(fb->buf);
+    rs_free(fb->buf);
     rs_bzero(fb, sizeof *fb);
-    free(fb);
+    rs_free(fb);
 }
 
 /* If the stream has no more data available, read some from F into BUF, and let
@@ -83,7 +90,15 @@ rs_result rs_infilebuf_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
         memmove(fb->buf, buf->next_in, buf->avail_in);
     }
     buf->next_in = fb->buf;
-    len = fread(fb->buf + buf->avail_in, 1, fb->buf_len - buf->avail_in, f);
+    len = fb->buf_len - buf->avail_in;
+    if (fb->left >= 0 && (rs_long_t)len > fb->left)
+        len = (size_t)fb->left;
+    if (!len) {
+        rs_trace("seen end of range on input");
+        buf->eof_in = 1;
+        return RS_DONE;
+    }
+    len = fread(fb->buf + buf->avail_in, 1, len, f);
     if (len == 0) {
         if ((buf->eof_in = feof(f))) {
             rs_trace("seen end of file on input");
@@ -95,6 +110,8 @@ rs_result rs_infilebuf_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
     }
     buf->avail_in += len;
     job->stats.in_bytes += len;
+    if (fb->left >= 0)
+        fb->left -= (rs_long_t)len;
     return RS_DONE;
 }
 
@@ -43,6 +43,9 @@ rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len);
 
 void rs_filebuf_free(rs_filebuf_t *fb);
 
+/** Limit the input read from a file buffer to the next len bytes. */
+void rs_filebuf_limit(rs_filebuf_t *fb, rs_long_t len);
+
 rs_result rs_infilebuf_fill(rs_job_t *, rs_buffers_t *buf, void *fb);
 
 rs_result rs_outfilebuf_drain(rs_job_t *, rs_buffers_t *, void *fb);
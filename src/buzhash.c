@@ -0,0 +1,139 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * buzhash -- The buzhash rolling checksum.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#include "config.h"             /* IWYU pragma: keep */
+#include "buzhash.h"
+
+/* The values are from splitmix64, so they are fixed for all platforms. */
+const uint64_t rs_gear[256] = {
+    0xea0c9a49ac0761b1ULL, 0x75f7434bcf812794ULL, 0x4e8e84e72c255b25ULL,
+    0x3ed7779c65a36e7fULL, 0xe2437330467063f4ULL, 0xddb2b0a09dd58e0dULL,
+    0x0d40361510a3f6eeULL, 0x66bf836e20c402a6ULL, 0x3e156eb5eae38e17ULL,
+    0x5a77118a579d8ba4ULL, 0xa7d62cd5a27fe130ULL, 0x6e2b71546a9b7f0aULL,
+    0xdf879d08b72ff547ULL, 0x135f8ba37feebc62ULL, 0xe37cd562c13385e0ULL,
+    0x9f5b93a9fdb0f2abULL, 0x08bfc157c8976efbULL, 0xcbae891fc6632934ULL,
+    0x1908b2ad4b0f322fULL, 0x8df12f6f129ee6f5ULL, 0xb60a6ea3c73cc2aaULL,
+    0xee0e9b846fbcf886ULL, 0x951ec54c46e0144fULL, 0x096843a5ba2e2fb7ULL,
+    0x75e6dbf4f554557eULL, 0xb15ad4be76a1542dULL, 0x6811733278915fe7ULL,
+    0xb6b0635b9477c317ULL, 0x10f5a4ceac2f6366ULL, 0xb030dca13b313103ULL,
+    0x315c8ff94aab13cfULL, 0x7df5426084c44030ULL, 0x32b65b39d7240d95ULL,
+    0x606eb7d8904318f6ULL, 0x56225ce6dcfd5645ULL, 0x0fe3d8d9f50ed5ecULL,
+    0xf30f3f31cb53cc25ULL, 0x550a64d6c173cf0cULL, 0x3bd66f154dda0941ULL,
+    0xcb89fff8474cffcaULL, 0xec550205a7d539d5ULL, 0xa38ca6e002935c9aULL,
+    0xc1769d4dd2dfff5cULL, 0x341d58d3bedd5707ULL, 0xec419e298cf7034bULL,
+    0xd67472211dcc08f1ULL, 0xa8eca512eb40dd26ULL, 0xb8bba11f5a3e09e2ULL,
+    0xd0cd85b9f9bda038ULL, 0x10999b0b5002012dULL, 0x8c47985baf3bde72ULL,
+    0x99371a07414b5d19ULL, 0x477e8d9a075a197dULL, 0x5438c11672ccc70fULL,
+    0x372a3aa83bdafdbfULL, 0x351031702cacfe2bULL, 0x2f48d7265bc3b797ULL,
+    0x88077f0435e1d557ULL, 0x8681595577b23731ULL, 0xf09eca583e491057ULL,
+    0xf492a8a2278f1fc1ULL, 0x1bff3cab40950038ULL, 0x212e421c9a69b70fULL,
+    0x8e236f80e24cbc6cULL, 0xb84ee53361d46099ULL, 0xbb57d667c533fbb4ULL,
+    0x1b368471944409fbULL, 0xee6730c469b080b0ULL, 0x616232b842ff7bc5ULL,
+    0xebc35e965f95df46ULL, 0xcd4e70d01b1cda29ULL, 0x22709785979f3cb5ULL,
+    0xcf20ded300ff3da4ULL, 0xa6f0524b4ed94cccULL, 0x54bbae16dc8af830ULL,
+    0x458473b20653bed5ULL, 0xee9029ade47e6d10ULL, 0x0dad2246931c20cbULL,
+    0xf37130b71d164c37ULL, 0x12e28b70410b21c8ULL, 0xafe44f092b34b798ULL,
+    0x8bccb1d53c03ed49ULL, 0x6297455402e6f800ULL, 0x7db042f4ef98f54bULL,
+    0x16a79070077365d3ULL, 0x3e3b3d97698b2c48ULL, 0xa6c04035c760414bULL,
+    0xacffc6e190738e1dULL, 0x11053e7706a887a5ULL, 0xc49ead10b5cd6055ULL,
+    0xccd833cb4a489a10ULL, 0x017cffbf1f8a5ee8ULL, 0xb1eb4a6817662b45ULL,
+    0xa0e960163547a3d7ULL, 0x38bc72a984305d5dULL, 0xb8b04162540fe122ULL,
+    0x1c23a7a6848d30a9ULL, 0x41a4cc62997e68a4ULL, 0x3c1f020f0e907dacULL,
+    0xd04f1400e461c6e0ULL, 0xf2f25072e83284a1ULL, 0x0095d70eddede1f0ULL,
+    0x33d2f481933a32bdULL, 0x24bf68eefb11d4b5ULL, 0xeaea14656ddeb9bbULL,
+    0x28c759f979e4cecaULL, 0xee4cdde46c8ca185ULL, 0x96c7bbca744e4dc6ULL,
+    0x86470cf19e247f3aULL, 0x38247a46d9fb5315ULL, 0x143424e11bebe8b0ULL,
+    0xe3e96973aeb00fddULL, 0x6c9c95220ac7c689ULL, 0x108b6c10d5d471d0ULL,
+    0x65af93e8eb2bcfb8ULL, 0xcd77c6cd9d603245ULL, 0x18f9e290c5aa100fULL,
+    0xf3ad44ed295e08a3ULL, 0xc0479d052ef2947bULL, 0x7d08b986c2caa6c5ULL,
+    0x2f4a201ae99ad651ULL, 0xcc6c0fe52553fa34ULL, 0x1b3b0eae5ed129edULL,
+    0x260b0d6fb629aef4ULL, 0x899647acba2f1783ULL, 0x3e72784c79293048ULL,
+    0xcfa5af84bb599de1ULL, 0x5cf7f9a504b6745aULL, 0x1538003c95e80c18ULL,
+    0x60e3f6f0736051acULL, 0x0e81c1444dc2ccb1ULL, 0x4899faccb3611163ULL,
+    0x6a1dfece93a14984ULL, 0xb1f7e3b3a9e2c83bULL, 0x3b77a34c4fbfc18aULL,
+    0x053772de6919aea2ULL, 0x89d16d10ec58e204ULL, 0xf7c3f581c947abd7ULL,
+    0x10df87a12f45808aULL, 0x6bab0863f8df89f6ULL, 0xd299fbc87d6eb64eULL,
+    0x11f1011bcb589d9cULL, 0x7dd061038b967298ULL, 0xa4c376b40b01fa03ULL,
+    0x917f03495da8492eULL, 0xcc31b657bc0edef2ULL, 0x336230ac39910b71ULL,
+    0xc86325bd99fee7d7ULL, 0x7a33bc1ae45db499ULL, 0xa8314c529300dac7ULL,
+    0x33a98b41181d1045ULL, 0x790f4920b03e44f8ULL, 0x98af4da874bdaeaeULL,
+    0xb95e7d6d8492cedfULL, 0x9566de33f1dcc218ULL, 0x103bcb6135efcbadULL,
+    0x9739c0bdb7a1494cULL, 0x80e61856ea1dc715ULL, 0x84553842609c4d8eULL,
+    0xa5ab2d4a4d510551ULL, 0xad22f47e298a26feULL, 0x09961310e27e0079ULL,
+    0xa818ba3ad342b34dULL, 0xbd592a7483704eb4ULL, 0xde2fda4e1b8e5171ULL,
+    0x89be4c6615605179ULL, 0xea2d96b37b193b72ULL, 0xd98fa4d4ea5bed2eULL,
+    0x00ea237d7098171dULL, 0x8d814b907509c6b5ULL, 0x5d3e5be40368402aULL,
+    0x0c1a23de6595e43cULL, 0xb308477adbcd2d3aULL, 0xbaddd7b60b43f749ULL,
+    0x9d8237138fd433a9ULL, 0x11857685bd71799aULL, 0x9182d15634755bb0ULL,
+    0xda8f6c1f65b91b1fULL, 0x78f777972d5f56b4ULL, 0xe369362533f01060ULL,
+    0x75235d4c51a259d8ULL, 0xd6355841a182326cULL, 0x646971c8563a7f14ULL,
+    0x951afadda4413c04ULL, 0xb07bcfd4032feb2dULL, 0x55eaf3452ab1c25bULL,
+    0xba879d8f7b8f8607ULL, 0x8341d190b02c2d7bULL, 0x9239ea5a190dbb4bULL,
+    0x8fb354fe47ad7a1eULL, 0xef3a6f6407a87dfeULL, 0xd80d41f86380940cULL,
+    0xf16c923c1e466f4cULL, 0x2546ea13eef63ae8ULL, 0x4c6e7610a9210f18ULL,
+    0x3dd66c8b2c903b12ULL, 0xec60a6a66bfd0781ULL, 0x3abf0e0e0ecdc1baULL,
+    0x5e981fdeaaadb6a3ULL, 0x339a69f19a460f3dULL, 0x22f1e32fd2fe2a2aULL,
+    0x2647184ac923517eULL, 0x9623624abdbb16a9ULL, 0xdbe3f5c8fa91ea39ULL,
+    0x9c14f6ca098dc853ULL, 0x6c41c8a062ec58f3ULL, 0x0478e3acd60422c3ULL,
+    0xce8a5aa1c694e41aULL, 0x385b22e276d033c7ULL, 0xbfc763d8a9e09472ULL,
+    0x92a8e36b4f6847e9ULL, 0xcab55ae22e98f126ULL, 0x4472aeb652f5d921ULL,
+    0x0ecee1804f981dceULL, 0xb65e3079b4845c7eULL, 0x587b214880dd6511ULL,
+    0xe4ae71f933007c99ULL, 0x5305515526ea5de3ULL, 0x73ea05d34955c3f3ULL,
+    0x709377619659233bULL, 0x8d5e5df4f2f9ad6eULL, 0x410fb0ce021dfc3dULL,
+    0x7bb565dc7ed5750eULL, 0x883419fa6986a7b2ULL, 0xdad011fdca83f90bULL,
+    0xfd26ac08ad5ff832ULL, 0x5fc1575508df2549ULL, 0x44c8b2d81977711bULL,
+    0x22fdaf87d78fd9b4ULL, 0x46f6dc4f430644abULL, 0x5e0d0401979a2aebULL,
+    0xbd82263dfd1cca14ULL, 0xab248b811c72fd3eULL, 0xb686a45f80535c7dULL,
+    0xe5eef06991ffaed3ULL, 0xd682111df3d9e91fULL, 0xda5de18dfd811378ULL,
+    0x5a58fe408ef5d090ULL, 0x1d4a77fb9c7ac50aULL, 0x87fd2680ecf4e15aULL,
+    0x3fb690acda540e96ULL, 0x66ac9d8772569a30ULL, 0x3d1855852531b83bULL,
+    0x14262deaeb0a09f4ULL, 0xdcca71408b951812ULL, 0x9260ded32a856b7bULL,
+    0x012ebafa30f6a6a2ULL, 0x7c178263dd0bd380ULL, 0xf14917fe1732f2ecULL,
+    0x2d9b08d46b2ece13ULL, 0x101d3239fd7b8f61ULL, 0x2afbe59cc4afe0ceULL,
+    0xbc2b89b39c5bb739ULL, 0xc99cea268cd88379ULL, 0xe3a5bbfb0290f721ULL,
+    0xedb3050b996ded63ULL
+};
+
+/* Macro for doing 4 bytes with the rotates done in parallel, so the hash
+   only has one dependent rotate and xor per 4 bytes. */
+#define BUZ4(hash,buf) (buzhash_rotl((hash), 4) ^ \
+                        buzhash_rotl(buzhash_gear((buf)[0]), 3) ^ \
+                        buzhash_rotl(buzhash_gear((buf)[1]), 2) ^ \
+                        buzhash_rotl(buzhash_gear((buf)[2]), 1) ^ \
+                        buzhash_gear((buf)[3]))
+
+void buzhash_update(buzhash_t *sum, const unsigned char *buf, size_t len)
+{
+    size_t n = len;
+    uint32_t hash = sum->hash;
+
+    while (n >= 16) {
+        hash = BUZ4(hash, buf);
+        hash = BUZ4(hash, buf + 4);
+        hash = BUZ4(hash, buf + 8);
+        hash = BUZ4(hash, buf + 12);
+        buf += 16;
+        n -= 16;
+    }
+    while (n) {
+        hash = buzhash_rotl(hash, 1) ^ buzhash_gear(*buf++);
+        n--;
+    }
+    sum->hash = hash;
+    sum->count += len;
+}
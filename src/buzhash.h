@@ -0,0 +1,97 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * buzhash -- The buzhash rolling checksum.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file buzhash.h
+ * The buzhash_t class implementation of the buzhash rollsum.
+ *
+ * Buzhash is a cyclic polynomial hash using a table of random values for each
+ * byte. The hash of bytes b[0..n] is the xor of gear[b[i]] rotated left by
+ * n-1-i bits, so rolling in a byte is a rotate, a table lookup, and an xor,
+ * and rolling out a byte xors out its value rotated by the count. Unlike the
+ * other rollsums there are no multiplies or dependent adds.
+ *
+ * Rotations repeat every 32 bytes, so bytes 32 apart with the same value
+ * cancel out. This makes blocks of a repeating pattern hash the same, but
+ * their strong sums are still checked. */
+#ifndef BUZHASH_H
+#  define BUZHASH_H
+
+#  include <stddef.h>
+#  include <stdint.h>
+
+/** The random values for each byte.
+ *
+ * These are also used by the gear hash for content defined chunks, with all
+ * 64 bits. Buzhash uses the bottom 32 bits. */
+extern const uint64_t rs_gear[256];
+
+/** The buzhash_t state type. */
+typedef struct buzhash {
+    size_t count;               /**< Count of bytes included in sum. */
+    uint32_t hash;              /**< The accumulated hash value. */
+} buzhash_t;
+
+/** Rotate a 32 bit value left by n bits. */
+static inline uint32_t buzhash_rotl(uint32_t v, unsigned n)
+{
+    /* Compilers make this a single rotate instruction. */
+    return (v << (n & 31)) | (v >> (-n & 31));
+}
+
+/** Get the table value for a byte. */
+static inline uint32_t buzhash_gear(unsigned char b)
+{
+    return (uint32_t)rs_gear[b];
+}
+
+static inline void buzhash_init(buzhash_t *sum)
+{
+    sum->count = 0;
+    sum->hash = 0;
+}
+
+void buzhash_update(buzhash_t *sum, const unsigned char *buf, size_t len);
+
+static inline void buzhash_rotate(buzhash_t *sum, unsigned char out,
+                                  unsigned char in)
+{
+    sum->hash =
+        buzhash_rotl(sum->hash, 1) ^ buzhash_rotl(buzhash_gear(out),
+                                                  (unsigned)sum->count) ^
+        buzhash_gear(in);
+}
+
+static inline void buzhash_rollin(buzhash_t *sum, unsigned char in)
+{
+    sum->hash = buzhash_rotl(sum->hash, 1) ^ buzhash_gear(in);
+    sum->count++;
+}
+
+static inline void buzhash_rollout(buzhash_t *sum, unsigned char out)
+{
+    sum->count--;
+    sum->hash ^= buzhash_rotl(buzhash_gear(out), (unsigned)sum->count);
+}
+
+static inline uint32_t buzhash_digest(buzhash_t *sum)
+{
+    return sum->hash;
+}
+
+#endif                          /* !BUZHASH_H */
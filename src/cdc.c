@@ -0,0 +1,58 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file cdc.c
+ * Content defined chunking with a gear hash. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include "cdc.h"
+#include "util.h"
+
+/** Get a mask of the top n bits of the gear hash. */
+static inline uint64_t rs_cdc_mask(int n)
+{
+    if (n < 1)
+        n = 1;
+    else if (n > 63)
+        n = 63;
+    return ~(uint64_t)0 << (64 - n);
+}
+
+size_t rs_cdc_cut(size_t avg, rs_byte_t const *buf, size_t len, int eof)
+{
+    const size_t min = RS_CDC_MIN(avg), max = RS_CDC_MAX(avg);
+    const int bits = rs_long_ln2((rs_long_t)avg);
+    const uint64_t mask_s = rs_cdc_mask(bits + 2), mask_l =
+        rs_cdc_mask(bits - 2);
+    size_t i = min, end = len < max ? len : max, mid = avg < end ? avg : end;
+    uint64_t h = 0;
+
+    for (; i < mid; i++) {
+        h = (h << 1) + rs_gear[buf[i]];
+        if (!(h & mask_s))
+            return i + 1;
+    }
+    for (; i < end; i++) {
+        h = (h << 1) + rs_gear[buf[i]];
+        if (!(h & mask_l))
+            return i + 1;
+    }
+    /* Without a cut, the chunk is the max or the rest of the data. */
+    return end == max || eof ? end : 0;
+}
@@ -0,0 +1,53 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file cdc.h
+ * Content defined chunking with a gear hash.
+ *
+ * This cuts data into chunks where the gear hash of the bytes before the cut
+ * has its top bits zero, as in FastCDC. The hash only depends on the last 64
+ * bytes, so an insert or delete only moves the cuts near it, and the chunks
+ * after it are the same as before. No cut is made in the first min bytes of
+ * a chunk, which is also not hashed. The chunk is cut at max bytes if the hash
+ * hasn't cut it. Up to the average length more hash bits must be zero than
+ * after it, which normalizes the chunk lengths towards the average. */
+#ifndef CDC_H
+#  define CDC_H
+
+#  include <stddef.h>
+#  include <stdint.h>
+#  include "librsync.h"
+#  include "buzhash.h"
+
+/** The min length of a chunk for an average chunk length. */
+#  define RS_CDC_MIN(avg) ((size_t)(avg) / 4)
+
+/** The max length of a chunk for an average chunk length. */
+#  define RS_CDC_MAX(avg) ((size_t)(avg) * 8)
+
+/** Find the length of the chunk at the start of buf[0..len].
+ *
+ * \param avg The average chunk length.
+ *
+ * \param eof Whether the data ends at len.
+ *
+ * \return The chunk length, or 0 if more data is needed to find it. */
+size_t rs_cdc_cut(size_t avg, rs_byte_t const *buf, size_t len, int eof);
+
+#endif                          /* !CDC_H */
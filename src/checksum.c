@@ -38,11 +38,16 @@ rs_weak_sum_t rs_calc_weak_sum(weaksum_kind_t kind, void const *buf, size_t len)
         RollsumInit(&sum);
         RollsumUpdate(&sum, buf, len);
         return RollsumDigest(&sum);
-    } else {
+    } else if (kind == RS_RABINKARP) {
         rabinkarp_t sum;
         rabinkarp_init(&sum);
         rabinkarp_update(&sum, buf, len);
         return rabinkarp_digest(&sum);
+    } else {
+        buzhash_t sum;
+        buzhash_init(&sum);
+        buzhash_update(&sum, buf, len);
+        return buzhash_digest(&sum);
     }
 }
 
@@ -29,12 +29,14 @@
 #  include "librsync.h"
 #  include "rollsum.h"
 #  include "rabinkarp.h"
+#  include "buzhash.h"
 #  include "hashtable.h"
 
 /** Weaksum implementations. */
 typedef enum {
     RS_ROLLSUM,
     RS_RABINKARP,
+    RS_BUZHASH,
 } weaksum_kind_t;
 
 /** Strongsum implementations. */
@@ -58,6 +60,7 @@ typedef struct weaksum {
     union {
         Rollsum rs;
         rabinkarp_t rk;
+        buzhash_t bh;
     } sum;
 } weaksum_t;
 
@@ -65,20 +68,23 @@ static inline void weaksum_reset(weaksum_t *sum)
 {
     if (sum->kind == RS_ROLLSUM)
         RollsumInit(&sum->sum.rs);
-    else
+    else if (sum->kind == RS_RABINKARP)
         rabinkarp_init(&sum->sum.rk);
+    else
+        buzhash_init(&sum->sum.bh);
 }
 
 static inline void weaksum_init(weaksum_t *sum, weaksum_kind_t kind)
 {
-    assert(kind == RS_ROLLSUM || kind == RS_RABINKARP);
+    assert(kind == RS_ROLLSUM || kind == RS_RABINKARP || kind == RS_BUZHASH);
     sum->kind = kind;
     weaksum_reset(sum);
 }
 
 static inline size_t weaksum_count(weaksum_t *sum)
 {
-    /* We take advantage of sum->sum.rs.count overlaying sum->sum.rk.count. */
+    /* We take advantage of sum->sum.rs.count overlaying sum->sum.rk.count
+       and sum->sum.bh.count. */
     return sum->sum.rs.count;
 }
 
@@ -87,8 +93,10 @@ static inline void weaksum_update(weaksum_t *sum, const unsigned char *buf,
 {
     if (sum->kind == RS_ROLLSUM)
         RollsumUpdate(&sum->sum.rs, buf, len);
-    else
+    else if (sum->kind == RS_RABINKARP)
         rabinkarp_update(&sum->sum.rk, buf, len);
+    else
+        buzhash_update(&sum->sum.bh, buf, len);
 }
 
 static inline void weaksum_rotate(weaksum_t *sum, unsigned char out,
@@ -96,24 +104,30 @@ static inline void weaksum_rotate(weaksum_t *sum, unsigned char out,
 {
     if (sum->kind == RS_ROLLSUM)
         RollsumRotate(&sum->sum.rs, out, in);
-    else
+    else if (sum->kind == RS_RABINKARP)
         rabinkarp_rotate(&sum->sum.rk, out, in);
+    else
+        buzhash_rotate(&sum->sum.bh, out, in);
 }
 
 static inline void weaksum_rollin(weaksum_t *sum, unsigned char in)
 {
     if (sum->kind == RS_ROLLSUM)
         RollsumRollin(&sum->sum.rs, in);
-    else
+    else if (sum->kind == RS_RABINKARP)
         rabinkarp_rollin(&sum->sum.rk, in);
+    else
+        buzhash_rollin(&sum->sum.bh, in);
 }
 
 static inline void weaksum_rollout(weaksum_t *sum, unsigned char out)
 {
     if (sum->kind == RS_ROLLSUM)
         RollsumRollout(&sum->sum.rs, out);
-    else
+    else if (sum->kind == RS_RABINKARP)
         rabinkarp_rollout(&sum->sum.rk, out);
+    else
+        buzhash_rollout(&sum->sum.bh, out);
 }
 
 static inline rs_weak_sum_t weaksum_digest(weaksum_t *sum)
@@ -121,8 +135,10 @@ static inline rs_weak_sum_t weaksum_digest(weaksum_t *sum)
     if (sum->kind == RS_ROLLSUM)
         /* We apply mix32() to rollsums before using them for matching. */
         return mix32(RollsumDigest(&sum->sum.rs));
-    else
+    else if (sum->kind == RS_RABINKARP)
         return rabinkarp_digest(&sum->sum.rk);
+    else
+        return buzhash_digest(&sum->sum.bh);
 }
 
 /** Calculate a weaksum.
@@ -30,6 +30,11 @@ struct rs_op_kind_name const rs_op_kind_names[] = {
     {"LITERAL", RS_KIND_LITERAL},
     {"SIGNATURE", RS_KIND_SIGNATURE},
     {"CHECKSUM", RS_KIND_CHECKSUM},
+    {"ZLITERAL", RS_KIND_ZLITERAL},
+    {"PRIME", RS_KIND_PRIME},
+    {"WINDOW", RS_KIND_WINDOW},
+    {"SELF", RS_KIND_SELF},
+    {"BLOCK", RS_KIND_BLOCK},
     {"INVALID", RS_KIND_INVALID},
     {NULL, 0}
 };
@@ -36,6 +36,11 @@ enum rs_op_kind {
     RS_KIND_SIGNATURE,
     RS_KIND_COPY,
     RS_KIND_CHECKSUM,
+    RS_KIND_ZLITERAL,
+    RS_KIND_PRIME,
+    RS_KIND_WINDOW,
+    RS_KIND_SELF,
+    RS_KIND_BLOCK,
     RS_KIND_RESERVED,           /* for future expansion */
 
     /* This one should never occur in file streams. It's an internal marker for
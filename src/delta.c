@@ -94,26 +94,30 @@
 #include "librsync.h"
 #include "job.h"
 #include "sumset.h"
+#include "cdc.h"
 #include "checksum.h"
 #include "scoop.h"
 #include "emit.h"
 #include "trace.h"
+#include "util.h"
 
 /** Max length of a miss is 64K including 3 command bytes. */
 #define MAX_MISS_LEN (MAX_DELTA_CMD - 3)
 
 static rs_result rs_delta_s_scan(rs_job_t *job);
 static rs_result rs_delta_s_flush(rs_job_t *job);
+static rs_result rs_delta_s_chunks(rs_job_t *job);
 static rs_result rs_delta_s_end(rs_job_t *job);
 static inline rs_result rs_getinput(rs_job_t *job, size_t block_len);
 static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
-                               size_t *match_len);
+                               size_t *match_len, rs_long_t *self_dist);
 static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos,
-                                       size_t match_len);
+                                       size_t match_len, rs_long_t self_dist);
 static inline rs_result rs_appendmiss(rs_job_t *job, size_t miss_len);
 static inline rs_result rs_appendflush(rs_job_t *job);
 static inline rs_result rs_processmatch(rs_job_t *job);
 static inline rs_result rs_processmiss(rs_job_t *job);
+static inline rs_result rs_processzmiss(rs_job_t *job);
 
 /** Get a block of data if possible, and see if it matches.
  *
@@ -122,7 +126,7 @@ static inline rs_result rs_processmiss(rs_job_t *job);
 static rs_result rs_delta_s_scan(rs_job_t *job)
 {
     const size_t block_len = job->signature->block_len;
-    rs_long_t match_pos;
+    rs_long_t match_pos, self_dist;
     size_t match_len;
     rs_result result;
 
@@ -136,9 +140,9 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
     /* while output is not blocked and there is a block of data */
     while ((result == RS_DONE) && ((job->scan_pos + block_len) < job->scan_len)) {
         /* check if this block matches */
-        if (rs_findmatch(job, &match_pos, &match_len)) {
+        if (rs_findmatch(job, &match_pos, &match_len, &self_dist)) {
             /* append the match and reset the weak_sum */
-            result = rs_appendmatch(job, match_pos, match_len);
+            result = rs_appendmatch(job, match_pos, match_len, self_dist);
             weaksum_reset(&job->weak_sum);
         } else {
             /* rotate the weak_sum and append the miss byte */
@@ -164,7 +168,7 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
 static rs_result rs_delta_s_flush(rs_job_t *job)
 {
     const size_t block_len = job->signature->block_len;
-    rs_long_t match_pos;
+    rs_long_t match_pos, self_dist;
     size_t match_len;
     rs_result result;
 
@@ -178,9 +182,9 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
     /* while output is not blocked and there is any remaining data */
     while ((result == RS_DONE) && (job->scan_pos < job->scan_len)) {
         /* check if this block matches */
-        if (rs_findmatch(job, &match_pos, &match_len)) {
+        if (rs_findmatch(job, &match_pos, &match_len, &self_dist)) {
             /* append the match and reset the weak_sum */
-            result = rs_appendmatch(job, match_pos, match_len);
+            result = rs_appendmatch(job, match_pos, match_len, self_dist);
             weaksum_reset(&job->weak_sum);
         } else {
             /* rollout from weak_sum and append the miss byte */
@@ -201,8 +205,75 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
     return result;
 }
 
+/** Cut the data into chunks like the signature, and see if they match.
+ *
+ * Only whole chunks can match, so a miss skips the chunk instead of rolling
+ * the weak sum over it a byte at a time. Missed chunks are appended in pieces
+ * so misses are never longer than MAX_MISS_LEN. */
+static rs_result rs_delta_s_chunks(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    const size_t avg = (size_t)sig->block_len;
+    rs_long_t match_pos;
+    size_t len;
+    rs_result result;
+
+    rs_job_check(job);
+    /* output any pending output from the tube */
+    if ((result = rs_tube_catchup(job)) != RS_DONE)
+        return result;
+    /* read the input into the scoop, with the longest chunk after scan_pos */
+    if ((result = rs_getinput(job, job->scan_pos + RS_CDC_MAX(avg))) != RS_DONE)
+        return result;
+    /* while output is not blocked and there is data */
+    while ((result == RS_DONE) && (job->scan_pos < job->scan_len)) {
+        if (job->scan_miss) {
+            /* append as much of the missed chunk as fits in a miss */
+            len = job->scan_miss < MAX_MISS_LEN ? job->scan_miss : MAX_MISS_LEN;
+            if (!job->basis_len && job->scan_pos < MAX_MISS_LEN
+                && len > MAX_MISS_LEN - job->scan_pos)
+                len = MAX_MISS_LEN - job->scan_pos;
+            job->scan_miss -= len;
+            result = rs_appendmiss(job, len);
+            continue;
+        }
+        if (!(len = rs_cdc_cut(avg, job->scan_buf + job->scan_pos,
+                               job->scan_len - job->scan_pos,
+                               job->stream->eof_in)))
+            break;
+        match_pos =
+            rs_signature_find_match(sig,
+                                    rs_signature_calc_weak_sum(sig,
+                                                               job->scan_buf +
+                                                               job->scan_pos,
+                                                               len),
+                                    job->scan_buf + job->scan_pos, len);
+        /* In-place deltas can't copy data already overwritten. */
+        if (job->inplace && match_pos != -1
+            && match_pos < job->new_pos + (rs_long_t)job->scan_pos)
+            match_pos = -1;
+        if (match_pos != -1)
+            result = rs_appendmatch(job, match_pos, len, 0);
+        else
+            job->scan_miss = len;
+    }
+    if (result != RS_DONE)
+        return result;
+    if (job->stream->eof_in && job->scan_pos == job->scan_len) {
+        /* at eof, flush the last miss or match */
+        if ((result = rs_appendflush(job)) != RS_DONE)
+            return result;
+        job->statefn = rs_delta_s_end;
+        return RS_RUNNING;
+    }
+    /* we are blocked waiting for more data */
+    return RS_BLOCKED;
+}
+
 static rs_result rs_delta_s_end(rs_job_t *job)
 {
+    if (job->checksum)
+        rs_emit_checksum_cmd(job, NULL);
     rs_emit_end_cmd(job);
     return RS_DONE;
 }
@@ -222,15 +293,21 @@ static inline rs_result rs_getinput(rs_job_t *job, size_t block_len)
  * Note that this will calculate weak_sum if required. It will also determine
  * the match_len.
  *
+ * If the delta has a history window, matches can also be in the new file
+ * data already output, which is tried after the basis. Then self_dist is set
+ * to the distance back to the match, and match_pos is its new file offset.
+ *
  * This routine could be modified to do xdelta style matches that would extend
  * matches past block boundaries by matching backwards and forwards beyond the
  * block boundaries. Extending backwards would require decrementing scan_pos as
  * appropriate. */
 static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
-                               size_t *match_len)
+                               size_t *match_len, rs_long_t *self_dist)
 {
     const size_t block_len = job->signature->block_len;
+    const rs_long_t pos = job->new_pos + (rs_long_t)job->scan_pos;
 
+    *self_dist = 0;
     /* calculate the weak_sum if we don't have one */
     if (weaksum_count(&job->weak_sum) == 0) {
         /* set match_len to min(block_len, scan_avail) */
@@ -238,6 +315,16 @@ static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
         if (*match_len > block_len) {
             *match_len = block_len;
         }
+        /* Straight after a match in the output, first try extending it,
+           which needs no sums. */
+        if (job->self_dist && job->basis_len
+            && rs_selfsums_same(job->selfsums,
+                                job->basis_pos + job->basis_len,
+                                job->scan_buf + job->scan_pos, *match_len)) {
+            *match_pos = job->basis_pos + job->basis_len;
+            *self_dist = job->self_dist;
+            return 1;
+        }
         /* Update the weak_sum */
         weaksum_update(&job->weak_sum, job->scan_buf + job->scan_pos,
                        *match_len);
@@ -250,18 +337,29 @@ static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
     *match_pos =
         rs_signature_find_match(job->signature, weaksum_digest(&job->weak_sum),
                                 job->scan_buf + job->scan_pos, *match_len);
+    /* For in-place deltas, a match before where it would be output reads
+       data that has already been overwritten, so treat it as a miss. */
+    if (job->inplace && *match_pos != -1 && *match_pos < pos)
+        *match_pos = -1;
+    if (*match_pos == -1 && job->selfsums
+        && (*match_pos =
+            rs_selfsums_find(job->selfsums, weaksum_digest(&job->weak_sum),
+                             job->scan_buf + job->scan_pos, *match_len,
+                             pos)) != -1)
+        *self_dist = pos - *match_pos;
     return *match_pos != -1;
 }
 
 /** Append a match at match_pos of length match_len to the delta, extending a
  * previous match if possible, or flushing any previous miss/match. */
 static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos,
-                                       size_t match_len)
+                                       size_t match_len, rs_long_t self_dist)
 {
     rs_result result = RS_DONE;
 
     /* if last was a match that can be extended, extend it */
-    if (job->basis_len && (job->basis_pos + job->basis_len) == match_pos) {
+    if (job->basis_len && (job->basis_pos + job->basis_len) == match_pos
+        && job->self_dist == self_dist) {
         job->basis_len += match_len;
     } else {
         /* else appendflush the last value */
@@ -269,6 +367,7 @@ static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos,
         /* make this the new match value */
         job->basis_pos = match_pos;
         job->basis_len = match_len;
+        job->self_dist = self_dist;
     }
     /* increment scan_pos to point at next unscanned data */
     job->scan_pos += match_len;
@@ -303,14 +402,20 @@ static inline rs_result rs_appendflush(rs_job_t *job)
 {
     /* if last is a match, emit it and reset last by resetting basis_len */
     if (job->basis_len) {
-        rs_trace("matched " FMT_LONG " bytes at " FMT_LONG "!", job->basis_len,
-                 job->basis_pos);
-        rs_emit_copy_cmd(job, job->basis_pos, job->basis_len);
+        rs_trace("matched " FMT_LONG " bytes at " FMT_LONG "%s!",
+                 job->basis_len, job->basis_pos,
+                 job->self_dist ? " in the output" : "");
+        if (job->self_dist)
+            rs_emit_self_cmd(job, job->self_dist, job->basis_len);
+        else
+            rs_emit_copy_cmd(job, job->basis_pos, job->basis_len);
         job->basis_len = 0;
         return rs_processmatch(job);
         /* else if last is a miss, emit and process it */
     } else if (job->scan_pos) {
         rs_trace("got " FMT_SIZE " bytes of literal data", job->scan_pos);
+        if (job->zlit)
+            return rs_processzmiss(job);
         rs_emit_literal_cmd(job, (int)job->scan_pos);
         return rs_processmiss(job);
     }
@@ -318,6 +423,18 @@ static inline rs_result rs_appendflush(rs_job_t *job)
     return RS_DONE;
 }
 
+/** Add the data at scan_buf of length scan_pos to the history, as it is
+ * output. */
+static inline void rs_delta_history_add(rs_job_t *job)
+{
+    job->new_pos += (rs_long_t)job->scan_pos;
+    if (job->history)
+        rs_job_history_add(job, job->scan_buf, job->scan_pos);
+    if (job->selfsums)
+        rs_selfsums_update(job->selfsums, job->history, job->history_len,
+                           job->new_pos);
+}
+
 /** Process matching data in the scoop.
  *
  * The scoop contains match data at scan_buf of length scan_pos. This function
@@ -332,6 +449,9 @@ static inline rs_result rs_appendflush(rs_job_t *job)
 static inline rs_result rs_processmatch(rs_job_t *job)
 {
     assert(job->copy_len == 0);
+    if (job->checksum)
+        blake2b_update(&job->checksum_state, job->scan_buf, job->scan_pos);
+    rs_delta_history_add(job);
     rs_scoop_advance(job, job->scan_pos);
     job->scan_buf += job->scan_pos;
     job->scan_len -= job->scan_pos;
@@ -355,6 +475,9 @@ static inline rs_result rs_processmatch(rs_job_t *job)
 static inline rs_result rs_processmiss(rs_job_t *job)
 {
     assert(job->write_len > 0);
+    if (job->checksum)
+        blake2b_update(&job->checksum_state, job->scan_buf, job->scan_pos);
+    rs_delta_history_add(job);
     rs_tube_copy(job, job->scan_pos);
     job->scan_buf += job->scan_pos;
     job->scan_len -= job->scan_pos;
@@ -362,15 +485,56 @@ static inline rs_result rs_processmiss(rs_job_t *job)
     return rs_tube_catchup(job);
 }
 
+/** Process miss data in the scoop, compressing it if it's worth it.
+ *
+ * The compressed data is queued with rs_tube_send, so the miss data is
+ * removed from the scoop like match data. If it doesn't compress, it's sent
+ * with a LITERAL command as usual. */
+static inline rs_result rs_processzmiss(rs_job_t *job)
+{
+    rs_byte_t const *zbuf;
+    size_t zlen;
+    size_t dict_len = job->prime ?
+        rs_zlit_dict_len(job->scan_pos, job->history_len) : 0;
+
+    if (!(zlen = rs_zlit_compress(job->zlit,
+                                  job->history + job->history_len - dict_len,
+                                  dict_len, job->scan_buf, job->scan_pos,
+                                  &zbuf))) {
+        rs_emit_literal_cmd(job, (int)job->scan_pos);
+        return rs_processmiss(job);
+    }
+    rs_emit_zliteral_cmd(job, job->scan_pos, zlen);
+    rs_tube_send(job, zbuf, zlen);
+    return rs_processmatch(job);
+}
+
 /** State function that does a slack delta containing only literal data to
  * recreate the input. */
 static rs_result rs_delta_s_slack(rs_job_t *job)
 {
     size_t avail = rs_scoop_avail(job);
 
-    if (avail) {
+    if (avail && job->zlit) {
+        /* Compress the data in pieces like misses, which need to be in one
+           buffer. */
+        if (avail > MAX_MISS_LEN)
+            avail = MAX_MISS_LEN;
+        rs_scoop_readahead(job, avail, (void **)&job->scan_buf);
+        job->scan_pos = job->scan_len = avail;
+        rs_trace("emit slack delta for " FMT_SIZE " bytes", avail);
+        rs_processzmiss(job);
+        return RS_RUNNING;
+    } else if (avail) {
         rs_trace("emit slack delta for " FMT_SIZE " available bytes", avail);
         rs_emit_literal_cmd(job, (int)avail);
+        if (job->checksum) {
+            /* The data is the rest of the scoop and then the input. */
+            blake2b_update(&job->checksum_state, job->scoop_next,
+                           job->scoop_avail);
+            blake2b_update(&job->checksum_state, job->stream->next_in,
+                           job->stream->avail_in);
+        }
         rs_tube_copy(job, avail);
         return RS_RUNNING;
     } else if (rs_scoop_eof(job)) {
@@ -384,7 +548,13 @@ static rs_result rs_delta_s_slack(rs_job_t *job)
 static rs_result rs_delta_s_header(rs_job_t *job)
 {
     rs_emit_delta_header(job);
-    if (job->signature) {
+    if (job->self_window)
+        rs_emit_window_cmd(job, job->self_window);
+    if (job->prime)
+        rs_emit_prime_cmd(job);
+    if (job->signature && job->signature->cdc) {
+        job->statefn = rs_delta_s_chunks;
+    } else if (job->signature) {
         job->statefn = rs_delta_s_scan;
     } else {
         rs_trace("no signature provided for delta, using slack deltas");
@@ -393,11 +563,72 @@ static rs_result rs_delta_s_header(rs_job_t *job)
     return RS_RUNNING;
 }
 
+/** State function for the end of a delta of an unchanged file.
+ *
+ * The new file's checksum is the digest in the signature. */
+static rs_result rs_delta_s_same_end(rs_job_t *job)
+{
+    if (job->checksum)
+        rs_emit_checksum_cmd(job, job->signature->digest);
+    rs_emit_end_cmd(job);
+    return RS_DONE;
+}
+
+/** State function for copying all of an unchanged file. */
+static rs_result rs_delta_s_same(rs_job_t *job)
+{
+    rs_trace("new file is the same as the " FMT_LONG " byte basis",
+             job->signature->file_len);
+    if (job->signature->file_len)
+        rs_emit_copy_cmd(job, 0, job->signature->file_len);
+    job->statefn = rs_delta_s_same_end;
+    return RS_RUNNING;
+}
+
+/** State function for the header of a delta of an unchanged file. */
+static rs_result rs_delta_s_same_header(rs_job_t *job)
+{
+    rs_delta_s_header(job);
+    job->statefn = rs_delta_s_same;
+    return RS_RUNNING;
+}
+
+
 rs_job_t *rs_delta_begin(rs_signature_t *sig)
+{
+    return rs_delta_reset_opts(NULL, sig, NULL);
+}
+
+rs_job_t *rs_delta_begin_opts(rs_signature_t *sig, rs_delta_opts_t const *opts)
+{
+    return rs_delta_reset_opts(NULL, sig, opts);
+}
+
+rs_job_t *rs_delta_same_begin(rs_signature_t *sig, rs_delta_opts_t const *opts)
 {
     rs_job_t *job;
 
-    job = rs_job_new("delta", rs_delta_s_header);
+    assert(sig->file_len >= 0);
+    job = rs_delta_reset_opts(NULL, sig, opts);
+    /* An empty file's signature has no blocks for rs_delta_reset(). */
+    job->signature = sig;
+    job->statefn = rs_delta_s_same_header;
+    return job;
+}
+
+rs_job_t *rs_delta_reset(rs_job_t *job, rs_signature_t *sig)
+{
+    return rs_delta_reset_opts(job, sig, NULL);
+}
+
+rs_job_t *rs_delta_reset_opts(rs_job_t *job, rs_signature_t *sig,
+                              rs_delta_opts_t const *opts)
+{
+    static rs_delta_opts_t const defaults;
+
+    if (!opts)
+        opts = &defaults;
+    job = rs_job_renew(job, "delta", rs_delta_s_header);
     /* Caller can pass NULL sig or empty sig for "slack deltas". */
     if (sig && sig->count > 0) {
         rs_signature_check(sig);
@@ -405,6 +636,34 @@ rs_job_t *rs_delta_begin(rs_signature_t *sig)
         assert(sig->hashtable);
         job->signature = sig;
         weaksum_init(&job->weak_sum, rs_signature_weaksum_kind(sig));
+        /* Chunk matches don't use the block sums of the output. */
+        if (opts->self_window > 0 && !sig->cdc) {
+            job->self_window = (size_t)opts->self_window < RS_MAX_WINDOW ?
+                (size_t)opts->self_window : RS_MAX_WINDOW;
+            rs_job_history_init(job, job->self_window);
+            job->selfsums =
+                rs_selfsums_new(rs_signature_weaksum_kind(sig),
+                                (size_t)sig->block_len, job->self_window);
+        }
+    }
+    job->inplace = opts->inplace;
+    assert(!opts->magic || opts->magic == RS_DELTA_MAGIC
+           || opts->magic == RS_DELTA_BLAKE2_MAGIC
+           || opts->magic == RS_DELTA_V2_MAGIC
+           || opts->magic == RS_DELTA_V2_BLAKE2_MAGIC);
+    job->format.compact = opts->magic == RS_DELTA_V2_MAGIC
+        || opts->magic == RS_DELTA_V2_BLAKE2_MAGIC;
+    if (opts->compress) {
+        job->zlit = rs_zlit_deflater_renew(job->spare_zlit, opts->compress);
+        job->spare_zlit = NULL;
+    }
+    if (job->zlit && opts->prime) {
+        job->prime = 1;
+        rs_job_history_init(job, RS_ZLIT_WINDOW);
     }
+    if ((job->checksum = opts->checksum
+         || opts->magic == RS_DELTA_BLAKE2_MAGIC
+         || opts->magic == RS_DELTA_V2_BLAKE2_MAGIC))
+        blake2b_init(&job->checksum_state, RS_MAX_STRONG_SUM_LENGTH);
     return job;
 }
@@ -0,0 +1,715 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file deltaindex.c
+ * Scanning a delta file to index its commands.
+ *
+ * The delta is read with pread(), skipping over the LITERAL data, so this
+ * costs little more than reading the commands. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>           /* IWYU pragma: keep */
+#endif
+#ifdef HAVE_IO_H
+#  include <io.h>               /* IWYU pragma: keep */
+#endif
+#include "librsync.h"
+#include "largefile.h"
+#include "deltaindex.h"
+#include "prototab.h"
+#include "selfsums.h"
+#include "blake2.h"
+#include "zlit.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
+
+/* Use _lseeki64 and _read if they exist. */
+#ifdef _WIN32
+#  define lseek(f, o, w) _lseeki64((f), (o), (w))
+#  define read(f, b, l) _read((f), (b), (unsigned)(l))
+#endif
+
+/** The size of the buffer for reading the commands. */
+#define RS_INDEX_BUF ((size_t)64 << 10)
+
+/** The length of the header of a delta index file. */
+#define RS_INDEX_HEAD_LEN 80
+
+/** The length of each command in a delta index file. */
+#define RS_INDEX_CMD_LEN 41
+
+/** The delta index file flags for a PRIME, a checksum, and the compact
+ * format. */
+#define RS_INDEX_PRIME 1
+#define RS_INDEX_CHECKSUM 2
+#define RS_INDEX_COMPACT 4
+
+/** A buffered reader for scanning the delta. */
+typedef struct rs_index_reader {
+    int fd;
+    rs_long_t pos;              /**< The delta offset of buf. */
+    size_t off, len;            /**< The read position and end in buf. */
+    rs_byte_t *buf;
+} rs_index_reader_t;
+
+/** Read up to len bytes at pos, returning the length or -1 on error. */
+static long rs_index_read(int fd, void *buf, size_t len, rs_long_t pos)
+{
+    long n;
+
+    do {
+#ifdef HAVE_PREAD
+        n = (long)pread(fd, buf, len, pos);
+#else
+        if (lseek(fd, pos, SEEK_SET) < 0)
+            return -1;
+        n = (long)read(fd, buf, len);
+#endif
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+rs_result rs_delta_index_pread(int fd, void *buf, size_t len, rs_long_t pos)
+{
+    long n;
+
+    while (len) {
+        if ((n = rs_index_read(fd, buf, len, pos)) < 0) {
+            rs_error("read error: %s", strerror(errno));
+            return RS_IO_ERROR;
+        } else if (!n) {
+            rs_error("unexpected eof on fd%d", fd);
+            return RS_INPUT_ENDED;
+        }
+        buf = (rs_byte_t *)buf + n;
+        len -= (size_t)n;
+        pos += n;
+    }
+    return RS_DONE;
+}
+
+/** Get up to len bytes of the delta without using them, returning how many
+ * there are before it ends. */
+static size_t rs_index_peek(rs_index_reader_t *r, size_t len, rs_byte_t **p)
+{
+    long n;
+
+    if (r->len - r->off < len) {
+        r->pos += (rs_long_t)r->off;
+        memmove(r->buf, r->buf + r->off, r->len - r->off);
+        r->len -= r->off;
+        r->off = 0;
+        n = rs_index_read(r->fd, r->buf + r->len, RS_INDEX_BUF - r->len,
+                          r->pos + (rs_long_t)r->len);
+        if (n > 0)
+            r->len += (size_t)n;
+        else if (n < 0)
+            rs_error("error reading delta: %s", strerror(errno));
+    }
+    *p = r->buf + r->off;
+    return r->len - r->off < len ? r->len - r->off : len;
+}
+
+/** Get the next len bytes of the delta, or NULL if it ends first. */
+static rs_byte_t *rs_index_need(rs_index_reader_t *r, size_t len)
+{
+    rs_byte_t *p;
+
+    if (rs_index_peek(r, len, &p) < len) {
+        rs_error("unexpected end of delta");
+        return NULL;
+    }
+    r->off += len;
+    return p;
+}
+
+/** Skip over len bytes of the delta. */
+static void rs_index_skip(rs_index_reader_t *r, rs_long_t len)
+{
+    if (len <= (rs_long_t)(r->len - r->off)) {
+        r->off += (size_t)len;
+    } else {
+        r->pos += (rs_long_t)r->off + len;
+        r->off = r->len = 0;
+    }
+}
+
+/** Add a command to the index. */
+static void rs_index_add(rs_delta_index_t *idx, rs_long_t src, rs_long_t len,
+                         int literal)
+{
+    rs_delta_cmd_t *c;
+
+    if (idx->count == idx->size) {
+        idx->size = idx->size ? 2 * idx->size : 1024;
+        idx->cmds = rs_realloc(idx->cmds, idx->size * sizeof(*c),
+                               "delta index");
+    }
+    c = &idx->cmds[idx->count++];
+    c->out = idx->out_len;
+    c->src = src;
+    c->len = len;
+    c->zlen = 0;
+    c->dist = 0;
+    c->literal = literal;
+    idx->out_len += len;
+}
+
+rs_result rs_delta_index_build(rs_delta_index_t *idx, int fd, rs_long_t pos,
+                               rs_stats_t *stats)
+{
+    rs_index_reader_t r;
+    rs_delta_format_t format;
+    rs_prototab_ent_t const *cmd;
+    rs_byte_t *p;
+    rs_long_t param1, param2;
+    rs_result result = RS_DONE;
+    size_t avail;
+    int op, magic, n, got_sum = 0;
+
+    rs_bzero(idx, sizeof(*idx));
+    idx->start = pos;
+    r.fd = fd;
+    r.pos = pos;
+    r.off = r.len = 0;
+    r.buf = rs_alloc(RS_INDEX_BUF, "delta buffer");
+    if (!(p = rs_index_need(&r, 4))) {
+        result = RS_INPUT_ENDED;
+        goto out;
+    }
+    magic = (int)rs_get_netint(p, 4);
+    if (!rs_delta_format_init(&format, magic, &idx->checksum)) {
+        rs_error("got magic number %#x rather than expected value %#x", magic,
+                 RS_DELTA_MAGIC);
+        result = RS_BAD_MAGIC;
+        goto out;
+    }
+    idx->compact = format.compact;
+    for (;;) {
+        avail = rs_index_peek(&r, RS_MAX_CMD_LEN, &p);
+        op = avail ? *p : 0;
+        if (!(n = rs_delta_format_decode(&format, p, avail, &cmd, &param1,
+                                         &param2))) {
+            rs_error("unexpected end of delta");
+            result = RS_INPUT_ENDED;
+            break;
+        } else if (n < 0) {
+            rs_error("bad parameters on command %#04x", op);
+            result = RS_CORRUPT;
+            break;
+        }
+        r.off += (size_t)n;
+        if (cmd->kind == RS_KIND_END) {
+            if (idx->checksum && !got_sum) {
+                rs_error("delta ended without its checksum");
+                result = RS_CORRUPT;
+            }
+            break;
+        } else if (cmd->kind == RS_KIND_CHECKSUM && idx->checksum
+                   && !got_sum) {
+            if (!(p = rs_index_need(&r, (size_t)param1))) {
+                result = RS_INPUT_ENDED;
+                break;
+            }
+            memcpy(idx->sum, p, (size_t)param1);
+            got_sum = 1;
+        } else if (cmd->kind == RS_KIND_LITERAL) {
+            if (param1 <= 0) {
+                rs_error("invalid length=" FMT_LONG " on LITERAL command",
+                         param1);
+                result = RS_CORRUPT;
+                break;
+            }
+            rs_index_add(idx, r.pos + (rs_long_t)r.off, param1, 1);
+            rs_index_skip(&r, param1);
+            stats->lit_cmds++;
+            stats->lit_bytes += param1;
+            stats->lit_cmdbytes += n;
+        } else if (cmd->kind == RS_KIND_ZLITERAL) {
+            if (param1 <= 0 || param2 <= 0) {
+                rs_error("invalid length=" FMT_LONG ", zlength=" FMT_LONG
+                         " on ZLITERAL command", param1, param2);
+                result = RS_CORRUPT;
+                break;
+            }
+            rs_index_add(idx, r.pos + (rs_long_t)r.off, param1, 1);
+            idx->cmds[idx->count - 1].zlen = param2;
+            rs_index_skip(&r, param2);
+            stats->lit_cmds++;
+            stats->lit_bytes += param2;
+            stats->lit_cmdbytes += n;
+        } else if (cmd->kind == RS_KIND_PRIME && !idx->prime
+                   && !idx->count) {
+            idx->prime = 1;
+            idx->prime_out = idx->out_len;
+        } else if (cmd->kind == RS_KIND_WINDOW && !idx->window
+                   && !idx->count) {
+            if (param1 <= 0 || param1 > (rs_long_t)RS_MAX_WINDOW) {
+                rs_error("invalid length=" FMT_LONG " on WINDOW command",
+                         param1);
+                result = RS_CORRUPT;
+                break;
+            }
+            idx->window = param1;
+        } else if (cmd->kind == RS_KIND_BLOCK) {
+            /* Only used to decode later COPY commands. */
+        } else if (cmd->kind == RS_KIND_SELF) {
+            if (param2 <= 0) {
+                rs_error("invalid length=" FMT_LONG " on SELF command", param2);
+                result = RS_CORRUPT;
+                break;
+            }
+            if (param1 <= 0 || param1 > idx->window || param1 > idx->out_len) {
+                rs_error("invalid distance=" FMT_LONG " on SELF command",
+                         param1);
+                result = RS_CORRUPT;
+                break;
+            }
+            rs_index_add(idx, idx->out_len - param1, param2, 1);
+            idx->cmds[idx->count - 1].dist = param1;
+            stats->copy_cmds++;
+            stats->copy_bytes += param2;
+            stats->copy_cmdbytes += n;
+        } else if (cmd->kind == RS_KIND_COPY) {
+            if (param2 <= 0) {
+                rs_error("invalid length=" FMT_LONG " on COPY command", param2);
+                result = RS_CORRUPT;
+                break;
+            }
+            if (param1 < 0) {
+                rs_error("invalid position=" FMT_LONG " on COPY command",
+                         param1);
+                result = RS_CORRUPT;
+                break;
+            }
+            rs_index_add(idx, param1, param2, 0);
+            stats->copy_cmds++;
+            stats->copy_bytes += param2;
+            stats->copy_cmdbytes += n;
+        } else {
+            rs_error("bogus command %#04x", op);
+            result = RS_CORRUPT;
+            break;
+        }
+    }
+    idx->end = r.pos + (rs_long_t)r.off;
+    stats->in_bytes = idx->end - pos;
+  out:
+    rs_free(r.buf);
+    return result;
+}
+
+/** Get the magic of the delta an index is for. */
+static int rs_delta_index_magic(rs_delta_index_t const *idx)
+{
+    if (idx->compact)
+        return idx->checksum ? RS_DELTA_V2_BLAKE2_MAGIC : RS_DELTA_V2_MAGIC;
+    return idx->checksum ? RS_DELTA_BLAKE2_MAGIC : RS_DELTA_MAGIC;
+}
+
+rs_result rs_delta_index_save(rs_delta_index_t const *idx, FILE *f)
+{
+    rs_byte_t head[RS_INDEX_HEAD_LEN], *p;
+    rs_delta_cmd_t const *c;
+    size_t i;
+
+    rs_put_netint(head, RS_DELTA_INDEX_MAGIC, 4);
+    rs_put_netint(head + 4, (idx->prime ? RS_INDEX_PRIME : 0) |
+                  (idx->checksum ? RS_INDEX_CHECKSUM : 0) |
+                  (idx->compact ? RS_INDEX_COMPACT : 0), 4);
+    rs_put_netint(head + 8, idx->end - idx->start, 8);
+    rs_put_netint(head + 16, idx->out_len, 8);
+    rs_put_netint(head + 24, idx->prime_out, 8);
+    rs_put_netint(head + 32, idx->window, 8);
+    rs_put_netint(head + 40, (rs_long_t)idx->count, 8);
+    memcpy(head + 48, idx->sum, RS_MAX_STRONG_SUM_LENGTH);
+    if (fwrite(head, sizeof(head), 1, f) != 1)
+        goto fail;
+    for (i = 0, c = idx->cmds; i < idx->count; i++, c++) {
+        p = head;
+        rs_put_netint(p, c->out, 8);
+        /* A SELF's src is an output offset. */
+        rs_put_netint(p + 8, c->literal && !c->dist ? c->src - idx->start :
+                      c->src, 8);
+        rs_put_netint(p + 16, c->len, 8);
+        rs_put_netint(p + 24, c->zlen, 8);
+        rs_put_netint(p + 32, c->dist, 8);
+        p[40] = (rs_byte_t)c->literal;
+        if (fwrite(head, RS_INDEX_CMD_LEN, 1, f) != 1)
+            goto fail;
+    }
+    return RS_DONE;
+  fail:
+    rs_error("error writing delta index: %s", strerror(errno));
+    return RS_IO_ERROR;
+}
+
+/** Bisect the commands in a delta index file for the first one ending after
+ * an output offset, or the first one starting at or after it if start. */
+static rs_result rs_index_bisect(int fd, rs_long_t pos, size_t count,
+                                 rs_long_t out, int start, size_t *found)
+{
+    rs_byte_t buf[24];
+    size_t lo = 0, hi = count, mid;
+    rs_long_t at;
+    rs_result result;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if ((result = rs_delta_index_pread(fd, buf, sizeof(buf),
+                                           pos + RS_INDEX_HEAD_LEN +
+                                           (rs_long_t)mid * RS_INDEX_CMD_LEN))
+            != RS_DONE)
+            return result;
+        at = rs_get_netint(buf, 8);
+        if (!start)
+            at += rs_get_netint(buf + 16, 8);
+        if (start ? at < out : at <= out)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo;
+    return RS_DONE;
+}
+
+rs_result rs_delta_index_load(rs_delta_index_t *idx, int fd,
+                              rs_long_t index_pos, int delta_fd, rs_long_t pos,
+                              rs_long_t from, rs_long_t to)
+{
+    rs_byte_t head[RS_INDEX_HEAD_LEN], *buf = NULL, *p;
+    rs_delta_cmd_t *c;
+    rs_long_t delta_len, total, at, need;
+    size_t first = 0, last, i, n;
+    rs_result result;
+    int flags;
+
+    rs_bzero(idx, sizeof(*idx));
+    if ((result = rs_delta_index_pread(fd, head, sizeof(head), index_pos))
+        != RS_DONE)
+        return result;
+    if ((int)rs_get_netint(head, 4) != RS_DELTA_INDEX_MAGIC) {
+        rs_error("got magic number %#x rather than expected value %#x",
+                 (int)rs_get_netint(head, 4), RS_DELTA_INDEX_MAGIC);
+        return RS_BAD_MAGIC;
+    }
+    flags = (int)rs_get_netint(head + 4, 4);
+    idx->prime = (flags & RS_INDEX_PRIME) != 0;
+    idx->checksum = (flags & RS_INDEX_CHECKSUM) != 0;
+    idx->compact = (flags & RS_INDEX_COMPACT) != 0;
+    delta_len = rs_get_netint(head + 8, 8);
+    idx->out_len = rs_get_netint(head + 16, 8);
+    idx->prime_out = rs_get_netint(head + 24, 8);
+    idx->window = rs_get_netint(head + 32, 8);
+    total = rs_get_netint(head + 40, 8);
+    memcpy(idx->sum, head + 48, RS_MAX_STRONG_SUM_LENGTH);
+    idx->start = pos;
+    idx->end = pos + delta_len;
+    if (delta_len < 5 || idx->out_len < 0 || total < 0
+        || (rs_long_t)(size_t)total != total || idx->window < 0
+        || idx->window > (rs_long_t)RS_MAX_WINDOW) {
+        rs_error("corrupt delta index header");
+        return RS_CORRUPT;
+    }
+    /* Check the delta has the right magic and ends with an END command where
+       the index says, which catches most indexes for the wrong delta. */
+    if ((result = rs_delta_index_pread(delta_fd, head, 4, pos)) != RS_DONE
+        || (result = rs_delta_index_pread(delta_fd, head + 4, 1,
+                                          idx->end - 1)) != RS_DONE) {
+        rs_error("delta index doesn't match the delta");
+        return result == RS_INPUT_ENDED ? RS_CORRUPT : result;
+    }
+    if ((int)rs_get_netint(head, 4) != rs_delta_index_magic(idx)
+        || head[4] != RS_OP_END) {
+        rs_error("delta index doesn't match the delta");
+        return RS_CORRUPT;
+    }
+    last = (size_t)total;
+    if (!idx->prime && !idx->window
+        && ((result = rs_index_bisect(fd, index_pos, last, from, 0, &first))
+            != RS_DONE
+            || (result = rs_index_bisect(fd, index_pos, last, to, 1, &last))
+            != RS_DONE))
+        return result;
+    if (last < first)
+        last = first;
+    idx->count = idx->size = last - first;
+    idx->cmds = rs_alloc((idx->size + 1) * sizeof(*c), "delta index");
+    buf = rs_alloc(RS_INDEX_BUF, "delta index buffer");
+    at = index_pos + RS_INDEX_HEAD_LEN + (rs_long_t)first * RS_INDEX_CMD_LEN;
+    for (i = 0, c = idx->cmds; i < idx->count; i += n) {
+        n = idx->count - i < RS_INDEX_BUF / RS_INDEX_CMD_LEN ?
+            idx->count - i : RS_INDEX_BUF / RS_INDEX_CMD_LEN;
+        if ((result = rs_delta_index_pread(fd, buf, n * RS_INDEX_CMD_LEN,
+                                           at)) != RS_DONE)
+            goto out;
+        at += (rs_long_t)(n * RS_INDEX_CMD_LEN);
+        for (p = buf; p < buf + n * RS_INDEX_CMD_LEN;
+             p += RS_INDEX_CMD_LEN, c++) {
+            c->out = rs_get_netint(p, 8);
+            c->src = rs_get_netint(p + 8, 8);
+            c->len = rs_get_netint(p + 16, 8);
+            c->zlen = rs_get_netint(p + 24, 8);
+            c->dist = rs_get_netint(p + 32, 8);
+            c->literal = p[40] != 0;
+            need = c->zlen ? c->zlen : c->len;
+            if (c->len <= 0 || c->zlen < 0 || c->dist < 0 || c->src < 0
+                || (c != idx->cmds && c->out != c[-1].out + c[-1].len)
+                || c->out < 0 || c->out + c->len > idx->out_len
+                || (!c->literal && (c->zlen || c->dist))
+                || (c->dist && (!c->literal || c->dist > idx->window
+                                || c->src != c->out - c->dist))
+                || (c->literal && !c->dist
+                    && (c->src < 4 || c->src + need > delta_len))) {
+                rs_error("corrupt command " FMT_SIZE " in delta index",
+                         first + (size_t)(c - idx->cmds));
+                result = RS_CORRUPT;
+                goto out;
+            }
+            if (c->literal && !c->dist)
+                c->src += pos;
+        }
+    }
+    if ((idx->count && last == (size_t)total
+         && c[-1].out + c[-1].len != idx->out_len)
+        || (!total && idx->out_len)) {
+        rs_error("delta index commands don't make the whole output");
+        result = RS_CORRUPT;
+    }
+  out:
+    rs_free(buf);
+    if (result != RS_DONE)
+        rs_delta_index_free(idx);
+    return result;
+}
+
+rs_result rs_delta_index_file(FILE *delta_file, FILE *index_file,
+                              rs_stats_t *stats)
+{
+    rs_delta_index_t idx;
+    rs_stats_t st;
+    rs_long_t pos;
+    rs_result result;
+
+    rs_bzero(&st, sizeof(st));
+    rs_bzero(&idx, sizeof(idx));
+    st.op = "index";
+    st.start = time(NULL);
+    /* The delta must be a seekable file. */
+    if ((pos = (rs_long_t)ftell(delta_file)) < 0) {
+        rs_error("can't index a delta that isn't a seekable file: %s",
+                 strerror(errno));
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    if ((result = rs_delta_index_build(&idx, fileno(delta_file), pos, &st))
+        != RS_DONE
+        || (result = rs_delta_index_save(&idx, index_file)) != RS_DONE)
+        goto out;
+    /* Leave the delta positioned after it like patching does. */
+    if (fseek(delta_file, idx.end, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        result = RS_IO_ERROR;
+    }
+  out:
+    st.end = time(NULL);
+    if (stats)
+        memcpy(stats, &st, sizeof *stats);
+    rs_delta_index_free(&idx);
+    return result;
+}
+
+size_t rs_delta_index_dict_len(rs_delta_index_t const *idx,
+                               rs_delta_cmd_t const *c)
+{
+    rs_long_t history_len;
+
+    if (!c->zlen || !idx->prime || c->out < idx->prime_out)
+        return 0;
+    /* Like for the patch job, the history is the output since the PRIME. */
+    history_len = c->out - idx->prime_out;
+    return rs_zlit_dict_len(c->len < (rs_long_t)RS_ZLIT_WINDOW ?
+                            (size_t)c->len : RS_ZLIT_WINDOW,
+                            history_len < (rs_long_t)RS_ZLIT_WINDOW ?
+                            (size_t)history_len : RS_ZLIT_WINDOW);
+}
+
+rs_result rs_delta_index_inflate(rs_delta_cmd_t const *c, int delta_fd,
+                                 void const *dict, size_t dict_len,
+                                 void *out, size_t len, rs_long_t off)
+{
+    rs_byte_t *buf = (rs_byte_t *)out;
+    rs_zlit_t *z;
+    rs_byte_t *in;
+    rs_long_t done = 0, zdone = 0;
+    size_t in_len = 0, in_off = 0, n, want;
+    rs_result result = RS_RUNNING;
+
+    if (!(z = rs_zlit_inflater())) {
+        rs_error("can't decompress ZLITERAL data without zlib");
+        return RS_UNIMPLEMENTED;
+    }
+    rs_zlit_start(z, dict, dict_len);
+    in = rs_alloc(RS_INDEX_BUF, "compressed literal buffer");
+    /* The data before off is decompressed into buf and thrown away. */
+    while (done < off + (rs_long_t)len && result == RS_RUNNING) {
+        if (in_off == in_len && zdone < c->zlen) {
+            in_len = c->zlen - zdone < (rs_long_t)RS_INDEX_BUF ?
+                (size_t)(c->zlen - zdone) : RS_INDEX_BUF;
+            if ((result = rs_delta_index_pread(delta_fd, in, in_len,
+                                               c->src + zdone)) != RS_DONE)
+                break;
+            result = RS_RUNNING;
+            zdone += (rs_long_t)in_len;
+            in_off = 0;
+        }
+        n = in_len - in_off;
+        if (done < off)
+            want = off - done < (rs_long_t)len ? (size_t)(off - done) : len;
+        else
+            want = len - (size_t)(done - off);
+        result = rs_zlit_inflate(z, in + in_off, &n,
+                                 done < off ? buf : buf + (done - off), &want);
+        in_off += n;
+        done += (rs_long_t)want;
+        if (result == RS_DONE && done < off + (rs_long_t)len) {
+            rs_error("ZLITERAL data is shorter than its length");
+            result = RS_CORRUPT;
+        } else if (result == RS_BLOCKED && zdone < c->zlen) {
+            result = RS_RUNNING;
+        } else if (result == RS_BLOCKED) {
+            rs_error("ZLITERAL data ended early");
+            result = RS_CORRUPT;
+        }
+    }
+    rs_free(in);
+    rs_zlit_free(z);
+    return result == RS_RUNNING ? RS_DONE : result;
+}
+
+rs_result rs_delta_index_read(rs_delta_index_t const *idx,
+                              rs_delta_cmd_t const *c, int basis_fd,
+                              int delta_fd, int new_fd, void *buf, size_t len,
+                              rs_long_t off)
+{
+    rs_result result = RS_DONE;
+    rs_byte_t *dict;
+    rs_long_t at;
+    size_t n;
+
+    if (c->zlen && !(n = rs_delta_index_dict_len(idx, c))) {
+        return rs_delta_index_inflate(c, delta_fd, NULL, 0, buf, len, off);
+    } else if (c->zlen) {
+        if (new_fd < 0) {
+            rs_error("can't decompress primed ZLITERAL data out of order");
+            return RS_UNIMPLEMENTED;
+        }
+        /* The dictionary is the output before the command. */
+        dict = rs_alloc(n, "compression dictionary");
+        if ((result = rs_delta_index_pread(new_fd, dict, n,
+                                           c->out - (rs_long_t)n)) == RS_DONE)
+            result = rs_delta_index_inflate(c, delta_fd, dict, n, buf, len,
+                                            off);
+        rs_free(dict);
+        return result;
+    }
+    if (c->dist) {
+        if (new_fd < 0) {
+            rs_error("can't copy SELF data out of order");
+            return RS_UNIMPLEMENTED;
+        }
+        /* The data repeats every dist bytes, from src. */
+        for (; len && result == RS_DONE; len -= n, off += (rs_long_t)n) {
+            at = off % c->dist;
+            n = c->dist - at < (rs_long_t)len ? (size_t)(c->dist - at) : len;
+            result = rs_delta_index_pread(new_fd, buf, n, c->src + at);
+            buf = (rs_byte_t *)buf + n;
+        }
+        return result;
+    }
+    return rs_delta_index_pread(c->literal ? delta_fd : basis_fd, buf, len,
+                                c->src + off);
+}
+
+rs_result rs_delta_index_check(rs_delta_index_t const *idx, int new_fd,
+                               rs_long_t pos, int basis_fd, int delta_fd)
+{
+    blake2b_state state;
+    rs_strong_sum_t sum;
+    rs_delta_cmd_t const *c;
+    rs_result result = RS_DONE;
+    rs_long_t done;
+    size_t n;
+    rs_byte_t *buf;
+
+    if (!idx->checksum)
+        return RS_DONE;
+    blake2b_init(&state, RS_MAX_STRONG_SUM_LENGTH);
+    buf = rs_alloc(RS_INDEX_BUF, "checksum buffer");
+    for (done = 0; done < idx->out_len && result == RS_DONE; done += n) {
+        n = idx->out_len - done < (rs_long_t)RS_INDEX_BUF ?
+            (size_t)(idx->out_len - done) : RS_INDEX_BUF;
+        if (new_fd >= 0) {
+            result = rs_delta_index_pread(new_fd, buf, n, pos + done);
+        } else {
+            /* Read up to the end of the command. */
+            c = &idx->cmds[rs_delta_index_find(idx, done)];
+            if (c->out + c->len - done < (rs_long_t)n)
+                n = (size_t)(c->out + c->len - done);
+            result = rs_delta_index_read(idx, c, basis_fd, delta_fd, -1, buf,
+                                         n, done - c->out);
+        }
+        if (result == RS_DONE)
+            blake2b_update(&state, buf, n);
+    }
+    rs_free(buf);
+    if (result != RS_DONE)
+        return result;
+    blake2b_final(&state, sum, RS_MAX_STRONG_SUM_LENGTH);
+    if (memcmp(sum, idx->sum, RS_MAX_STRONG_SUM_LENGTH)) {
+        rs_error("checksum mismatch, the new file is corrupt");
+        return RS_CORRUPT;
+    }
+    return RS_DONE;
+}
+
+size_t rs_delta_index_find(rs_delta_index_t const *idx, rs_long_t out)
+{
+    size_t lo = 0, hi = idx->count, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (idx->cmds[mid].out + idx->cmds[mid].len <= out)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void rs_delta_index_free(rs_delta_index_t *idx)
+{
+    rs_free(idx->cmds);
+    rs_bzero(idx, sizeof(*idx));
+}
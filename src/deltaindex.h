@@ -0,0 +1,124 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file deltaindex.h
+ * An index of the commands in a delta file.
+ *
+ * This is built by scanning a delta file, and gives the output offset of
+ * every command along with where its data comes from, so patches can be
+ * applied out of order. */
+#ifndef DELTAINDEX_H
+#  define DELTAINDEX_H
+
+#  include <stddef.h>
+#  include <stdio.h>
+#  include "librsync.h"
+
+/** A command in a delta index. */
+typedef struct rs_delta_cmd {
+    rs_long_t out;              /**< The output offset. */
+    rs_long_t src;              /**< The basis or delta offset of the data. */
+    rs_long_t len;
+    rs_long_t zlen;             /**< The compressed length, or 0. */
+    rs_long_t dist;             /**< The SELF distance, or 0. */
+    int literal;                /**< Whether the data is in the delta. */
+} rs_delta_cmd_t;
+
+/** An index of the commands in a delta. */
+typedef struct rs_delta_index {
+    rs_delta_cmd_t *cmds;
+    size_t count, size;
+    rs_long_t out_len;          /**< The total output length. */
+    rs_long_t start, end;       /**< The delta offsets of the start and end. */
+    int prime;                  /**< Whether the delta has a PRIME command. */
+    rs_long_t prime_out;        /**< The output offset of the PRIME. */
+    rs_long_t window;           /**< The WINDOW length, or 0. */
+    int checksum;               /**< Whether the delta has a checksum. */
+    int compact;                /**< Whether the delta is compact. */
+    rs_strong_sum_t sum;        /**< The BLAKE2b hash of the new file. */
+} rs_delta_index_t;
+
+/** Build the index for the delta in fd starting at offset pos.
+ *
+ * The command stats are added to stats, and in_bytes is set to the delta
+ * length. */
+rs_result rs_delta_index_build(rs_delta_index_t *idx, int fd, rs_long_t pos,
+                               rs_stats_t *stats);
+
+/** Write the index to a delta index file.
+ *
+ * The LITERAL offsets are saved relative to the start of the delta, so the
+ * delta can be moved. */
+rs_result rs_delta_index_save(rs_delta_index_t const *idx, FILE *f);
+
+/** Load the index for the delta in delta_fd at offset pos from a delta index
+ * file in fd at offset index_pos.
+ *
+ * Only the commands making output offsets from up to to are loaded, found by
+ * bisecting the file, unless the delta has a PRIME or WINDOW. Then reading
+ * its output can need the output before, so all of them are loaded.
+ *
+ * \return RS_BAD_MAGIC if it's not a delta index file, or RS_CORRUPT if it
+ * doesn't match the delta. */
+rs_result rs_delta_index_load(rs_delta_index_t *idx, int fd,
+                              rs_long_t index_pos, int delta_fd, rs_long_t pos,
+                              rs_long_t from, rs_long_t to);
+
+/** Find the first command that ends after an output offset. */
+size_t rs_delta_index_find(rs_delta_index_t const *idx, rs_long_t out);
+
+void rs_delta_index_free(rs_delta_index_t *idx);
+
+/** Check the new file against the delta checksum.
+ *
+ * This reads the new file back from new_fd at pos, or if new_fd is -1 reads
+ * the data for each command again from basis_fd or delta_fd, so is only worth
+ * it for patches that can't hash their output in order as it is written. It
+ * does nothing for deltas without a checksum. */
+rs_result rs_delta_index_check(rs_delta_index_t const *idx, int new_fd,
+                               rs_long_t pos, int basis_fd, int delta_fd);
+
+/** Read len bytes at offset off in the data of a command.
+ *
+ * The data is read from basis_fd for a COPY, or from delta_fd for a
+ * LITERAL. A ZLITERAL is decompressed from its start each time, so should be
+ * read in as few pieces as possible, and if it's primed the dictionary is
+ * read from the output before it in new_fd. A SELF is also read from the
+ * output before it in new_fd. A SELF is marked literal, as like a LITERAL its
+ * data isn't in the basis. */
+rs_result rs_delta_index_read(rs_delta_index_t const *idx,
+                              rs_delta_cmd_t const *c, int basis_fd,
+                              int delta_fd, int new_fd, void *buf, size_t len,
+                              rs_long_t off);
+
+/** Get the length of the dictionary for a ZLITERAL, which is the output just
+ * before it, or 0 if it's not primed. */
+size_t rs_delta_index_dict_len(rs_delta_index_t const *idx,
+                               rs_delta_cmd_t const *c);
+
+/** Decompress len bytes at offset off in the data of a ZLITERAL, with the
+ * dictionary from rs_delta_index_dict_len(). */
+rs_result rs_delta_index_inflate(rs_delta_cmd_t const *c, int delta_fd,
+                                 void const *dict, size_t dict_len, void *buf,
+                                 size_t len, rs_long_t off);
+
+/** Read exactly len bytes at pos from fd. */
+rs_result rs_delta_index_pread(int fd, void *buf, size_t len, rs_long_t pos);
+
+#endif                          /* !DELTAINDEX_H */
@@ -21,17 +21,35 @@
 
 #include "config.h"             /* IWYU pragma: keep */
 #include <assert.h>
+#include <string.h>
 #include "librsync.h"
 #include "emit.h"
 #include "job.h"
 #include "netint.h"
 #include "prototab.h"
+#include "scoop.h"
+#include "sumset.h"
 #include "trace.h"
 
 void rs_emit_delta_header(rs_job_t *job)
 {
-    rs_trace("emit DELTA magic");
-    rs_squirt_n4(job, RS_DELTA_MAGIC);
+    int magic;
+
+    if (job->format.compact)
+        magic = job->checksum ? RS_DELTA_V2_BLAKE2_MAGIC : RS_DELTA_V2_MAGIC;
+    else
+        magic = job->checksum ? RS_DELTA_BLAKE2_MAGIC : RS_DELTA_MAGIC;
+    rs_trace("emit DELTA magic %#x", magic);
+    rs_squirt_n4(job, magic);
+    rs_delta_format_init(&job->format, magic, &job->checksum);
+    if (job->format.compact && job->signature) {
+        /* Set the length of the blocks for short COPYs. */
+        job->format.block_len = job->signature->block_len;
+        rs_trace("emit BLOCK_V(length=" FMT_LONG "), cmd_byte=%#04x",
+                 job->format.block_len, RS_OP_V2_BLOCK_V);
+        rs_squirt_byte(job, RS_OP_V2_BLOCK_V);
+        rs_squirt_varint(job, job->format.block_len);
+    }
 }
 
 void rs_emit_literal_cmd(rs_job_t *job, int len)
@@ -42,6 +60,10 @@ void rs_emit_literal_cmd(rs_job_t *job, int len)
     if (param_len == 0) {
         cmd = len;
         rs_trace("emit LITERAL_%d, cmd_byte=%#04x", len, cmd);
+    } else if (job->format.compact) {
+        cmd = RS_OP_V2_LITERAL_V;
+        param_len = rs_varint_len(len);
+        rs_trace("emit LITERAL_V(len=%d), cmd_byte=%#04x", len, cmd);
     } else if (param_len == 1) {
         cmd = RS_OP_LITERAL_N1;
         rs_trace("emit LITERAL_N1(len=%d), cmd_byte=%#04x", len, cmd);
@@ -55,7 +77,9 @@ void rs_emit_literal_cmd(rs_job_t *job, int len)
     }
 
     rs_squirt_byte(job, (rs_byte_t)cmd);
-    if (param_len)
+    if (param_len && job->format.compact)
+        rs_squirt_varint(job, len);
+    else if (param_len)
         rs_squirt_netint(job, len, param_len);
 
     job->stats.lit_cmds++;
@@ -63,24 +87,83 @@ void rs_emit_literal_cmd(rs_job_t *job, int len)
     job->stats.lit_cmdbytes += 1 + param_len;
 }
 
-void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
+void rs_emit_zliteral_cmd(rs_job_t *job, size_t len, size_t zlen)
 {
     int cmd;
-    rs_stats_t *stats = &job->stats;
-    const int where_bytes = rs_int_len(where);
-    const int len_bytes = rs_int_len(len);
+    int param_len = rs_int_len((rs_long_t)(len > zlen ? len : zlen));
+
+    if (job->format.compact) {
+        rs_trace("emit ZLITERAL_V_V(len=" FMT_SIZE ", zlen=" FMT_SIZE
+                 "), cmd_byte=%#04x", len, zlen, RS_OP_V2_ZLITERAL_V_V);
+        rs_squirt_byte(job, RS_OP_V2_ZLITERAL_V_V);
+        rs_squirt_varint(job, (rs_long_t)len);
+        rs_squirt_varint(job, (rs_long_t)zlen);
+        job->stats.lit_cmds++;
+        job->stats.lit_bytes += (rs_long_t)zlen;
+        job->stats.lit_cmdbytes += 1 + rs_varint_len((rs_long_t)len) +
+            rs_varint_len((rs_long_t)zlen);
+        return;
+    }
+
+    if (param_len == 1)
+        cmd = RS_OP_ZLITERAL_N1;
+    else if (param_len == 2)
+        cmd = RS_OP_ZLITERAL_N2;
+    else if (param_len == 4)
+        cmd = RS_OP_ZLITERAL_N4;
+    else {
+        assert(param_len == 8);
+        cmd = RS_OP_ZLITERAL_N8;
+    }
+    rs_trace("emit ZLITERAL_N%d(len=" FMT_SIZE ", zlen=" FMT_SIZE
+             "), cmd_byte=%#04x", param_len, len, zlen, cmd);
+    rs_squirt_byte(job, (rs_byte_t)cmd);
+    rs_squirt_netint(job, (rs_long_t)len, param_len);
+    rs_squirt_netint(job, (rs_long_t)zlen, param_len);
+
+    job->stats.lit_cmds++;
+    job->stats.lit_bytes += (rs_long_t)zlen;
+    job->stats.lit_cmdbytes += 1 + 2 * param_len;
+}
+
+void rs_emit_prime_cmd(rs_job_t *job)
+{
+    int cmd = job->format.compact ? RS_OP_V2_PRIME : RS_OP_PRIME;
+
+    rs_trace("emit PRIME, cmd_byte=%#04x", cmd);
+    rs_squirt_byte(job, (rs_byte_t)cmd);
+}
+
+void rs_emit_window_cmd(rs_job_t *job, size_t window)
+{
+    if (job->format.compact) {
+        rs_trace("emit WINDOW_V(window=" FMT_SIZE "), cmd_byte=%#04x",
+                 window, RS_OP_V2_WINDOW_V);
+        rs_squirt_byte(job, RS_OP_V2_WINDOW_V);
+        rs_squirt_varint(job, (rs_long_t)window);
+        return;
+    }
+    rs_trace("emit WINDOW_N4(window=" FMT_SIZE "), cmd_byte=%#04x", window,
+             RS_OP_WINDOW_N4);
+    rs_squirt_byte(job, RS_OP_WINDOW_N4);
+    rs_squirt_n4(job, (int)window);
+}
+
+/** Get the command for a COPY or SELF with parameters of where_bytes and
+ * len_bytes, given the command for (1,1). */
+static int rs_copy_op(int op_n1_n1, int where_bytes, int len_bytes)
+{
+    int cmd = op_n1_n1;
 
     /* Commands ascend (1,1), (1,2), ... (8, 8) */
     if (where_bytes == 8)
-        cmd = RS_OP_COPY_N8_N1;
+        cmd += 12;
     else if (where_bytes == 4)
-        cmd = RS_OP_COPY_N4_N1;
+        cmd += 8;
     else if (where_bytes == 2)
-        cmd = RS_OP_COPY_N2_N1;
-    else {
+        cmd += 4;
+    else
         assert(where_bytes == 1);
-        cmd = RS_OP_COPY_N1_N1;
-    }
     if (len_bytes == 1) ;
     else if (len_bytes == 2)
         cmd += 1;
@@ -90,6 +173,58 @@ void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
         assert(len_bytes == 8);
         cmd += 3;
     }
+    return cmd;
+}
+
+/** Write a COPY command in a compact delta.
+ *
+ * The position is relative to the end of the last COPY. If it continues
+ * there, the position is left out, and for whole blocks so is the length. */
+static void rs_emit_copy_v2(rs_job_t *job, rs_long_t where, rs_long_t len)
+{
+    rs_stats_t *stats = &job->stats;
+    rs_delta_format_t *f = &job->format;
+    const rs_long_t delta = rs_zigzag(where - f->copy_next);
+    const rs_long_t blocks = f->block_len ? len / f->block_len : 0;
+    int cmd_len = 1;
+
+    if (!delta && blocks && blocks <= 128 && len == blocks * f->block_len) {
+        rs_trace("emit COPY_BLOCKS_" FMT_LONG "(where=" FMT_LONG ", len="
+                 FMT_LONG "), cmd_byte=%#04x", blocks, where, len,
+                 (int)(RS_OP_V2_COPY_BLOCKS_1 + blocks - 1));
+        rs_squirt_byte(job, (rs_byte_t)(RS_OP_V2_COPY_BLOCKS_1 + blocks - 1));
+    } else if (!delta) {
+        rs_trace("emit COPY_NEXT_V(where=" FMT_LONG ", len=" FMT_LONG
+                 "), cmd_byte=%#04x", where, len, RS_OP_V2_COPY_NEXT_V);
+        rs_squirt_byte(job, RS_OP_V2_COPY_NEXT_V);
+        rs_squirt_varint(job, len);
+        cmd_len += rs_varint_len(len);
+    } else {
+        rs_trace("emit COPY_V_V(where=" FMT_LONG ", len=" FMT_LONG
+                 "), cmd_byte=%#04x", where, len, RS_OP_V2_COPY_V_V);
+        rs_squirt_byte(job, RS_OP_V2_COPY_V_V);
+        rs_squirt_varint(job, delta);
+        rs_squirt_varint(job, len);
+        cmd_len += rs_varint_len(delta) + rs_varint_len(len);
+    }
+    f->copy_next = where + len;
+
+    stats->copy_cmds++;
+    stats->copy_bytes += len;
+    stats->copy_cmdbytes += cmd_len;
+}
+
+void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
+{
+    rs_stats_t *stats = &job->stats;
+    const int where_bytes = rs_int_len(where);
+    const int len_bytes = rs_int_len(len);
+    const int cmd = rs_copy_op(RS_OP_COPY_N1_N1, where_bytes, len_bytes);
+
+    if (job->format.compact) {
+        rs_emit_copy_v2(job, where, len);
+        return;
+    }
 
     rs_trace("emit COPY_N%d_N%d(where=" FMT_LONG ", len=" FMT_LONG
              "), cmd_byte=%#04x", where_bytes, len_bytes, where, len, cmd);
@@ -102,6 +237,50 @@ void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
     stats->copy_cmdbytes += 1 + where_bytes + len_bytes;
 }
 
+void rs_emit_self_cmd(rs_job_t *job, rs_long_t dist, rs_long_t len)
+{
+    rs_stats_t *stats = &job->stats;
+    const int dist_bytes = rs_int_len(dist);
+    const int len_bytes = rs_int_len(len);
+    const int cmd = rs_copy_op(RS_OP_SELF_N1_N1, dist_bytes, len_bytes);
+
+    if (job->format.compact) {
+        rs_trace("emit SELF_V_V(dist=" FMT_LONG ", len=" FMT_LONG
+                 "), cmd_byte=%#04x", dist, len, RS_OP_V2_SELF_V_V);
+        rs_squirt_byte(job, RS_OP_V2_SELF_V_V);
+        rs_squirt_varint(job, dist);
+        rs_squirt_varint(job, len);
+        stats->copy_cmds++;
+        stats->copy_bytes += len;
+        stats->copy_cmdbytes += 1 + rs_varint_len(dist) + rs_varint_len(len);
+        return;
+    }
+
+    rs_trace("emit SELF_N%d_N%d(dist=" FMT_LONG ", len=" FMT_LONG
+             "), cmd_byte=%#04x", dist_bytes, len_bytes, dist, len, cmd);
+    rs_squirt_byte(job, (rs_byte_t)cmd);
+    rs_squirt_netint(job, dist, dist_bytes);
+    rs_squirt_netint(job, len, len_bytes);
+
+    stats->copy_cmds++;
+    stats->copy_bytes += len;
+    stats->copy_cmdbytes += 1 + dist_bytes + len_bytes;
+}
+
+void rs_emit_checksum_cmd(rs_job_t *job, rs_byte_t const *sum)
+{
+    rs_byte_t cmd[1 + RS_MAX_STRONG_SUM_LENGTH];
+
+    cmd[0] = job->format.compact ? RS_OP_V2_CHECKSUM_32 : RS_OP_CHECKSUM_32;
+    rs_trace("emit CHECKSUM_32, cmd_byte=%#04x", cmd[0]);
+    if (sum)
+        memcpy(cmd + 1, sum, RS_MAX_STRONG_SUM_LENGTH);
+    else
+        blake2b_final(&job->checksum_state, cmd + 1,
+                      RS_MAX_STRONG_SUM_LENGTH);
+    rs_tube_write(job, cmd, sizeof(cmd));
+}
+
 void rs_emit_end_cmd(rs_job_t *job)
 {
     int cmd = RS_OP_END;
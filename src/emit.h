@@ -35,12 +35,31 @@ void rs_emit_delta_header(rs_job_t *);
 /** Write a LITERAL command. */
 void rs_emit_literal_cmd(rs_job_t *, int len);
 
+/** Write a ZLITERAL command for len bytes compressed to zlen bytes. */
+void rs_emit_zliteral_cmd(rs_job_t *job, size_t len, size_t zlen);
+
+/** Write a PRIME command to start priming ZLITERAL compression. */
+void rs_emit_prime_cmd(rs_job_t *);
+
+/** Write a WINDOW command to start keeping window bytes of history for SELF
+ * commands. */
+void rs_emit_window_cmd(rs_job_t *job, size_t window);
+
 /** Write a COPY command for given offset and length.
  *
  * There is a choice of variable-length encodings, depending on the size of
  * representation for the parameters. */
 void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len);
 
+/** Write a SELF command to copy len bytes from dist bytes back in the
+ * output. */
+void rs_emit_self_cmd(rs_job_t *job, rs_long_t dist, rs_long_t len);
+
+/** Write a CHECKSUM command with the hash of the new file.
+ *
+ * The hash is sum, or if it's NULL the one the job made of the new file. */
+void rs_emit_checksum_cmd(rs_job_t *, rs_byte_t const *sum);
+
 /** Write an END command. */
 void rs_emit_end_cmd(rs_job_t *);
 
@@ -50,25 +50,14 @@
 #  include <windows.h>
 #endif
 #include "librsync.h"
+#include "largefile.h"
 #include "trace.h"
+#include "util.h"
 
-/* Use fseeko64, _fseeki64, or fseeko for long files if they exist. */
-#if defined(HAVE_FSEEKO64) && (SIZEOF_OFF_T < 8)
-#  define fopen(f, m) fopen64((f), (m))
-#  define fseek(f, o, w) fseeko64((f), (o), (w))
-#elif defined(HAVE__FSEEKI64)
-#  define fseek(f, o, w) _fseeki64((f), (o), (w))
-#elif defined(HAVE_FSEEKO)
-#  define fseek(f, o, w) fseeko((f), (o), (w))
-#endif
-
-/* Use fstat64 or _fstati64 for long file fstat if they exist. */
-#if defined(HAVE_FSTAT64) && (SIZEOF_OFF_T < 8)
-#  define stat stat64
-#  define fstat(f,s) fstat64((f), (s))
-#elif defined(HAVE__FSTATI64)
-#  define stat _stati64
-#  define fstat(f,s) _fstati64((f), (s))
+/* Use _lseeki64 and _read if they exist. */
+#ifdef _WIN32
+#  define lseek(f, o, w) _lseeki64((f), (o), (w))
+#  define read(f, b, l) _read((f), (b), (unsigned)(l))
 #endif
 
 /* Make sure S_ISREG is defined. */
@@ -184,3 +173,94 @@ rs_result rs_file_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
         return RS_INPUT_ENDED;
     }
 }
+
+/** Default size of the basis read-ahead buffer for rs_fd_copy_cb(). */
+#define RS_DEFAULT_READAHEAD ((size_t)64 << 10)
+
+/** State for rs_fd_copy_cb(). */
+struct rs_fd_basis {
+    int fd;
+    rs_byte_t *buf;             /**< The read-ahead buffer. */
+    size_t buf_size;            /**< The read-ahead buffer size. */
+    rs_long_t buf_pos;          /**< The file offset of the buffer data. */
+    size_t buf_len;             /**< The amount of data in the buffer. */
+    rs_long_t next_pos;         /**< The end of the last read. */
+};
+
+rs_fd_basis_t *rs_fd_basis_new(int fd, size_t readahead)
+{
+    rs_fd_basis_t *basis = rs_alloc_struct(rs_fd_basis_t);
+
+    basis->fd = fd;
+    basis->buf_size = readahead ? readahead : RS_DEFAULT_READAHEAD;
+    basis->buf = rs_alloc(basis->buf_size, "basis read-ahead buffer");
+    return basis;
+}
+
+void rs_fd_basis_free(rs_fd_basis_t *basis)
+{
+    rs_free(basis->buf);
+    rs_free(basis);
+}
+
+/** Read up to *len bytes at pos from fd without moving the file offset. */
+static rs_result rs_fd_read(int fd, rs_long_t pos, size_t *len, void *buf)
+{
+    long n;
+
+    do {
+#ifdef HAVE_PREAD
+        /* Casting pos to off_t would truncate it for pread64. */
+        n = (long)pread(fd, buf, *len, pos);
+#else
+        if (lseek(fd, pos, SEEK_SET) < 0) {
+            rs_error("seek failed: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        n = (long)read(fd, buf, *len);
+#endif
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        rs_error("read error: %s", strerror(errno));
+        return RS_IO_ERROR;
+    } else if (!n) {
+        rs_error("unexpected eof on fd%d", fd);
+        return RS_INPUT_ENDED;
+    }
+    *len = (size_t)n;
+    return RS_DONE;
+}
+
+rs_result rs_fd_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    rs_fd_basis_t *basis = (rs_fd_basis_t *)arg;
+    size_t avail;
+    rs_result result;
+
+    if (pos < basis->buf_pos
+        || pos >= basis->buf_pos + (rs_long_t)basis->buf_len) {
+        /* Only read ahead if this continues on from or just after the last
+           read, otherwise read only what was asked for straight into the
+           output. Reads at least as big as the buffer always go straight to
+           the output. */
+        if (*len >= basis->buf_size || pos < basis->next_pos
+            || pos - basis->next_pos >= (rs_long_t)basis->buf_size) {
+            result = rs_fd_read(basis->fd, pos, len, *buf);
+            basis->next_pos = pos + (rs_long_t)*len;
+            return result;
+        }
+        avail = basis->buf_size;
+        basis->buf_len = 0;
+        result = rs_fd_read(basis->fd, pos, &avail, basis->buf);
+        if (result != RS_DONE)
+            return result;
+        basis->buf_pos = pos;
+        basis->buf_len = avail;
+    }
+    avail = basis->buf_len - (size_t)(pos - basis->buf_pos);
+    if (*len > avail)
+        *len = avail;
+    *buf = basis->buf + (pos - basis->buf_pos);
+    basis->next_pos = pos + (rs_long_t)*len;
+    return RS_DONE;
+}
@@ -21,13 +21,16 @@
 #include <assert.h>
 #include <stdlib.h>
 #include "hashtable.h"
+#include "util.h"
 
 /* Open addressing works best if it can take advantage of memory caches using
    locality for probes of adjacent buckets on collisions. So we pack the keys
    tightly together in their own key table and avoid referencing the element
    table and elements as much as possible. Key value zero is reserved as a
    marker for an empty bucket to avoid checking for NULL in the element table.
-   If we do get a hash value of zero, we -1 to wrap it around to 0xffff. */
+   If we do get a hash value of zero, we -1 to wrap it around to 0xffff. A
+   removed entry keeps its key with a NULL element, so the element table is
+   only checked for NULL after a key matches. */
 
 /* Use max 0.7 load factor to avoid bad open addressing performance. */
 #define HASHTABLE_LOADFACTOR_NUM 7
@@ -42,20 +45,17 @@ hashtable_t *_hashtable_new(int size)
     size = 1 + size * HASHTABLE_LOADFACTOR_DEN / HASHTABLE_LOADFACTOR_NUM;
     /* Use next power of 2 larger than the requested size and get mask bits. */
     for (size2 = 2, bits2 = 1; (int)size2 < size; size2 <<= 1, bits2++) ;
-    if (!(t = calloc(1, sizeof(hashtable_t)+ size2 * sizeof(unsigned))))
-        return NULL;
-    if (!(t->etable = calloc(size2, sizeof(void *)))) {
-        _hashtable_free(t);
-        return NULL;
-    }
+    /* Big tables are randomly probed, so use huge pages if enabled. */
+    t = rs_alloc_huge0(sizeof(hashtable_t)+ size2 * sizeof(unsigned),
+                       "hashtable");
+    t->etable = rs_alloc_huge0(size2 * sizeof(void *), "hashtable->etable");
     t->size = (int)size2;
-    t->count = 0;
+    t->count = t->removed = 0;
+    t->limit =
+        (int)(size2 * HASHTABLE_LOADFACTOR_NUM / HASHTABLE_LOADFACTOR_DEN);
     t->tmask = size2 - 1;
 #ifndef HASHTABLE_NBLOOM
-    if (!(t->kbloom = calloc((size2 + 7) / 8, sizeof(unsigned char)))) {
-        _hashtable_free(t);
-        return NULL;
-    }
+    t->kbloom = rs_alloc_huge0((size2 + 7) / 8, "hashtable->kbloom");
     t->bshift = (unsigned)sizeof(unsigned) * 8 - bits2;
     assert(t->tmask == (unsigned)-1 >> t->bshift);
 #endif
@@ -65,13 +65,42 @@ hashtable_t *_hashtable_new(int size)
     return t;
 }
 
+hashtable_t *_hashtable_resize(hashtable_t *t, int size)
+{
+    hashtable_t *n = _hashtable_new(size);
+    unsigned i, j, s, h;
+
+    assert(size >= t->count);
+    for (i = 0; i < (unsigned)t->size; i++) {
+        if (!t->etable[i])
+            continue;
+        /* The keys already have any mix32() applied. */
+        h = t->ktable[i];
+        for (j = h & n->tmask, s = 0; n->ktable[j]; j = (j + ++s) & n->tmask) ;
+        n->ktable[j] = h;
+        n->etable[j] = t->etable[i];
+#ifndef HASHTABLE_NBLOOM
+        hashtable_setbloom(n, h);
+#endif
+    }
+    n->count = t->count;
+#ifndef HASHTABLE_NSTATS
+    n->find_count = t->find_count;
+    n->match_count = t->match_count;
+    n->hashcmp_count = t->hashcmp_count;
+    n->entrycmp_count = t->entrycmp_count;
+#endif
+    _hashtable_free(t);
+    return n;
+}
+
 void _hashtable_free(hashtable_t *t)
 {
     if (t) {
-        free(t->etable);
+        rs_free(t->etable);
 #ifndef HASHTABLE_NBLOOM
-        free(t->kbloom);
+        rs_free(t->kbloom);
 #endif
-        free(t);
+        rs_free(t);
     }
 }
@@ -30,14 +30,16 @@
  *
  * It uses open addressing with quadratic probing for collisions. The
  * MurmurHash3 finalization function is optionally used on the hash() output to
- * avoid clustering and can be disabled by setting HASHTABLE_NMIX32. There is
- * no support for removing entries, only adding them. Multiple entries with the
- * same key can be added, and you can use a fancy cmp() function to find
- * particular entries by more than just their key. There is an iterator for
- * iterating through all entries in the hashtable. There are optional
- * NAME_find() find/match/hashcmp/entrycmp stats counters that can be disabled
- * by defining HASHTABLE_NSTATS. There is an optional simple k=1 bloom filter
- * for speed that can be disabled by defining HASHTABLE_NBLOOM.
+ * avoid clustering and can be disabled by setting HASHTABLE_NMIX32. Removed
+ * entries leave their bucket in use to keep the probe sequences through it
+ * intact, but it is reused by later adds. The table can be resized to grow it
+ * as entries are added, which also clears out removed entries. Multiple
+ * entries with the same key can be added, and you can use a fancy cmp()
+ * function to find particular entries by more than just their key. There is
+ * an iterator for iterating through all entries in the hashtable. There are
+ * optional NAME_find() find/match/hashcmp/entrycmp stats counters that can be
+ * disabled by defining HASHTABLE_NSTATS. There is an optional simple k=1
+ * bloom filter for speed that can be disabled by defining HASHTABLE_NBLOOM.
  *
  * The types and methods of the hashtable and its contents are specified by
  * using \#define parameters set to their basenames (the prefixes for the *_t
@@ -79,6 +81,9 @@
  *   myentry_hashtable_add(t, &entries[5]);
  *   k = ...;
  *   e = myentry_hashtable_find(t, &k);
+ *   myentry_hashtable_remove(t, &entries[5]);
+ *   if (hashtable_full(t))
+ *     t = myentry_hashtable_resize(t, 2 * t->count);
  *
  *   int i;
  *   for (e = myentry_hashtable_iter(t, &i); e != NULL;
@@ -128,6 +133,8 @@
 typedef struct hashtable {
     int size;                   /**< Size of allocated hashtable. */
     int count;                  /**< Number of entries in hashtable. */
+    int removed;                /**< Number of removed entries' buckets. */
+    int limit;                  /**< Max count + removed for performance. */
     unsigned tmask;             /**< Mask to get the hashtable index. */
 #  ifndef HASHTABLE_NBLOOM
     unsigned bshift;            /**< Shift to get the bloomfilter index. */
@@ -148,8 +155,17 @@ typedef struct hashtable {
 
 /* void* implementations for the type-safe static inline wrappers below. */
 hashtable_t *_hashtable_new(int size);
+hashtable_t *_hashtable_resize(hashtable_t *t, int size);
 void _hashtable_free(hashtable_t *t);
 
+/** Whether a hashtable is full enough that performance will degrade.
+ *
+ * Removed entries count too, as their buckets are still in use. */
+static inline bool hashtable_full(hashtable_t const *t)
+{
+    return t->count + t->removed >= t->limit;
+}
+
 #  ifndef HASHTABLE_NBLOOM
 static inline void hashtable_setbloom(hashtable_t *t, unsigned const h)
 {
@@ -177,6 +193,17 @@ static inline unsigned mix32(unsigned h)
     return h;
 }
 
+/** The inverse of mix32(). */
+static inline unsigned unmix32(unsigned h)
+{
+    h ^= h >> 16;
+    h *= 0x7ed1b41d;
+    h ^= (h >> 13) ^ (h >> 26);
+    h *= 0xa5cb9243;
+    h ^= h >> 16;
+    return h;
+}
+
 /** Ensure hash's are never zero. */
 static inline unsigned nozero(unsigned h)
 {
@@ -215,7 +242,9 @@ static inline unsigned nozero(unsigned h)
 #  define NAME_new _JOIN(NAME, _new)
 #  define NAME_free _JOIN(NAME, _free)
 #  define NAME_stats_init _JOIN(NAME, _stats_init)
+#  define NAME_resize _JOIN(NAME, _resize)
 #  define NAME_add _JOIN(NAME, _add)
+#  define NAME_remove _JOIN(NAME, _remove)
 #  define NAME_find _JOIN(NAME, _find)
 #  define NAME_iter _JOIN(NAME, _iter)
 #  define NAME_next _JOIN(NAME, _next)
@@ -270,6 +299,23 @@ static inline void NAME_free(hashtable_t *t)
     _hashtable_free(t);
 }
 
+/** Resize a hashtable, moving its entries to a new one.
+ *
+ * This can be used to grow a hashtable as entries are added, and also clears
+ * out the buckets of removed entries. Pointers to the old hashtable are no
+ * longer valid.
+ *
+ * \param *t - The hashtable to resize.
+ *
+ * \param size - The desired minimum size of the new hash table, which should
+ * be at least the number of entries.
+ *
+ * \return The resized hashtable instance. */
+static inline hashtable_t *NAME_resize(hashtable_t *t, int size)
+{
+    return _hashtable_resize(t, size);
+}
+
 /** Initialize hashtable stats counters.
  *
  * This will reset all the stats counters for the hashtable,
@@ -298,17 +344,48 @@ static inline ENTRY_t *NAME_add(hashtable_t *t, ENTRY_t *e)
     unsigned he = _KEY_HASH(e);
 
     assert(e != NULL);
-    if (t->count + 1 == t->size)
+    _for_probe(t, he, i, h) {
+        /* Reuse the bucket of a removed entry. */
+        if (t->removed && !t->etable[i])
+            break;
+    }
+    if (h)
+        t->removed--;
+    else if (t->count + t->removed + 1 == t->size)
         return NULL;
 #  ifndef HASHTABLE_NBLOOM
     hashtable_setbloom(t, he);
 #  endif
-    _for_probe(t, he, i, h);
     t->count++;
     t->ktable[i] = he;
     return t->etable[i] = e;
 }
 
+/** Remove an entry from a hashtable.
+ *
+ * This finds the entry itself, not by using MATCH_cmp(), and doesn't free it.
+ *
+ * \param *t - The hashtable to remove from.
+ *
+ * \param *e - The entry object to remove.
+ *
+ * \return The removed entry, or NULL if it wasn't in the table. */
+static inline ENTRY_t *NAME_remove(hashtable_t *t, ENTRY_t *e)
+{
+    unsigned he = _KEY_HASH(e);
+
+    assert(e != NULL);
+    _for_probe(t, he, i, h) {
+        if (h == he && t->etable[i] == e) {
+            t->etable[i] = NULL;
+            t->count--;
+            t->removed++;
+            return e;
+        }
+    }
+    return NULL;
+}
+
 /** Find an entry in a hashtable.
  *
  * Uses MATCH_cmp() to find the first matching entry in the table in the same
@@ -332,9 +409,9 @@ static inline ENTRY_t *NAME_find(hashtable_t *t, MATCH_t *m)
 #  endif
     _for_probe(t, hm, i, he) {
         _stats_inc(t->hashcmp_count);
-        if (hm == he) {
+        if (hm == he && (e = t->etable[i])) {
             _stats_inc(t->entrycmp_count);
-            if (!MATCH_cmp(m, e = t->etable[i])) {
+            if (!MATCH_cmp(m, e)) {
                 _stats_inc(t->match_count);
                 return e;
             }
@@ -402,7 +479,9 @@ static inline ENTRY_t *NAME_next(hashtable_t *t, int *i)
 #  undef NAME_new
 #  undef NAME_free
 #  undef NAME_stats_init
+#  undef NAME_resize
 #  undef NAME_add
+#  undef NAME_remove
 #  undef NAME_find
 #  undef NAME_iter
 #  undef NAME_next
@@ -28,6 +28,7 @@
 #include "config.h"             /* IWYU pragma: keep */
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "librsync.h"
 #include "job.h"
@@ -37,11 +38,51 @@
 
 static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers);
 
+/** Free the members that are only used by one job. */
+static void rs_job_free_members(rs_job_t *job)
+{
+    if (job->job_owns_sig)
+        rs_free_sumset(job->signature);
+    rs_selfsums_free(job->selfsums);
+    rs_chain_free(job->chain);
+}
+
 rs_job_t *rs_job_new(char const *job_name, rs_result (*statefn)(rs_job_t *))
 {
-    rs_job_t *job;
+    return rs_job_renew(NULL, job_name, statefn);
+}
+
+rs_job_t *rs_job_renew(rs_job_t *job, char const *job_name,
+                       rs_result (*statefn)(rs_job_t *))
+{
+    rs_byte_t *scoop_buf, *history;
+    size_t scoop_alloc, history_window;
+    rs_zlit_t *zlit;
 
-    job = rs_alloc_struct(rs_job_t);
+    if (job) {
+        /* Keep the scoop buffer, compressor and history buffer, but reset
+           everything else. */
+        rs_job_check(job);
+        scoop_buf = job->scoop_buf;
+        scoop_alloc = job->scoop_alloc;
+        zlit = job->zlit ? job->zlit : job->spare_zlit;
+        if (job->history) {
+            history = job->history;
+            history_window = job->history_window;
+        } else {
+            history = job->spare_history;
+            history_window = job->spare_history_window;
+        }
+        rs_job_free_members(job);
+        rs_bzero(job, sizeof *job);
+        job->scoop_buf = job->scoop_next = scoop_buf;
+        job->scoop_alloc = scoop_alloc;
+        job->spare_zlit = zlit;
+        job->spare_history = history;
+        job->spare_history_window = history_window;
+    } else {
+        job = rs_alloc_struct(rs_job_t);
+    }
 
     job->job_name = job_name;
     job->dogtag = RS_JOB_TAG;
@@ -57,11 +98,14 @@ rs_job_t *rs_job_new(char const *job_name, rs_result (*statefn)(rs_job_t *))
 
 rs_result rs_job_free(rs_job_t *job)
 {
-    free(job->scoop_buf);
-    if (job->job_owns_sig)
-        rs_free_sumset(job->signature);
+    rs_free(job->scoop_buf);
+    rs_zlit_free(job->zlit);
+    rs_zlit_free(job->spare_zlit);
+    rs_free(job->history);
+    rs_free(job->spare_history);
+    rs_job_free_members(job);
     rs_bzero(job, sizeof *job);
-    free(job);
+    rs_free(job);
 
     return RS_DONE;
 }
@@ -105,6 +149,53 @@ rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers)
     return result;
 }
 
+void rs_job_track_output(rs_job_t *job)
+{
+    rs_byte_t *out = (rs_byte_t *)job->stream->next_out;
+
+    if (out > job->output_next) {
+        if (job->checksum_output)
+            blake2b_update(&job->checksum_state, job->output_next,
+                           (size_t)(out - job->output_next));
+        if (job->history_output)
+            rs_job_history_add(job, job->output_next,
+                               (size_t)(out - job->output_next));
+    }
+    job->output_next = out;
+}
+
+void rs_job_history_init(rs_job_t *job, size_t window)
+{
+    if (!job->history && job->spare_history) {
+        job->history = job->spare_history;
+        job->history_window = job->spare_history_window;
+        job->spare_history = NULL;
+    }
+    if (window > job->history_window) {
+        job->history = rs_realloc(job->history, 2 * window, "history");
+        job->history_window = window;
+    }
+}
+
+void rs_job_history_add(rs_job_t *job, void const *buf, size_t len)
+{
+    const size_t window = job->history_window;
+    size_t keep;
+
+    if (len >= window) {
+        buf = (rs_byte_t const *)buf + len - window;
+        len = window;
+        job->history_len = 0;
+    } else if (job->history_len + len > 2 * window) {
+        /* Move the data that's still needed to the start. */
+        keep = window - len;
+        memmove(job->history, job->history + job->history_len - keep, keep);
+        job->history_len = keep;
+    }
+    memcpy(job->history + job->history_len, buf, len);
+    job->history_len += len;
+}
+
 static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
 {
     rs_result result;
@@ -113,6 +204,7 @@ static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
     assert(buffers);
 
     job->stream = buffers;
+    job->output_next = (rs_byte_t *)buffers->next_out;
     while (1) {
         result = rs_tube_catchup(job);
         if (result == RS_DONE && job->statefn) {
@@ -124,6 +216,8 @@ static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
                 continue;
             }
         }
+        if (result == RS_BLOCKED || result != RS_RUNNING)
+            rs_job_track_output(job);
         if (result == RS_BLOCKED)
             return result;
         if (result != RS_RUNNING)
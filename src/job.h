@@ -33,6 +33,10 @@
 #  include <stddef.h>
 #  include "mdfour.h"
 #  include "checksum.h"
+#  include "blake2.h"
+#  include "zlit.h"
+#  include "selfsums.h"
+#  include "prototab.h"
 #  include "librsync.h"
 
 /** Magic job tag number for checking jobs have been initialized. */
@@ -43,6 +47,9 @@
  * This is used to constrain and set the internal buffer sizes. */
 #  define MAX_DELTA_CMD (1<<16)
 
+/** The earlier deltas of a chain of patches. */
+typedef struct rs_chain rs_chain_t;
+
 /** The contents of this structure are private. */
 struct rs_job {
     int dogtag;
@@ -64,10 +71,16 @@ struct rs_job {
     int sig_block_len;
     int sig_strong_len;
 
+    /** Whether the signature has content defined chunks. */
+    int sig_cdc;
+
     /** The size of the signature file if available. Used by loadsums.c when
      * initializing the signature to preallocate memory. */
     rs_long_t sig_fsize;
 
+    /** The offset and length of the range signed by a range signature job. */
+    rs_long_t sig_range_start, sig_range_len;
+
     /** Pointer to the signature that's being used by the operation. */
     rs_signature_t *signature;
 
@@ -80,6 +93,9 @@ struct rs_job {
     /** The weak signature digest used by readsums.c */
     rs_weak_sum_t weak_sig;
 
+    /** The chunk length used by readsums.c */
+    int chunk_len;
+
     /** The rollsum weak signature accumulator used by delta.c */
     weaksum_t weak_sum;
 
@@ -87,7 +103,26 @@ struct rs_job {
     rs_long_t param1, param2;
 
     struct rs_prototab_ent const *cmd;
-    rs_mdfour_t output_md4;
+
+    /** The length of the current command with its parameters. */
+    int cmd_len;
+
+    /** The format of the delta commands being read or written. */
+    rs_delta_format_t format;
+
+    /** Whether the delta has a checksum of the new file. */
+    int checksum;
+
+    /** Whether the new file is the output, which is hashed as it is written
+     * until the checksum is checked. This is set for patch jobs. */
+    int checksum_output;
+
+    /** The BLAKE2b hash of the new file so far. */
+    blake2b_state checksum_state;
+
+    /** The output from here on hasn't been hashed or added to the history
+     * yet. */
+    rs_byte_t *output_next;
 
     /** Encoding statistics. */
     rs_stats_t stats;
@@ -104,11 +139,17 @@ struct rs_job {
     rs_byte_t *scan_buf;        /**< The delta scan buffer pointer. */
     size_t scan_len;            /**< The delta scan buffer length. */
     size_t scan_pos;            /**< The delta scan position. */
+    size_t scan_miss;           /**< The missed chunk left to scan. */
 
     /** If USED is >0, then buf contains that much write data to be sent out. */
-    rs_byte_t write_buf[36];
+    rs_byte_t write_buf[40];
     size_t write_len;
 
+    /** If send_len is >0, then send_buf[0..send_len] is sent after write_buf.
+     * The data is owned by the caller of rs_tube_send(). */
+    rs_byte_t const *send_buf;
+    size_t send_len;
+
     /** If \p copy_len is >0, then that much data should be copied through
      * from the input. */
     size_t copy_len;
@@ -116,13 +157,87 @@ struct rs_job {
     /** Copy from the basis position. */
     rs_long_t basis_pos, basis_len;
 
+    /** The distance back to a match in the delta output, or 0 for a match in
+     * the basis. For a match in the output, basis_pos is its new file offset.
+     * In a patch job this is the distance for the current SELF command. */
+    rs_long_t self_dist;
+
+    /** The new file offset of scan_buf in a delta job. */
+    rs_long_t new_pos;
+
+    /** The compressor for LITERAL data in a delta job, or decompressor for
+     * ZLITERAL commands in a patch job, or NULL. */
+    rs_zlit_t *zlit;
+
+    /** The new file data before the current position, used to prime ZLITERAL
+     * compression and for SELF commands, or NULL if neither is used.
+     * history[0..history_len] holds at least the last history_window bytes,
+     * in a buffer twice that size. */
+    rs_byte_t *history;
+    size_t history_len, history_window;
+
+    /** The compressor or decompressor and the history buffer, with its
+     * window, from before the job was renewed, kept for reuse, or NULL. */
+    rs_zlit_t *spare_zlit;
+    rs_byte_t *spare_history;
+    size_t spare_history_window;
+
+    /** Whether ZLITERAL data is primed with the history. */
+    int prime;
+
+    /** The max distance of SELF commands, or 0 if there are none. */
+    size_t self_window;
+
+    /** The block sums of the delta output for finding SELF matches, or
+     * NULL. */
+    rs_selfsums_t *selfsums;
+
+    /** Whether the output is added to the history as it is written. This is
+     * set for patch jobs. */
+    int history_output;
+
+    /** Whether the delta only COPYs from at or after its output position, so
+     * it can be applied in place. Set from rs_delta_opts_t::inplace. */
+    int inplace;
+
     /** Callback used to copy data from the basis into the output. */
     rs_copy_cb *copy_cb;
     void *copy_arg;
+
+    /** The earlier deltas of a patch job from rs_patch_chain_begin(), which
+     * copy_cb reads the basis through, or NULL. */
+    rs_chain_t *chain;
+
+    /** If set, this is used to copy COPY data from the basis into the output
+     * instead of copy_cb and the output buffer. It is called with the basis
+     * position and length to copy, and sets len to the amount copied. This is
+     * used by drivers that write the output themselves, for zero-copy or
+     * kernel-side copies. */
+    rs_result (*copy_out)(rs_job_t *job, rs_long_t pos, size_t *len);
+    void *copy_out_arg;
 };
 
 rs_job_t *rs_job_new(const char *, rs_result (*statefn)(rs_job_t *));
 
+/** Add the output written since the last call to the checksum and history,
+ * if the job tracks its output. */
+void rs_job_track_output(rs_job_t *job);
+
+/** Keep a history of at least window bytes of new file data. */
+void rs_job_history_init(rs_job_t *job, size_t window);
+
+/** Add new file data to the history. */
+void rs_job_history_add(rs_job_t *job, void const *buf, size_t len);
+
+/** Free the deltas of a job from rs_patch_chain_begin(). */
+void rs_chain_free(rs_chain_t *chain);
+
+/** Reset a job for reuse as a new job, keeping its scoop buffer.
+ *
+ * If \p job is NULL a new job is allocated like rs_job_new(). */
+rs_job_t *rs_job_renew(rs_job_t *job, const char *,
+                       rs_result (*statefn)(rs_job_t *));
+
 /** Assert that a job is valid.
  *
  * We don't use a static inline function here so that assert failure output
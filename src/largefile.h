@@ -0,0 +1,62 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file largefile.h
+ * File IO with 64 bit offsets.
+ *
+ * Where off_t is 32 bits, these map the file IO functions to the versions
+ * that can use offsets past 2GB. It must be included after config.h and the
+ * system headers that declare the functions. */
+#ifndef LARGEFILE_H
+#  define LARGEFILE_H
+
+/* Use fseeko64, _fseeki64, or fseeko for long files if they exist. */
+#  if defined(HAVE_FSEEKO64) && (SIZEOF_OFF_T < 8)
+#    define fopen(f, m) fopen64((f), (m))
+#    define fseek(f, o, w) fseeko64((f), (o), (w))
+#    define ftell(f) ftello64((f))
+#  elif defined(HAVE__FSEEKI64)
+#    define fseek(f, o, w) _fseeki64((f), (o), (w))
+#    define ftell(f) _ftelli64((f))
+#  elif defined(HAVE_FSEEKO)
+#    define fseek(f, o, w) fseeko((f), (o), (w))
+#    define ftell(f) ftello((f))
+#  endif
+
+/* Use fstat64 or _fstati64 for long file fstat if they exist. */
+#  if defined(HAVE_FSTAT64) && (SIZEOF_OFF_T < 8)
+#    define stat stat64
+#    define fstat(f,s) fstat64((f), (s))
+#  elif defined(HAVE__FSTATI64)
+#    define stat _stati64
+#    define fstat(f,s) _fstati64((f), (s))
+#  endif
+
+/* Use pread64, pwrite64 and lseek64 for long files if they exist. */
+#  if defined(HAVE_PREAD64) && (SIZEOF_OFF_T < 8)
+#    define pread(f, b, l, o) pread64((f), (b), (l), (o))
+#  endif
+#  if defined(HAVE_PWRITE64) && (SIZEOF_OFF_T < 8)
+#    define pwrite(f, b, l, o) pwrite64((f), (b), (l), (o))
+#  endif
+#  if defined(HAVE_LSEEK64) && (SIZEOF_OFF_T < 8)
+#    define lseek(f, o, w) lseek64((f), (o), (w))
+#  endif
+
+#endif                          /* !LARGEFILE_H */
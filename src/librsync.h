@@ -70,6 +70,36 @@ typedef enum {
      * The four-byte literal \c "rs\x026". */
     RS_DELTA_MAGIC = 0x72730236,
 
+    /** A delta file with a checksum of the new file.
+     *
+     * This is like ::RS_DELTA_MAGIC, but the END command is preceded by a
+     * CHECKSUM command with the 32 byte BLAKE2b hash of the new file, which
+     * is checked when patching. Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x027".
+     *
+     * \sa rs_delta_opts_t::checksum */
+    RS_DELTA_BLAKE2_MAGIC = 0x72730237,
+
+    /** A compact delta file.
+     *
+     * This has the same commands as ::RS_DELTA_MAGIC, but with varint
+     * parameters, COPY positions relative to the end of the last COPY, and
+     * one byte COPYs of whole blocks. Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x028".
+     *
+     * \sa rs_delta_opts_t::magic */
+    RS_DELTA_V2_MAGIC = 0x72730238,
+
+    /** A compact delta file with a checksum of the new file.
+     *
+     * This is to ::RS_DELTA_V2_MAGIC what ::RS_DELTA_BLAKE2_MAGIC is to
+     * ::RS_DELTA_MAGIC. Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x029". */
+    RS_DELTA_V2_BLAKE2_MAGIC = 0x72730239,
+
     /** A signature file with MD4 signatures.
      *
      * Backward compatible with librsync < 1.0, but strongly deprecated because
@@ -108,6 +138,48 @@ typedef enum {
      * \sa rs_sig_begin() */
     RS_RK_BLAKE2_SIG_MAGIC = 0x72730147,
 
+    /** A signature file with buzhash rollsum and MD4 hash.
+     *
+     * Uses a rollsum that is faster to roll than RabinKarp, but still
+     * strongly discouraged because of MD4's security vulnerability. Supported
+     * since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01V".
+     *
+     * \sa rs_sig_begin() */
+    RS_BH_MD4_SIG_MAGIC = 0x72730156,
+
+    /** A signature file with buzhash rollsum and BLAKE2 hash.
+     *
+     * Uses a rollsum that is faster to roll than RabinKarp, with a table
+     * lookup, rotate, and xor per byte, but that hashes blocks of a repeating
+     * pattern the same. Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01W".
+     *
+     * \sa rs_sig_begin() */
+    RS_BH_BLAKE2_SIG_MAGIC = 0x72730157,
+
+    /** A range signature, with the block sums of a range of a file.
+     *
+     * The header also has the signature's magic and the range, and range
+     * signatures covering a whole file can be merged into its signature.
+     * Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01R".
+     *
+     * \sa rs_sig_range_begin() \sa rs_signature_merge() */
+    RS_RANGE_SIG_MAGIC = 0x72730152,
+
+    /** A delta index file, for reading ranges of a patch's output.
+     *
+     * Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x02I".
+     *
+     * \sa rs_delta_index_file() */
+    RS_DELTA_INDEX_MAGIC = 0x72730249,
+
 } rs_magic_number;
 
 /** Log severity levels.
@@ -290,6 +362,74 @@ LIBRSYNC_EXPORT void rs_free_sumset(rs_signature_t *);
 /** Dump signatures to the log. */
 LIBRSYNC_EXPORT void rs_sumset_dump(rs_signature_t const *);
 
+/** Use huge pages for large signature tables and buffers.
+ *
+ * If non-zero, large allocations like signature block sums, their hashtables,
+ * and big scoop buffers are huge page aligned and advised to be backed by
+ * huge pages where the platform supports it (Linux transparent huge pages).
+ * This reduces TLB misses for the random lookups done into big signatures
+ * while generating deltas, at the cost of possibly using more memory. The
+ * default 0 means use normal allocations. */
+LIBRSYNC_EXPORT extern int rs_hugepages;
+
+/** A memory allocator for librsync.
+ *
+ * All memory librsync allocates for jobs, signatures, and buffers comes from
+ * the allocator set with rs_set_allocator(). The default uses malloc() and
+ * free(). A custom allocator can avoid the global heap, e.g. to use a
+ * per-thread ::rs_arena_t.
+ *
+ * \sa rs_set_allocator() */
+typedef struct rs_allocator {
+    /** Allocate size bytes, returning NULL on failure. The memory must be
+     * aligned for any type. */
+    void *(*alloc)(void *opaque, size_t size);
+    /** Free memory of size bytes returned by alloc. */
+    void (*free)(void *opaque, void *ptr, size_t size);
+    /** Passed to alloc and free. */
+    void *opaque;
+} rs_allocator_t;
+
+/** Set the allocator for new allocations made by the calling thread.
+ *
+ * Memory is always given back to the allocator it came from, so objects can
+ * be freed after the allocator is changed. The allocator must stay valid
+ * until all memory allocated from it is freed.
+ *
+ * \param allocator The allocator to use, or NULL for malloc() and free().
+ *
+ * \return The previous allocator, so it can be restored. */
+LIBRSYNC_EXPORT rs_allocator_t const *rs_set_allocator(rs_allocator_t const
+                                                       *allocator);
+
+/** An arena for allocating many jobs without using the global heap.
+ *
+ * Arenas allocate memory in big chunks and keep freed memory in pools for
+ * reuse, so after warming up a worker can create and free jobs, scoop
+ * buffers, file buffers, and signatures without calling malloc(). An arena is
+ * not thread safe; use one per thread.
+ *
+ * \sa rs_arena_new() */
+typedef struct rs_arena rs_arena_t;
+
+/** Create a new arena.
+ *
+ * \param chunk_size The size of chunks to allocate from the heap, or 0 for
+ * the default of 1MB. Allocations bigger than this get their own chunk. */
+LIBRSYNC_EXPORT rs_arena_t *rs_arena_new(size_t chunk_size);
+
+/** Get the allocator for an arena, for use with rs_set_allocator(). */
+LIBRSYNC_EXPORT rs_allocator_t const *rs_arena_allocator(rs_arena_t *arena);
+
+/** Free everything allocated from an arena in bulk.
+ *
+ * The arena keeps its chunks for reuse. Any jobs or signatures allocated
+ * from it become invalid and must not be freed or used afterwards. */
+LIBRSYNC_EXPORT void rs_arena_reset(rs_arena_t *arena);
+
+/** Free an arena and everything allocated from it. */
+LIBRSYNC_EXPORT void rs_arena_free(rs_arena_t *arena);
+
 /** Description of input and output buffers.
  *
  * On each call to ::rs_job_iter(), the caller can make available
@@ -445,7 +585,37 @@ LIBRSYNC_EXPORT rs_result rs_sig_args(rs_long_t old_fsize,
                                       rs_magic_number * magic,
                                       size_t *block_len, size_t *strong_len);
 
-/** Start generating a signature.
+/** Options for generating a signature.
+ *
+ * A zeroed struct gives the defaults. The options are copied into the job
+ * when it is started, so jobs in different threads can use different
+ * options.
+ *
+ * \sa rs_sig_begin_opts() */
+typedef struct rs_sig_opts {
+    /** Whether the signature includes a digest of the whole file.
+     *
+     * The signature ends with the length and BLAKE2 hash of the file.
+     * rs_delta_file() uses them to find a new file that hasn't changed with
+     * one read of it, and makes its delta with rs_delta_same_begin(). Older
+     * versions can't load these signatures, and rs_sig_append() can't update
+     * them. */
+    int digest;
+    /** Whether the signature is of content defined chunks.
+     *
+     * The file is cut into chunks where a gear hash of its data matches, like
+     * FastCDC, instead of into blocks of block_len. The block_len is the
+     * average chunk length, and chunks are from a quarter to 8 times it. A
+     * delta against such a signature cuts the new file the same way and only
+     * looks up whole chunks, which is much faster than rolling the weak sum
+     * over every byte of misses, but finds fewer matches. Chunks are still
+     * found after data is inserted or deleted, and are the same in any file
+     * with the same data. Older versions can't load these signatures, and
+     * rs_sig_append() and rs_sig_from_delta() can't make them. */
+    int cdc;
+} rs_sig_opts_t;
+
+/** Start generating a signature with the default options.
  *
  * It's recommended you use rs_sig_args() to get the recommended arguments for
  * this based on the original file size.
@@ -462,16 +632,168 @@ LIBRSYNC_EXPORT rs_result rs_sig_args(rs_long_t old_fsize,
  * "minimum"). Smaller values make the signature shorter but increase the risk
  * of corruption from hash collisions.
  *
- * \sa rs_sig_file() */
+ * \sa rs_sig_file() \sa rs_sig_begin_opts() */
 LIBRSYNC_EXPORT rs_job_t *rs_sig_begin(size_t block_len, size_t strong_len,
                                        rs_magic_number sig_magic);
 
-/** Prepare to compute a streaming delta.
+/** Start generating a signature, like rs_sig_begin().
+ *
+ * \param opts The options, or NULL for the defaults. */
+LIBRSYNC_EXPORT rs_job_t *rs_sig_begin_opts(size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            rs_sig_opts_t const *opts);
+
+/** Reset a job to start generating a signature, like rs_sig_begin().
+ *
+ * This and the other reset functions turn an existing job into a new job
+ * instead of allocating one. The job's scoop buffer is kept, so processing
+ * many small files with one job avoids allocating and growing buffers for
+ * each file. Anything the job owned, like the signature of a signature job,
+ * is freed. The job can be finished, failed, or abandoned part way.
+ *
+ * \sa rs_delta_reset() \sa rs_loadsig_reset() \sa rs_patch_reset() */
+LIBRSYNC_EXPORT rs_job_t *rs_sig_reset(rs_job_t *job, size_t block_len,
+                                       size_t strong_len,
+                                       rs_magic_number sig_magic);
+
+/** Reset a job to start generating a signature, like rs_sig_begin_opts().
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_job_t *rs_sig_reset_opts(rs_job_t *job, size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            rs_sig_opts_t const *opts);
+
+/** Start generating the block sums of a signature without its header.
+ *
+ * This is like rs_sig_begin(), but only outputs the block sums, for
+ * appending to an existing signature with the same arguments.
+ *
+ * \sa rs_sig_append() */
+LIBRSYNC_EXPORT rs_job_t *rs_sig_blocks_begin(size_t block_len,
+                                              size_t strong_len,
+                                              rs_magic_number sig_magic);
+
+/** Start generating a range signature of len bytes from offset start.
  *
- * \todo Add a version of this that takes a ::rs_magic_number controlling the
- * delta format. */
+ * This is like rs_sig_blocks_begin(), but first outputs a range header, so
+ * the range signatures of a file can be made separately and merged with
+ * rs_signature_merge(). The job should be given only the range's data, and
+ * start must be a multiple of the block length.
+ *
+ * \sa rs_sig_range_file() */
+LIBRSYNC_EXPORT rs_job_t *rs_sig_range_begin(rs_long_t start, rs_long_t len,
+                                             size_t block_len,
+                                             size_t strong_len,
+                                             rs_magic_number sig_magic);
+
+/** Options for making a delta.
+ *
+ * A zeroed struct gives the defaults, which make deltas with
+ * ::RS_DELTA_MAGIC.
+ * The options are copied into the job when it is started, so jobs in
+ * different threads can use different options.
+ *
+ * \sa rs_delta_begin_opts() */
+typedef struct rs_delta_opts {
+    /** The delta format, or 0 for ::RS_DELTA_MAGIC.
+     *
+     * ::RS_DELTA_V2_MAGIC makes compact deltas, which save most of the
+     * command bytes of deltas with many small changes. Older versions can't
+     * apply these deltas, and rs_delta_merge() writes the merged delta with
+     * ::RS_DELTA_MAGIC. ::RS_DELTA_BLAKE2_MAGIC and ::RS_DELTA_V2_BLAKE2_MAGIC
+     * are the same formats with the checksum option set. */
+    rs_magic_number magic;
+
+    /** Whether the delta is made to be applied in place.
+     *
+     * COPY commands are only used where they read from at or after the
+     * position they are written to, and other matches are sent as LITERAL
+     * data instead. Such deltas can be applied over the basis with
+     * rs_patch_inplace() without buffering anything, at the cost of being
+     * bigger when data has moved towards the end of the file. */
+    int inplace;
+
+    /** Whether the delta includes a checksum of the new file.
+     *
+     * The delta is made with ::RS_DELTA_BLAKE2_MAGIC. The new file is hashed
+     * as it is read, and the hash is added at the end of the delta. Patching
+     * it hashes the output as it is written and fails with RS_CORRUPT if they
+     * don't match, so a wrong basis or a damaged delta is detected without
+     * reading the new file again. rs_patch_parallel() and rs_patch_inplace()
+     * don't write the output in order, so they read it back to check it. */
+    int checksum;
+
+    /** The zlib compression level for LITERAL data, or 0 for none.
+     *
+     * Each run of literal data that compresses is sent with a ZLITERAL
+     * command instead, using this level, or the zlib default for -1.
+     * Patching handles these without any option, but deltas with them can't
+     * be applied by older versions. This is ignored if librsync is built
+     * without zlib. */
+    int compress;
+
+    /** Whether compressed LITERAL data is primed with the new file before it.
+     *
+     * If set with the compress option, the delta starts with a PRIME
+     * command, and each ZLITERAL stream after it is compressed with a
+     * dictionary of the preceding new file data, up to the deflate window.
+     * Literals between matches often repeat data just before them, so this
+     * makes them smaller. Patching such a delta needs the output written
+     * before each ZLITERAL, so rs_patch_parallel() applies it with one
+     * thread, and rs_delta_merge() can't merge it as the first delta. */
+    int prime;
+
+    /** The length of new file data to look back in for repeats, or 0.
+     *
+     * If set for a delta job with a signature, the delta starts with a
+     * WINDOW command, and data that repeats new file data up to this far
+     * back is sent as a SELF command that copies it from the patch output
+     * instead of as literal data. This helps new files with repeated data
+     * not in the basis. It is capped at 64MB, and patching such a delta keeps
+     * up to twice this much of its output in memory, and so
+     * rs_patch_parallel() applies it with one thread. Older versions can't
+     * apply these deltas. */
+    int self_window;
+} rs_delta_opts_t;
+
+/** Prepare to compute a streaming delta with the default options.
+ *
+ * \sa rs_delta_begin_opts() */
 LIBRSYNC_EXPORT rs_job_t *rs_delta_begin(rs_signature_t *);
 
+/** Prepare to compute a streaming delta.
+ *
+ * \param opts The options, or NULL for the defaults. */
+LIBRSYNC_EXPORT rs_job_t *rs_delta_begin_opts(rs_signature_t *,
+                                              rs_delta_opts_t const *opts);
+
+/** Reset a job to compute a streaming delta, like rs_delta_begin().
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_job_t *rs_delta_reset(rs_job_t *job, rs_signature_t *);
+
+/** Reset a job to compute a streaming delta, like rs_delta_begin_opts().
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_job_t *rs_delta_reset_opts(rs_job_t *job,
+                                              rs_signature_t *,
+                                              rs_delta_opts_t const *opts);
+
+/** Start a delta for a new file that's the same as the one signed.
+ *
+ * The delta is a single COPY of the whole basis, with its checksum if the
+ * checksum option is set, and the job reads no input. The signature must
+ * have a digest of the file from rs_sig_opts_t::digest, which the caller has
+ * checked the new file against.
+ *
+ * \param opts The delta options, or NULL for the defaults.
+ *
+ * \sa rs_delta_begin_opts() */
+LIBRSYNC_EXPORT rs_job_t *rs_delta_same_begin(rs_signature_t *sig,
+                                              rs_delta_opts_t const *opts);
+
 /** Read a signature from a file into an ::rs_signature structure in memory.
  *
  * Once there, it can be used to generate a delta to a newer version of the
@@ -481,6 +803,11 @@ LIBRSYNC_EXPORT rs_job_t *rs_delta_begin(rs_signature_t *);
  * before you can use them. */
 LIBRSYNC_EXPORT rs_job_t *rs_loadsig_begin(rs_signature_t **);
 
+/** Reset a job to read a signature, like rs_loadsig_begin().
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_job_t *rs_loadsig_reset(rs_job_t *job, rs_signature_t **);
+
 /** Call this after loading a signature to index it.
  *
  * Use rs_free_sumset() to release it after use. */
@@ -512,14 +839,70 @@ typedef rs_result rs_copy_cb(void *opaque, rs_long_t pos, size_t *len,
  *
  * \param copy_arg Opaque environment pointer passed through to the callback.
  *
- * \todo As output is produced, accumulate the MD4 checksum of the output. Then
- * if we find a CHECKSUM command we can check it's contents against the output.
+ * If the delta has a checksum of the new file, the output is hashed as it is
+ * produced, and the job fails with RS_CORRUPT if it doesn't match.
  *
  * \todo Implement COPY commands.
  *
  * \sa rs_patch_file() \sa \ref api_streaming */
 LIBRSYNC_EXPORT rs_job_t *rs_patch_begin(rs_copy_cb * copy_cb, void *copy_arg);
 
+/** Reset a job to apply a delta, like rs_patch_begin().
+ *
+ * \sa rs_sig_reset() */
+LIBRSYNC_EXPORT rs_job_t *rs_patch_reset(rs_job_t *job, rs_copy_cb * copy_cb,
+                                         void *copy_arg);
+
+/** Start applying a chain of deltas in one pass.
+ *
+ * This is like rs_patch_begin() for the last delta of a chain, which is fed
+ * to the job as usual, but its basis is the output of the earlier deltas
+ * applied in order to the basis read with \p copy_cb. The earlier deltas are
+ * indexed when the job starts, and their output is read through the indexes
+ * as the job needs it, so only the final output is written. Checksums in the
+ * earlier deltas are not checked.
+ *
+ * \param delta_fds The earlier deltas in order, which must be seekable files
+ * positioned at their start. They are read with pread() where available and
+ * not closed.
+ *
+ * \param count The number of earlier deltas, which can be 0.
+ *
+ * If a delta can't be read or is corrupt, the job fails with the error when
+ * it's run.
+ *
+ * \sa rs_patch_chain_file() */
+LIBRSYNC_EXPORT rs_job_t *rs_patch_chain_begin(int const *delta_fds, int count,
+                                               rs_copy_cb * copy_cb,
+                                               void *copy_arg);
+
+/** A basis file descriptor with a read-ahead buffer for rs_fd_copy_cb().
+ *
+ * \sa rs_fd_basis_new() */
+typedef struct rs_fd_basis rs_fd_basis_t;
+
+/** Create a basis for rs_fd_copy_cb() that reads from a file descriptor.
+ *
+ * The file is read with pread() where available, so the file offset of \p fd
+ * is not used or changed, and \p fd must be seekable.
+ *
+ * \param fd The basis file descriptor. It is not closed by
+ * rs_fd_basis_free().
+ *
+ * \param readahead The size of the read-ahead buffer, or 0 for the default
+ * of 64KB. Small COPY commands are served from this buffer, so runs of small
+ * nearby COPYs only need one read. */
+LIBRSYNC_EXPORT rs_fd_basis_t *rs_fd_basis_new(int fd, size_t readahead);
+
+/** Free a basis created by rs_fd_basis_new(). */
+LIBRSYNC_EXPORT void rs_fd_basis_free(rs_fd_basis_t *basis);
+
+/** ::rs_copy_cb that reads from a ::rs_fd_basis_t.
+ *
+ * Unlike rs_file_copy_cb() this does not seek or use stdio buffering. */
+LIBRSYNC_EXPORT rs_result rs_fd_copy_cb(void *arg, rs_long_t pos, size_t *len,
+                                        void **buf);
+
 #  ifndef RSYNC_NO_STDIO_INTERFACE
 #    include <stdio.h>
 
@@ -590,6 +973,80 @@ LIBRSYNC_EXPORT rs_result rs_sig_file(FILE *old_file, FILE *sig_file,
                                       rs_magic_number sig_magic,
                                       rs_stats_t *stats);
 
+/** Generate the signature of a basis file with options, like rs_sig_file().
+ *
+ * \param opts The signature options, or NULL for the defaults.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_sig_file_opts(FILE *old_file, FILE *sig_file,
+                                           size_t block_len,
+                                           size_t strong_len,
+                                           rs_magic_number sig_magic,
+                                           rs_sig_opts_t const *opts,
+                                           rs_stats_t *stats);
+
+/** Update the signature of a file that has been appended to.
+ *
+ * Only the last block in the signature is hashed again, as it may have been
+ * short, along with the blocks after it, so this costs about as much as the
+ * appended data. The data before the last block must be unchanged.
+ *
+ * \param old_file Stdio readable file whose signature will be updated. It
+ * must be seekable.
+ *
+ * \param sig_file The signature of the file before it was appended to, opened
+ * for update. It must be a regular file. The new block sums are written over
+ * its last one, and as the file only grew they always cover the old ones.
+ *
+ * \param stats Optional pointer to receive statistics.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_sig_append(FILE *old_file, FILE *sig_file,
+                                        rs_stats_t *stats);
+
+/** Generate the range signature of part of a file.
+ *
+ * The arguments are like rs_sig_file(), and the recommended ones are for the
+ * size of the whole file, so the ranges of a file signed separately with the
+ * same arguments can be merged with rs_signature_merge().
+ *
+ * \param old_file Stdio readable file to sign a range of. It must be
+ * seekable.
+ *
+ * \param start The offset of the range, which must be a multiple of the
+ * block length.
+ *
+ * \param len The length of the range. It's cut short at the end of the file
+ * if the file size is known.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_sig_range_file(FILE *old_file, FILE *sig_file,
+                                            rs_long_t start, rs_long_t len,
+                                            size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            rs_stats_t *stats);
+
+/** Merge range signatures into the signature of the whole file.
+ *
+ * The range signatures must have the same arguments and be in order,
+ * starting at offset 0 with each starting where the last ended, and all but
+ * the last must be a whole number of blocks long. The result is the same as
+ * signing the whole file with those arguments.
+ *
+ * \param range_files The range signature files, in order.
+ *
+ * \param count The number of range signature files.
+ *
+ * \param sig_file The signature file to write.
+ *
+ * \param stats Optional pointer to receive statistics.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_signature_merge(FILE **range_files, int count,
+                                             FILE *sig_file,
+                                             rs_stats_t *stats);
+
 /** Load signatures from a signature file into memory.
  *
  * \param sig_file Readable stdio file from which the signature will be read.
@@ -609,12 +1066,295 @@ LIBRSYNC_EXPORT rs_result rs_loadsig_file(FILE *sig_file,
 LIBRSYNC_EXPORT rs_result rs_delta_file(rs_signature_t *, FILE *new_file,
                                         FILE *delta_file, rs_stats_t *);
 
+/** Generate a delta with options, like rs_delta_file().
+ *
+ * \param opts The delta options, or NULL for the defaults.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_delta_file_opts(rs_signature_t *,
+                                             FILE *new_file,
+                                             FILE *delta_file,
+                                             rs_delta_opts_t const *opts,
+                                             rs_stats_t *);
+
+/** Generate a delta and the signature of the new file in the same pass.
+ *
+ * The new file data is fed to a signature job as it's read for the delta,
+ * so it's only read once. The arguments for the signature are like for
+ * rs_sig_file(), with the recommended ones based on the size of the new
+ * file.
+ *
+ * \param opts The delta options, or NULL for the defaults.
+ *
+ * \param sig_file Writable stdio file to which the signature of the new file
+ * will be written.
+ *
+ * \param sig_opts The signature options, or NULL for the defaults.
+ *
+ * \param stats Optional pointer to receive the delta statistics.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_delta_sig_file(rs_signature_t *, FILE *new_file,
+                                            FILE *delta_file,
+                                            rs_delta_opts_t const *opts,
+                                            FILE *sig_file,
+                                            size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            rs_sig_opts_t const *sig_opts,
+                                            rs_stats_t *stats);
+
 /** Apply a patch, relative to a basis, into a new file.
  *
  * \sa \ref api_whole */
 LIBRSYNC_EXPORT rs_result rs_patch_file(FILE *basis_file, FILE *delta_file,
                                         FILE *new_file, rs_stats_t *);
 
+/** Apply a patch, relative to a basis file descriptor, into a new file.
+ *
+ * This is like rs_patch_file() but reads the basis with rs_fd_copy_cb(),
+ * which is much faster for deltas with many small COPY commands. The basis
+ * must be a seekable file.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_fd(int basis_fd, FILE *delta_file,
+                                      FILE *new_file, rs_stats_t *);
+
+/** Apply a chain of up to 65 patches to a basis in one pass.
+ *
+ * The deltas are applied in order with rs_patch_chain_begin(), so the files
+ * in between are never written. All but the last delta must be seekable
+ * files, and the stats are for the last one.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_chain_file(FILE *basis_file,
+                                              FILE **delta_files, int count,
+                                              FILE *new_file, rs_stats_t *);
+
+/** Apply a patch and write the signature of the new file in the same pass.
+ *
+ * The output of the patch is fed to a signature job as it's written, so the
+ * new file doesn't have to be read again to sign it for the next delta.
+ * The arguments for the signature are like for rs_sig_file(), with the
+ * recommended ones based on the size of the basis.
+ *
+ * \param sig_file Writable stdio file to which the signature of the new file
+ * will be written.
+ *
+ * \param opts The signature options, or NULL for the defaults.
+ *
+ * \param stats Optional pointer to receive the patch statistics.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_sig_file(FILE *basis_file, FILE *delta_file,
+                                            FILE *new_file, FILE *sig_file,
+                                            size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            rs_sig_opts_t const *opts,
+                                            rs_stats_t *stats);
+
+/** Write an index of a delta for rs_patch_range().
+ *
+ * The index gives the new file offset of every command in the delta and
+ * where its data is, in fixed length records sorted by offset, so a range of
+ * the new file can be found by bisecting it. It takes 41 bytes per command.
+ * The delta is afterwards positioned at its end like after patching.
+ *
+ * \param delta_file The delta, which must be a seekable file.
+ *
+ * \param index_file Where to write the index.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_delta_index_file(FILE *delta_file,
+                                              FILE *index_file, rs_stats_t *);
+
+/** Read a range of the new file made by a patch, without patching the rest.
+ *
+ * This reads just the commands making the range from an index written by
+ * rs_delta_index_file(), and then their data from the basis and the delta,
+ * so reading a small part of a big file is cheap. Deltas with SELF commands
+ * or primed ZLITERAL data can need the new file data before the range too,
+ * which is read the same way. The delta checksum is not checked. The files
+ * are read with pread() where available and stay positioned where they were.
+ *
+ * \param basis_file The basis, which must be seekable.
+ *
+ * \param delta_file The delta, which must be a seekable file.
+ *
+ * \param index_file The index of the delta, or NULL to scan the delta for it
+ * instead, which costs reading all its commands.
+ *
+ * \param pos The new file offset of the range.
+ *
+ * \param buf Where to read the range.
+ *
+ * \param len The length of the range, which is updated to what was read. It
+ * is shorter if the range is past the end of the new file.
+ *
+ * \return RS_CORRUPT if the index doesn't match the delta.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_range(FILE *basis_file, FILE *delta_file,
+                                         FILE *index_file, rs_long_t pos,
+                                         void *buf, size_t *len);
+
+/** Make the signature of the new file of a patch from the basis signature.
+ *
+ * The sums of the blocks of the new file that a COPY takes whole from the
+ * start of a basis block are taken from the basis signature, so only the
+ * other blocks are read and hashed. For deltas of mostly unchanged data this
+ * costs little more than the changed bytes. The new signature has the same
+ * format and block length as the basis one.
+ *
+ * \param old_sig The signature of the basis, which doesn't need
+ * rs_build_hash_table().
+ *
+ * \param delta_file The delta, which must be a seekable file.
+ *
+ * \param copy_cb Callback to read the basis data the new signature needs.
+ *
+ * \param sig_file Where to write the new signature.
+ *
+ * \param stats Optional pointer to receive the delta command and signature
+ * statistics.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_sig_from_delta(rs_signature_t const *old_sig,
+                                            FILE *delta_file,
+                                            rs_copy_cb * copy_cb,
+                                            void *copy_arg, FILE *sig_file,
+                                            rs_stats_t *stats);
+
+/** Apply a patch, relative to a memory mapped basis, into a new file.
+ *
+ * The basis file is memory mapped, and the data for COPY commands is written
+ * straight from the mapping to \p new_fd with writev(), without copying it
+ * through any buffers. The kernel is advised with madvise() to read ahead
+ * the COPY ranges as they are reached. This is the fastest way to apply
+ * deltas against big local basis files.
+ *
+ * \return RS_UNIMPLEMENTED on platforms without mmap() and writev(), or
+ * RS_IO_ERROR if the basis cannot be mapped.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_mmap(int basis_fd, FILE *delta_file,
+                                        int new_fd, rs_stats_t *);
+
+/** Apply a patch between file descriptors, using kernel-side copies.
+ *
+ * COPY commands of 32KB or more are done in the kernel without passing the
+ * data through user space. If they are filesystem block aligned they are
+ * reflinked with FICLONERANGE, sharing the blocks on filesystems like btrfs
+ * and XFS, otherwise copy_file_range() is used. Smaller COPYs and LITERALs
+ * are written through a buffer as usual. If the kernel can't do these copies,
+ * e.g. for a non-seekable output or on filesystems like tmpfs and ext4 that
+ * don't support reflinks, it falls back to copying through the buffer.
+ *
+ * \return RS_UNIMPLEMENTED on platforms without POSIX file IO.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_fds(int basis_fd, FILE *delta_file,
+                                       int new_fd, rs_stats_t *);
+
+/** Apply a patch with several threads.
+ *
+ * The delta is first scanned to find the output offset of every command,
+ * and then \p threads threads fill separate ranges of the output with
+ * pwrite(), reading the basis and the LITERAL data in the delta with
+ * pread(). The output is the same as from rs_patch_file(). This is much
+ * faster for big files on storage that handles many concurrent reads.
+ *
+ * The delta and new files must be seekable files. If they are not, or
+ * \p threads is 1 or less, or the platform doesn't have threads, this just
+ * calls rs_patch_file(). Afterwards they are positioned at the end of the
+ * delta and the end of the output.
+ *
+ * If the delta has a checksum, the output is read back to check it, so the
+ * new file should be open for reading too. If it is write-only, the basis and
+ * LITERAL data are read again instead, which doesn't check what was written.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_parallel(FILE *basis_file, FILE *delta_file,
+                                            FILE *new_file, int threads,
+                                            rs_stats_t *);
+
+/** Apply a patch, reading the basis ahead for the COPY commands.
+ *
+ * The delta is decoded ahead of the patch job, and basis reads for the
+ * upcoming COPY commands are queued as asynchronous reads, using io_uring if
+ * the kernel supports it and ::rs_patch_uring is set, or otherwise a pool of
+ * threads. The data is then used in order as the COPYs are reached. This
+ * keeps many reads in flight, which is much faster when the basis is not
+ * cached, like for cold files on NVMe drives or on network filesystems. On
+ * platforms without either the basis is read synchronously like
+ * rs_patch_fd().
+ *
+ * \param basis_fd The basis file descriptor, which must be seekable.
+ *
+ * \param depth The max number of basis reads to queue ahead, or 0 for the
+ * default of 32.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_ahead(int basis_fd, FILE *delta_file,
+                                         FILE *new_file, int depth,
+                                         rs_stats_t *);
+
+/** Whether rs_patch_ahead() uses io_uring where the kernel supports it.
+ *
+ * The default 1 uses io_uring, set it to 0 to always use threads instead. */
+LIBRSYNC_EXPORT extern int rs_patch_uring;
+
+/** Apply a patch over the basis file in place.
+ *
+ * The new file is written over the basis, so no second copy of the file is
+ * needed. The delta is scanned first, and its COPY commands are ordered so
+ * that each reads the basis before it is overwritten. Where COPYs depend on
+ * each other in a cycle, the data of one of them is read up front and kept
+ * in the journal or memory until it is written. LITERAL data is written
+ * last, and the file is truncated to the new length. Deltas made with
+ * the rs_delta_opts_t::inplace option never need this buffering.
+ *
+ * \param fd The basis file descriptor, which must be seekable and open for
+ * reading and writing.
+ *
+ * \param delta_file The delta, which must be a seekable file.
+ *
+ * \param journal The name of a journal file to make the patch crash-safe,
+ * or NULL. Data that could be lost if interrupted is saved to the journal
+ * and synced before it is overwritten. If the patch is interrupted, e.g. by a
+ * crash or power loss, calling this again with the same basis, delta and
+ * journal finishes it. The journal is removed when the patch is done.
+ *
+ * \return RS_CORRUPT if the delta COPYs past the end of the basis or the
+ * journal is for a different basis or delta, or RS_UNIMPLEMENTED on platforms
+ * without POSIX file IO.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_inplace(int fd, FILE *delta_file,
+                                          char const *journal, rs_stats_t *);
+
+/** Merge two deltas into one.
+ *
+ * Given a delta from A to B and a delta from B to C, this writes a delta from
+ * A to C, so a chain of updates can be applied with one patch without
+ * writing the files in between. Neither file is needed. The COPYs of the
+ * second delta are resolved through the first into COPYs from A and the
+ * LITERAL data of the first delta, and the rest of the second delta is kept
+ * as it is, including any checksum.
+ *
+ * \param first_file The delta from A to B, which must be a seekable file.
+ *
+ * \param second_file The delta from B to C, which must be a seekable file.
+ *
+ * \return RS_UNIMPLEMENTED if the first delta has primed ZLITERAL data that
+ * is needed, as decompressing it needs B. `rdiff delta -z` primes them unless
+ * given `--no-prime`.
+ *
+ * \sa rs_delta_opts_t::prime */
+LIBRSYNC_EXPORT rs_result rs_delta_merge(FILE *first_file, FILE *second_file,
+                                         FILE *merged_file, rs_stats_t *);
+
 /** PatchKit wrapper: generate signature from file paths.
  *
  * \param basis_name path to basis file.
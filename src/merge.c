@@ -0,0 +1,360 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file merge.c
+ * Merging two deltas into one.
+ *
+ * Both deltas are indexed, and the commands of the second are copied to the
+ * merged delta in order. A COPY from its basis, which is the output of the
+ * first delta, is resolved through the first delta's index into COPYs from
+ * the first basis and the LITERAL data that the first delta has for that
+ * range. A SELF in the first delta is resolved again from the range it
+ * repeats, using a stack of the ranges still to add instead of recursing, so
+ * a long chain of SELFs can't overflow the call stack. The second delta's
+ * LITERAL, ZLITERAL and SELF commands make the same output in the merged
+ * delta, so are copied as they are, along with its WINDOW, PRIME and
+ * checksum.
+ *
+ * A primed ZLITERAL in the first delta can't be decompressed without the
+ * output before it, which needs the first basis, so merging fails with
+ * RS_UNIMPLEMENTED if the second delta COPYs from the output of one. Make
+ * the first delta without rs_delta_opts_t::prime, e.g. with rdiff delta
+ * --no-prime, to merge it. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "librsync.h"
+#include "largefile.h"
+#include "deltaindex.h"
+#include "prototab.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
+
+/** The max length of LITERAL data to gather before writing it. */
+#define RS_MERGE_LIT ((size_t)256 << 10)
+
+/** A range of the first delta's output. */
+typedef struct rs_merge_span {
+    rs_long_t from, to;
+} rs_merge_span_t;
+
+/** A merge of two deltas. */
+typedef struct rs_merge {
+    rs_delta_index_t first, second;
+    int first_fd, second_fd;
+    FILE *out;
+    rs_stats_t *stats;
+    rs_long_t copy_pos, copy_len;       /**< A COPY to write. */
+    rs_byte_t *lit;             /**< LITERAL data to write. */
+    size_t lit_len;
+    rs_merge_span_t *todo;      /**< Ranges of the first output to add. */
+    size_t todo_len, todo_size;
+} rs_merge_t;
+
+/** Write bytes to the merged delta. */
+static rs_result rs_merge_write(rs_merge_t *m, void const *buf, size_t len)
+{
+    if (fwrite(buf, 1, len, m->out) != len) {
+        rs_error("error writing merged delta: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    m->stats->out_bytes += (rs_long_t)len;
+    return RS_DONE;
+}
+
+/** Write a command, using the shortest op in the prototab for it. */
+static rs_result rs_merge_cmd(rs_merge_t *m, enum rs_op_kind kind,
+                              rs_long_t param1, rs_long_t param2)
+{
+    rs_prototab_ent_t const *e;
+    rs_byte_t buf[17], *p = buf;
+    int op, i, len_1 = rs_int_len(param1), len_2 = rs_int_len(param2);
+
+    for (op = 0; op < 256; op++) {
+        e = &rs_prototab[op];
+        if (e->kind == kind && (e->len_1 ? e->len_1 >= len_1 :
+                                e->immediate == param1)
+            && (!e->len_2 || e->len_2 >= len_2))
+            break;
+    }
+    assert(op < 256);
+    rs_trace("write %s(" FMT_LONG ", " FMT_LONG "), cmd_byte=%#04x",
+             rs_op_kind_name(kind), param1, param2, op);
+    *p++ = (rs_byte_t)op;
+    for (i = e->len_1; i--;)
+        *p++ = (rs_byte_t)(param1 >> (8 * i));
+    for (i = e->len_2; i--;)
+        *p++ = (rs_byte_t)(param2 >> (8 * i));
+    return rs_merge_write(m, buf, (size_t)(p - buf));
+}
+
+/** Write any COPY or LITERAL data gathered so far. */
+static rs_result rs_merge_flush(rs_merge_t *m)
+{
+    rs_stats_t *stats = m->stats;
+    rs_long_t start = stats->out_bytes;
+    rs_result result = RS_DONE;
+
+    if (m->copy_len) {
+        result = rs_merge_cmd(m, RS_KIND_COPY, m->copy_pos, m->copy_len);
+        stats->copy_cmds++;
+        stats->copy_bytes += m->copy_len;
+        stats->copy_cmdbytes += stats->out_bytes - start;
+        m->copy_len = 0;
+    } else if (m->lit_len) {
+        result = rs_merge_cmd(m, RS_KIND_LITERAL, (rs_long_t)m->lit_len, 0);
+        stats->lit_cmds++;
+        stats->lit_bytes += (rs_long_t)m->lit_len;
+        stats->lit_cmdbytes += stats->out_bytes - start;
+        if (result == RS_DONE)
+            result = rs_merge_write(m, m->lit, m->lit_len);
+        m->lit_len = 0;
+    }
+    return result;
+}
+
+/** Add a COPY from the first basis, extending the last one if possible. */
+static rs_result rs_merge_copy(rs_merge_t *m, rs_long_t pos, rs_long_t len)
+{
+    rs_result result;
+
+    if (m->copy_len && m->copy_pos + m->copy_len == pos) {
+        m->copy_len += len;
+        return RS_DONE;
+    }
+    if ((result = rs_merge_flush(m)) != RS_DONE)
+        return result;
+    m->copy_pos = pos;
+    m->copy_len = len;
+    return RS_DONE;
+}
+
+/** Get space for up to len bytes more LITERAL data, setting len to how much
+ * there is. */
+static rs_result rs_merge_literal(rs_merge_t *m, size_t *len)
+{
+    rs_result result = RS_DONE;
+
+    if (m->copy_len || m->lit_len == RS_MERGE_LIT)
+        result = rs_merge_flush(m);
+    if (*len > RS_MERGE_LIT - m->lit_len)
+        *len = RS_MERGE_LIT - m->lit_len;
+    return result;
+}
+
+/** Push a range of the first delta's output to add. */
+static void rs_merge_push(rs_merge_t *m, rs_long_t from, rs_long_t to)
+{
+    if (m->todo_len == m->todo_size) {
+        m->todo_size = m->todo_size ? 2 * m->todo_size : 16;
+        m->todo = rs_realloc(m->todo, m->todo_size * sizeof(*m->todo),
+                             "merge ranges");
+    }
+    m->todo[m->todo_len].from = from;
+    m->todo[m->todo_len].to = to;
+    m->todo_len++;
+}
+
+/** Add the commands for a range of the first delta's output. */
+static rs_result rs_merge_range(rs_merge_t *m, rs_long_t from, rs_long_t to)
+{
+    rs_delta_index_t const *idx = &m->first;
+    rs_delta_cmd_t const *c, *end = idx->cmds + idx->count;
+    rs_long_t a, b, off, at, n;
+    rs_result result = RS_DONE;
+    size_t len;
+
+    if (to > idx->out_len) {
+        rs_error("COPY of " FMT_LONG " bytes at " FMT_LONG
+                 " is past the end of the first delta's output " FMT_LONG,
+                 to - from, from, idx->out_len);
+        return RS_CORRUPT;
+    }
+    m->todo_len = 0;
+    rs_merge_push(m, from, to);
+    while (m->todo_len && result == RS_DONE) {
+        m->todo_len--;
+        from = m->todo[m->todo_len].from;
+        to = m->todo[m->todo_len].to;
+        for (c = &idx->cmds[rs_delta_index_find(idx, from)];
+             c < end && c->out < to && result == RS_DONE; c++) {
+            a = c->out > from ? c->out : from;
+            b = c->out + c->len < to ? c->out + c->len : to;
+            if (!c->literal) {
+                result = rs_merge_copy(m, c->src + (a - c->out), b - a);
+            } else if (c->dist) {
+                /* The SELF repeats the dist bytes at src, which are earlier
+                   output. Add the first part of them before the rest of the
+                   range. */
+                off = a - c->out;
+                at = off % c->dist;
+                n = c->dist - at < b - a ? c->dist - at : b - a;
+                if (a + n < to)
+                    rs_merge_push(m, a + n, to);
+                rs_merge_push(m, c->src + at, c->src + at + n);
+                break;
+            } else {
+                for (off = a - c->out; off < b - c->out && result == RS_DONE;
+                     off += (rs_long_t)len) {
+                    len = (size_t)(b - c->out - off);
+                    if ((result = rs_merge_literal(m, &len)) != RS_DONE)
+                        break;
+                    result = rs_delta_index_read(idx, c, -1, m->first_fd, -1,
+                                                 m->lit + m->lit_len, len,
+                                                 off);
+                    m->lit_len += len;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/** Add a command of the second delta. */
+static rs_result rs_merge_second(rs_merge_t *m, rs_delta_cmd_t const *c)
+{
+    rs_stats_t *stats = m->stats;
+    rs_long_t start, done;
+    rs_result result;
+    size_t len;
+
+    if (!c->literal)
+        return rs_merge_range(m, c->src, c->src + c->len);
+    if (!c->dist && !c->zlen) {
+        for (done = 0; done < c->len; done += (rs_long_t)len) {
+            len = (size_t)(c->len - done);
+            if ((result = rs_merge_literal(m, &len)) != RS_DONE
+                || (result =
+                    rs_delta_index_pread(m->second_fd, m->lit + m->lit_len,
+                                         len, c->src + done)) != RS_DONE)
+                return result;
+            m->lit_len += len;
+        }
+        return RS_DONE;
+    }
+    /* SELF and ZLITERAL commands make the same output, so are copied as they
+       are. */
+    if ((result = rs_merge_flush(m)) != RS_DONE)
+        return result;
+    start = stats->out_bytes;
+    if (c->dist) {
+        result = rs_merge_cmd(m, RS_KIND_SELF, c->dist, c->len);
+        stats->copy_cmds++;
+        stats->copy_bytes += c->len;
+        stats->copy_cmdbytes += stats->out_bytes - start;
+        return result;
+    }
+    result = rs_merge_cmd(m, RS_KIND_ZLITERAL, c->len, c->zlen);
+    stats->lit_cmds++;
+    stats->lit_bytes += c->zlen;
+    stats->lit_cmdbytes += stats->out_bytes - start;
+    /* The LITERAL buffer is empty, so is used to copy the data. */
+    for (done = 0; done < c->zlen && result == RS_DONE;
+         done += (rs_long_t)len) {
+        len = c->zlen - done < (rs_long_t)RS_MERGE_LIT ?
+            (size_t)(c->zlen - done) : RS_MERGE_LIT;
+        if ((result = rs_delta_index_pread(m->second_fd, m->lit, len,
+                                           c->src + done)) == RS_DONE)
+            result = rs_merge_write(m, m->lit, len);
+    }
+    return result;
+}
+
+rs_result rs_delta_merge(FILE *first_file, FILE *second_file,
+                         FILE *merged_file, rs_stats_t *stats)
+{
+    rs_merge_t m;
+    rs_stats_t st, st1, st2;
+    rs_long_t first_pos, second_pos;
+    rs_byte_t magic[4];
+    rs_result result;
+    size_t i;
+    int k;
+
+    rs_bzero(&m, sizeof(m));
+    rs_bzero(&st, sizeof(st));
+    rs_bzero(&st1, sizeof(st1));
+    rs_bzero(&st2, sizeof(st2));
+    st.op = "merge";
+    st.start = time(NULL);
+    m.out = merged_file;
+    m.stats = &st;
+    /* The deltas must be seekable files. */
+    if ((first_pos = (rs_long_t)ftell(first_file)) < 0
+        || (second_pos = (rs_long_t)ftell(second_file)) < 0) {
+        rs_error("can't merge deltas that aren't seekable files: %s",
+                 strerror(errno));
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    m.first_fd = fileno(first_file);
+    m.second_fd = fileno(second_file);
+    if ((result = rs_delta_index_build(&m.first, m.first_fd, first_pos, &st1))
+        != RS_DONE
+        || (result = rs_delta_index_build(&m.second, m.second_fd, second_pos,
+                                          &st2)) != RS_DONE)
+        goto out;
+    st.in_bytes = st1.in_bytes + st2.in_bytes;
+    m.lit = rs_alloc(RS_MERGE_LIT, "merge literal buffer");
+
+    /* The merged delta makes the second delta's output, so has its magic,
+       WINDOW, PRIME and checksum. */
+    for (k = 0; k < 4; k++)
+        magic[k] = (rs_byte_t)((m.second.checksum ? RS_DELTA_BLAKE2_MAGIC :
+                                RS_DELTA_MAGIC) >> (24 - 8 * k));
+    if ((result = rs_merge_write(&m, magic, sizeof(magic))) != RS_DONE
+        || (m.second.window
+            && (result = rs_merge_cmd(&m, RS_KIND_WINDOW, m.second.window,
+                                      0)) != RS_DONE)
+        || (m.second.prime
+            && (result = rs_merge_cmd(&m, RS_KIND_PRIME, 0, 0)) != RS_DONE))
+        goto out;
+    for (i = 0; i < m.second.count && result == RS_DONE; i++)
+        result = rs_merge_second(&m, &m.second.cmds[i]);
+    if (result != RS_DONE || (result = rs_merge_flush(&m)) != RS_DONE)
+        goto out;
+    if (m.second.checksum
+        && ((result = rs_merge_cmd(&m, RS_KIND_CHECKSUM,
+                                   RS_MAX_STRONG_SUM_LENGTH, 0)) != RS_DONE
+            || (result = rs_merge_write(&m, m.second.sum,
+                                        RS_MAX_STRONG_SUM_LENGTH)) != RS_DONE))
+        goto out;
+    if ((result = rs_merge_cmd(&m, RS_KIND_END, 0, 0)) != RS_DONE)
+        goto out;
+    /* Leave the deltas positioned after them like patching does. */
+    if (fseek(first_file, m.first.end, SEEK_SET)
+        || fseek(second_file, m.second.end, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        result = RS_IO_ERROR;
+    }
+  out:
+    st.end = time(NULL);
+    if (stats)
+        memcpy(stats, &st, sizeof *stats);
+    rs_free(m.lit);
+    rs_free(m.todo);
+    rs_delta_index_free(&m.first);
+    rs_delta_index_free(&m.second);
+    return result;
+}
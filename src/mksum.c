@@ -32,6 +32,7 @@
 #include "librsync.h"
 #include "job.h"
 #include "sumset.h"
+#include "cdc.h"
 #include "scoop.h"
 #include "netint.h"
 #include "trace.h"
@@ -39,7 +40,12 @@
 
 /* Possible state functions for signature generation. */
 static rs_result rs_sig_s_header(rs_job_t *);
+static rs_result rs_sig_s_blocks(rs_job_t *);
+static rs_result rs_sig_s_range(rs_job_t *);
 static rs_result rs_sig_s_generate(rs_job_t *);
+static rs_result rs_sig_s_chunk(rs_job_t *);
+static rs_result rs_sig_s_digest(rs_job_t *);
+
 
 /** State of trying to send the signature header. \private */
 static rs_result rs_sig_s_header(rs_job_t *job)
@@ -47,21 +53,66 @@ static rs_result rs_sig_s_header(rs_job_t *job)
     rs_signature_t *sig = job->signature;
     rs_result result;
 
+    if ((result = rs_sig_s_blocks(job)) != RS_RUNNING)
+        return result;
+    rs_squirt_n4(job, sig->magic);
+    rs_squirt_n4(job, sig->block_len);
+    rs_squirt_n4(job, sig->strong_sum_len |
+                 (job->checksum ? RS_SIG_DIGEST_FLAG : 0) |
+                 (job->sig_cdc ? RS_SIG_CDC_FLAG : 0));
+    rs_trace("sent header (magic %#x, block len = %d, strong sum len = %d%s%s)",
+             sig->magic, sig->block_len, sig->strong_sum_len,
+             job->checksum ? ", digest" : "", job->sig_cdc ? ", chunks" : "");
+    if (job->checksum) {
+        sig->file_len = 0;
+        blake2b_init(&job->checksum_state, RS_SIG_DIGEST_LEN);
+    }
+    if ((sig->cdc = job->sig_cdc))
+        job->statefn = rs_sig_s_chunk;
+    return RS_RUNNING;
+}
+
+/** State of starting the block sums without a header. \private */
+static rs_result rs_sig_s_blocks(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    rs_result result;
+
     if ((result =
          rs_signature_init(sig, job->sig_magic, job->sig_block_len,
                            job->sig_strong_len, 0)) != RS_DONE)
         return result;
-    rs_squirt_n4(job, sig->magic);
-    rs_squirt_n4(job, sig->block_len);
-    rs_squirt_n4(job, sig->strong_sum_len);
-    rs_trace("sent header (magic %#x, block len = %d, strong sum len = %d)",
-             sig->magic, sig->block_len, sig->strong_sum_len);
     job->stats.block_len = sig->block_len;
 
     job->statefn = rs_sig_s_generate;
     return RS_RUNNING;
 }
 
+/** State of sending the range signature header. \private */
+static rs_result rs_sig_s_range(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    rs_result result;
+
+    if ((result = rs_sig_s_blocks(job)) != RS_RUNNING)
+        return result;
+    if (job->sig_range_start < 0 || job->sig_range_len < 0
+        || job->sig_range_start % sig->block_len) {
+        rs_error("range start " FMT_LONG " isn't a multiple of block len %d",
+                 job->sig_range_start, sig->block_len);
+        return RS_PARAM_ERROR;
+    }
+    rs_squirt_n4(job, RS_RANGE_SIG_MAGIC);
+    rs_squirt_n4(job, sig->magic);
+    rs_squirt_n4(job, sig->block_len);
+    rs_squirt_n4(job, sig->strong_sum_len);
+    rs_squirt_netint(job, job->sig_range_start, 8);
+    rs_squirt_netint(job, job->sig_range_len, 8);
+    rs_trace("sent range header (magic %#x, start " FMT_LONG ", len " FMT_LONG
+             ")", sig->magic, job->sig_range_start, job->sig_range_len);
+    return RS_RUNNING;
+}
+
 /** Generate the checksums for a block and write it out. Called when we
  * already know we have enough data in memory at \p block. \private */
 static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
@@ -72,6 +123,12 @@ static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
 
     weak_sum = rs_signature_calc_weak_sum(sig, block, len);
     rs_signature_calc_strong_sum(sig, block, len, &strong_sum);
+    if (job->checksum) {
+        blake2b_update(&job->checksum_state, block, len);
+        sig->file_len += (rs_long_t)len;
+    }
+    if (sig->cdc)
+        rs_squirt_n4(job, (int)len);
     rs_squirt_n4(job, weak_sum);
     rs_tube_write(job, strong_sum, sig->strong_sum_len);
     if (rs_trace_enabled()) {
@@ -84,6 +141,17 @@ static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
     return RS_RUNNING;
 }
 
+/** Finish the signature at the end of the file. \private */
+static rs_result rs_sig_end(rs_job_t *job)
+{
+    if (!job->checksum)
+        return RS_DONE;
+    /* The digest doesn't fit in the tube with the length. */
+    rs_squirt_netint(job, job->signature->file_len, 8);
+    job->statefn = rs_sig_s_digest;
+    return RS_RUNNING;
+}
+
 /** State of reading a block and trying to generate its sum. \private */
 static rs_result rs_sig_s_generate(rs_job_t *job)
 {
@@ -98,7 +166,7 @@ static rs_result rs_sig_s_generate(rs_job_t *job)
     if (result == RS_INPUT_ENDED)
         result = rs_scoop_read_rest(job, &len, &block);
     if (result == RS_INPUT_ENDED) {
-        return RS_DONE;
+        return rs_sig_end(job);
     } else if (result != RS_DONE) {
         rs_trace("generate stopped: %s", rs_strerror(result));
         return result;
@@ -107,16 +175,97 @@ static rs_result rs_sig_s_generate(rs_job_t *job)
     return rs_sig_do_block(job, block, len);
 }
 
+/** State of reading a content defined chunk and generating its sum.
+ * \private */
+static rs_result rs_sig_s_chunk(rs_job_t *job)
+{
+    const size_t avg = (size_t)job->signature->block_len;
+    size_t len = RS_CDC_MAX(avg);
+    rs_result result;
+    void *chunk;
+
+    /* Get enough data for the longest chunk, or whatever is left. */
+    result = rs_scoop_readahead(job, len, &chunk);
+    if (result == RS_INPUT_ENDED && (len = rs_scoop_avail(job)))
+        result = rs_scoop_readahead(job, len, &chunk);
+    if (result == RS_INPUT_ENDED) {
+        return rs_sig_end(job);
+    } else if (result != RS_DONE) {
+        rs_trace("generate stopped: %s", rs_strerror(result));
+        return result;
+    }
+    len = rs_cdc_cut(avg, chunk, len, 1);
+    rs_scoop_advance(job, len);
+    rs_trace("got " FMT_SIZE " byte chunk", len);
+    return rs_sig_do_block(job, chunk, len);
+}
+
+/** State of sending the digest of the whole file. \private */
+static rs_result rs_sig_s_digest(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+
+    blake2b_final(&job->checksum_state, sig->digest, RS_SIG_DIGEST_LEN);
+    rs_tube_write(job, sig->digest, RS_SIG_DIGEST_LEN);
+    rs_trace("sent digest of " FMT_LONG " bytes", sig->file_len);
+    return RS_DONE;
+}
+
 rs_job_t *rs_sig_begin(size_t block_len, size_t strong_len,
                        rs_magic_number sig_magic)
 {
-    rs_job_t *job;
+    return rs_sig_reset_opts(NULL, block_len, strong_len, sig_magic, NULL);
+}
+
+rs_job_t *rs_sig_begin_opts(size_t block_len, size_t strong_len,
+                            rs_magic_number sig_magic,
+                            rs_sig_opts_t const *opts)
+{
+    return rs_sig_reset_opts(NULL, block_len, strong_len, sig_magic, opts);
+}
+
+rs_job_t *rs_sig_blocks_begin(size_t block_len, size_t strong_len,
+                              rs_magic_number sig_magic)
+{
+    rs_job_t *job = rs_sig_reset(NULL, block_len, strong_len, sig_magic);
+
+    job->statefn = rs_sig_s_blocks;
+    return job;
+}
+
+rs_job_t *rs_sig_range_begin(rs_long_t start, rs_long_t len,
+                             size_t block_len, size_t strong_len,
+                             rs_magic_number sig_magic)
+{
+    rs_job_t *job = rs_sig_reset(NULL, block_len, strong_len, sig_magic);
+
+    job->sig_range_start = start;
+    job->sig_range_len = len;
+    job->statefn = rs_sig_s_range;
+    return job;
+}
+
+rs_job_t *rs_sig_reset(rs_job_t *job, size_t block_len, size_t strong_len,
+                       rs_magic_number sig_magic)
+{
+    return rs_sig_reset_opts(job, block_len, strong_len, sig_magic, NULL);
+}
+
+rs_job_t *rs_sig_reset_opts(rs_job_t *job, size_t block_len,
+                            size_t strong_len, rs_magic_number sig_magic,
+                            rs_sig_opts_t const *opts)
+{
+    static rs_sig_opts_t const defaults;
 
-    job = rs_job_new("signature", rs_sig_s_header);
+    if (!opts)
+        opts = &defaults;
+    job = rs_job_renew(job, "signature", rs_sig_s_header);
     job->signature = rs_alloc_struct(rs_signature_t);
     job->job_owns_sig = 1;
     job->sig_magic = sig_magic;
     job->sig_block_len = (int)block_len;
     job->sig_strong_len = (int)strong_len;
+    job->checksum = opts->digest;
+    job->sig_cdc = opts->cdc;
     return job;
 }
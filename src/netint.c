@@ -35,6 +35,26 @@
 
 #define RS_MAX_INT_BYTES 8
 
+void rs_put_netint(rs_byte_t *buf, rs_long_t val, int len)
+{
+    assert(len <= RS_MAX_INT_BYTES);
+    /* Fill the buffer with a bigendian representation of the number. */
+    while (len--) {
+        buf[len] = (rs_byte_t)val;     /* truncated */
+        val >>= 8;
+    }
+}
+
+rs_long_t rs_get_netint(rs_byte_t const *buf, int len)
+{
+    rs_long_t val = 0;
+
+    assert(len <= RS_MAX_INT_BYTES);
+    while (len--)
+        val = (val << 8) | (rs_long_t)*buf++;
+    return val;
+}
+
 rs_result rs_squirt_byte(rs_job_t *job, rs_byte_t val)
 {
     rs_tube_write(job, &val, 1);
@@ -44,14 +64,8 @@ rs_result rs_squirt_byte(rs_job_t *job, rs_byte_t val)
 rs_result rs_squirt_netint(rs_job_t *job, rs_long_t val, int len)
 {
     rs_byte_t buf[RS_MAX_INT_BYTES];
-    int i;
 
-    assert(len <= RS_MAX_INT_BYTES);
-    /* Fill the output buffer with a bigendian representation of the number. */
-    for (i = len - 1; i >= 0; i--) {
-        buf[i] = (rs_byte_t)val;       /* truncated */
-        val >>= 8;
-    }
+    rs_put_netint(buf, val, len);
     rs_tube_write(job, buf, len);
     return RS_DONE;
 }
@@ -75,14 +89,10 @@ rs_result rs_suck_netint(rs_job_t *job, rs_long_t *val, int len)
 {
     rs_result result;
     rs_byte_t *buf;
-    int i;
 
     assert(len <= RS_MAX_INT_BYTES);
-    if ((result = rs_scoop_read(job, len, (void **)&buf)) == RS_DONE) {
-        *val = 0;
-        for (i = 0; i < len; i++)
-            *val = (*val << 8) | (rs_long_t)buf[i];
-    }
+    if ((result = rs_scoop_read(job, len, (void **)&buf)) == RS_DONE)
+        *val = rs_get_netint(buf, len);
     return result;
 }
 
@@ -108,3 +118,51 @@ int rs_int_len(rs_long_t val)
     assert(!(val & ~(rs_long_t)0xffffffffffffffff));
     return 8;
 }
+
+int rs_varint_len(rs_long_t val)
+{
+    int len = 1;
+
+    assert(val >= 0);
+    while (val >>= 7)
+        len++;
+    return len;
+}
+
+int rs_varint_put(rs_byte_t *buf, rs_long_t val)
+{
+    int len = 0;
+
+    assert(val >= 0);
+    while (val >> 7) {
+        buf[len++] = (rs_byte_t)(val | 0x80);
+        val >>= 7;
+    }
+    buf[len++] = (rs_byte_t)val;
+    return len;
+}
+
+rs_result rs_squirt_varint(rs_job_t *job, rs_long_t val)
+{
+    rs_byte_t buf[RS_MAX_VARINT_BYTES];
+
+    rs_tube_write(job, buf, (size_t)rs_varint_put(buf, val));
+    return RS_DONE;
+}
+
+int rs_varint_get(rs_byte_t const *buf, size_t len, rs_long_t *val)
+{
+    rs_long_t v = 0;
+    int i;
+
+    for (i = 0; i < RS_MAX_VARINT_BYTES; i++) {
+        if ((size_t)i == len)
+            return 0;
+        v |= (rs_long_t)(buf[i] & 0x7f) << (7 * i);
+        if (!(buf[i] & 0x80)) {
+            *val = v;
+            return i + 1;
+        }
+    }
+    return -1;
+}
@@ -33,8 +33,15 @@
 #ifndef NETINT_H
 #  define NETINT_H
 
+#  include <stddef.h>
 #  include "librsync.h"
 
+/** Put a network order integer of len bytes into buf. */
+void rs_put_netint(rs_byte_t *buf, rs_long_t val, int len);
+
+/** Get a network order integer of len bytes from buf. */
+rs_long_t rs_get_netint(rs_byte_t const *buf, int len);
+
 /** Write a single byte to a stream output. */
 rs_result rs_squirt_byte(rs_job_t *job, rs_byte_t val);
 
@@ -57,4 +64,39 @@ rs_result rs_suck_n4(rs_job_t *job, int *val);
 
 int rs_int_len(rs_long_t val);
 
+/** The max length of a varint, which holds up to 63 bits. */
+#  define RS_MAX_VARINT_BYTES 9
+
+/** Write a non-negative integer as a LEB128 varint to a stream.
+ *
+ * The varint has 7 bits of the value in each byte, lowest first, with the top
+ * bit set in all but the last byte. */
+rs_result rs_squirt_varint(rs_job_t *job, rs_long_t val);
+
+/** Get the length of the varint for a non-negative integer. */
+int rs_varint_len(rs_long_t val);
+
+/** Write the varint for a non-negative integer to buf, returning its
+ * length. */
+int rs_varint_put(rs_byte_t *buf, rs_long_t val);
+
+/** Read a varint from buf[0..len].
+ *
+ * \return The length of the varint, 0 if it doesn't end within len bytes, or
+ * -1 if it's too long. */
+int rs_varint_get(rs_byte_t const *buf, size_t len, rs_long_t *val);
+
+/** Map a signed integer to a non-negative one for a varint, with small
+ * negative values kept small. */
+static inline rs_long_t rs_zigzag(rs_long_t val)
+{
+    return val < 0 ? ((-(val + 1)) << 1) | 1 : val << 1;
+}
+
+/** Map a non-negative integer from rs_zigzag() back to the signed one. */
+static inline rs_long_t rs_unzigzag(rs_long_t val)
+{
+    return val & 1 ? -(val >> 1) - 1 : val >> 1;
+}
+
 #endif                          /* !NETINT_H */
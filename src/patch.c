@@ -38,54 +38,56 @@
 #include "command.h"
 #include "prototab.h"
 #include "trace.h"
+#include "util.h"
 
 static rs_result rs_patch_s_cmdbyte(rs_job_t *);
-static rs_result rs_patch_s_params(rs_job_t *);
 static rs_result rs_patch_s_run(rs_job_t *);
 static rs_result rs_patch_s_literal(rs_job_t *);
+static rs_result rs_patch_s_zliteral(rs_job_t *);
+static rs_result rs_patch_s_inflating(rs_job_t *);
 static rs_result rs_patch_s_copy(rs_job_t *);
 static rs_result rs_patch_s_copying(rs_job_t *);
+static rs_result rs_patch_s_copying_out(rs_job_t *);
+static rs_result rs_patch_s_self(rs_job_t *);
+static rs_result rs_patch_s_selfcopying(rs_job_t *);
+static rs_result rs_patch_s_checksum(rs_job_t *);
 
-/** State of trying to read the first byte of a command. Once we've taken that
- * in, we can know how much data to read to get the arguments. */
+/** State of trying to read a command.
+ *
+ * The command byte gives the kind and format of the parameters in the table
+ * for the delta format, so the command is decoded as soon as enough of it is
+ * buffered. Usually it's all in the input, so this doesn't copy it. */
 static rs_result rs_patch_s_cmdbyte(rs_job_t *job)
 {
+    size_t len = rs_scoop_avail(job);
     rs_result result;
-
-    if ((result = rs_suck_byte(job, &job->op)) != RS_DONE)
-        return result;
-    job->cmd = &rs_prototab[job->op];
-    rs_trace("got command %#04x (%s), len_1=%d, len_2=%d", job->op,
-             rs_op_kind_name(job->cmd->kind), job->cmd->len_1, job->cmd->len_2);
-    if (job->cmd->len_1)
-        job->statefn = rs_patch_s_params;
-    else {
-        job->param1 = job->cmd->immediate;
-        job->statefn = rs_patch_s_run;
-    }
-    return RS_RUNNING;
-}
-
-/** Called after reading a command byte to pull in its parameters and then
- * setup to execute the command. */
-static rs_result rs_patch_s_params(rs_job_t *job)
-{
-    rs_result result;
-    const size_t len = (size_t)(job->cmd->len_1 + job->cmd->len_2);
     void *p;
+    int n;
 
-    assert(len);
-    result = rs_scoop_readahead(job, len, &p);
-    if (result != RS_DONE)
-        return result;
-    /* we now must have LEN bytes buffered */
-    result = rs_suck_netint(job, &job->param1, job->cmd->len_1);
-    /* shouldn't fail, since we already checked */
-    assert(result == RS_DONE);
-    if (job->cmd->len_2) {
-        result = rs_suck_netint(job, &job->param2, job->cmd->len_2);
-        assert(result == RS_DONE);
+    if (len > RS_MAX_CMD_LEN)
+        len = RS_MAX_CMD_LEN;
+    else if (!len)
+        len = 1;
+    for (;;) {
+        if ((result = rs_scoop_readahead(job, len, &p)) != RS_DONE)
+            return result;
+        job->op = *(rs_byte_t *)p;
+        n = rs_delta_format_decode(&job->format, (rs_byte_t *)p, len,
+                                   &job->cmd, &job->param1, &job->param2);
+        if (n > 0)
+            break;
+        if (n < 0) {
+            rs_error("bad parameters on command %#04x", job->op);
+            return RS_CORRUPT;
+        }
+        /* It continues past the data so far. */
+        len++;
     }
+    job->cmd_len = n;
+    rs_scoop_advance(job, (size_t)n);
+    rs_trace("got command %#04x (%s), param1=" FMT_LONG ", param2=" FMT_LONG,
+             job->op, rs_op_kind_name(job->cmd->kind), job->param1,
+             job->param2);
     job->statefn = rs_patch_s_run;
     return RS_RUNNING;
 }
@@ -98,12 +100,61 @@ static rs_result rs_patch_s_run(rs_job_t *job)
     case RS_KIND_LITERAL:
         job->statefn = rs_patch_s_literal;
         return RS_RUNNING;
+    case RS_KIND_ZLITERAL:
+        job->statefn = rs_patch_s_zliteral;
+        return RS_RUNNING;
+    case RS_KIND_PRIME:
+    case RS_KIND_WINDOW:
+        /* These come before any output, and only once. */
+        if (job->stats.lit_cmds || job->stats.copy_cmds
+            || (job->cmd->kind == RS_KIND_PRIME ? job->prime :
+                job->self_window != 0)) {
+            rs_error("bogus command %#04x", job->op);
+            return RS_CORRUPT;
+        }
+        if (job->cmd->kind == RS_KIND_PRIME) {
+            job->prime = 1;
+            rs_job_history_init(job, RS_ZLIT_WINDOW);
+        } else {
+            rs_trace("WINDOW(length=" FMT_LONG ")", job->param1);
+            if (job->param1 <= 0 || job->param1 > (rs_long_t)RS_MAX_WINDOW) {
+                rs_error("invalid length=" FMT_LONG " on WINDOW command",
+                         job->param1);
+                return RS_CORRUPT;
+            }
+            job->self_window = (size_t)job->param1;
+            rs_job_history_init(job, job->self_window);
+        }
+        /* The history starts with the output after this. */
+        rs_job_track_output(job);
+        job->history_output = 1;
+        job->statefn = rs_patch_s_cmdbyte;
+        return RS_RUNNING;
+    case RS_KIND_BLOCK:
+        /* The block length is kept by the decoding. */
+        rs_trace("BLOCK(length=" FMT_LONG ")", job->param1);
+        job->statefn = rs_patch_s_cmdbyte;
+        return RS_RUNNING;
     case RS_KIND_END:
+        if (job->checksum_output) {
+            rs_error("delta ended without its checksum");
+            return RS_CORRUPT;
+        }
         return RS_DONE;
         /* so we exit here; trying to continue causes an error */
     case RS_KIND_COPY:
         job->statefn = rs_patch_s_copy;
         return RS_RUNNING;
+    case RS_KIND_SELF:
+        job->statefn = rs_patch_s_self;
+        return RS_RUNNING;
+    case RS_KIND_CHECKSUM:
+        if (job->checksum_output) {
+            job->statefn = rs_patch_s_checksum;
+            return RS_RUNNING;
+        }
+        rs_error("bogus command %#04x", job->op);
+        return RS_CORRUPT;
     default:
         rs_error("bogus command %#04x", job->op);
         return RS_CORRUPT;
@@ -123,12 +174,106 @@ static rs_result rs_patch_s_literal(rs_job_t *job)
     }
     stats->lit_cmds++;
     stats->lit_bytes += len;
-    stats->lit_cmdbytes += 1 + job->cmd->len_1;
+    stats->lit_cmdbytes += job->cmd_len;
     rs_tube_copy(job, (size_t)len);
     job->statefn = rs_patch_s_cmdbyte;
     return RS_RUNNING;
 }
 
+/** Called when starting a ZLITERAL command, with param1 and param2 the
+ * lengths of the literal data and its compressed data. */
+static rs_result rs_patch_s_zliteral(rs_job_t *job)
+{
+    const rs_long_t len = job->param1;
+    const rs_long_t zlen = job->param2;
+    rs_stats_t *stats = &job->stats;
+    size_t dict_len = 0;
+
+    rs_trace("ZLITERAL(length=" FMT_LONG ", zlength=" FMT_LONG ")", len, zlen);
+    if (len <= 0 || zlen <= 0) {
+        rs_error("invalid length=" FMT_LONG ", zlength=" FMT_LONG
+                 " on ZLITERAL command", len, zlen);
+        return RS_CORRUPT;
+    }
+    if (!job->zlit) {
+        job->zlit = rs_zlit_inflater_renew(job->spare_zlit);
+        job->spare_zlit = NULL;
+    }
+    if (!job->zlit) {
+        rs_error("can't decompress ZLITERAL data without zlib");
+        return RS_UNIMPLEMENTED;
+    }
+    stats->lit_cmds++;
+    stats->lit_bytes += zlen;
+    stats->lit_cmdbytes += job->cmd_len;
+    if (job->prime) {
+        /* The tube is idle, so all the output so far is in the output
+           buffer. */
+        rs_job_track_output(job);
+        dict_len = rs_zlit_dict_len(len < (rs_long_t)RS_ZLIT_WINDOW ?
+                                    (size_t)len : RS_ZLIT_WINDOW,
+                                    job->history_len);
+    }
+    rs_zlit_start(job->zlit, job->history + job->history_len - dict_len,
+                  dict_len);
+    job->statefn = rs_patch_s_inflating;
+    return RS_RUNNING;
+}
+
+/** Called while decompressing ZLITERAL data into the output, with param1 and
+ * param2 the lengths left to write and to read. */
+static rs_result rs_patch_s_inflating(rs_job_t *job)
+{
+    rs_buffers_t *buffs = job->stream;
+    rs_byte_t spare;
+    size_t in_len, out_len;
+    void *in, *out;
+    rs_result result;
+
+    in_len = job->param2 < (rs_long_t)(SIZE_MAX >> 1) ? (size_t)job->param2 :
+        SIZE_MAX >> 1;
+    in = rs_scoop_getbuf(job, &in_len);
+    if (job->param1) {
+        out = buffs->next_out;
+        out_len = job->param1 < (rs_long_t)buffs->avail_out ?
+            (size_t)job->param1 : buffs->avail_out;
+        if (!out_len)
+            return RS_BLOCKED;
+    } else {
+        /* All the output is done, but the end of the data may be left.
+           Anything more it makes is an error. */
+        out = &spare;
+        out_len = 1;
+    }
+    result = rs_zlit_inflate(job->zlit, in, &in_len, out, &out_len);
+    if (result == RS_CORRUPT || result == RS_UNIMPLEMENTED)
+        return result;
+    rs_scoop_advance(job, in_len);
+    job->param2 -= (rs_long_t)in_len;
+    if (out == &spare && out_len) {
+        rs_error("ZLITERAL data is longer than its length");
+        return RS_CORRUPT;
+    }
+    buffs->next_out += out_len;
+    buffs->avail_out -= out_len;
+    job->param1 -= (rs_long_t)out_len;
+    if (result == RS_DONE) {
+        if (job->param1 || job->param2) {
+            rs_error("ZLITERAL data doesn't match its lengths");
+            return RS_CORRUPT;
+        }
+        job->statefn = rs_patch_s_cmdbyte;
+    } else if (result == RS_BLOCKED) {
+        /* It needs more input. */
+        if (!job->param2) {
+            rs_error("ZLITERAL data ended early");
+            return RS_CORRUPT;
+        }
+        return rs_scoop_eof(job) ? RS_INPUT_ENDED : RS_BLOCKED;
+    }
+    return RS_RUNNING;
+}
+
 static rs_result rs_patch_s_copy(rs_job_t *job)
 {
     const rs_long_t pos = job->param1;
@@ -146,10 +291,13 @@ static rs_result rs_patch_s_copy(rs_job_t *job)
     }
     stats->copy_cmds++;
     stats->copy_bytes += len;
-    stats->copy_cmdbytes += 1 + job->cmd->len_1 + job->cmd->len_2;
+    stats->copy_cmdbytes += job->cmd_len;
     job->basis_pos = pos;
     job->basis_len = len;
-    job->statefn = rs_patch_s_copying;
+    /* The output is hashed for the checksum or kept in the history, so must
+       go through the output buffer. */
+    job->statefn = job->copy_out && !job->checksum && !job->history ?
+        rs_patch_s_copying_out : rs_patch_s_copying;
     return RS_RUNNING;
 }
 
@@ -200,6 +348,114 @@ static rs_result rs_patch_s_copying(rs_job_t *job)
     return RS_RUNNING;
 }
 
+/** Called instead of rs_patch_s_copying() when the driver copies the data
+ * to the output itself with copy_out. */
+static rs_result rs_patch_s_copying_out(rs_job_t *job)
+{
+    rs_result result;
+    rs_long_t req = job->basis_len;
+    size_t len;
+
+    /* The data doesn't go through the output buffer, so it doesn't need any
+       space there. */
+    if (req > (rs_long_t)(SIZE_MAX >> 1))
+        req = (rs_long_t)(SIZE_MAX >> 1);
+    rs_trace("copy out " FMT_LONG " bytes from basis at offset " FMT_LONG "",
+             req, job->basis_pos);
+    len = (size_t)req;
+    result = job->copy_out(job, job->basis_pos, &len);
+    if (result != RS_DONE) {
+        rs_trace("copy out returned %s", rs_strerror(result));
+        return result;
+    }
+    assert(len <= req);
+    job->basis_pos += (rs_long_t)len;
+    job->basis_len -= (rs_long_t)len;
+    if (!job->basis_len) {
+        /* Nothing left to copy, we are done! */
+        job->statefn = rs_patch_s_cmdbyte;
+    }
+    return RS_RUNNING;
+}
+
+/** Called when starting a SELF command, with param1 the distance back in the
+ * output to copy from and param2 the length. */
+static rs_result rs_patch_s_self(rs_job_t *job)
+{
+    const rs_long_t dist = job->param1;
+    const rs_long_t len = job->param2;
+    rs_stats_t *stats = &job->stats;
+
+    rs_trace("SELF(distance=" FMT_LONG ", length=" FMT_LONG ")", dist, len);
+    if (len <= 0) {
+        rs_error("invalid length=" FMT_LONG " on SELF command", len);
+        return RS_CORRUPT;
+    }
+    /* The tube is idle, so all the output so far is in the history. */
+    rs_job_track_output(job);
+    if (dist <= 0 || dist > (rs_long_t)job->self_window
+        || dist > (rs_long_t)job->history_len) {
+        rs_error("invalid distance=" FMT_LONG " on SELF command", dist);
+        return RS_CORRUPT;
+    }
+    stats->copy_cmds++;
+    stats->copy_bytes += len;
+    stats->copy_cmdbytes += job->cmd_len;
+    job->self_dist = dist;
+    job->basis_len = len;
+    job->statefn = rs_patch_s_selfcopying;
+    return RS_RUNNING;
+}
+
+/** Called while executing a SELF command, copying from the history into the
+ * output.
+ *
+ * The copy can overlap the data it makes, so it's done in pieces no longer
+ * than the distance, adding each to the history before the next. */
+static rs_result rs_patch_s_selfcopying(rs_job_t *job)
+{
+    rs_buffers_t *buffs = job->stream;
+    size_t len = buffs->avail_out;
+
+    if (!len)
+        return RS_BLOCKED;
+    rs_job_track_output(job);
+    if ((rs_long_t)len > job->basis_len)
+        len = (size_t)job->basis_len;
+    if ((rs_long_t)len > job->self_dist)
+        len = (size_t)job->self_dist;
+    memcpy(buffs->next_out,
+           job->history + job->history_len - (size_t)job->self_dist, len);
+    buffs->next_out += len;
+    buffs->avail_out -= len;
+    job->basis_len -= (rs_long_t)len;
+    if (!job->basis_len)
+        job->statefn = rs_patch_s_cmdbyte;
+    return RS_RUNNING;
+}
+
+/** Called to check the checksum of the new file at the end of the delta. */
+static rs_result rs_patch_s_checksum(rs_job_t *job)
+{
+    rs_strong_sum_t sum;
+    rs_result result;
+    void *p;
+
+    if ((result = rs_scoop_read(job, (size_t)job->param1, &p)) != RS_DONE)
+        return result;
+    /* The tube is idle, so all the output so far is in the output buffer. */
+    rs_job_track_output(job);
+    job->checksum_output = 0;
+    blake2b_final(&job->checksum_state, sum, (size_t)job->param1);
+    if (memcmp(sum, p, (size_t)job->param1)) {
+        rs_error("checksum mismatch, the new file is corrupt");
+        return RS_CORRUPT;
+    }
+    rs_trace("checksum of the new file is correct");
+    job->statefn = rs_patch_s_cmdbyte;
+    return RS_RUNNING;
+}
+
 /** Called while we're trying to read the header of the patch. */
 static rs_result rs_patch_s_header(rs_job_t *job)
 {
@@ -208,10 +464,14 @@ static rs_result rs_patch_s_header(rs_job_t *job)
 
     if ((result = rs_suck_n4(job, &v)) != RS_DONE)
         return result;
-    if (v != RS_DELTA_MAGIC) {
+    if (!rs_delta_format_init(&job->format, v, &job->checksum)) {
         rs_error("got magic number %#x rather than expected value %#x", v,
                  RS_DELTA_MAGIC);
         return RS_BAD_MAGIC;
+    } else if (job->checksum) {
+        rs_trace("got patch magic %#x, checking the new file checksum", v);
+        job->checksum_output = 1;
+        blake2b_init(&job->checksum_state, RS_MAX_STRONG_SUM_LENGTH);
     } else
         rs_trace("got patch magic %#x", v);
     job->statefn = rs_patch_s_cmdbyte;
@@ -220,10 +480,13 @@ static rs_result rs_patch_s_header(rs_job_t *job)
 
 rs_job_t *rs_patch_begin(rs_copy_cb * copy_cb, void *copy_arg)
 {
-    rs_job_t *job = rs_job_new("patch", rs_patch_s_header);
+    return rs_patch_reset(NULL, copy_cb, copy_arg);
+}
 
+rs_job_t *rs_patch_reset(rs_job_t *job, rs_copy_cb * copy_cb, void *copy_arg)
+{
+    job = rs_job_renew(job, "patch", rs_patch_s_header);
     job->copy_cb = copy_cb;
     job->copy_arg = copy_arg;
-    rs_mdfour_begin(&job->output_md4);
     return job;
 }
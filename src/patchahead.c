@@ -0,0 +1,653 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file patchahead.c
+ * Patching with basis reads queued ahead of the patch job.
+ *
+ * The delta is read into a big input buffer, and a scanner decodes the
+ * commands in it ahead of the patch job. Basis reads for the COPY commands it
+ * finds are queued as asynchronous reads into a ring of slots, using io_uring
+ * where the kernel supports it, or otherwise a pool of threads doing pread().
+ * The job's copy callback then takes the data from the slots in order,
+ * waiting only if a read hasn't finished yet. This overlaps basis reads with
+ * each other and with parsing the delta, which matters a lot when the basis is
+ * not in the page cache.
+ *
+ * Big COPYs are split over several slots. Anything the slots can't provide,
+ * like after a short or failed read, is read synchronously with
+ * rs_fd_copy_cb(), which also reports any errors. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>           /* IWYU pragma: keep */
+#endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#endif
+#include "librsync.h"
+#include "largefile.h"
+#include "job.h"
+#include "buf.h"
+#include "prototab.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#  define RS_HAVE_URING 1
+#endif
+
+LIBRSYNC_EXPORT int rs_patch_uring = 1;
+
+/** The default number of basis reads to queue ahead. */
+#define RS_DEFAULT_AHEAD 32
+
+/** The max number of threads to use for basis reads. */
+#define RS_AHEAD_THREADS 16
+
+/** The max size of a read, bigger COPYs are split over several slots. */
+#define RS_AHEAD_CHUNK ((size_t)128 << 10)
+
+/** The max gap between COPYs that are read together. */
+#define RS_AHEAD_GAP ((rs_long_t)4 << 10)
+
+/** The size of the delta input buffer, which limits how far ahead the COPYs
+ * can be found. */
+#define RS_AHEAD_INBUF ((size_t)256 << 10)
+
+/** A queued basis read. */
+typedef struct rs_ahead_slot {
+    rs_long_t pos;              /**< The basis offset. */
+    size_t len;                 /**< The length to read. */
+    long done;                  /**< The length read, or -1 on error. */
+    size_t used;                /**< The length given to the job so far. */
+    int ready;                  /**< Whether the read has finished. */
+    char *buf;
+    size_t buf_size;
+#ifdef RS_HAVE_URING
+    struct iovec iov;
+#endif
+} rs_ahead_slot_t;
+
+#ifdef RS_HAVE_URING
+/** An io_uring instance, used without liburing. */
+typedef struct rs_uring {
+    int fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+} rs_uring_t;
+#endif
+
+/** State for patching with queued basis reads. */
+typedef struct rs_ahead {
+    int fd;                     /**< The basis file descriptor. */
+    rs_fd_basis_t *basis;       /**< For synchronous reads. */
+    FILE *delta;
+    char *in_buf;               /**< The delta input buffer. */
+    size_t in_size;
+    size_t in_end;              /**< The end of the data in in_buf. */
+    size_t scan;                /**< The scanner position in in_buf. */
+    rs_long_t skip;             /**< Bytes to skip before the next command. */
+    int got_magic;              /**< Whether the scanner read the magic. */
+    rs_delta_format_t format;   /**< The format for decoding commands. */
+    int ended;                  /**< Whether the scanner saw the end. */
+    rs_long_t copy_pos, copy_len;       /**< The part of a COPY not queued. */
+    rs_ahead_slot_t *slots;     /**< The ring of queued reads. */
+    int depth;
+    int head;                   /**< The first queued slot. */
+    int count;                  /**< The number of queued slots. */
+    int open;                   /**< The last slot if not read yet, or -1. */
+#ifdef RS_HAVE_URING
+    rs_uring_t *uring;
+#endif
+#ifdef HAVE_PTHREAD_H
+    pthread_t threads[RS_AHEAD_THREADS];
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    int issue;                  /**< The next slot for a thread to read. */
+    int unissued;               /**< The number of slots not being read. */
+    int stop;
+#endif
+} rs_ahead_t;
+
+/** Read a slot synchronously, as done by the threads. */
+static void rs_ahead_read(int fd, rs_ahead_slot_t *s)
+{
+    long n;
+
+    do {
+#ifdef HAVE_PREAD
+        n = (long)pread(fd, s->buf, s->len, s->pos);
+#else
+        n = -1;
+        errno = ENOSYS;
+#endif
+    } while (n < 0 && errno == EINTR);
+    s->done = n;
+}
+
+#ifdef RS_HAVE_URING
+static int rs_uring_enter(rs_uring_t *u, unsigned submit, unsigned wait)
+{
+    return (int)syscall(__NR_io_uring_enter, u->fd, submit, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void rs_uring_free(rs_uring_t *u)
+{
+    if (u->sqes)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr)
+        munmap(u->cq_ptr, u->cq_size);
+    if (u->sq_ptr)
+        munmap(u->sq_ptr, u->sq_size);
+    close(u->fd);
+    rs_free(u);
+}
+
+/** Set up an io_uring, returning NULL if the kernel doesn't support it. */
+static rs_uring_t *rs_uring_new(unsigned entries)
+{
+    struct io_uring_params p;
+    rs_uring_t *u;
+    int fd;
+
+    rs_bzero(&p, sizeof(p));
+    if ((fd = (int)syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+        rs_trace("io_uring_setup failed: %s", strerror(errno));
+        return NULL;
+    }
+    u = rs_alloc_struct(rs_uring_t);
+    u->fd = fd;
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_size > u->sq_size)
+            u->sq_size = u->cq_size;
+        u->cq_size = u->sq_size;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED)
+        goto fail_sq;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED)
+            goto fail_cq;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                   IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto fail_sqes;
+    u->sq_tail = (unsigned *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_ptr + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+    return u;
+
+  fail_sqes:
+    u->sqes = NULL;
+    if (u->cq_ptr != u->sq_ptr)
+        munmap(u->cq_ptr, u->cq_size);
+  fail_cq:
+    u->cq_ptr = NULL;
+    munmap(u->sq_ptr, u->sq_size);
+  fail_sq:
+    rs_trace("can't map io_uring: %s", strerror(errno));
+    u->sq_ptr = NULL;
+    rs_uring_free(u);
+    return NULL;
+}
+
+/** Add a read for a slot to the submission queue. */
+static void rs_uring_queue(rs_uring_t *u, int fd, rs_ahead_slot_t *s,
+                           int index)
+{
+    unsigned tail = *u->sq_tail, i = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[i];
+
+    s->iov.iov_base = s->buf;
+    s->iov.iov_len = s->len;
+    rs_bzero(sqe, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = (uint64_t)s->pos;
+    sqe->addr = (uint64_t)(uintptr_t)&s->iov;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t)index;
+    u->sq_array[i] = i;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+}
+
+/** Mark the slots for all finished reads as ready. */
+static void rs_uring_reap(rs_uring_t *u, rs_ahead_slot_t *slots)
+{
+    unsigned head = *u->cq_head;
+    struct io_uring_cqe *cqe;
+    rs_ahead_slot_t *s;
+
+    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &u->cqes[head & *u->cq_mask];
+        s = &slots[cqe->user_data];
+        s->done = cqe->res < 0 ? -1 : (long)cqe->res;
+        s->ready = 1;
+        head++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif                          /* RS_HAVE_URING */
+
+#ifdef HAVE_PTHREAD_H
+/** Thread that reads queued slots until stopped. */
+static void *rs_ahead_thread(void *arg)
+{
+    rs_ahead_t *a = (rs_ahead_t *)arg;
+    rs_ahead_slot_t *s;
+
+    pthread_mutex_lock(&a->lock);
+    for (;;) {
+        while (!a->stop && !a->unissued)
+            pthread_cond_wait(&a->work, &a->lock);
+        if (a->stop)
+            break;
+        s = &a->slots[a->issue];
+        a->issue = (a->issue + 1) % a->depth;
+        a->unissued--;
+        pthread_mutex_unlock(&a->lock);
+        rs_ahead_read(a->fd, s);
+        pthread_mutex_lock(&a->lock);
+        s->ready = 1;
+        pthread_cond_broadcast(&a->done);
+    }
+    pthread_mutex_unlock(&a->lock);
+    return NULL;
+}
+#endif                          /* HAVE_PTHREAD_H */
+
+/** Start the read for the open slot. */
+static void rs_ahead_submit(rs_ahead_t *a)
+{
+    rs_ahead_slot_t *s = &a->slots[a->open];
+
+    if (s->buf_size < s->len) {
+        rs_free(s->buf);
+        s->buf = rs_alloc(s->len, "look-ahead buffer");
+        s->buf_size = s->len;
+    }
+#ifdef RS_HAVE_URING
+    if (a->uring)
+        rs_uring_queue(a->uring, a->fd, s, a->open);
+#endif
+#ifdef HAVE_PTHREAD_H
+    if (a->nthreads) {
+        pthread_mutex_lock(&a->lock);
+        a->unissued++;
+        pthread_cond_signal(&a->work);
+        pthread_mutex_unlock(&a->lock);
+    }
+#endif
+    a->open = -1;
+}
+
+/** Queue a read of a basis range, returning 0 if the ring is full.
+ *
+ * Ranges close after the last one are added to its slot while it is still
+ * open, so runs of small nearby COPYs only need one read. */
+static int rs_ahead_queue(rs_ahead_t *a, rs_long_t pos, size_t len)
+{
+    rs_ahead_slot_t *s;
+    rs_long_t end;
+    int i;
+
+    if (a->open >= 0) {
+        s = &a->slots[a->open];
+        end = s->pos + (rs_long_t)s->len;
+        if (pos >= end && pos - end <= RS_AHEAD_GAP
+            && pos + (rs_long_t)len - s->pos <= (rs_long_t)RS_AHEAD_CHUNK) {
+            s->len = (size_t)(pos + (rs_long_t)len - s->pos);
+            return 1;
+        }
+    }
+    if (a->count == a->depth)
+        return 0;
+    if (a->open >= 0)
+        rs_ahead_submit(a);
+    i = (a->head + a->count) % a->depth;
+    s = &a->slots[i];
+    s->pos = pos;
+    s->len = len;
+    s->done = 0;
+    s->used = 0;
+    s->ready = 0;
+    a->count++;
+    a->open = i;
+    return 1;
+}
+
+/** Decode the commands in the input buffer ahead of the job, queueing
+ * reads for their COPYs until the ring is full. */
+static void rs_ahead_scan(rs_ahead_t *a)
+{
+    rs_prototab_ent_t const *cmd;
+    rs_byte_t const *p;
+    size_t len;
+    rs_long_t param1, param2;
+    int n, checksum, full = 0;
+
+    if (!a->depth)
+        return;
+    /* Free slots the job has finished with. */
+    while (a->count && a->slots[a->head].used == a->slots[a->head].len) {
+        a->head = (a->head + 1) % a->depth;
+        a->count--;
+    }
+    for (;;) {
+        if (a->copy_len) {
+            len = a->copy_len < (rs_long_t)RS_AHEAD_CHUNK ?
+                (size_t)a->copy_len : RS_AHEAD_CHUNK;
+            if (!(full = !rs_ahead_queue(a, a->copy_pos, len))) {
+                a->copy_pos += (rs_long_t)len;
+                a->copy_len -= (rs_long_t)len;
+            } else
+                break;
+        } else if (a->skip) {
+            len = a->in_end - a->scan;
+            if ((rs_long_t)len > a->skip)
+                len = (size_t)a->skip;
+            a->scan += len;
+            a->skip -= (rs_long_t)len;
+            if (a->skip)
+                break;
+        } else if (a->ended || a->scan == a->in_end) {
+            break;
+        } else if (!a->got_magic) {
+            p = (rs_byte_t const *)a->in_buf + a->scan;
+            if (a->in_end - a->scan < 4)
+                break;
+            a->scan += 4;
+            a->got_magic = 1;
+            /* The job reports a bad magic. */
+            a->ended = !rs_delta_format_init(&a->format,
+                                             (int)rs_get_netint(p, 4),
+                                             &checksum);
+        } else {
+            p = (rs_byte_t const *)a->in_buf + a->scan;
+            if (!(n = rs_delta_format_decode(&a->format, p,
+                                             a->in_end - a->scan, &cmd,
+                                             &param1, &param2)))
+                break;
+            if (n < 0) {
+                /* Bad parameters the job will report. */
+                a->ended = 1;
+                continue;
+            }
+            a->scan += (size_t)n;
+            if (cmd->kind == RS_KIND_LITERAL && param1 > 0) {
+                a->skip = param1;
+            } else if (cmd->kind == RS_KIND_ZLITERAL && param2 > 0) {
+                a->skip = param2;
+            } else if (cmd->kind == RS_KIND_PRIME
+                       || cmd->kind == RS_KIND_WINDOW
+                       || cmd->kind == RS_KIND_SELF
+                       || cmd->kind == RS_KIND_BLOCK) {
+                continue;
+            } else if (cmd->kind == RS_KIND_COPY && param1 >= 0 && param2 > 0) {
+                a->copy_pos = param1;
+                a->copy_len = param2;
+            } else {
+                /* The end, or something the job will report as bad. */
+                a->ended = 1;
+            }
+        }
+    }
+    /* Leave the last slot open for more COPYs while the ring is full,
+       unless the job needs it next. */
+    if (a->open >= 0 && (!full || a->open == a->head))
+        rs_ahead_submit(a);
+#ifdef RS_HAVE_URING
+    if (a->uring && a->uring->to_submit) {
+        if (rs_uring_enter(a->uring, a->uring->to_submit, 0) >= 0)
+            a->uring->to_submit = 0;
+        else
+            rs_trace("io_uring_enter failed: %s", strerror(errno));
+    }
+#endif
+}
+
+/** Wait for the read of a slot to finish. */
+static void rs_ahead_wait(rs_ahead_t *a, rs_ahead_slot_t *s)
+{
+#ifdef RS_HAVE_URING
+    if (a->uring) {
+        for (;;) {
+            rs_uring_reap(a->uring, a->slots);
+            if (s->ready)
+                return;
+            if (rs_uring_enter(a->uring, a->uring->to_submit, 1) >= 0)
+                a->uring->to_submit = 0;
+            else if (errno != EINTR) {
+                rs_error("io_uring_enter failed: %s", strerror(errno));
+                /* Treat it as failed, so it is read synchronously. */
+                s->done = -1;
+                return;
+            }
+        }
+    }
+#endif
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&a->lock);
+    while (!s->ready)
+        pthread_cond_wait(&a->done, &a->lock);
+    pthread_mutex_unlock(&a->lock);
+#endif
+}
+
+/** ::rs_copy_cb that takes data from the queued reads. */
+static rs_result rs_ahead_copy_cb(void *arg, rs_long_t pos, size_t *len,
+                                  void **buf)
+{
+    rs_ahead_t *a = (rs_ahead_t *)arg;
+    rs_ahead_slot_t *s;
+    rs_result result;
+    size_t off, avail;
+
+    rs_ahead_scan(a);
+    s = &a->slots[a->head];
+    if (!a->count || pos < s->pos + (rs_long_t)s->used
+        || pos >= s->pos + (rs_long_t)s->len)
+        return rs_fd_copy_cb(a->basis, pos, len, buf);
+    rs_ahead_wait(a, s);
+    off = (size_t)(pos - s->pos);
+    avail = s->done > (long)off ? (size_t)s->done - off : 0;
+    if (!avail) {
+        /* Read what the slot didn't get synchronously. */
+        if (*len > s->len - off)
+            *len = s->len - off;
+        if ((result = rs_fd_copy_cb(a->basis, pos, len, buf)) == RS_DONE)
+            s->used = off + *len;
+        return result;
+    }
+    if (*len > avail)
+        *len = avail;
+    *buf = s->buf + off;
+    s->used = off + *len;
+    return RS_DONE;
+}
+
+/** ::rs_driven_cb that reads the delta and scans it ahead of the job. */
+static rs_result rs_ahead_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    rs_ahead_t *a = (rs_ahead_t *)opaque;
+    size_t start, keep, len;
+
+    start = buf->next_in ? (size_t)(buf->next_in - a->in_buf) : 0;
+    /* Keep what the job and the scanner still need. */
+    keep = a->depth && !a->ended && a->scan < start ? a->scan : start;
+    /* Wait until there is lots of room, unless the job needs more. */
+    if (buf->avail_in && a->in_size - a->in_end + keep < a->in_size / 2)
+        return RS_DONE;
+    if (keep) {
+        memmove(a->in_buf, a->in_buf + keep, a->in_end - keep);
+        a->in_end -= keep;
+        a->scan -= keep;
+        start -= keep;
+    }
+    buf->next_in = a->in_buf + start;
+    len = fread(a->in_buf + a->in_end, 1, a->in_size - a->in_end, a->delta);
+    if (len == 0) {
+        if ((buf->eof_in = feof(a->delta))) {
+            rs_trace("seen end of file on input");
+            return RS_DONE;
+        }
+        rs_error("error filling buf from file: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    a->in_end += len;
+    buf->avail_in += len;
+    job->stats.in_bytes += len;
+    rs_ahead_scan(a);
+    return RS_DONE;
+}
+
+/** Start the io_uring or threads for the queued reads. */
+static void rs_ahead_start(rs_ahead_t *a)
+{
+#ifdef RS_HAVE_URING
+    if (rs_patch_uring && (a->uring = rs_uring_new((unsigned)a->depth))) {
+        rs_trace("using io_uring for " FMT_SIZE " reads ahead",
+                 (size_t)a->depth);
+        return;
+    }
+#endif
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->work, NULL);
+    pthread_cond_init(&a->done, NULL);
+    while (a->nthreads < a->depth && a->nthreads < RS_AHEAD_THREADS
+           && !pthread_create(&a->threads[a->nthreads], NULL, rs_ahead_thread,
+                              a))
+        a->nthreads++;
+    if (a->nthreads) {
+        rs_trace("using %d threads for " FMT_SIZE " reads ahead",
+                 a->nthreads, (size_t)a->depth);
+        return;
+    }
+    pthread_cond_destroy(&a->done);
+    pthread_cond_destroy(&a->work);
+    pthread_mutex_destroy(&a->lock);
+#endif
+    /* Without either, all reads are done synchronously. */
+    rs_trace("no async reads, reading the basis synchronously");
+    a->depth = 0;
+}
+
+/** Stop the io_uring or threads, waiting for reads using the slots. */
+static void rs_ahead_stop(rs_ahead_t *a)
+{
+    int i;
+
+#ifdef RS_HAVE_URING
+    if (a->uring) {
+        /* The open slot is always the last, and isn't being read. */
+        for (i = 0; i < a->count - (a->open >= 0); i++)
+            rs_ahead_wait(a, &a->slots[(a->head + i) % a->depth]);
+        rs_uring_free(a->uring);
+        return;
+    }
+#endif
+#ifdef HAVE_PTHREAD_H
+    if (a->nthreads) {
+        pthread_mutex_lock(&a->lock);
+        a->stop = 1;
+        pthread_cond_broadcast(&a->work);
+        pthread_mutex_unlock(&a->lock);
+        for (i = 0; i < a->nthreads; i++)
+            pthread_join(a->threads[i], NULL);
+        pthread_cond_destroy(&a->done);
+        pthread_cond_destroy(&a->work);
+        pthread_mutex_destroy(&a->lock);
+    }
+#endif
+    (void)i;
+}
+
+rs_result rs_patch_ahead(int basis_fd, FILE *delta_file, FILE *new_file,
+                         int depth, rs_stats_t *stats)
+{
+    rs_ahead_t a;
+    rs_filebuf_t *out_fb;
+    rs_buffers_t buf;
+    rs_job_t *job;
+    rs_result r;
+    int i;
+
+    rs_bzero(&a, sizeof(a));
+    a.fd = basis_fd;
+    a.basis = rs_fd_basis_new(basis_fd, 0);
+    a.delta = delta_file;
+    a.in_size = rs_inbuflen ? (size_t)rs_inbuflen : RS_AHEAD_INBUF;
+    a.in_buf = rs_alloc(a.in_size, "input buffer");
+    a.depth = depth > 0 ? depth : RS_DEFAULT_AHEAD;
+    a.open = -1;
+    rs_ahead_start(&a);
+    if (a.depth)
+        a.slots = rs_alloc_struct0(a.depth * sizeof(rs_ahead_slot_t),
+                                   "look-ahead slots");
+
+    job = rs_patch_begin(rs_ahead_copy_cb, &a);
+    out_fb = rs_filebuf_new(new_file, rs_outbuflen ? rs_outbuflen :
+                            4 * MAX_DELTA_CMD);
+    r = rs_job_drive(job, &buf, rs_ahead_fill, &a, rs_outfilebuf_drain,
+                     out_fb);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_ahead_stop(&a);
+    rs_filebuf_free(out_fb);
+    rs_job_free(job);
+    for (i = 0; i < a.depth; i++)
+        rs_free(a.slots[i].buf);
+    rs_free(a.slots);
+    rs_free(a.in_buf);
+    rs_fd_basis_free(a.basis);
+    return r;
+}
@@ -0,0 +1,439 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file patchchain.c
+ * Applying a chain of patches in one pass.
+ *
+ * The earlier deltas of the chain are indexed, and the last one is applied
+ * by a normal patch job whose copy callback reads its basis, the output of
+ * the delta before it, through the indexes. A range of a delta's output is
+ * read from its LITERAL data, or for a COPY from the output of the delta
+ * before, down to the original basis. A SELF or the dictionary of a primed
+ * ZLITERAL is read from the delta's own output before it. Only the final
+ * output is written.
+ *
+ * Decompressed ZLITERALs are kept in a few slots for each delta, as
+ * sequential reads and the dictionaries of the following ZLITERALs usually
+ * need them again.
+ *
+ * A range of the output of a single delta is read the same way, with a chain
+ * of just that delta whose index is loaded from a delta index file. Only the
+ * commands for the range are loaded, so this costs about as much as the
+ * range, unless the delta has SELF commands or primed ZLITERALs that need the
+ * output before them.
+ *
+ * The signature of a patch's output is made the same way, reading only the
+ * blocks that don't come whole from a COPY of a block of the basis, whose
+ * sums are already in the basis signature. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>           /* IWYU pragma: keep */
+#endif
+#ifdef HAVE_IO_H
+#  include <io.h>               /* IWYU pragma: keep */
+#endif
+#include "librsync.h"
+#include "largefile.h"
+#include "job.h"
+#include "deltaindex.h"
+#include "sumset.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
+
+/* Use _lseeki64 if it exists. */
+#ifdef _WIN32
+#  define lseek(f, o, w) _lseeki64((f), (o), (w))
+#endif
+
+/** The number of decompressed ZLITERALs kept for each delta. */
+#define RS_CHAIN_SLOTS 16
+
+/** The max length of a ZLITERAL to keep decompressed. */
+#define RS_CHAIN_ZMAX ((rs_long_t)1 << 20)
+
+/** A decompressed ZLITERAL. */
+typedef struct rs_chain_slot {
+    rs_delta_cmd_t const *cmd;  /**< The command, or NULL if empty. */
+    rs_byte_t *data;
+    size_t size;
+} rs_chain_slot_t;
+
+/** A delta in the chain, whose output is the basis of the next. */
+typedef struct rs_chain_delta {
+    rs_delta_index_t idx;
+    int fd;
+    rs_chain_slot_t slots[RS_CHAIN_SLOTS];
+    int next;                   /**< The slot to use next. */
+} rs_chain_delta_t;
+
+struct rs_chain {
+    rs_chain_delta_t *deltas;
+    int count;
+    rs_copy_cb *copy_cb;        /**< The callback to read the basis. */
+    void *copy_arg;
+    rs_result result;           /**< The result of indexing the deltas. */
+};
+
+static rs_result rs_chain_read(rs_chain_t *chain, int level, rs_byte_t *buf,
+                               size_t len, rs_long_t pos);
+
+/** Read len bytes at offset off in the data of a ZLITERAL. */
+static rs_result rs_chain_inflate(rs_chain_t *chain, int level,
+                                  rs_delta_cmd_t const *c, rs_byte_t *buf,
+                                  size_t len, rs_long_t off)
+{
+    rs_chain_delta_t *d = &chain->deltas[level];
+    rs_chain_slot_t *s;
+    size_t dict_len = rs_delta_index_dict_len(&d->idx, c);
+    rs_byte_t *dict = NULL;
+    rs_result result = RS_DONE;
+    int i;
+
+    for (i = 0; i < RS_CHAIN_SLOTS; i++) {
+        if (d->slots[i].cmd == c) {
+            memcpy(buf, d->slots[i].data + off, len);
+            return RS_DONE;
+        }
+    }
+    if (dict_len) {
+        dict = rs_alloc(dict_len, "compression dictionary");
+        result = rs_chain_read(chain, level, dict, dict_len,
+                               c->out - (rs_long_t)dict_len);
+    }
+    if (result == RS_DONE && c->len <= RS_CHAIN_ZMAX) {
+        /* Reading the dictionary can use the slots, so take one after. */
+        s = &d->slots[d->next];
+        d->next = (d->next + 1) % RS_CHAIN_SLOTS;
+        s->cmd = NULL;
+        if (s->size < (size_t)c->len) {
+            s->data = rs_realloc(s->data, (size_t)c->len, "ZLITERAL data");
+            s->size = (size_t)c->len;
+        }
+        result = rs_delta_index_inflate(c, d->fd, dict, dict_len, s->data,
+                                        (size_t)c->len, 0);
+        if (result == RS_DONE) {
+            s->cmd = c;
+            memcpy(buf, s->data + off, len);
+        }
+    } else if (result == RS_DONE) {
+        result = rs_delta_index_inflate(c, d->fd, dict, dict_len, buf, len,
+                                        off);
+    }
+    rs_free(dict);
+    return result;
+}
+
+/** Read len bytes at pos in the output of the delta at level, or the basis
+ * for level -1. */
+static rs_result rs_chain_read(rs_chain_t *chain, int level, rs_byte_t *buf,
+                               size_t len, rs_long_t pos)
+{
+    rs_delta_index_t const *idx;
+    rs_delta_cmd_t const *c;
+    rs_long_t off, at;
+    rs_result result = RS_DONE;
+    size_t n, k, done;
+    void *p;
+
+    if (level < 0) {
+        while (len && result == RS_DONE) {
+            n = len;
+            p = buf;
+            if ((result = chain->copy_cb(chain->copy_arg, pos, &n, &p))
+                != RS_DONE)
+                break;
+            if (!n) {
+                rs_error("unexpected eof reading basis at " FMT_LONG, pos);
+                return RS_INPUT_ENDED;
+            }
+            if (p != buf)
+                memcpy(buf, p, n);
+            buf += n;
+            len -= n;
+            pos += (rs_long_t)n;
+        }
+        return result;
+    }
+    idx = &chain->deltas[level].idx;
+    if (pos + (rs_long_t)len > idx->out_len) {
+        rs_error("COPY of " FMT_SIZE " bytes at " FMT_LONG
+                 " is past the end of the output of delta %d", len, pos,
+                 level + 1);
+        return RS_CORRUPT;
+    }
+    for (c = &idx->cmds[rs_delta_index_find(idx, pos)];
+         len && result == RS_DONE; c++) {
+        off = pos - c->out;
+        n = c->len - off < (rs_long_t)len ? (size_t)(c->len - off) : len;
+        if (!c->literal) {
+            result = rs_chain_read(chain, level - 1, buf, n, c->src + off);
+        } else if (c->dist) {
+            /* The SELF repeats the dist bytes at src. */
+            for (done = 0; done < n && result == RS_DONE; done += k) {
+                at = (off + (rs_long_t)done) % c->dist;
+                k = c->dist - at < (rs_long_t)(n - done) ?
+                    (size_t)(c->dist - at) : n - done;
+                result = rs_chain_read(chain, level, buf + done, k,
+                                       c->src + at);
+            }
+        } else if (c->zlen) {
+            result = rs_chain_inflate(chain, level, c, buf, n, off);
+        } else {
+            result = rs_delta_index_pread(chain->deltas[level].fd, buf, n,
+                                          c->src + off);
+        }
+        buf += n;
+        len -= n;
+        pos += (rs_long_t)n;
+    }
+    return result;
+}
+
+/** The copy callback for the last delta, reading the output of the delta
+ * before it. */
+static rs_result rs_chain_copy_cb(void *arg, rs_long_t pos, size_t *len,
+                                  void **buf)
+{
+    rs_chain_t *chain = (rs_chain_t *)arg;
+
+    return rs_chain_read(chain, chain->count - 1, (rs_byte_t *)*buf, *len,
+                         pos);
+}
+
+/** State function that fails a job whose deltas couldn't be indexed. */
+static rs_result rs_chain_s_failed(rs_job_t *job)
+{
+    return job->chain->result;
+}
+
+/** Free the index and slots of a delta in the chain. */
+static void rs_chain_delta_free(rs_chain_delta_t *d)
+{
+    int k;
+
+    for (k = 0; k < RS_CHAIN_SLOTS; k++)
+        rs_free(d->slots[k].data);
+    rs_delta_index_free(&d->idx);
+}
+
+void rs_chain_free(rs_chain_t *chain)
+{
+    int i;
+
+    if (!chain)
+        return;
+    for (i = 0; i < chain->count; i++)
+        rs_chain_delta_free(&chain->deltas[i]);
+    rs_free(chain->deltas);
+    rs_free(chain);
+}
+
+rs_job_t *rs_patch_chain_begin(int const *delta_fds, int count,
+                               rs_copy_cb * copy_cb, void *copy_arg)
+{
+    rs_chain_t *chain = rs_alloc_struct(rs_chain_t);
+    rs_job_t *job = rs_patch_begin(rs_chain_copy_cb, chain);
+    rs_stats_t stats;
+    rs_long_t pos;
+    int i;
+
+    job->chain = chain;
+    chain->copy_cb = copy_cb;
+    chain->copy_arg = copy_arg;
+    chain->result = RS_DONE;
+    chain->deltas = rs_alloc_struct0((size_t)(count + 1) *
+                                     sizeof(rs_chain_delta_t), "delta chain");
+    for (i = 0; i < count; i++) {
+        chain->deltas[i].fd = delta_fds[i];
+        if ((pos = (rs_long_t)lseek(delta_fds[i], 0, SEEK_CUR)) < 0) {
+            rs_error("can't chain delta %d on fd%d that isn't seekable: %s",
+                     i + 1, delta_fds[i], strerror(errno));
+            chain->result = RS_IO_ERROR;
+            break;
+        }
+        rs_bzero(&stats, sizeof(stats));
+        chain->count = i + 1;
+        if ((chain->result =
+             rs_delta_index_build(&chain->deltas[i].idx, delta_fds[i], pos,
+                                  &stats)) != RS_DONE)
+            break;
+        rs_trace("chained delta %d of " FMT_LONG " bytes making " FMT_LONG
+                 " bytes", i + 1, stats.in_bytes,
+                 chain->deltas[i].idx.out_len);
+    }
+    if (chain->result != RS_DONE)
+        job->statefn = rs_chain_s_failed;
+    return job;
+}
+
+rs_result rs_patch_range(FILE *basis_file, FILE *delta_file, FILE *index_file,
+                         rs_long_t pos, void *buf, size_t *len)
+{
+    rs_chain_delta_t d;
+    rs_chain_t chain;
+    rs_stats_t stats;
+    rs_long_t delta_pos, index_pos = 0;
+    rs_result result;
+
+    if (pos < 0)
+        return RS_PARAM_ERROR;
+    /* The delta and index must be seekable files. */
+    if ((delta_pos = (rs_long_t)ftell(delta_file)) < 0
+        || (index_file && (index_pos = (rs_long_t)ftell(index_file)) < 0)) {
+        rs_error("can't read a range of a patch from files that aren't "
+                 "seekable: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    rs_bzero(&d, sizeof(d));
+    d.fd = fileno(delta_file);
+    chain.deltas = &d;
+    chain.count = 1;
+    chain.copy_cb = rs_file_copy_cb;
+    chain.copy_arg = basis_file;
+    chain.result = RS_DONE;
+    if (index_file) {
+        result = rs_delta_index_load(&d.idx, fileno(index_file), index_pos,
+                                     d.fd, delta_pos, pos,
+                                     pos + (rs_long_t)*len);
+    } else {
+        rs_bzero(&stats, sizeof(stats));
+        result = rs_delta_index_build(&d.idx, d.fd, delta_pos, &stats);
+    }
+    if (result == RS_DONE) {
+        if (pos >= d.idx.out_len)
+            *len = 0;
+        else if ((rs_long_t)*len > d.idx.out_len - pos)
+            *len = (size_t)(d.idx.out_len - pos);
+        if (*len)
+            result = rs_chain_read(&chain, 0, (rs_byte_t *)buf, *len, pos);
+    }
+    rs_chain_delta_free(&d);
+    return result;
+}
+
+/** Write len bytes of a signature. */
+static rs_result rs_chain_sig_write(FILE *f, void const *buf, size_t len,
+                                    rs_stats_t *stats)
+{
+    if (fwrite(buf, 1, len, f) != len) {
+        rs_error("error writing signature: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    stats->out_bytes += (rs_long_t)len;
+    return RS_DONE;
+}
+
+rs_result rs_sig_from_delta(rs_signature_t const *old_sig, FILE *delta_file,
+                            rs_copy_cb * copy_cb, void *copy_arg,
+                            FILE *sig_file, rs_stats_t *stats)
+{
+    const rs_long_t block_len = old_sig->block_len;
+    const size_t sum_len = (size_t)old_sig->strong_sum_len;
+    rs_chain_delta_t d;
+    rs_chain_t chain;
+    rs_stats_t st;
+    rs_delta_cmd_t const *c;
+    rs_block_sig_t const *b;
+    rs_byte_t rec[4 + RS_MAX_STRONG_SUM_LENGTH], *block = NULL;
+    rs_strong_sum_t strong_sum;
+    rs_weak_sum_t weak_sum;
+    rs_long_t delta_pos, start, src, reused = 0;
+    rs_result result;
+    size_t i = 0, len;
+
+    /* Chunks can only be cut from the new file's data. */
+    if (old_sig->cdc) {
+        rs_error("can't make a signature of content defined chunks from a "
+                 "delta");
+        return RS_PARAM_ERROR;
+    }
+    rs_bzero(&st, sizeof(st));
+    st.op = "signature";
+    st.start = time(NULL);
+    rs_bzero(&d, sizeof(d));
+    /* The delta must be a seekable file. */
+    if ((delta_pos = (rs_long_t)ftell(delta_file)) < 0) {
+        rs_error("can't make a signature from a delta that isn't a seekable "
+                 "file: %s", strerror(errno));
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    d.fd = fileno(delta_file);
+    chain.deltas = &d;
+    chain.count = 1;
+    chain.copy_cb = copy_cb;
+    chain.copy_arg = copy_arg;
+    chain.result = RS_DONE;
+    if ((result = rs_delta_index_build(&d.idx, d.fd, delta_pos, &st))
+        != RS_DONE)
+        goto out;
+    /* The new signature has the same format as the old one. */
+    rs_put_netint(rec, old_sig->magic, 4);
+    rs_put_netint(rec + 4, block_len, 4);
+    rs_put_netint(rec + 8, (rs_long_t)sum_len, 4);
+    if ((result = rs_chain_sig_write(sig_file, rec, 12, &st)) != RS_DONE)
+        goto out;
+    st.block_len = (size_t)block_len;
+    block = rs_alloc((size_t)block_len, "signature block");
+    for (start = 0; start < d.idx.out_len; start += block_len) {
+        len = d.idx.out_len - start < block_len ?
+            (size_t)(d.idx.out_len - start) : (size_t)block_len;
+        while (d.idx.cmds[i].out + d.idx.cmds[i].len <= start)
+            i++;
+        c = &d.idx.cmds[i];
+        src = c->src + (start - c->out);
+        /* A whole block copied from the start of a basis block has its
+           sums. A short last block might not match a whole basis block. */
+        if (len == (size_t)block_len && !c->literal
+            && start + block_len <= c->out + c->len && src % block_len == 0
+            && src / block_len < old_sig->count) {
+            b = rs_block_sig_ptr(old_sig, (int)(src / block_len));
+            weak_sum = rs_block_sig_weak_sum(old_sig, b);
+            memcpy(strong_sum, b->strong_sum, sum_len);
+            reused++;
+        } else {
+            if ((result = rs_chain_read(&chain, 0, block, len, start))
+                != RS_DONE)
+                break;
+            weak_sum = rs_signature_calc_weak_sum(old_sig, block, len);
+            rs_signature_calc_strong_sum(old_sig, block, len, &strong_sum);
+        }
+        rs_put_netint(rec, weak_sum, 4);
+        memcpy(rec + 4, strong_sum, sum_len);
+        if ((result = rs_chain_sig_write(sig_file, rec, 4 + sum_len, &st))
+            != RS_DONE)
+            break;
+        st.sig_blocks++;
+    }
+    rs_trace("reused " FMT_LONG " of " FMT_LONG " block sums", reused,
+             st.sig_blocks);
+  out:
+    st.end = time(NULL);
+    if (stats)
+        memcpy(stats, &st, sizeof(st));
+    rs_free(block);
+    rs_chain_delta_free(&d);
+    return result;
+}
@@ -0,0 +1,285 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file patchfd.c
+ * Patching between file descriptors with kernel-side copies.
+ *
+ * Large COPY commands are done in the kernel without passing the data
+ * through user space. If the basis and output offsets and the length are
+ * filesystem block aligned they are reflinked with FICLONERANGE, which on
+ * filesystems like btrfs and XFS shares the blocks instead of copying them.
+ * Otherwise copy_file_range() is used, which can also share blocks or at
+ * least copy them within the kernel.
+ *
+ * Small COPYs and LITERALs go through the output buffer as usual. If the
+ * kernel can't do a copy, e.g. reflinks on tmpfs and ext4, or copies between
+ * different filesystems on older kernels, that method is disabled and the
+ * data is copied through the output buffer instead. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>           /* IWYU pragma: keep */
+#endif
+#ifdef HAVE_SYS_STAT_H
+#  include <sys/stat.h>         /* IWYU pragma: keep */
+#endif
+#ifdef HAVE_SYS_IOCTL_H
+#  include <sys/ioctl.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#  include <linux/fs.h>
+#endif
+#include "librsync.h"
+#include "largefile.h"
+#include "job.h"
+#include "buf.h"
+#include "trace.h"
+#include "util.h"
+
+#ifdef HAVE_UNISTD_H
+
+/* Kernel copies need 64 bit file offsets to work on long files. */
+#  if (SIZEOF_OFF_T >= 8) || defined(HAVE_LSEEK64)
+#    if defined(HAVE_SYS_IOCTL_H) && defined(FICLONERANGE)
+#      define RS_HAVE_CLONE 1
+#    endif
+#    ifdef HAVE_COPY_FILE_RANGE
+#      define RS_HAVE_COPY 1
+#    endif
+#  endif
+
+/* Use off64_t for long files if it exists, as lseek64 is used. */
+#  if defined(HAVE_LSEEK64) && (SIZEOF_OFF_T < 8)
+typedef off64_t rs_fd_off_t;
+#  else
+typedef off_t rs_fd_off_t;
+#  endif
+
+/** COPYs at least this big are done in the kernel. */
+#  define RS_KCOPY_MIN ((size_t)32 << 10)
+
+/** State for patching between file descriptors. */
+typedef struct rs_fds {
+    rs_fd_basis_t *basis;       /**< The basis for small COPYs. */
+    int basis_fd;
+    int fd;                     /**< The output file descriptor. */
+    rs_long_t out_pos;          /**< The output file offset. */
+    rs_long_t block_size;       /**< The output filesystem block size. */
+    int can_clone;              /**< Whether to try FICLONERANGE. */
+    int can_copy;               /**< Whether to try copy_file_range(). */
+    char *buf;                  /**< The output buffer. */
+    size_t buf_len;
+} rs_fds_t;
+
+/** Write out the output buffer. */
+static rs_result rs_fds_flush(rs_job_t *job, rs_fds_t *f, rs_buffers_t *buf)
+{
+    char *p = f->buf;
+    size_t len;
+    long n;
+
+    /* The output is not pointed at our buffer until the first drain. */
+    len = buf->next_out ? (size_t)(buf->next_out - p) : 0;
+    while (len) {
+        if ((n = (long)write(f->fd, p, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            rs_error("error writing to fd%d: %s", f->fd, strerror(errno));
+            return RS_IO_ERROR;
+        }
+        p += n;
+        len -= (size_t)n;
+        f->out_pos += n;
+        job->stats.out_bytes += n;
+    }
+    buf->next_out = f->buf;
+    buf->avail_out = f->buf_len;
+    return RS_DONE;
+}
+
+#  ifdef RS_HAVE_CLONE
+/** Try to reflink a COPY, returning the length done or 0 if it can't. */
+static size_t rs_fds_clone(rs_fds_t *f, rs_long_t pos, size_t len)
+{
+    struct file_clone_range range;
+    rs_long_t mask = f->block_size - 1;
+
+    /* Only the block aligned part can be cloned. */
+    len &= ~(size_t)mask;
+    if ((pos & mask) || (f->out_pos & mask) || !len)
+        return 0;
+    range.src_fd = f->basis_fd;
+    range.src_offset = (uint64_t)pos;
+    range.src_length = (uint64_t)len;
+    range.dest_offset = (uint64_t)f->out_pos;
+    if (ioctl(f->fd, FICLONERANGE, &range)) {
+        rs_trace("FICLONERANGE failed, not using it: %s", strerror(errno));
+        f->can_clone = 0;
+        return 0;
+    }
+    /* Cloning doesn't move the file offset. */
+    if (lseek(f->fd, (rs_fd_off_t)(f->out_pos + (rs_long_t)len), SEEK_SET)
+        < 0) {
+        f->can_clone = 0;
+        return 0;
+    }
+    return len;
+}
+#  endif                        /* RS_HAVE_CLONE */
+
+#  ifdef RS_HAVE_COPY
+/** Try to copy a COPY in the kernel, returning the length done or 0 if it
+ * can't. */
+static size_t rs_fds_copy(rs_fds_t *f, rs_long_t pos, size_t len)
+{
+    rs_fd_off_t in_pos = (rs_fd_off_t)pos;
+    long n;
+
+    /* This uses and moves the output file offset. */
+    n = (long)copy_file_range(f->basis_fd, &in_pos, f->fd, NULL, len, 0);
+    if (n <= 0) {
+        /* Errors and eof are handled by copying the normal way. */
+        rs_trace("copy_file_range failed, not using it: %s",
+                 n ? strerror(errno) : "unexpected eof");
+        f->can_copy = 0;
+        return 0;
+    }
+    return (size_t)n;
+}
+#  endif                        /* RS_HAVE_COPY */
+
+/** Copy COPY data from the basis to the output. */
+static rs_result rs_fds_copy_out(rs_job_t *job, rs_long_t pos, size_t *len)
+{
+    rs_fds_t *f = (rs_fds_t *)job->copy_out_arg;
+    rs_buffers_t *buf = job->stream;
+    rs_result result;
+    size_t done = 0;
+    void *ptr;
+
+    if (*len >= RS_KCOPY_MIN && (f->can_clone || f->can_copy)) {
+        /* The output buffer must be written out first. */
+        if ((result = rs_fds_flush(job, f, buf)) != RS_DONE)
+            return result;
+#  ifdef RS_HAVE_CLONE
+        if (f->can_clone)
+            done = rs_fds_clone(f, pos, *len);
+#  endif
+#  ifdef RS_HAVE_COPY
+        if (!done && f->can_copy)
+            done = rs_fds_copy(f, pos, *len);
+#  endif
+        if (done) {
+            rs_trace("copied " FMT_SIZE " bytes in the kernel", done);
+            f->out_pos += (rs_long_t)done;
+            job->stats.out_bytes += (rs_long_t)done;
+            *len = done;
+            return RS_DONE;
+        }
+    }
+    /* Copy through the output buffer. */
+    if (!buf->avail_out && (result = rs_fds_flush(job, f, buf)) != RS_DONE)
+        return result;
+    if (*len > buf->avail_out)
+        *len = buf->avail_out;
+    ptr = buf->next_out;
+    if ((result = rs_fd_copy_cb(f->basis, pos, len, &ptr)) != RS_DONE)
+        return result;
+    if (ptr != buf->next_out)
+        memcpy(buf->next_out, ptr, *len);
+    buf->next_out += *len;
+    buf->avail_out -= *len;
+    return RS_DONE;
+}
+
+/** ::rs_driven_cb that writes out the output after each iteration. */
+static rs_result rs_fds_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    return rs_fds_flush(job, (rs_fds_t *)opaque, buf);
+}
+
+rs_result rs_patch_fds(int basis_fd, FILE *delta_file, int new_fd,
+                       rs_stats_t *stats)
+{
+    rs_fds_t f;
+    rs_filebuf_t *in_fb;
+    rs_buffers_t buf;
+    rs_job_t *job;
+    rs_result r;
+#  ifdef HAVE_SYS_STAT_H
+    struct stat st;
+#  endif
+
+    rs_bzero(&f, sizeof(f));
+    f.basis = rs_fd_basis_new(basis_fd, 0);
+    f.basis_fd = basis_fd;
+    f.fd = new_fd;
+    f.buf_len = 4 * MAX_DELTA_CMD;
+    f.buf = rs_alloc(f.buf_len, "output buffer");
+    /* Kernel copies need to know the output offset, so can't be used if
+       the output is not seekable. */
+    f.out_pos = (rs_long_t)lseek(new_fd, 0, SEEK_CUR);
+    if (f.out_pos >= 0) {
+#  ifdef RS_HAVE_CLONE
+        f.can_clone = 1;
+#  endif
+#  ifdef RS_HAVE_COPY
+        f.can_copy = 1;
+#  endif
+    }
+#  ifdef HAVE_SYS_STAT_H
+    if (f.can_clone && !fstat(new_fd, &st) && st.st_blksize > 0)
+        f.block_size = (rs_long_t)st.st_blksize;
+    else
+#  endif
+        f.can_clone = 0;
+
+    job = rs_patch_begin(rs_fd_copy_cb, f.basis);
+    job->copy_out = rs_fds_copy_out;
+    job->copy_out_arg = &f;
+    in_fb = rs_filebuf_new(delta_file, rs_inbuflen ? rs_inbuflen :
+                           MAX_DELTA_CMD);
+    r = rs_job_drive(job, &buf, rs_infilebuf_fill, in_fb, rs_fds_drain, &f);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_filebuf_free(in_fb);
+    rs_job_free(job);
+    rs_free(f.buf);
+    rs_fd_basis_free(f.basis);
+    return r;
+}
+
+#else                           /* !HAVE_UNISTD_H */
+
+rs_result rs_patch_fds(int basis_fd, FILE *delta_file, int new_fd,
+                       rs_stats_t *stats)
+{
+    (void)basis_fd;
+    (void)delta_file;
+    (void)new_fd;
+    (void)stats;
+    rs_error("patching between file descriptors is not supported on this "
+             "platform");
+    return RS_UNIMPLEMENTED;
+}
+
+#endif                          /* !HAVE_UNISTD_H */
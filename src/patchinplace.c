@@ -0,0 +1,764 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file patchinplace.c
+ * Applying a patch over the basis file in place.
+ *
+ * Writing the new file over the basis is only safe if no COPY reads basis
+ * data after it has been overwritten. The COPY commands in the delta index
+ * are split into pieces of at most 1MB, which are the nodes of a graph with
+ * an edge from i to k when k overwrites basis data that i reads, so i must
+ * be done first. The pieces are ordered with a topological sort, and where
+ * there is a cycle the data of its shortest piece is read up front into a
+ * pending area, which removes its edges. The LITERAL data is in the delta,
+ * so it is written after all the COPYs, and then the file is truncated.
+ *
+ * Deltas made with the rs_delta_opts_t::inplace option only COPY forwards, so
+ * they never have cycles and need no pending data.
+ *
+ * With a journal file the patch is crash-safe. The pending data is saved in
+ * the journal before anything is overwritten, and the COPYs are done in
+ * batches. Before a batch, the data of any COPY in it that reads what it or
+ * a later COPY in the batch overwrites is saved too, and after it the file is
+ * synced and the journal header updated. The order only depends on the delta
+ * and basis length, so after a crash patching again with the same journal
+ * recomputes it, redoes the last batch, and carries on. The journal header
+ * has a hash of the delta and the device and inode of the basis, so it is
+ * only resumed for the same basis and delta. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>           /* IWYU pragma: keep */
+#  include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#  include <sys/stat.h>         /* IWYU pragma: keep */
+#endif
+#include "librsync.h"
+#include "largefile.h"
+#include "blake2.h"
+#include "deltaindex.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
+
+#if defined(HAVE_UNISTD_H) && defined(HAVE_PREAD) && defined(HAVE_PWRITE)
+
+#  ifndef HAVE_FDATASYNC
+#    define fdatasync(f) fsync(f)
+#  endif
+
+/** The max length of a COPY piece. */
+#  define RS_IP_PIECE ((rs_long_t)1 << 20)
+
+/** The max length of the COPYs in a journaled batch. */
+#  define RS_IP_BATCH ((rs_long_t)64 << 20)
+
+/** The max length of the data saved in the journal for a batch. */
+#  define RS_IP_SAVE ((rs_long_t)16 << 20)
+
+/** The journal magic number, "rsJ2". */
+#  define RS_IP_MAGIC 0x72734a32
+
+/** The journal header length. There are two, written alternately, followed
+ * by the pending data and then the data saved for the batch. */
+#  define RS_IP_HDR 112
+
+/** The length of the delta hash in the journal header. */
+#  define RS_IP_SUM 32
+
+/* Node flags. */
+#  define RS_IP_QUEUED 1        /**< The piece has been ordered. */
+#  define RS_IP_PENDING 2       /**< The piece data is in the pending area. */
+
+/** A COPY piece in the dependency graph. */
+typedef struct rs_ip_node {
+    rs_long_t off;              /**< The offset of its pending or saved data. */
+    size_t rank;                /**< Its position in the order. */
+    size_t indeg;               /**< The number of pieces it waits for. */
+    size_t mark;                /**< Marks cycle walks and saved batches. */
+    int flags;
+} rs_ip_node_t;
+
+/** The journal header. */
+typedef struct rs_ip_header {
+    unsigned seq;               /**< Incremented on every write. */
+    rs_long_t delta_len, basis_len, out_len;
+    rs_long_t pending_len;      /**< The length of the pending data. */
+    rs_long_t next;             /**< The first piece not known to be done. */
+    rs_long_t batch_end;        /**< The end of the batch with saved data. */
+    rs_long_t basis_dev, basis_ino;     /**< The basis file identity. */
+    rs_byte_t delta_sum[RS_IP_SUM];     /**< The delta hash. */
+} rs_ip_header_t;
+
+/** State for patching in place. */
+typedef struct rs_inplace {
+    int fd, delta_fd, jfd;
+    rs_delta_index_t idx;       /**< The delta commands. */
+    rs_delta_index_t pieces;    /**< The COPY pieces, ordered by output. */
+    rs_ip_node_t *nodes;
+    size_t *out_start, *out_edges;      /**< The pieces each must precede. */
+    size_t *in_start, *in_edges;        /**< The pieces each must follow. */
+    size_t *order;              /**< The pieces in the order to do them. */
+    rs_ip_header_t hdr;
+    rs_byte_t *pending;         /**< The pending data if there's no journal. */
+    rs_byte_t *save;            /**< The data saved for a batch. */
+    rs_byte_t *buf;
+} rs_inplace_t;
+
+/** Write exactly len bytes at pos to fd. */
+static rs_result rs_ip_pwrite(int fd, void const *buf, size_t len,
+                              rs_long_t pos)
+{
+    long n;
+
+    while (len) {
+        if ((n = (long)pwrite(fd, buf, len, pos)) < 0) {
+            if (errno == EINTR)
+                continue;
+            rs_error("error writing to fd%d: %s", fd, strerror(errno));
+            return RS_IO_ERROR;
+        }
+        buf = (rs_byte_t const *)buf + n;
+        len -= (size_t)n;
+        pos += n;
+    }
+    return RS_DONE;
+}
+
+static rs_result rs_ip_sync(int fd)
+{
+    if (fdatasync(fd)) {
+        rs_error("error syncing fd%d: %s", fd, strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
+/** Encode a journal header, returning its checksum offset. */
+static int rs_ip_encode(rs_ip_header_t const *h, rs_byte_t *p)
+{
+    rs_put_netint(p, RS_IP_MAGIC, 4);
+    rs_put_netint(p + 4, h->seq, 4);
+    rs_put_netint(p + 8, h->delta_len, 8);
+    rs_put_netint(p + 16, h->basis_len, 8);
+    rs_put_netint(p + 24, h->out_len, 8);
+    rs_put_netint(p + 32, h->pending_len, 8);
+    rs_put_netint(p + 40, h->next, 8);
+    rs_put_netint(p + 48, h->batch_end, 8);
+    rs_put_netint(p + 56, h->basis_dev, 8);
+    rs_put_netint(p + 64, h->basis_ino, 8);
+    memcpy(p + 72, h->delta_sum, RS_IP_SUM);
+    return 72 + RS_IP_SUM;
+}
+
+/** Write the next journal header over the older one, and sync it. */
+static rs_result rs_ip_write_header(rs_inplace_t *ip)
+{
+    rs_byte_t p[RS_IP_HDR];
+    rs_strong_sum_t sum;
+    rs_result result;
+    int len;
+
+    ip->hdr.seq++;
+    len = rs_ip_encode(&ip->hdr, p);
+    rs_mdfour(sum, p, (size_t)len);
+    memcpy(p + len, sum, RS_IP_HDR - len);
+    if ((result = rs_ip_pwrite(ip->jfd, p, RS_IP_HDR,
+                               (rs_long_t)(ip->hdr.seq & 1) * RS_IP_HDR))
+        != RS_DONE)
+        return result;
+    return rs_ip_sync(ip->jfd);
+}
+
+/** Read the newest valid journal header, returning whether there is one. */
+static int rs_ip_read_header(rs_inplace_t *ip)
+{
+    rs_byte_t p[2 * RS_IP_HDR], *h;
+    rs_strong_sum_t sum;
+    rs_ip_header_t hdr;
+    int i, len, found = 0;
+
+    /* A new journal has no header yet. */
+    if (pread(ip->jfd, p, sizeof(p), 0) != (long)sizeof(p))
+        return 0;
+    for (i = 0; i < 2; i++) {
+        h = p + i * RS_IP_HDR;
+        hdr.seq = (unsigned)rs_get_netint(h + 4, 4);
+        hdr.delta_len = rs_get_netint(h + 8, 8);
+        hdr.basis_len = rs_get_netint(h + 16, 8);
+        hdr.out_len = rs_get_netint(h + 24, 8);
+        hdr.pending_len = rs_get_netint(h + 32, 8);
+        hdr.next = rs_get_netint(h + 40, 8);
+        hdr.batch_end = rs_get_netint(h + 48, 8);
+        hdr.basis_dev = rs_get_netint(h + 56, 8);
+        hdr.basis_ino = rs_get_netint(h + 64, 8);
+        memcpy(hdr.delta_sum, h + 72, RS_IP_SUM);
+        len = 72 + RS_IP_SUM;
+        rs_mdfour(sum, h, (size_t)len);
+        if (rs_get_netint(h, 4) != RS_IP_MAGIC
+            || memcmp(h + len, sum, RS_IP_HDR - len)
+            || (found && hdr.seq < ip->hdr.seq))
+            continue;
+        ip->hdr = hdr;
+        found = 1;
+    }
+    return found;
+}
+
+/** Set the journal header's basis identity and delta hash. */
+static rs_result rs_ip_identify(rs_inplace_t *ip, rs_ip_header_t *h)
+{
+    blake2b_state state;
+    rs_long_t done;
+    rs_result result = RS_DONE;
+    size_t n;
+#  ifdef HAVE_SYS_STAT_H
+    struct stat st;
+
+    if (fstat(ip->fd, &st)) {
+        rs_error("can't stat fd%d: %s", ip->fd, strerror(errno));
+        return RS_IO_ERROR;
+    }
+    h->basis_dev = (rs_long_t)st.st_dev;
+    h->basis_ino = (rs_long_t)st.st_ino;
+#  endif
+    blake2b_init(&state, RS_IP_SUM);
+    for (done = ip->idx.start; done < ip->idx.end && result == RS_DONE;
+         done += (rs_long_t)n) {
+        n = ip->idx.end - done < RS_IP_PIECE ? (size_t)(ip->idx.end - done) :
+            (size_t)RS_IP_PIECE;
+        if ((result = rs_delta_index_pread(ip->delta_fd, ip->buf, n, done))
+            == RS_DONE)
+            blake2b_update(&state, ip->buf, n);
+    }
+    blake2b_final(&state, h->delta_sum, RS_IP_SUM);
+    return result;
+}
+
+/** Split the COPY commands into pieces, skipping those that copy in place. */
+static void rs_ip_split(rs_inplace_t *ip)
+{
+    rs_delta_cmd_t const *c;
+    rs_delta_cmd_t *p;
+    rs_long_t done, len;
+    size_t i, n = 0;
+
+    for (i = 0; i < ip->idx.count; i++) {
+        c = &ip->idx.cmds[i];
+        if (!c->literal && c->src != c->out)
+            n += (size_t)((c->len + RS_IP_PIECE - 1) / RS_IP_PIECE);
+    }
+    ip->pieces.cmds = rs_alloc((n + 1) * sizeof(*p), "in-place pieces");
+    for (i = 0; i < ip->idx.count; i++) {
+        c = &ip->idx.cmds[i];
+        if (c->literal || c->src == c->out)
+            continue;
+        for (done = 0; done < c->len; done += len) {
+            len = c->len - done < RS_IP_PIECE ? c->len - done : RS_IP_PIECE;
+            p = &ip->pieces.cmds[ip->pieces.count++];
+            p->out = c->out + done;
+            p->src = c->src + done;
+            p->len = len;
+            p->literal = 0;
+        }
+    }
+}
+
+/** Build the edges from each piece to the pieces that overwrite its data. */
+static void rs_ip_graph(rs_inplace_t *ip)
+{
+    rs_delta_cmd_t const *p = ip->pieces.cmds;
+    rs_ip_node_t *nodes;
+    size_t n = ip->pieces.count, i, k, e = 0;
+    int pass;
+
+    nodes = ip->nodes = rs_alloc_struct0((n + 1) * sizeof(*nodes),
+                                         "in-place nodes");
+    ip->out_start = rs_alloc((n + 1) * sizeof(size_t), "in-place edges");
+    ip->in_start = rs_alloc((n + 1) * sizeof(size_t), "in-place edges");
+    /* The first pass counts the edges, and the second fills them in. */
+    for (pass = 0; pass < 2; pass++) {
+        for (e = i = 0; i < n; i++) {
+            ip->out_start[i] = e;
+            for (k = rs_delta_index_find(&ip->pieces, p[i].src);
+                 k < n && p[k].out < p[i].src + p[i].len; k++) {
+                if (k == i)
+                    continue;
+                if (pass) {
+                    ip->out_edges[e] = k;
+                    ip->in_edges[nodes[k].mark++] = i;
+                } else {
+                    nodes[k].indeg++;
+                }
+                e++;
+            }
+        }
+        ip->out_start[n] = e;
+        if (!pass) {
+            ip->out_edges = rs_alloc((e + 1) * sizeof(size_t),
+                                     "in-place edges");
+            ip->in_edges = rs_alloc((e + 1) * sizeof(size_t),
+                                    "in-place edges");
+            for (e = k = 0; k < n; k++) {
+                ip->in_start[k] = nodes[k].mark = e;
+                e += nodes[k].indeg;
+            }
+            ip->in_start[n] = e;
+        }
+    }
+    for (k = 0; k < n; k++)
+        nodes[k].mark = 0;
+    rs_trace("built graph of " FMT_SIZE " pieces with " FMT_SIZE " edges", n,
+             e);
+}
+
+/** Find a piece that must be done before piece v and isn't done yet. */
+static size_t rs_ip_pred(rs_inplace_t const *ip, size_t v)
+{
+    size_t x, i = v;
+
+    for (x = ip->in_start[v]; x < ip->in_start[v + 1]; x++) {
+        i = ip->in_edges[x];
+        if (!(ip->nodes[i].flags & (RS_IP_QUEUED | RS_IP_PENDING)))
+            break;
+    }
+    return i;
+}
+
+/** Add a piece to the order. */
+static void rs_ip_queue(rs_inplace_t *ip, size_t *tail, size_t k)
+{
+    ip->nodes[k].flags |= RS_IP_QUEUED;
+    ip->order[(*tail)++] = k;
+}
+
+/** Order the pieces, making the pieces that break cycles pending.
+ *
+ * \return The length of the pending data. */
+static rs_long_t rs_ip_schedule(rs_inplace_t *ip)
+{
+    rs_ip_node_t *nodes = ip->nodes;
+    rs_delta_cmd_t const *p = ip->pieces.cmds;
+    size_t n = ip->pieces.count, head = 0, tail = 0, next = 0, walk = 0;
+    size_t *path, len, i, k, m, v, x;
+    rs_long_t pending_len = 0;
+
+    ip->order = rs_alloc((n + 1) * sizeof(size_t), "in-place order");
+    for (k = 0; k < n; k++)
+        if (!nodes[k].indeg)
+            rs_ip_queue(ip, &tail, k);
+    while (head < n) {
+        if (head == tail) {
+            /* All the remaining pieces wait on others, so walk back from
+               one until a piece repeats to find a cycle. The unused end of
+               the order is used for the path. */
+            while (nodes[next].flags & RS_IP_QUEUED)
+                next++;
+            path = ip->order + tail;
+            walk++;
+            for (len = 0, v = next; nodes[v].mark != walk;
+                 v = rs_ip_pred(ip, v)) {
+                nodes[v].mark = walk;
+                path[len++] = v;
+            }
+            /* Make the shortest piece in the cycle pending. */
+            for (m = v, i = len; path[--i] != v;)
+                if (p[path[i]].len < p[m].len)
+                    m = path[i];
+            nodes[m].flags |= RS_IP_PENDING;
+            nodes[m].off = pending_len;
+            pending_len += p[m].len;
+            for (x = ip->out_start[m]; x < ip->out_start[m + 1]; x++) {
+                k = ip->out_edges[x];
+                if (!(nodes[k].flags & RS_IP_QUEUED) && !--nodes[k].indeg)
+                    rs_ip_queue(ip, &tail, k);
+            }
+            continue;
+        }
+        i = ip->order[head];
+        nodes[i].rank = head++;
+        if (nodes[i].flags & RS_IP_PENDING)
+            continue;
+        for (x = ip->out_start[i]; x < ip->out_start[i + 1]; x++) {
+            k = ip->out_edges[x];
+            if (!--nodes[k].indeg)
+                rs_ip_queue(ip, &tail, k);
+        }
+    }
+    for (k = 0; k < n; k++)
+        nodes[k].mark = 0;
+    return pending_len;
+}
+
+/** Read the pending data into memory or the journal. */
+static rs_result rs_ip_pend(rs_inplace_t *ip)
+{
+    rs_delta_cmd_t const *p = ip->pieces.cmds;
+    rs_result result = RS_DONE;
+    rs_byte_t *data;
+    size_t k;
+
+    if (ip->jfd < 0)
+        ip->pending = rs_alloc((size_t)ip->hdr.pending_len + 1,
+                               "pending data");
+    for (k = 0; k < ip->pieces.count && result == RS_DONE; k++) {
+        if (!(ip->nodes[k].flags & RS_IP_PENDING))
+            continue;
+        data = ip->pending ? ip->pending + ip->nodes[k].off : ip->buf;
+        result = rs_delta_index_pread(ip->fd, data, (size_t)p[k].len,
+                                      p[k].src);
+        if (result == RS_DONE && ip->jfd >= 0)
+            result = rs_ip_pwrite(ip->jfd, data, (size_t)p[k].len,
+                                  2 * RS_IP_HDR + ip->nodes[k].off);
+    }
+    if (result != RS_DONE || ip->jfd < 0)
+        return result;
+    /* The pending data must be safe before anything is overwritten. */
+    if ((result = rs_ip_sync(ip->jfd)) != RS_DONE)
+        return result;
+    ip->hdr.next = ip->hdr.batch_end = 0;
+    return rs_ip_write_header(ip);
+}
+
+/** Find the end of the batch starting at the piece ordered at c, and mark
+ * the pieces whose data must be saved.
+ *
+ * A piece must be saved if it reads what it or a later piece in the batch
+ * overwrites, because redoing the batch after a crash would read the new
+ * data.
+ *
+ * \return The length of the saved data. */
+static rs_long_t rs_ip_plan(rs_inplace_t *ip, size_t c, size_t *end)
+{
+    rs_ip_node_t *nodes = ip->nodes;
+    rs_delta_cmd_t const *p = ip->pieces.cmds;
+    size_t n = ip->pieces.count, e, i, j, x;
+    rs_long_t saved = 0, written = 0, add;
+    int self;
+
+    for (e = c; e < n; e++) {
+        j = ip->order[e];
+        self = !(nodes[j].flags & RS_IP_PENDING)
+            && p[j].src < p[j].out + p[j].len && p[j].out < p[j].src + p[j].len;
+        add = self ? p[j].len : 0;
+        for (x = ip->in_start[j]; x < ip->in_start[j + 1]; x++) {
+            i = ip->in_edges[x];
+            if (!(nodes[i].flags & RS_IP_PENDING) && nodes[i].rank >= c
+                && nodes[i].mark != c + 1)
+                add += p[i].len;
+        }
+        if (e > c && (saved + add > RS_IP_SAVE
+                      || written + p[j].len > RS_IP_BATCH))
+            break;
+        if (self) {
+            nodes[j].mark = c + 1;
+            nodes[j].off = saved;
+            saved += p[j].len;
+        }
+        for (x = ip->in_start[j]; x < ip->in_start[j + 1]; x++) {
+            i = ip->in_edges[x];
+            if (!(nodes[i].flags & RS_IP_PENDING) && nodes[i].rank >= c
+                && nodes[i].mark != c + 1) {
+                nodes[i].mark = c + 1;
+                nodes[i].off = saved;
+                saved += p[i].len;
+            }
+        }
+        written += p[j].len;
+    }
+    *end = e;
+    return saved;
+}
+
+/** Save the data of the marked pieces in the batch from c to e to the
+ * journal. */
+static rs_result rs_ip_save(rs_inplace_t *ip, size_t c, size_t e,
+                            rs_long_t saved)
+{
+    rs_delta_cmd_t const *p = ip->pieces.cmds;
+    rs_result result = RS_DONE;
+    size_t x, k;
+
+    for (x = c; x < e && result == RS_DONE; x++) {
+        k = ip->order[x];
+        if (ip->nodes[k].mark == c + 1)
+            result = rs_delta_index_pread(ip->fd, ip->save + ip->nodes[k].off,
+                                          (size_t)p[k].len, p[k].src);
+    }
+    if (result == RS_DONE)
+        result = rs_ip_pwrite(ip->jfd, ip->save, (size_t)saved,
+                              2 * RS_IP_HDR + ip->hdr.pending_len);
+    if (result == RS_DONE)
+        result = rs_ip_sync(ip->jfd);
+    return result;
+}
+
+/** Do the pieces ordered from c to e. */
+static rs_result rs_ip_copy(rs_inplace_t *ip, size_t c, size_t e, size_t mark)
+{
+    rs_delta_cmd_t const *p = ip->pieces.cmds;
+    rs_ip_node_t const *node;
+    rs_result result = RS_DONE;
+    rs_byte_t *data;
+    size_t k;
+
+    for (; c < e && result == RS_DONE; c++) {
+        k = ip->order[c];
+        node = &ip->nodes[k];
+        data = ip->buf;
+        if ((node->flags & RS_IP_PENDING) && ip->pending)
+            data = ip->pending + node->off;
+        else if (node->flags & RS_IP_PENDING)
+            result = rs_delta_index_pread(ip->jfd, data, (size_t)p[k].len,
+                                          2 * RS_IP_HDR + node->off);
+        else if (mark && node->mark == mark)
+            data = ip->save + node->off;
+        else
+            result = rs_delta_index_pread(ip->fd, data, (size_t)p[k].len,
+                                          p[k].src);
+        if (result == RS_DONE)
+            result = rs_ip_pwrite(ip->fd, data, (size_t)p[k].len, p[k].out);
+    }
+    return result;
+}
+
+/** Do all the COPY pieces in journaled batches. */
+static rs_result rs_ip_journaled(rs_inplace_t *ip)
+{
+    size_t c, e, n = ip->pieces.count;
+    rs_long_t saved;
+    rs_result result;
+
+    ip->save = rs_alloc((size_t)RS_IP_SAVE, "in-place saved data");
+    for (c = (size_t)ip->hdr.next; c < n; c = e) {
+        saved = rs_ip_plan(ip, c, &e);
+        if ((size_t)ip->hdr.batch_end > c) {
+            /* Redo the batch that was being done, with its saved data. */
+            if ((size_t)ip->hdr.batch_end != e) {
+                rs_error("journal batch doesn't match the delta");
+                return RS_CORRUPT;
+            }
+            rs_trace("redoing pieces " FMT_SIZE " to " FMT_SIZE, c, e);
+            result = rs_delta_index_pread(ip->jfd, ip->save, (size_t)saved,
+                                          2 * RS_IP_HDR + ip->hdr.pending_len);
+            if (result != RS_DONE)
+                return result;
+        } else if (saved) {
+            if ((result = rs_ip_save(ip, c, e, saved)) != RS_DONE)
+                return result;
+            ip->hdr.batch_end = (rs_long_t)e;
+            if ((result = rs_ip_write_header(ip)) != RS_DONE)
+                return result;
+        }
+        if ((result = rs_ip_copy(ip, c, e, c + 1)) != RS_DONE
+            || (result = rs_ip_sync(ip->fd)) != RS_DONE)
+            return result;
+        ip->hdr.next = ip->hdr.batch_end = (rs_long_t)e;
+        if ((result = rs_ip_write_header(ip)) != RS_DONE)
+            return result;
+    }
+    return RS_DONE;
+}
+
+/** Write the LITERAL data from the delta. */
+static rs_result rs_ip_literals(rs_inplace_t *ip)
+{
+    rs_delta_cmd_t const *c;
+    rs_result result = RS_DONE;
+    rs_long_t done, len;
+    size_t i;
+
+    for (i = 0; i < ip->idx.count && result == RS_DONE; i++) {
+        c = &ip->idx.cmds[i];
+        if (!c->literal)
+            continue;
+        for (done = 0; done < c->len && result == RS_DONE; done += len) {
+            len = c->len - done < RS_IP_PIECE ? c->len - done : RS_IP_PIECE;
+            result = rs_delta_index_read(&ip->idx, c, -1, ip->delta_fd,
+                                         ip->fd, ip->buf, (size_t)len, done);
+            if (result == RS_DONE)
+                result = rs_ip_pwrite(ip->fd, ip->buf, (size_t)len,
+                                      c->out + done);
+        }
+    }
+    return result;
+}
+
+rs_result rs_patch_inplace(int fd, FILE *delta_file, char const *journal,
+                           rs_stats_t *stats)
+{
+    rs_inplace_t ip;
+    rs_ip_header_t id;
+    rs_stats_t st;
+    rs_long_t delta_pos, basis_len;
+    rs_result result;
+    size_t i;
+    int resume = 0;
+
+    rs_bzero(&ip, sizeof(ip));
+    rs_bzero(&id, sizeof(id));
+    rs_bzero(&st, sizeof(st));
+    st.op = "patch";
+    st.start = time(NULL);
+    ip.fd = fd;
+    ip.jfd = -1;
+    ip.delta_fd = fileno(delta_file);
+    if ((delta_pos = (rs_long_t)ftell(delta_file)) < 0
+        || lseek(ip.delta_fd, 0, SEEK_CUR) < 0) {
+        rs_error("in-place patching needs a seekable delta");
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    if ((result = rs_delta_index_build(&ip.idx, ip.delta_fd, delta_pos, &st))
+        != RS_DONE)
+        goto out;
+    if ((basis_len = (rs_long_t)lseek(fd, 0, SEEK_END)) < 0) {
+        rs_error("basis is not seekable: %s", strerror(errno));
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    ip.buf = rs_alloc((size_t)RS_IP_PIECE, "in-place buffer");
+    if (journal) {
+        if ((result = rs_ip_identify(&ip, &id)) != RS_DONE)
+            goto out;
+        if ((ip.jfd = open(journal, O_RDWR | O_CREAT, 0666)) < 0) {
+            rs_error("can't open journal %s: %s", journal, strerror(errno));
+            result = RS_IO_ERROR;
+            goto out;
+        }
+        if ((resume = rs_ip_read_header(&ip))) {
+            if (ip.hdr.delta_len != ip.idx.end - ip.idx.start
+                || ip.hdr.out_len != ip.idx.out_len
+                || memcmp(ip.hdr.delta_sum, id.delta_sum, RS_IP_SUM)) {
+                rs_error("journal %s is for a different delta", journal);
+                result = RS_CORRUPT;
+                goto out;
+            }
+            if (ip.hdr.basis_dev != id.basis_dev
+                || ip.hdr.basis_ino != id.basis_ino) {
+                rs_error("journal %s is for a different basis", journal);
+                result = RS_CORRUPT;
+                goto out;
+            }
+            rs_trace("resuming in-place patch at piece " FMT_LONG,
+                     ip.hdr.next);
+            basis_len = ip.hdr.basis_len;
+        }
+    }
+    /* Check the COPYs before anything is overwritten. */
+    for (i = 0; i < ip.idx.count; i++) {
+        if (!ip.idx.cmds[i].literal
+            && ip.idx.cmds[i].src + ip.idx.cmds[i].len > basis_len) {
+            rs_error("COPY of " FMT_LONG " bytes at " FMT_LONG
+                     " is past the basis end " FMT_LONG, ip.idx.cmds[i].len,
+                     ip.idx.cmds[i].src, basis_len);
+            result = RS_CORRUPT;
+            goto out;
+        }
+    }
+    rs_ip_split(&ip);
+    rs_ip_graph(&ip);
+    if (resume) {
+        if (rs_ip_schedule(&ip) != ip.hdr.pending_len
+            || ip.hdr.next > (rs_long_t)ip.pieces.count) {
+            rs_error("journal %s doesn't match the delta", journal);
+            result = RS_CORRUPT;
+            goto out;
+        }
+    } else {
+        ip.hdr.delta_len = ip.idx.end - ip.idx.start;
+        ip.hdr.basis_len = basis_len;
+        ip.hdr.out_len = ip.idx.out_len;
+        ip.hdr.pending_len = rs_ip_schedule(&ip);
+        ip.hdr.basis_dev = id.basis_dev;
+        ip.hdr.basis_ino = id.basis_ino;
+        memcpy(ip.hdr.delta_sum, id.delta_sum, RS_IP_SUM);
+    }
+    rs_trace("patching " FMT_SIZE " pieces in place with " FMT_LONG
+             " bytes pending", ip.pieces.count, ip.hdr.pending_len);
+    if (!resume && (result = rs_ip_pend(&ip)) != RS_DONE)
+        goto out;
+    if (ip.jfd >= 0)
+        result = rs_ip_journaled(&ip);
+    else
+        result = rs_ip_copy(&ip, 0, ip.pieces.count, 0);
+    if (result != RS_DONE || (result = rs_ip_literals(&ip)) != RS_DONE)
+        goto out;
+    if (ftruncate(fd, (off_t)ip.idx.out_len)) {
+        rs_error("error truncating fd%d: %s", fd, strerror(errno));
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    if (ip.jfd >= 0) {
+        /* The journal is only removed once the new file is safe. */
+        if (fsync(fd)) {
+            rs_error("error syncing fd%d: %s", fd, strerror(errno));
+            result = RS_IO_ERROR;
+            goto out;
+        }
+        close(ip.jfd);
+        ip.jfd = -1;
+        unlink(journal);
+    }
+    if ((result = rs_delta_index_check(&ip.idx, fd, 0, -1, -1)) != RS_DONE)
+        goto out;
+    st.out_bytes = ip.idx.out_len;
+    if (fseek(delta_file, ip.idx.end, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        result = RS_IO_ERROR;
+    }
+  out:
+    st.end = time(NULL);
+    if (stats)
+        memcpy(stats, &st, sizeof *stats);
+    if (ip.jfd >= 0)
+        close(ip.jfd);
+    rs_delta_index_free(&ip.idx);
+    rs_free(ip.pieces.cmds);
+    rs_free(ip.nodes);
+    rs_free(ip.out_start);
+    rs_free(ip.out_edges);
+    rs_free(ip.in_start);
+    rs_free(ip.in_edges);
+    rs_free(ip.order);
+    rs_free(ip.pending);
+    rs_free(ip.save);
+    rs_free(ip.buf);
+    return result;
+}
+
+#else                           /* !(HAVE_UNISTD_H && ...) */
+
+rs_result rs_patch_inplace(int fd, FILE *delta_file, char const *journal,
+                           rs_stats_t *stats)
+{
+    (void)fd;
+    (void)delta_file;
+    (void)journal;
+    (void)stats;
+    rs_error("in-place patching is not supported on this platform");
+    return RS_UNIMPLEMENTED;
+}
+
+#endif                          /* !(HAVE_UNISTD_H && ...) */
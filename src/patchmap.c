@@ -0,0 +1,270 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file patchmap.c
+ * Zero-copy patching from a memory mapped basis.
+ *
+ * The basis is mapped into memory and the copy callback returns pointers
+ * into the mapping. Instead of copying COPY data into the output buffer, the
+ * job calls rs_map_copy_out(), which adds it to a list of iovecs along with
+ * the literal data before it in the output buffer. The iovecs are
+ * written out with writev(), so COPY data goes straight from the page cache
+ * to the new file.
+ *
+ * The kernel is advised with madvise() about the COPY ranges as they come,
+ * asking it to read ahead sequentially for runs of nearby COPYs. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>           /* IWYU pragma: keep */
+#endif
+#ifdef HAVE_SYS_STAT_H
+#  include <sys/stat.h>         /* IWYU pragma: keep */
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_UIO_H
+#  include <sys/uio.h>
+#endif
+#include "librsync.h"
+#include "job.h"
+#include "buf.h"
+#include "trace.h"
+#include "util.h"
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_UIO_H) && defined(HAVE_WRITEV)
+
+/** Max number of iovecs to collect before writing them. */
+#  define RS_MAP_IOVS 64
+
+/** COPYs smaller than this are copied into the output buffer instead of
+ * being written from the mapping, as this is cheaper than an extra iovec. */
+#  define RS_MAP_SMALL ((size_t)16 << 10)
+
+/** Size of the window to read ahead for sequential COPYs. */
+#  define RS_MAP_WINDOW ((rs_long_t)4 << 20)
+
+/** State for patching from a mapped basis. */
+typedef struct rs_map {
+    rs_byte_t *map;             /**< The basis mapping. */
+    rs_long_t size;             /**< The basis size. */
+    rs_long_t page_size;
+    rs_long_t next_pos;         /**< The end of the last COPY. */
+    rs_long_t adv_start, adv_end;       /**< The last advised range. */
+    int fd;                     /**< The output file descriptor. */
+    char *buf;                  /**< The output buffer for literal data. */
+    size_t buf_len;
+    char *pending;              /**< Output buffer data not in iov yet. */
+    struct iovec iov[RS_MAP_IOVS];
+    int iov_cnt;
+} rs_map_t;
+
+/** Tell the kernel about the next COPY range. */
+static void rs_map_advise(rs_map_t *m, rs_long_t pos, size_t len)
+{
+    rs_long_t end = pos + (rs_long_t)len;
+    int seq = pos >= m->next_pos && pos - m->next_pos < RS_MAP_WINDOW;
+
+    m->next_pos = end;
+    if (pos >= m->adv_start && end <= m->adv_end)
+        return;
+    /* Read a window ahead for sequential runs of COPYs, otherwise just what
+       this COPY needs. Small scattered COPYs are left to page faults. */
+    if (seq)
+        end += RS_MAP_WINDOW;
+    else if (len < RS_MAP_SMALL)
+        return;
+    if (end > m->size)
+        end = m->size;
+    m->adv_start = pos & ~(m->page_size - 1);
+    m->adv_end = end;
+    if (seq)
+        madvise(m->map + m->adv_start, (size_t)(end - m->adv_start),
+                MADV_SEQUENTIAL);
+    if (madvise(m->map + m->adv_start, (size_t)(end - m->adv_start),
+                MADV_WILLNEED))
+        rs_trace("madvise(MADV_WILLNEED) failed: %s", strerror(errno));
+}
+
+/** ::rs_copy_cb that returns pointers into the mapped basis. */
+static rs_result rs_map_copy_cb(void *arg, rs_long_t pos, size_t *len,
+                                void **buf)
+{
+    rs_map_t *m = (rs_map_t *)arg;
+
+    if (pos >= m->size) {
+        rs_error("unexpected eof in mapped basis at " FMT_LONG, pos);
+        return RS_INPUT_ENDED;
+    }
+    if ((rs_long_t)*len > m->size - pos)
+        *len = (size_t)(m->size - pos);
+    rs_map_advise(m, pos, *len);
+    *buf = m->map + pos;
+    return RS_DONE;
+}
+
+/** Add the output buffer data not yet in the iovecs to them. */
+static void rs_map_add_pending(rs_map_t *m, rs_buffers_t *buf)
+{
+    if (buf->next_out > m->pending) {
+        m->iov[m->iov_cnt].iov_base = m->pending;
+        m->iov[m->iov_cnt].iov_len = (size_t)(buf->next_out - m->pending);
+        m->iov_cnt++;
+        m->pending = buf->next_out;
+    }
+}
+
+/** Write out all the iovecs and reset the output buffer. */
+static rs_result rs_map_flush(rs_job_t *job, rs_map_t *m, rs_buffers_t *buf)
+{
+    struct iovec *iov = m->iov;
+    int cnt;
+    ssize_t n;
+
+    rs_map_add_pending(m, buf);
+    for (cnt = m->iov_cnt; cnt;) {
+        if ((n = writev(m->fd, iov, cnt)) < 0) {
+            if (errno == EINTR)
+                continue;
+            rs_error("error writing to fd%d: %s", m->fd, strerror(errno));
+            return RS_IO_ERROR;
+        }
+        job->stats.out_bytes += n;
+        /* Skip over what was written, which might end part way through. */
+        while (cnt && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt) {
+            iov->iov_base = (rs_byte_t *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    m->iov_cnt = 0;
+    buf->next_out = m->pending = m->buf;
+    buf->avail_out = m->buf_len;
+    return RS_DONE;
+}
+
+/** Add COPY data from the mapping to the output. */
+static rs_result rs_map_copy_out(rs_job_t *job, rs_long_t pos, size_t *len)
+{
+    rs_map_t *m = (rs_map_t *)job->copy_out_arg;
+    rs_buffers_t *buf = job->stream;
+    rs_result result;
+    void *ptr;
+
+    if ((result = rs_map_copy_cb(m, pos, len, &ptr)) != RS_DONE)
+        return result;
+    if (*len < RS_MAP_SMALL && *len <= buf->avail_out) {
+        memcpy(buf->next_out, ptr, *len);
+        buf->next_out += *len;
+        buf->avail_out -= *len;
+        return RS_DONE;
+    }
+    /* Make room for the pending output, this, and the pending output after
+       this when it is flushed. */
+    if (m->iov_cnt > RS_MAP_IOVS - 3
+        && (result = rs_map_flush(job, m, buf)) != RS_DONE)
+        return result;
+    rs_map_add_pending(m, buf);
+    m->iov[m->iov_cnt].iov_base = ptr;
+    m->iov[m->iov_cnt].iov_len = *len;
+    m->iov_cnt++;
+    return RS_DONE;
+}
+
+/** ::rs_driven_cb that writes out the output after each iteration. */
+static rs_result rs_map_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    rs_map_t *m = (rs_map_t *)opaque;
+
+    /* The first time, point the output at our buffer. */
+    if (!buf->next_out) {
+        buf->next_out = m->pending = m->buf;
+        buf->avail_out = m->buf_len;
+        return RS_DONE;
+    }
+    return rs_map_flush(job, m, buf);
+}
+
+rs_result rs_patch_mmap(int basis_fd, FILE *delta_file, int new_fd,
+                        rs_stats_t *stats)
+{
+    rs_map_t m;
+    struct stat st;
+    rs_filebuf_t *in_fb;
+    rs_buffers_t buf;
+    rs_job_t *job;
+    rs_result r;
+
+    if (fstat(basis_fd, &st)) {
+        rs_error("can't stat basis fd%d: %s", basis_fd, strerror(errno));
+        return RS_IO_ERROR;
+    }
+    rs_bzero(&m, sizeof(m));
+    m.size = (rs_long_t)st.st_size;
+    m.page_size = (rs_long_t)sysconf(_SC_PAGESIZE);
+    if (m.size > 0) {
+        m.map = mmap(NULL, (size_t)m.size, PROT_READ, MAP_PRIVATE, basis_fd,
+                     0);
+        if (m.map == MAP_FAILED) {
+            rs_error("can't map basis fd%d: %s", basis_fd, strerror(errno));
+            return RS_IO_ERROR;
+        }
+    }
+    m.fd = new_fd;
+    m.buf_len = 4 * MAX_DELTA_CMD;
+    m.buf = rs_alloc(m.buf_len, "output buffer");
+
+    job = rs_patch_begin(rs_map_copy_cb, &m);
+    job->copy_out = rs_map_copy_out;
+    job->copy_out_arg = &m;
+    in_fb = rs_filebuf_new(delta_file, rs_inbuflen ? rs_inbuflen :
+                           MAX_DELTA_CMD);
+    r = rs_job_drive(job, &buf, rs_infilebuf_fill, in_fb, rs_map_drain, &m);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_filebuf_free(in_fb);
+    rs_job_free(job);
+    rs_free(m.buf);
+    if (m.map)
+        munmap(m.map, (size_t)m.size);
+    return r;
+}
+
+#else                           /* !(HAVE_SYS_MMAN_H && ...) */
+
+rs_result rs_patch_mmap(int basis_fd, FILE *delta_file, int new_fd,
+                        rs_stats_t *stats)
+{
+    (void)basis_fd;
+    (void)delta_file;
+    (void)new_fd;
+    (void)stats;
+    rs_error("mmap patching is not supported on this platform");
+    return RS_UNIMPLEMENTED;
+}
+
+#endif                          /* !(HAVE_SYS_MMAN_H && ...) */
@@ -0,0 +1,226 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file patchpar.c
+ * Applying a patch with several threads.
+ *
+ * The delta is first scanned to build an index of its commands, with the
+ * output offset of each and where its data comes from, which is the basis
+ * range for a COPY or the payload offset in the delta for a LITERAL. The
+ * output is then split into ranges of about equal size, and each thread
+ * fills its range by reading the basis and delta with pread() and writing
+ * with pwrite(). The ranges don't overlap, so the threads need no locking,
+ * and the output is exactly the same as from rs_patch_file(). */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>           /* IWYU pragma: keep */
+#  include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+#include <time.h>
+#include "librsync.h"
+#include "largefile.h"
+#include "deltaindex.h"
+#include "trace.h"
+#include "util.h"
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PREAD) && defined(HAVE_PWRITE)
+
+/** The max number of threads. */
+#  define RS_PAR_THREADS 64
+
+/** The min output size for each thread. */
+#  define RS_PAR_MIN ((rs_long_t)1 << 20)
+
+/** The size of the buffers for copying. */
+#  define RS_PAR_BUF ((size_t)256 << 10)
+
+/** A thread filling a range of the output. */
+typedef struct rs_par_worker {
+    rs_delta_index_t const *idx;
+    int basis_fd, delta_fd, new_fd;
+    rs_long_t out_base;         /**< The new file offset to write at. */
+    rs_long_t start, end;
+    rs_result result;
+    pthread_t thread;
+} rs_par_worker_t;
+
+/** Fill a range of the output from the index. */
+static rs_result rs_par_fill(rs_par_worker_t *w)
+{
+    rs_delta_cmd_t const *c, *end = w->idx->cmds + w->idx->count;
+    rs_long_t from, to;
+    rs_result result = RS_DONE;
+    size_t len;
+    char *buf;
+    long n;
+
+    buf = rs_alloc(RS_PAR_BUF, "copy buffer");
+    for (c = &w->idx->cmds[rs_delta_index_find(w->idx, w->start)];
+         c < end && c->out < w->end; c++) {
+        from = c->out > w->start ? c->out : w->start;
+        to = c->out + c->len < w->end ? c->out + c->len : w->end;
+        while (from < to) {
+            len = to - from < (rs_long_t)RS_PAR_BUF ? (size_t)(to - from) :
+                RS_PAR_BUF;
+            result = rs_delta_index_read(w->idx, c, w->basis_fd, w->delta_fd,
+                                         -1, buf, len, from - c->out);
+            if (result != RS_DONE)
+                goto out;
+            do {
+                n = (long)pwrite(w->new_fd, buf, len, w->out_base + from);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                rs_error("error writing to fd%d: %s", w->new_fd,
+                         strerror(errno));
+                result = RS_IO_ERROR;
+                goto out;
+            }
+            from += n;
+        }
+    }
+  out:
+    rs_free(buf);
+    return result;
+}
+
+static void *rs_par_thread(void *arg)
+{
+    rs_par_worker_t *w = (rs_par_worker_t *)arg;
+
+    w->result = rs_par_fill(w);
+    return NULL;
+}
+
+rs_result rs_patch_parallel(FILE *basis_file, FILE *delta_file,
+                            FILE *new_file, int threads, rs_stats_t *stats)
+{
+    rs_delta_index_t idx;
+    int basis_fd, delta_fd, new_fd;
+    rs_long_t out_base;
+    rs_par_worker_t workers[RS_PAR_THREADS];
+    rs_stats_t st;
+    rs_long_t delta_pos, out_len, share;
+    rs_result result;
+    int i, started, flags;
+
+    if (threads > RS_PAR_THREADS)
+        threads = RS_PAR_THREADS;
+    /* The delta and output must be seekable files. */
+    fflush(new_file);
+    if (threads <= 1 || (delta_pos = (rs_long_t)ftell(delta_file)) < 0
+        || lseek(fileno(delta_file), 0, SEEK_CUR) < 0) {
+        rs_trace("patching with one thread");
+        return rs_patch_file(basis_file, delta_file, new_file, stats);
+    }
+    basis_fd = fileno(basis_file);
+    delta_fd = fileno(delta_file);
+    new_fd = fileno(new_file);
+    if ((out_base = (rs_long_t)lseek(new_fd, 0, SEEK_CUR)) < 0) {
+        rs_trace("output is not seekable, patching with one thread");
+        return rs_patch_file(basis_file, delta_file, new_file, stats);
+    }
+    rs_bzero(&st, sizeof(st));
+    st.op = "patch";
+    st.start = time(NULL);
+    result = rs_delta_index_build(&idx, delta_fd, delta_pos, &st);
+    if (result != RS_DONE)
+        goto out;
+    if (idx.prime || idx.window) {
+        /* Primed ZLITERAL data needs the output before it to decompress, and
+           SELF commands copy it. */
+        rs_trace("delta uses its output, patching with one thread");
+        rs_delta_index_free(&idx);
+        return rs_patch_file(basis_file, delta_file, new_file, stats);
+    }
+    out_len = idx.out_len;
+
+    /* Split the output into a range for each thread, but don't bother with
+       lots of threads for small outputs. */
+    if (threads > out_len / RS_PAR_MIN + 1)
+        threads = (int)(out_len / RS_PAR_MIN + 1);
+    share = (out_len / threads + 4095) & ~(rs_long_t)4095;
+    rs_trace("patching with %d threads of " FMT_LONG " bytes", threads, share);
+    for (i = 0; i < threads; i++) {
+        workers[i].idx = &idx;
+        workers[i].basis_fd = basis_fd;
+        workers[i].delta_fd = delta_fd;
+        workers[i].new_fd = new_fd;
+        workers[i].out_base = out_base;
+        workers[i].start = i * share < out_len ? i * share : out_len;
+        workers[i].end = (i + 1) * share < out_len && i < threads - 1 ?
+            (i + 1) * share : out_len;
+        workers[i].result = RS_DONE;
+    }
+    /* The first range is filled by this thread, as are any that a thread
+       can't be started for. */
+    for (started = 1; started < threads; started++)
+        if (pthread_create(&workers[started].thread, NULL, rs_par_thread,
+                           &workers[started]))
+            break;
+    for (i = started; i < threads; i++)
+        rs_par_thread(&workers[i]);
+    rs_par_thread(&workers[0]);
+    for (i = 1; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+    for (i = 0; i < threads && result == RS_DONE; i++)
+        result = workers[i].result;
+    /* The output can't be hashed in order as it's written, so it is read
+       back to check the checksum. If it is open write-only, the data is read
+       again from the basis and delta instead. */
+    if (result != RS_DONE)
+        goto out;
+    flags = fcntl(new_fd, F_GETFL);
+    if ((result = rs_delta_index_check(&idx, flags >= 0
+                                       && (flags & O_ACCMODE) != O_WRONLY ?
+                                       new_fd : -1, out_base, basis_fd,
+                                       delta_fd)) != RS_DONE)
+        goto out;
+
+    /* Leave the files positioned like rs_patch_file() does. */
+    st.out_bytes = out_len;
+    if (fseek(new_file, out_base + out_len, SEEK_SET)
+        || fseek(delta_file, idx.end, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        result = RS_IO_ERROR;
+    }
+  out:
+    st.end = time(NULL);
+    if (stats)
+        memcpy(stats, &st, sizeof *stats);
+    rs_delta_index_free(&idx);
+    return result;
+}
+
+#else                           /* !(HAVE_PTHREAD_H && ...) */
+
+rs_result rs_patch_parallel(FILE *basis_file, FILE *delta_file,
+                            FILE *new_file, int threads, rs_stats_t *stats)
+{
+    (void)threads;
+    return rs_patch_file(basis_file, delta_file, new_file, stats);
+}
+
+#endif                          /* !(HAVE_PTHREAD_H && ...) */
@@ -21,8 +21,12 @@
  */
 
 #include "config.h"             /* IWYU pragma: keep */
+#include <limits.h>
+#include <stdint.h>
+#include "librsync.h"
 #include "command.h"
 #include "prototab.h"
+#include "netint.h"
 
 const struct rs_prototab_ent rs_prototab[] = {
     {RS_KIND_END, 0, 0, 0},     /* RS_OP_END = 0 */
@@ -110,29 +114,29 @@ const struct rs_prototab_ent rs_prototab[] = {
     {RS_KIND_COPY, 0, 8, 2},    /* RS_OP_COPY_N8_N2 = 0x52 */
     {RS_KIND_COPY, 0, 8, 4},    /* RS_OP_COPY_N8_N4 = 0x53 */
     {RS_KIND_COPY, 0, 8, 8},    /* RS_OP_COPY_N8_N8 = 0x54 */
-    {RS_KIND_RESERVED, 85, 0, 0},       /* RS_OP_RESERVED_85 = 0x55 */
-    {RS_KIND_RESERVED, 86, 0, 0},       /* RS_OP_RESERVED_86 = 0x56 */
-    {RS_KIND_RESERVED, 87, 0, 0},       /* RS_OP_RESERVED_87 = 0x57 */
-    {RS_KIND_RESERVED, 88, 0, 0},       /* RS_OP_RESERVED_88 = 0x58 */
-    {RS_KIND_RESERVED, 89, 0, 0},       /* RS_OP_RESERVED_89 = 0x59 */
-    {RS_KIND_RESERVED, 90, 0, 0},       /* RS_OP_RESERVED_90 = 0x5a */
-    {RS_KIND_RESERVED, 91, 0, 0},       /* RS_OP_RESERVED_91 = 0x5b */
-    {RS_KIND_RESERVED, 92, 0, 0},       /* RS_OP_RESERVED_92 = 0x5c */
-    {RS_KIND_RESERVED, 93, 0, 0},       /* RS_OP_RESERVED_93 = 0x5d */
-    {RS_KIND_RESERVED, 94, 0, 0},       /* RS_OP_RESERVED_94 = 0x5e */
-    {RS_KIND_RESERVED, 95, 0, 0},       /* RS_OP_RESERVED_95 = 0x5f */
-    {RS_KIND_RESERVED, 96, 0, 0},       /* RS_OP_RESERVED_96 = 0x60 */
-    {RS_KIND_RESERVED, 97, 0, 0},       /* RS_OP_RESERVED_97 = 0x61 */
-    {RS_KIND_RESERVED, 98, 0, 0},       /* RS_OP_RESERVED_98 = 0x62 */
-    {RS_KIND_RESERVED, 99, 0, 0},       /* RS_OP_RESERVED_99 = 0x63 */
-    {RS_KIND_RESERVED, 100, 0, 0},      /* RS_OP_RESERVED_100 = 0x64 */
-    {RS_KIND_RESERVED, 101, 0, 0},      /* RS_OP_RESERVED_101 = 0x65 */
-    {RS_KIND_RESERVED, 102, 0, 0},      /* RS_OP_RESERVED_102 = 0x66 */
-    {RS_KIND_RESERVED, 103, 0, 0},      /* RS_OP_RESERVED_103 = 0x67 */
-    {RS_KIND_RESERVED, 104, 0, 0},      /* RS_OP_RESERVED_104 = 0x68 */
-    {RS_KIND_RESERVED, 105, 0, 0},      /* RS_OP_RESERVED_105 = 0x69 */
-    {RS_KIND_RESERVED, 106, 0, 0},      /* RS_OP_RESERVED_106 = 0x6a */
-    {RS_KIND_RESERVED, 107, 0, 0},      /* RS_OP_RESERVED_107 = 0x6b */
+    {RS_KIND_CHECKSUM, 32, 0, 0},       /* RS_OP_CHECKSUM_32 = 0x55 */
+    {RS_KIND_ZLITERAL, 0, 1, 1},        /* RS_OP_ZLITERAL_N1 = 0x56 */
+    {RS_KIND_ZLITERAL, 0, 2, 2},        /* RS_OP_ZLITERAL_N2 = 0x57 */
+    {RS_KIND_ZLITERAL, 0, 4, 4},        /* RS_OP_ZLITERAL_N4 = 0x58 */
+    {RS_KIND_ZLITERAL, 0, 8, 8},        /* RS_OP_ZLITERAL_N8 = 0x59 */
+    {RS_KIND_PRIME, 0, 0, 0},   /* RS_OP_PRIME = 0x5a */
+    {RS_KIND_WINDOW, 0, 4, 0},  /* RS_OP_WINDOW_N4 = 0x5b */
+    {RS_KIND_SELF, 0, 1, 1},    /* RS_OP_SELF_N1_N1 = 0x5c */
+    {RS_KIND_SELF, 0, 1, 2},    /* RS_OP_SELF_N1_N2 = 0x5d */
+    {RS_KIND_SELF, 0, 1, 4},    /* RS_OP_SELF_N1_N4 = 0x5e */
+    {RS_KIND_SELF, 0, 1, 8},    /* RS_OP_SELF_N1_N8 = 0x5f */
+    {RS_KIND_SELF, 0, 2, 1},    /* RS_OP_SELF_N2_N1 = 0x60 */
+    {RS_KIND_SELF, 0, 2, 2},    /* RS_OP_SELF_N2_N2 = 0x61 */
+    {RS_KIND_SELF, 0, 2, 4},    /* RS_OP_SELF_N2_N4 = 0x62 */
+    {RS_KIND_SELF, 0, 2, 8},    /* RS_OP_SELF_N2_N8 = 0x63 */
+    {RS_KIND_SELF, 0, 4, 1},    /* RS_OP_SELF_N4_N1 = 0x64 */
+    {RS_KIND_SELF, 0, 4, 2},    /* RS_OP_SELF_N4_N2 = 0x65 */
+    {RS_KIND_SELF, 0, 4, 4},    /* RS_OP_SELF_N4_N4 = 0x66 */
+    {RS_KIND_SELF, 0, 4, 8},    /* RS_OP_SELF_N4_N8 = 0x67 */
+    {RS_KIND_SELF, 0, 8, 1},    /* RS_OP_SELF_N8_N1 = 0x68 */
+    {RS_KIND_SELF, 0, 8, 2},    /* RS_OP_SELF_N8_N2 = 0x69 */
+    {RS_KIND_SELF, 0, 8, 4},    /* RS_OP_SELF_N8_N4 = 0x6a */
+    {RS_KIND_SELF, 0, 8, 8},    /* RS_OP_SELF_N8_N8 = 0x6b */
     {RS_KIND_RESERVED, 108, 0, 0},      /* RS_OP_RESERVED_108 = 0x6c */
     {RS_KIND_RESERVED, 109, 0, 0},      /* RS_OP_RESERVED_109 = 0x6d */
     {RS_KIND_RESERVED, 110, 0, 0},      /* RS_OP_RESERVED_110 = 0x6e */
@@ -282,3 +286,330 @@ const struct rs_prototab_ent rs_prototab[] = {
     {RS_KIND_RESERVED, 254, 0, 0},      /* RS_OP_RESERVED_254 = 0xfe */
     {RS_KIND_RESERVED, 255, 0, 0},      /* RS_OP_RESERVED_255 = 0xff */
 };
+
+const struct rs_prototab_ent rs_prototab_v2[] = {
+    {RS_KIND_END, 0, 0, 0},     /* RS_OP_END = 0x0 */
+    {RS_KIND_LITERAL, 1, 0, 0}, /* RS_OP_LITERAL_1 = 0x1 */
+    {RS_KIND_LITERAL, 2, 0, 0}, /* RS_OP_LITERAL_2 = 0x2 */
+    {RS_KIND_LITERAL, 3, 0, 0}, /* RS_OP_LITERAL_3 = 0x3 */
+    {RS_KIND_LITERAL, 4, 0, 0}, /* RS_OP_LITERAL_4 = 0x4 */
+    {RS_KIND_LITERAL, 5, 0, 0}, /* RS_OP_LITERAL_5 = 0x5 */
+    {RS_KIND_LITERAL, 6, 0, 0}, /* RS_OP_LITERAL_6 = 0x6 */
+    {RS_KIND_LITERAL, 7, 0, 0}, /* RS_OP_LITERAL_7 = 0x7 */
+    {RS_KIND_LITERAL, 8, 0, 0}, /* RS_OP_LITERAL_8 = 0x8 */
+    {RS_KIND_LITERAL, 9, 0, 0}, /* RS_OP_LITERAL_9 = 0x9 */
+    {RS_KIND_LITERAL, 10, 0, 0},        /* RS_OP_LITERAL_10 = 0xa */
+    {RS_KIND_LITERAL, 11, 0, 0},        /* RS_OP_LITERAL_11 = 0xb */
+    {RS_KIND_LITERAL, 12, 0, 0},        /* RS_OP_LITERAL_12 = 0xc */
+    {RS_KIND_LITERAL, 13, 0, 0},        /* RS_OP_LITERAL_13 = 0xd */
+    {RS_KIND_LITERAL, 14, 0, 0},        /* RS_OP_LITERAL_14 = 0xe */
+    {RS_KIND_LITERAL, 15, 0, 0},        /* RS_OP_LITERAL_15 = 0xf */
+    {RS_KIND_LITERAL, 16, 0, 0},        /* RS_OP_LITERAL_16 = 0x10 */
+    {RS_KIND_LITERAL, 17, 0, 0},        /* RS_OP_LITERAL_17 = 0x11 */
+    {RS_KIND_LITERAL, 18, 0, 0},        /* RS_OP_LITERAL_18 = 0x12 */
+    {RS_KIND_LITERAL, 19, 0, 0},        /* RS_OP_LITERAL_19 = 0x13 */
+    {RS_KIND_LITERAL, 20, 0, 0},        /* RS_OP_LITERAL_20 = 0x14 */
+    {RS_KIND_LITERAL, 21, 0, 0},        /* RS_OP_LITERAL_21 = 0x15 */
+    {RS_KIND_LITERAL, 22, 0, 0},        /* RS_OP_LITERAL_22 = 0x16 */
+    {RS_KIND_LITERAL, 23, 0, 0},        /* RS_OP_LITERAL_23 = 0x17 */
+    {RS_KIND_LITERAL, 24, 0, 0},        /* RS_OP_LITERAL_24 = 0x18 */
+    {RS_KIND_LITERAL, 25, 0, 0},        /* RS_OP_LITERAL_25 = 0x19 */
+    {RS_KIND_LITERAL, 26, 0, 0},        /* RS_OP_LITERAL_26 = 0x1a */
+    {RS_KIND_LITERAL, 27, 0, 0},        /* RS_OP_LITERAL_27 = 0x1b */
+    {RS_KIND_LITERAL, 28, 0, 0},        /* RS_OP_LITERAL_28 = 0x1c */
+    {RS_KIND_LITERAL, 29, 0, 0},        /* RS_OP_LITERAL_29 = 0x1d */
+    {RS_KIND_LITERAL, 30, 0, 0},        /* RS_OP_LITERAL_30 = 0x1e */
+    {RS_KIND_LITERAL, 31, 0, 0},        /* RS_OP_LITERAL_31 = 0x1f */
+    {RS_KIND_LITERAL, 32, 0, 0},        /* RS_OP_LITERAL_32 = 0x20 */
+    {RS_KIND_LITERAL, 33, 0, 0},        /* RS_OP_LITERAL_33 = 0x21 */
+    {RS_KIND_LITERAL, 34, 0, 0},        /* RS_OP_LITERAL_34 = 0x22 */
+    {RS_KIND_LITERAL, 35, 0, 0},        /* RS_OP_LITERAL_35 = 0x23 */
+    {RS_KIND_LITERAL, 36, 0, 0},        /* RS_OP_LITERAL_36 = 0x24 */
+    {RS_KIND_LITERAL, 37, 0, 0},        /* RS_OP_LITERAL_37 = 0x25 */
+    {RS_KIND_LITERAL, 38, 0, 0},        /* RS_OP_LITERAL_38 = 0x26 */
+    {RS_KIND_LITERAL, 39, 0, 0},        /* RS_OP_LITERAL_39 = 0x27 */
+    {RS_KIND_LITERAL, 40, 0, 0},        /* RS_OP_LITERAL_40 = 0x28 */
+    {RS_KIND_LITERAL, 41, 0, 0},        /* RS_OP_LITERAL_41 = 0x29 */
+    {RS_KIND_LITERAL, 42, 0, 0},        /* RS_OP_LITERAL_42 = 0x2a */
+    {RS_KIND_LITERAL, 43, 0, 0},        /* RS_OP_LITERAL_43 = 0x2b */
+    {RS_KIND_LITERAL, 44, 0, 0},        /* RS_OP_LITERAL_44 = 0x2c */
+    {RS_KIND_LITERAL, 45, 0, 0},        /* RS_OP_LITERAL_45 = 0x2d */
+    {RS_KIND_LITERAL, 46, 0, 0},        /* RS_OP_LITERAL_46 = 0x2e */
+    {RS_KIND_LITERAL, 47, 0, 0},        /* RS_OP_LITERAL_47 = 0x2f */
+    {RS_KIND_LITERAL, 48, 0, 0},        /* RS_OP_LITERAL_48 = 0x30 */
+    {RS_KIND_LITERAL, 49, 0, 0},        /* RS_OP_LITERAL_49 = 0x31 */
+    {RS_KIND_LITERAL, 50, 0, 0},        /* RS_OP_LITERAL_50 = 0x32 */
+    {RS_KIND_LITERAL, 51, 0, 0},        /* RS_OP_LITERAL_51 = 0x33 */
+    {RS_KIND_LITERAL, 52, 0, 0},        /* RS_OP_LITERAL_52 = 0x34 */
+    {RS_KIND_LITERAL, 53, 0, 0},        /* RS_OP_LITERAL_53 = 0x35 */
+    {RS_KIND_LITERAL, 54, 0, 0},        /* RS_OP_LITERAL_54 = 0x36 */
+    {RS_KIND_LITERAL, 55, 0, 0},        /* RS_OP_LITERAL_55 = 0x37 */
+    {RS_KIND_LITERAL, 56, 0, 0},        /* RS_OP_LITERAL_56 = 0x38 */
+    {RS_KIND_LITERAL, 57, 0, 0},        /* RS_OP_LITERAL_57 = 0x39 */
+    {RS_KIND_LITERAL, 58, 0, 0},        /* RS_OP_LITERAL_58 = 0x3a */
+    {RS_KIND_LITERAL, 59, 0, 0},        /* RS_OP_LITERAL_59 = 0x3b */
+    {RS_KIND_LITERAL, 60, 0, 0},        /* RS_OP_LITERAL_60 = 0x3c */
+    {RS_KIND_LITERAL, 61, 0, 0},        /* RS_OP_LITERAL_61 = 0x3d */
+    {RS_KIND_LITERAL, 62, 0, 0},        /* RS_OP_LITERAL_62 = 0x3e */
+    {RS_KIND_LITERAL, 63, 0, 0},        /* RS_OP_LITERAL_63 = 0x3f */
+    {RS_KIND_LITERAL, 64, 0, 0},        /* RS_OP_LITERAL_64 = 0x40 */
+    {RS_KIND_LITERAL, 0, RS_VARINT, 0}, /* RS_OP_V2_LITERAL_V = 0x41 */
+    {RS_KIND_COPY, 0, RS_VARINT, RS_VARINT},    /* RS_OP_V2_COPY_V_V = 0x42 */
+    {RS_KIND_COPY, 0, 0, RS_VARINT},    /* RS_OP_V2_COPY_NEXT_V = 0x43 */
+    {RS_KIND_ZLITERAL, 0, RS_VARINT, RS_VARINT},        /* RS_OP_V2_ZLITERAL_V_V = 0x44 */
+    {RS_KIND_PRIME, 0, 0, 0},   /* RS_OP_V2_PRIME = 0x45 */
+    {RS_KIND_WINDOW, 0, RS_VARINT, 0},  /* RS_OP_V2_WINDOW_V = 0x46 */
+    {RS_KIND_SELF, 0, RS_VARINT, RS_VARINT},    /* RS_OP_V2_SELF_V_V = 0x47 */
+    {RS_KIND_CHECKSUM, 32, 0, 0},       /* RS_OP_V2_CHECKSUM_32 = 0x48 */
+    {RS_KIND_BLOCK, 0, RS_VARINT, 0},   /* RS_OP_V2_BLOCK_V = 0x49 */
+    {RS_KIND_RESERVED, 74, 0, 0},       /* RS_OP_V2_RESERVED_74 = 0x4a */
+    {RS_KIND_RESERVED, 75, 0, 0},       /* RS_OP_V2_RESERVED_75 = 0x4b */
+    {RS_KIND_RESERVED, 76, 0, 0},       /* RS_OP_V2_RESERVED_76 = 0x4c */
+    {RS_KIND_RESERVED, 77, 0, 0},       /* RS_OP_V2_RESERVED_77 = 0x4d */
+    {RS_KIND_RESERVED, 78, 0, 0},       /* RS_OP_V2_RESERVED_78 = 0x4e */
+    {RS_KIND_RESERVED, 79, 0, 0},       /* RS_OP_V2_RESERVED_79 = 0x4f */
+    {RS_KIND_RESERVED, 80, 0, 0},       /* RS_OP_V2_RESERVED_80 = 0x50 */
+    {RS_KIND_RESERVED, 81, 0, 0},       /* RS_OP_V2_RESERVED_81 = 0x51 */
+    {RS_KIND_RESERVED, 82, 0, 0},       /* RS_OP_V2_RESERVED_82 = 0x52 */
+    {RS_KIND_RESERVED, 83, 0, 0},       /* RS_OP_V2_RESERVED_83 = 0x53 */
+    {RS_KIND_RESERVED, 84, 0, 0},       /* RS_OP_V2_RESERVED_84 = 0x54 */
+    {RS_KIND_RESERVED, 85, 0, 0},       /* RS_OP_V2_RESERVED_85 = 0x55 */
+    {RS_KIND_RESERVED, 86, 0, 0},       /* RS_OP_V2_RESERVED_86 = 0x56 */
+    {RS_KIND_RESERVED, 87, 0, 0},       /* RS_OP_V2_RESERVED_87 = 0x57 */
+    {RS_KIND_RESERVED, 88, 0, 0},       /* RS_OP_V2_RESERVED_88 = 0x58 */
+    {RS_KIND_RESERVED, 89, 0, 0},       /* RS_OP_V2_RESERVED_89 = 0x59 */
+    {RS_KIND_RESERVED, 90, 0, 0},       /* RS_OP_V2_RESERVED_90 = 0x5a */
+    {RS_KIND_RESERVED, 91, 0, 0},       /* RS_OP_V2_RESERVED_91 = 0x5b */
+    {RS_KIND_RESERVED, 92, 0, 0},       /* RS_OP_V2_RESERVED_92 = 0x5c */
+    {RS_KIND_RESERVED, 93, 0, 0},       /* RS_OP_V2_RESERVED_93 = 0x5d */
+    {RS_KIND_RESERVED, 94, 0, 0},       /* RS_OP_V2_RESERVED_94 = 0x5e */
+    {RS_KIND_RESERVED, 95, 0, 0},       /* RS_OP_V2_RESERVED_95 = 0x5f */
+    {RS_KIND_RESERVED, 96, 0, 0},       /* RS_OP_V2_RESERVED_96 = 0x60 */
+    {RS_KIND_RESERVED, 97, 0, 0},       /* RS_OP_V2_RESERVED_97 = 0x61 */
+    {RS_KIND_RESERVED, 98, 0, 0},       /* RS_OP_V2_RESERVED_98 = 0x62 */
+    {RS_KIND_RESERVED, 99, 0, 0},       /* RS_OP_V2_RESERVED_99 = 0x63 */
+    {RS_KIND_RESERVED, 100, 0, 0},      /* RS_OP_V2_RESERVED_100 = 0x64 */
+    {RS_KIND_RESERVED, 101, 0, 0},      /* RS_OP_V2_RESERVED_101 = 0x65 */
+    {RS_KIND_RESERVED, 102, 0, 0},      /* RS_OP_V2_RESERVED_102 = 0x66 */
+    {RS_KIND_RESERVED, 103, 0, 0},      /* RS_OP_V2_RESERVED_103 = 0x67 */
+    {RS_KIND_RESERVED, 104, 0, 0},      /* RS_OP_V2_RESERVED_104 = 0x68 */
+    {RS_KIND_RESERVED, 105, 0, 0},      /* RS_OP_V2_RESERVED_105 = 0x69 */
+    {RS_KIND_RESERVED, 106, 0, 0},      /* RS_OP_V2_RESERVED_106 = 0x6a */
+    {RS_KIND_RESERVED, 107, 0, 0},      /* RS_OP_V2_RESERVED_107 = 0x6b */
+    {RS_KIND_RESERVED, 108, 0, 0},      /* RS_OP_V2_RESERVED_108 = 0x6c */
+    {RS_KIND_RESERVED, 109, 0, 0},      /* RS_OP_V2_RESERVED_109 = 0x6d */
+    {RS_KIND_RESERVED, 110, 0, 0},      /* RS_OP_V2_RESERVED_110 = 0x6e */
+    {RS_KIND_RESERVED, 111, 0, 0},      /* RS_OP_V2_RESERVED_111 = 0x6f */
+    {RS_KIND_RESERVED, 112, 0, 0},      /* RS_OP_V2_RESERVED_112 = 0x70 */
+    {RS_KIND_RESERVED, 113, 0, 0},      /* RS_OP_V2_RESERVED_113 = 0x71 */
+    {RS_KIND_RESERVED, 114, 0, 0},      /* RS_OP_V2_RESERVED_114 = 0x72 */
+    {RS_KIND_RESERVED, 115, 0, 0},      /* RS_OP_V2_RESERVED_115 = 0x73 */
+    {RS_KIND_RESERVED, 116, 0, 0},      /* RS_OP_V2_RESERVED_116 = 0x74 */
+    {RS_KIND_RESERVED, 117, 0, 0},      /* RS_OP_V2_RESERVED_117 = 0x75 */
+    {RS_KIND_RESERVED, 118, 0, 0},      /* RS_OP_V2_RESERVED_118 = 0x76 */
+    {RS_KIND_RESERVED, 119, 0, 0},      /* RS_OP_V2_RESERVED_119 = 0x77 */
+    {RS_KIND_RESERVED, 120, 0, 0},      /* RS_OP_V2_RESERVED_120 = 0x78 */
+    {RS_KIND_RESERVED, 121, 0, 0},      /* RS_OP_V2_RESERVED_121 = 0x79 */
+    {RS_KIND_RESERVED, 122, 0, 0},      /* RS_OP_V2_RESERVED_122 = 0x7a */
+    {RS_KIND_RESERVED, 123, 0, 0},      /* RS_OP_V2_RESERVED_123 = 0x7b */
+    {RS_KIND_RESERVED, 124, 0, 0},      /* RS_OP_V2_RESERVED_124 = 0x7c */
+    {RS_KIND_RESERVED, 125, 0, 0},      /* RS_OP_V2_RESERVED_125 = 0x7d */
+    {RS_KIND_RESERVED, 126, 0, 0},      /* RS_OP_V2_RESERVED_126 = 0x7e */
+    {RS_KIND_RESERVED, 127, 0, 0},      /* RS_OP_V2_RESERVED_127 = 0x7f */
+    {RS_KIND_COPY, 1, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_1 = 0x80 */
+    {RS_KIND_COPY, 2, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_2 = 0x81 */
+    {RS_KIND_COPY, 3, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_3 = 0x82 */
+    {RS_KIND_COPY, 4, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_4 = 0x83 */
+    {RS_KIND_COPY, 5, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_5 = 0x84 */
+    {RS_KIND_COPY, 6, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_6 = 0x85 */
+    {RS_KIND_COPY, 7, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_7 = 0x86 */
+    {RS_KIND_COPY, 8, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_8 = 0x87 */
+    {RS_KIND_COPY, 9, 0, 0},    /* RS_OP_V2_COPY_BLOCKS_9 = 0x88 */
+    {RS_KIND_COPY, 10, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_10 = 0x89 */
+    {RS_KIND_COPY, 11, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_11 = 0x8a */
+    {RS_KIND_COPY, 12, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_12 = 0x8b */
+    {RS_KIND_COPY, 13, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_13 = 0x8c */
+    {RS_KIND_COPY, 14, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_14 = 0x8d */
+    {RS_KIND_COPY, 15, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_15 = 0x8e */
+    {RS_KIND_COPY, 16, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_16 = 0x8f */
+    {RS_KIND_COPY, 17, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_17 = 0x90 */
+    {RS_KIND_COPY, 18, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_18 = 0x91 */
+    {RS_KIND_COPY, 19, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_19 = 0x92 */
+    {RS_KIND_COPY, 20, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_20 = 0x93 */
+    {RS_KIND_COPY, 21, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_21 = 0x94 */
+    {RS_KIND_COPY, 22, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_22 = 0x95 */
+    {RS_KIND_COPY, 23, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_23 = 0x96 */
+    {RS_KIND_COPY, 24, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_24 = 0x97 */
+    {RS_KIND_COPY, 25, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_25 = 0x98 */
+    {RS_KIND_COPY, 26, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_26 = 0x99 */
+    {RS_KIND_COPY, 27, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_27 = 0x9a */
+    {RS_KIND_COPY, 28, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_28 = 0x9b */
+    {RS_KIND_COPY, 29, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_29 = 0x9c */
+    {RS_KIND_COPY, 30, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_30 = 0x9d */
+    {RS_KIND_COPY, 31, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_31 = 0x9e */
+    {RS_KIND_COPY, 32, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_32 = 0x9f */
+    {RS_KIND_COPY, 33, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_33 = 0xa0 */
+    {RS_KIND_COPY, 34, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_34 = 0xa1 */
+    {RS_KIND_COPY, 35, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_35 = 0xa2 */
+    {RS_KIND_COPY, 36, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_36 = 0xa3 */
+    {RS_KIND_COPY, 37, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_37 = 0xa4 */
+    {RS_KIND_COPY, 38, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_38 = 0xa5 */
+    {RS_KIND_COPY, 39, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_39 = 0xa6 */
+    {RS_KIND_COPY, 40, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_40 = 0xa7 */
+    {RS_KIND_COPY, 41, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_41 = 0xa8 */
+    {RS_KIND_COPY, 42, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_42 = 0xa9 */
+    {RS_KIND_COPY, 43, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_43 = 0xaa */
+    {RS_KIND_COPY, 44, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_44 = 0xab */
+    {RS_KIND_COPY, 45, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_45 = 0xac */
+    {RS_KIND_COPY, 46, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_46 = 0xad */
+    {RS_KIND_COPY, 47, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_47 = 0xae */
+    {RS_KIND_COPY, 48, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_48 = 0xaf */
+    {RS_KIND_COPY, 49, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_49 = 0xb0 */
+    {RS_KIND_COPY, 50, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_50 = 0xb1 */
+    {RS_KIND_COPY, 51, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_51 = 0xb2 */
+    {RS_KIND_COPY, 52, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_52 = 0xb3 */
+    {RS_KIND_COPY, 53, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_53 = 0xb4 */
+    {RS_KIND_COPY, 54, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_54 = 0xb5 */
+    {RS_KIND_COPY, 55, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_55 = 0xb6 */
+    {RS_KIND_COPY, 56, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_56 = 0xb7 */
+    {RS_KIND_COPY, 57, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_57 = 0xb8 */
+    {RS_KIND_COPY, 58, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_58 = 0xb9 */
+    {RS_KIND_COPY, 59, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_59 = 0xba */
+    {RS_KIND_COPY, 60, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_60 = 0xbb */
+    {RS_KIND_COPY, 61, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_61 = 0xbc */
+    {RS_KIND_COPY, 62, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_62 = 0xbd */
+    {RS_KIND_COPY, 63, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_63 = 0xbe */
+    {RS_KIND_COPY, 64, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_64 = 0xbf */
+    {RS_KIND_COPY, 65, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_65 = 0xc0 */
+    {RS_KIND_COPY, 66, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_66 = 0xc1 */
+    {RS_KIND_COPY, 67, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_67 = 0xc2 */
+    {RS_KIND_COPY, 68, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_68 = 0xc3 */
+    {RS_KIND_COPY, 69, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_69 = 0xc4 */
+    {RS_KIND_COPY, 70, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_70 = 0xc5 */
+    {RS_KIND_COPY, 71, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_71 = 0xc6 */
+    {RS_KIND_COPY, 72, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_72 = 0xc7 */
+    {RS_KIND_COPY, 73, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_73 = 0xc8 */
+    {RS_KIND_COPY, 74, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_74 = 0xc9 */
+    {RS_KIND_COPY, 75, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_75 = 0xca */
+    {RS_KIND_COPY, 76, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_76 = 0xcb */
+    {RS_KIND_COPY, 77, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_77 = 0xcc */
+    {RS_KIND_COPY, 78, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_78 = 0xcd */
+    {RS_KIND_COPY, 79, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_79 = 0xce */
+    {RS_KIND_COPY, 80, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_80 = 0xcf */
+    {RS_KIND_COPY, 81, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_81 = 0xd0 */
+    {RS_KIND_COPY, 82, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_82 = 0xd1 */
+    {RS_KIND_COPY, 83, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_83 = 0xd2 */
+    {RS_KIND_COPY, 84, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_84 = 0xd3 */
+    {RS_KIND_COPY, 85, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_85 = 0xd4 */
+    {RS_KIND_COPY, 86, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_86 = 0xd5 */
+    {RS_KIND_COPY, 87, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_87 = 0xd6 */
+    {RS_KIND_COPY, 88, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_88 = 0xd7 */
+    {RS_KIND_COPY, 89, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_89 = 0xd8 */
+    {RS_KIND_COPY, 90, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_90 = 0xd9 */
+    {RS_KIND_COPY, 91, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_91 = 0xda */
+    {RS_KIND_COPY, 92, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_92 = 0xdb */
+    {RS_KIND_COPY, 93, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_93 = 0xdc */
+    {RS_KIND_COPY, 94, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_94 = 0xdd */
+    {RS_KIND_COPY, 95, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_95 = 0xde */
+    {RS_KIND_COPY, 96, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_96 = 0xdf */
+    {RS_KIND_COPY, 97, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_97 = 0xe0 */
+    {RS_KIND_COPY, 98, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_98 = 0xe1 */
+    {RS_KIND_COPY, 99, 0, 0},   /* RS_OP_V2_COPY_BLOCKS_99 = 0xe2 */
+    {RS_KIND_COPY, 100, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_100 = 0xe3 */
+    {RS_KIND_COPY, 101, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_101 = 0xe4 */
+    {RS_KIND_COPY, 102, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_102 = 0xe5 */
+    {RS_KIND_COPY, 103, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_103 = 0xe6 */
+    {RS_KIND_COPY, 104, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_104 = 0xe7 */
+    {RS_KIND_COPY, 105, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_105 = 0xe8 */
+    {RS_KIND_COPY, 106, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_106 = 0xe9 */
+    {RS_KIND_COPY, 107, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_107 = 0xea */
+    {RS_KIND_COPY, 108, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_108 = 0xeb */
+    {RS_KIND_COPY, 109, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_109 = 0xec */
+    {RS_KIND_COPY, 110, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_110 = 0xed */
+    {RS_KIND_COPY, 111, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_111 = 0xee */
+    {RS_KIND_COPY, 112, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_112 = 0xef */
+    {RS_KIND_COPY, 113, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_113 = 0xf0 */
+    {RS_KIND_COPY, 114, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_114 = 0xf1 */
+    {RS_KIND_COPY, 115, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_115 = 0xf2 */
+    {RS_KIND_COPY, 116, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_116 = 0xf3 */
+    {RS_KIND_COPY, 117, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_117 = 0xf4 */
+    {RS_KIND_COPY, 118, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_118 = 0xf5 */
+    {RS_KIND_COPY, 119, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_119 = 0xf6 */
+    {RS_KIND_COPY, 120, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_120 = 0xf7 */
+    {RS_KIND_COPY, 121, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_121 = 0xf8 */
+    {RS_KIND_COPY, 122, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_122 = 0xf9 */
+    {RS_KIND_COPY, 123, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_123 = 0xfa */
+    {RS_KIND_COPY, 124, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_124 = 0xfb */
+    {RS_KIND_COPY, 125, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_125 = 0xfc */
+    {RS_KIND_COPY, 126, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_126 = 0xfd */
+    {RS_KIND_COPY, 127, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_127 = 0xfe */
+    {RS_KIND_COPY, 128, 0, 0},  /* RS_OP_V2_COPY_BLOCKS_128 = 0xff */
+};
+
+int rs_delta_format_init(rs_delta_format_t *f, int magic, int *checksum)
+{
+    f->compact = magic == RS_DELTA_V2_MAGIC
+        || magic == RS_DELTA_V2_BLAKE2_MAGIC;
+    if (!f->compact && magic != RS_DELTA_MAGIC
+        && magic != RS_DELTA_BLAKE2_MAGIC)
+        return 0;
+    f->table = f->compact ? rs_prototab_v2 : rs_prototab;
+    f->block_len = 0;
+    f->copy_next = 0;
+    *checksum = magic == RS_DELTA_BLAKE2_MAGIC
+        || magic == RS_DELTA_V2_BLAKE2_MAGIC;
+    return 1;
+}
+
+/** Decode a parameter of a command at p[0..len], returning its length like
+ * rs_delta_format_decode(). */
+static int rs_delta_format_param(rs_byte_t const *p, size_t len, int param_len,
+                                 rs_long_t *val)
+{
+    if (param_len == RS_VARINT)
+        return rs_varint_get(p, len, val);
+    if (len < (size_t)param_len)
+        return 0;
+    *val = rs_get_netint(p, param_len);
+    return param_len;
+}
+
+int rs_delta_format_decode(rs_delta_format_t *f, rs_byte_t const *p,
+                           size_t len, rs_prototab_ent_t const **cmd,
+                           rs_long_t *param1, rs_long_t *param2)
+{
+    rs_prototab_ent_t const *e;
+    size_t n = 1;
+    int k;
+
+    if (!len)
+        return 0;
+    e = &f->table[*p];
+    *param1 = e->immediate;
+    *param2 = 0;
+    if (e->len_1) {
+        if ((k = rs_delta_format_param(p + n, len - n, e->len_1, param1)) <= 0)
+            return k;
+        n += (size_t)k;
+    }
+    if (e->len_2) {
+        if ((k = rs_delta_format_param(p + n, len - n, e->len_2, param2)) <= 0)
+            return k;
+        n += (size_t)k;
+    }
+    if (f->compact && e->kind == RS_KIND_COPY) {
+        /* Without a length it's a short COPY of immediate blocks. */
+        if (!e->len_2)
+            *param2 = *param1 * f->block_len;
+        /* Without a position it's at the end of the last COPY. */
+        *param1 = (rs_long_t)((uint64_t)f->copy_next +
+                              (uint64_t)(e->len_1 ? rs_unzigzag(*param1) : 0));
+        f->copy_next = (rs_long_t)((uint64_t)*param1 + (uint64_t)*param2);
+    } else if (e->kind == RS_KIND_BLOCK) {
+        if (*param1 <= 0 || *param1 > INT_MAX)
+            return -1;
+        f->block_len = *param1;
+    }
+    *cmd = e;
+    return (int)n;
+}
@@ -33,11 +33,25 @@
  *
  * This file defines an array mapping command IDs to the operation kind,
  * implied literal value, and length of the first and second parameters. The
- * implied value is only used if the first parameter length is zero. */
+ * implied value is only used if the first parameter length is zero.
+ *
+ * Compact deltas have their own array, where the parameters are varints.
+ * Their COPY positions are relative to the end of the last COPY, and there
+ * are short COPYs of whole blocks at the end of the last COPY, with the
+ * number of blocks as the implied value. Commands are decoded with
+ * rs_delta_format_decode(), which handles both. */
 #ifndef PROTOTAB_H
 #  define PROTOTAB_H
 
+#  include <stddef.h>
 #  include "command.h"
+#  include "librsync.h"
+
+/** The parameter length of a varint parameter. */
+#  define RS_VARINT (-1)
+
+/** The max length of a command with its parameters. */
+#  define RS_MAX_CMD_LEN 19
 
 typedef struct rs_prototab_ent {
     enum rs_op_kind kind;
@@ -47,6 +61,34 @@ typedef struct rs_prototab_ent {
 
 extern const rs_prototab_ent_t rs_prototab[];
 
+/** The commands of compact deltas. */
+extern const rs_prototab_ent_t rs_prototab_v2[];
+
+/** The format of a delta's commands, with the state to read or write
+ * them. */
+typedef struct rs_delta_format {
+    rs_prototab_ent_t const *table;
+    int compact;                /**< Whether it's a compact delta. */
+    rs_long_t block_len;        /**< The length of short COPY blocks. */
+    rs_long_t copy_next;        /**< The basis offset after the last COPY. */
+} rs_delta_format_t;
+
+/** Start the format for a delta magic.
+ *
+ * \return 0 if it's not a delta magic. */
+int rs_delta_format_init(rs_delta_format_t *f, int magic, int *checksum);
+
+/** Decode the command at p[0..len].
+ *
+ * COPY positions are made absolute. A COPY with a bad position or length
+ * gets a negative position or length, which the caller must check.
+ *
+ * \return The length of the command with its parameters, 0 if it doesn't
+ * end within len bytes, or -1 if its parameters are bad. */
+int rs_delta_format_decode(rs_delta_format_t *f, rs_byte_t const *p,
+                           size_t len, rs_prototab_ent_t const **cmd,
+                           rs_long_t *param1, rs_long_t *param2);
+
 enum {
     RS_OP_END = 0,
     RS_OP_LITERAL_1 = 0x1,
@@ -133,29 +175,29 @@ enum {
     RS_OP_COPY_N8_N2 = 0x52,
     RS_OP_COPY_N8_N4 = 0x53,
     RS_OP_COPY_N8_N8 = 0x54,
-    RS_OP_RESERVED_85 = 0x55,
-    RS_OP_RESERVED_86 = 0x56,
-    RS_OP_RESERVED_87 = 0x57,
-    RS_OP_RESERVED_88 = 0x58,
-    RS_OP_RESERVED_89 = 0x59,
-    RS_OP_RESERVED_90 = 0x5a,
-    RS_OP_RESERVED_91 = 0x5b,
-    RS_OP_RESERVED_92 = 0x5c,
-    RS_OP_RESERVED_93 = 0x5d,
-    RS_OP_RESERVED_94 = 0x5e,
-    RS_OP_RESERVED_95 = 0x5f,
-    RS_OP_RESERVED_96 = 0x60,
-    RS_OP_RESERVED_97 = 0x61,
-    RS_OP_RESERVED_98 = 0x62,
-    RS_OP_RESERVED_99 = 0x63,
-    RS_OP_RESERVED_100 = 0x64,
-    RS_OP_RESERVED_101 = 0x65,
-    RS_OP_RESERVED_102 = 0x66,
-    RS_OP_RESERVED_103 = 0x67,
-    RS_OP_RESERVED_104 = 0x68,
-    RS_OP_RESERVED_105 = 0x69,
-    RS_OP_RESERVED_106 = 0x6a,
-    RS_OP_RESERVED_107 = 0x6b,
+    RS_OP_CHECKSUM_32 = 0x55,
+    RS_OP_ZLITERAL_N1 = 0x56,
+    RS_OP_ZLITERAL_N2 = 0x57,
+    RS_OP_ZLITERAL_N4 = 0x58,
+    RS_OP_ZLITERAL_N8 = 0x59,
+    RS_OP_PRIME = 0x5a,
+    RS_OP_WINDOW_N4 = 0x5b,
+    RS_OP_SELF_N1_N1 = 0x5c,
+    RS_OP_SELF_N1_N2 = 0x5d,
+    RS_OP_SELF_N1_N4 = 0x5e,
+    RS_OP_SELF_N1_N8 = 0x5f,
+    RS_OP_SELF_N2_N1 = 0x60,
+    RS_OP_SELF_N2_N2 = 0x61,
+    RS_OP_SELF_N2_N4 = 0x62,
+    RS_OP_SELF_N2_N8 = 0x63,
+    RS_OP_SELF_N4_N1 = 0x64,
+    RS_OP_SELF_N4_N2 = 0x65,
+    RS_OP_SELF_N4_N4 = 0x66,
+    RS_OP_SELF_N4_N8 = 0x67,
+    RS_OP_SELF_N8_N1 = 0x68,
+    RS_OP_SELF_N8_N2 = 0x69,
+    RS_OP_SELF_N8_N4 = 0x6a,
+    RS_OP_SELF_N8_N8 = 0x6b,
     RS_OP_RESERVED_108 = 0x6c,
     RS_OP_RESERVED_109 = 0x6d,
     RS_OP_RESERVED_110 = 0x6e,
@@ -306,4 +348,19 @@ enum {
     RS_OP_RESERVED_255 = 0xff
 };
 
+/** The commands of compact deltas that differ from rs_prototab. */
+enum {
+    RS_OP_V2_LITERAL_V = 0x41,
+    RS_OP_V2_COPY_V_V = 0x42,
+    RS_OP_V2_COPY_NEXT_V = 0x43,
+    RS_OP_V2_ZLITERAL_V_V = 0x44,
+    RS_OP_V2_PRIME = 0x45,
+    RS_OP_V2_WINDOW_V = 0x46,
+    RS_OP_V2_SELF_V_V = 0x47,
+    RS_OP_V2_CHECKSUM_32 = 0x48,
+    RS_OP_V2_BLOCK_V = 0x49,
+    RS_OP_V2_COPY_BLOCKS_1 = 0x80,
+    RS_OP_V2_COPY_BLOCKS_128 = 0xff
+};
+
 #endif                          /* !PROTOTAB_H */
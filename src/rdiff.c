@@ -29,9 +29,8 @@
 /** \file rdiff.c
  * Command-line network-delta tool.
  *
- * \todo Add a -z option to gzip/gunzip patches. This would be somewhat useful,
- * but more importantly a good test of the streaming API. Also add -I for
- * bzip2.
+ * \todo Add -i for bzip2 compression of the literal data in deltas, like -z
+ * does with zlib.
  *
  * \todo If built with debug support and we have mcheck, then turn it on.
  * (Optionally?)
@@ -60,6 +59,16 @@ static int show_stats = 0;
 static int bzip2_level = 0;
 static int gzip_level = 0;
 static int file_force = 0;
+static int patch_threads = 0;
+static int in_place = 0;
+static int delta_checksum = 0;
+static int self_window = 0;
+static int delta_compact = 0;
+static int no_prime = 0;
+static int sig_append = 0;
+static int sig_digest = 0;
+static int sig_cdc = 0;
+static char *new_sig_name = NULL;
 
 enum {
     OPT_GZIP = 1069, OPT_BZIP2
@@ -98,7 +107,16 @@ static void help(void)
 {
     printf("Usage: rdiff [OPTIONS] signature [BASIS [SIGNATURE]]\n"
            "             [OPTIONS] delta SIGNATURE [NEWFILE [DELTA]]\n"
-           "             [OPTIONS] patch BASIS [DELTA [NEWFILE]]\n" "\n"
+           "             [OPTIONS] patch BASIS [DELTA [NEWFILE]]\n"
+           "             [OPTIONS] --in-place patch BASIS [DELTA]\n"
+           "             [OPTIONS] merge DELTA1 DELTA2 [MERGED]\n"
+           "             [OPTIONS] chain BASIS NEWFILE DELTA...\n"
+           "             [OPTIONS] index DELTA [INDEX]\n"
+           "             [OPTIONS] range BASIS DELTA INDEX OFFSET LENGTH [NEWFILE]\n"
+           "             [OPTIONS] newsig SIGNATURE BASIS DELTA [NEWSIG]\n"
+           "             [OPTIONS] sigrange BASIS OFFSET LENGTH [RANGESIG]\n"
+           "             [OPTIONS] sigmerge SIGNATURE RANGESIG...\n"
+           "\n"
            "Options:\n"
            "  -v, --verbose             Trace internal processing\n"
            "  -V, --version             Show program version\n"
@@ -107,13 +125,28 @@ static void help(void)
            "  -f, --force               Force overwriting existing files\n"
            "Signature generation options:\n"
            "  -H, --hash=ALG            Hash algorithm: blake2 (default), md4\n"
-           "  -R, --rollsum=ALG         Rollsum algorithm: rabinkarp (default), rollsum\n"
+           "  -R, --rollsum=ALG         Rollsum algorithm: rabinkarp (default), rollsum,\n"
+           "                            buzhash\n"
+           "      --append              Update SIGNATURE for data appended to BASIS\n"
+           "      --digest              Add a digest of BASIS to find unchanged files\n"
+           "      --cdc                 Sign content defined chunks averaging block size\n"
            "Delta-encoding options:\n"
            "  -b, --block-size=BYTES    Signature block size, 0 (default) for recommended\n"
            "  -S, --sum-size=BYTES      Signature strength, 0 (default) for max, -1 for min\n"
+           "  -c, --checksum            Add a checksum of the new file to check patches\n"
+           "      --in-place            Make a delta that can be applied in place\n"
+           "  -w, --window=BYTES        Copy data repeated up to BYTES back in the new file\n"
+           "      --compact             Use the compact delta format\n"
+           "      --signature=SIG       Also write the signature of NEWFILE to SIG\n"
+           "Patch options:\n"
+           "  -j, --threads=N           Apply the patch with N threads\n"
+           "      --in-place            Patch BASIS in place, journaled in BASIS.journal\n"
+           "      --signature=SIG       Also write the signature of NEWFILE to SIG\n"
            "IO options:\n" "  -I, --input-size=BYTES    Input buffer size\n"
            "  -O, --output-size=BYTES   Output buffer size\n"
-           "  -z, --gzip[=LEVEL]        gzip-compress deltas\n"
+           "  -z, --gzip[=LEVEL]        Compress literal data in deltas with zlib\n"
+           "      --no-prime            Don't prime compressed literal data with the\n"
+           "                            new file, so the delta can be a merge DELTA1\n"
            "  -i, --bzip2[=LEVEL]       bzip2-compress deltas\n");
 }
 
@@ -121,13 +154,13 @@ static void rdiff_show_version(void)
 {
     char const *bzlib = "", *zlib = "", *trace = "";
 
-#if 0
-    /* Compression isn't implemented so don't mention it. */
-#  ifdef HAVE_LIBZ
+#ifdef HAVE_ZLIB_H
     zlib = ", gzip";
-#  endif
+#endif
 
-#  ifdef HAVE_LIBBZ2
+#if 0
+    /* bzip2 compression isn't implemented so don't mention it. */
+#  ifdef HAVE_BZLIB_H
     bzlib = ", bzip2";
 #  endif
 #endif
@@ -181,6 +214,10 @@ static void rdiff_options(poptContext opcon)
                 else
                     bzip2_level = 9;    /* demand the best */
             }
+#ifdef HAVE_ZLIB_H
+            if (c == OPT_GZIP)
+                break;
+#endif
             rdiff_usage("Sorry, compression is not implemented yet.");
             exit(RS_UNIMPLEMENTED);
 
@@ -190,19 +227,11 @@ static void rdiff_options(poptContext opcon)
     }
 }
 
-/** Generate signature from remaining command line arguments. */
-static rs_result rdiff_sig(poptContext opcon)
+/** Get the signature magic for the --hash and --rollsum options. */
+static rs_magic_number rdiff_sig_magic(void)
 {
-    FILE *basis_file, *sig_file;
-    rs_stats_t stats;
-    rs_result result;
     rs_magic_number sig_magic;
 
-    basis_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
-    sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
-
-    rdiff_no_more_args(opcon);
-
     if (!rs_hash_name || !strcmp(rs_hash_name, "blake2")) {
         sig_magic = RS_BLAKE2_SIG_MAGIC;
     } else if (!strcmp(rs_hash_name, "md4")) {
@@ -214,14 +243,48 @@ static rs_result rdiff_sig(poptContext opcon)
     if (!rs_rollsum_name || !strcmp(rs_rollsum_name, "rabinkarp")) {
         /* The RabinKarp magics are 0x10 greater than the rollsum magics. */
         sig_magic += 0x10;
+    } else if (!strcmp(rs_rollsum_name, "buzhash")) {
+        /* The buzhash magics are 0x20 greater than the rollsum magics. */
+        sig_magic += 0x20;
     } else if (strcmp(rs_rollsum_name, "rollsum")) {
         rdiff_usage("Unknown rollsum algorithm '%s'.", rs_rollsum_name);
         exit(RS_SYNTAX_ERROR);
     }
+    return sig_magic;
+}
 
-    result =
-        rs_sig_file(basis_file, sig_file, block_len, strong_len, sig_magic,
-                    &stats);
+static void rdiff_sig_opts(rs_sig_opts_t *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->digest = sig_digest;
+    opts->cdc = sig_cdc;
+}
+
+/** Generate signature from remaining command line arguments. */
+static rs_result rdiff_sig(poptContext opcon)
+{
+    FILE *basis_file, *sig_file;
+    rs_stats_t stats;
+    rs_result result;
+    rs_magic_number sig_magic;
+    rs_sig_opts_t sig_opts;
+
+    basis_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+    sig_file =
+        rs_file_open(poptGetArg(opcon), sig_append ? "r+b" : "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if (sig_append) {
+        /* The signature's header has the arguments to use. */
+        result = rs_sig_append(basis_file, sig_file, &stats);
+    } else {
+        sig_magic = rdiff_sig_magic();
+        rdiff_sig_opts(&sig_opts);
+        result =
+            rs_sig_file_opts(basis_file, sig_file, block_len, strong_len,
+                             sig_magic, &sig_opts, &stats);
+    }
 
     rs_file_close(sig_file);
     rs_file_close(basis_file);
@@ -236,10 +299,12 @@ static rs_result rdiff_sig(poptContext opcon)
 
 static rs_result rdiff_delta(poptContext opcon)
 {
-    FILE *sig_file, *new_file, *delta_file;
+    FILE *sig_file, *new_file, *delta_file, *new_sig_file = NULL;
     char const *sig_name;
     rs_result result;
     rs_signature_t *sumset;
+    rs_delta_opts_t opts;
+    rs_sig_opts_t sig_opts;
     rs_stats_t stats;
 
     if (!(sig_name = poptGetArg(opcon))) {
@@ -251,6 +316,8 @@ static rs_result rdiff_delta(poptContext opcon)
     sig_file = rs_file_open(sig_name, "rb", file_force);
     new_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
     delta_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+    if (new_sig_name)
+        new_sig_file = rs_file_open(new_sig_name, "wb", file_force);
 
     rdiff_no_more_args(opcon);
 
@@ -264,8 +331,24 @@ static rs_result rdiff_delta(poptContext opcon)
     if ((result = rs_build_hash_table(sumset)) != RS_DONE)
         return result;
 
-    result = rs_delta_file(sumset, new_file, delta_file, &stats);
-
+    memset(&opts, 0, sizeof(opts));
+    opts.inplace = in_place;
+    opts.checksum = delta_checksum;
+    opts.compress = gzip_level;
+    opts.prime = gzip_level != 0 && !no_prime;
+    opts.self_window = self_window;
+    opts.magic = delta_compact ? RS_DELTA_V2_MAGIC : RS_DELTA_MAGIC;
+    rdiff_sig_opts(&sig_opts);
+    if (new_sig_file)
+        result = rs_delta_sig_file(sumset, new_file, delta_file, &opts,
+                                   new_sig_file, block_len, strong_len,
+                                   rdiff_sig_magic(), &sig_opts, &stats);
+    else
+        result = rs_delta_file_opts(sumset, new_file, delta_file, &opts,
+                                    &stats);
+
+    if (new_sig_file)
+        rs_file_close(new_sig_file);
     rs_file_close(delta_file);
     rs_file_close(new_file);
     rs_file_close(sig_file);
@@ -280,11 +363,48 @@ static rs_result rdiff_delta(poptContext opcon)
     return result;
 }
 
+/** Patch the basis in place, with a journal next to it. */
+static rs_result rdiff_patch_inplace(poptContext opcon, char const *basis_name)
+{
+    FILE *basis_file, *delta_file;
+    char *journal;
+    rs_stats_t stats;
+    rs_result result;
+
+    basis_file = rs_file_open(basis_name, "r+b", file_force);
+    delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if (!basis_file || !delta_file) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    if (!(journal = malloc(strlen(basis_name) + sizeof(".journal")))) {
+        result = RS_MEM_ERROR;
+        goto out;
+    }
+    strcat(strcpy(journal, basis_name), ".journal");
+    result = rs_patch_inplace(fileno(basis_file), delta_file, journal, &stats);
+    free(journal);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+  out:
+    if (delta_file)
+        rs_file_close(delta_file);
+    if (basis_file)
+        rs_file_close(basis_file);
+    return result;
+}
+
 static rs_result rdiff_patch(poptContext opcon)
 {
     /* patch BASIS [DELTA [NEWFILE]] */
-    FILE *basis_file, *delta_file, *new_file;
+    FILE *basis_file, *delta_file, *new_file, *sig_file = NULL;
     char const *basis_name;
+    rs_sig_opts_t sig_opts;
     rs_stats_t stats;
     rs_result result;
 
@@ -293,22 +413,371 @@ static rs_result rdiff_patch(poptContext opcon)
                     "rdiff [OPTIONS] patch BASIS [DELTA [NEW]]");
         exit(RS_SYNTAX_ERROR);
     }
+    if (in_place)
+        return rdiff_patch_inplace(opcon, basis_name);
 
     basis_file = rs_file_open(basis_name, "rb", file_force);
     delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+    /* A parallel patch reads the output back to check its checksum. */
+    new_file = rs_file_open(poptGetArg(opcon), "w+b", file_force);
+    if (new_sig_name)
+        sig_file = rs_file_open(new_sig_name, "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if (!basis_file || !delta_file || !new_file
+        || (new_sig_name && !sig_file)) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    rdiff_sig_opts(&sig_opts);
+    if (sig_file)
+        result = rs_patch_sig_file(basis_file, delta_file, new_file, sig_file,
+                                   block_len, strong_len, rdiff_sig_magic(),
+                                   &sig_opts, &stats);
+    else
+        result = rs_patch_parallel(basis_file, delta_file, new_file,
+                                   patch_threads, &stats);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+  out:
+    if (sig_file)
+        rs_file_close(sig_file);
+    if (new_file)
+        rs_file_close(new_file);
+    if (delta_file)
+        rs_file_close(delta_file);
+    if (basis_file)
+        rs_file_close(basis_file);
+    return result;
+}
+
+static rs_result rdiff_merge(poptContext opcon)
+{
+    /* merge DELTA1 DELTA2 [MERGED] */
+    FILE *first_file, *second_file, *merged_file;
+    char const *first_name, *second_name;
+    rs_stats_t stats;
+    rs_result result;
+
+    if (!(first_name = poptGetArg(opcon))
+        || !(second_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for merge: "
+                    "rdiff [OPTIONS] merge DELTA1 DELTA2 [MERGED]");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    first_file = rs_file_open(first_name, "rb", file_force);
+    second_file = rs_file_open(second_name, "rb", file_force);
+    merged_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if (!first_file || !second_file || !merged_file) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    result = rs_delta_merge(first_file, second_file, merged_file, &stats);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+  out:
+    if (merged_file)
+        rs_file_close(merged_file);
+    if (second_file)
+        rs_file_close(second_file);
+    if (first_file)
+        rs_file_close(first_file);
+    return result;
+}
+
+static rs_result rdiff_chain(poptContext opcon)
+{
+    /* chain BASIS NEWFILE DELTA... */
+    FILE *basis_file, *new_file, *delta_files[65];
+    char const *basis_name, *new_name, *delta_name;
+    rs_stats_t stats;
+    rs_result result = RS_DONE;
+    int count = 0, i;
+
+    if (!(basis_name = poptGetArg(opcon)) || !(new_name = poptGetArg(opcon))
+        || !poptPeekArg(opcon)) {
+        rdiff_usage("Usage for chain: "
+                    "rdiff [OPTIONS] chain BASIS NEWFILE DELTA...");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    basis_file = rs_file_open(basis_name, "rb", file_force);
+    new_file = rs_file_open(new_name, "wb", file_force);
+    while ((delta_name = poptGetArg(opcon))) {
+        if (count == sizeof(delta_files) / sizeof(*delta_files)) {
+            rdiff_usage("Too many deltas for chain.");
+            exit(RS_SYNTAX_ERROR);
+        }
+        if (!(delta_files[count++] = rs_file_open(delta_name, "rb", file_force)))
+            result = RS_IO_ERROR;
+    }
+
+    if (!basis_file || !new_file || result != RS_DONE) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    result = rs_patch_chain_file(basis_file, delta_files, count, new_file,
+                                 &stats);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+  out:
+    for (i = 0; i < count; i++)
+        if (delta_files[i])
+            rs_file_close(delta_files[i]);
+    if (new_file)
+        rs_file_close(new_file);
+    if (basis_file)
+        rs_file_close(basis_file);
+    return result;
+}
+
+static rs_result rdiff_index(poptContext opcon)
+{
+    /* index DELTA [INDEX] */
+    FILE *delta_file, *index_file;
+    char const *delta_name;
+    rs_stats_t stats;
+    rs_result result;
+
+    if (!(delta_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for index: rdiff [OPTIONS] index DELTA [INDEX]");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    delta_file = rs_file_open(delta_name, "rb", file_force);
+    index_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if (!delta_file || !index_file) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    result = rs_delta_index_file(delta_file, index_file, &stats);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+  out:
+    if (index_file)
+        rs_file_close(index_file);
+    if (delta_file)
+        rs_file_close(delta_file);
+    return result;
+}
+
+static rs_result rdiff_range(poptContext opcon)
+{
+    /* range BASIS DELTA INDEX OFFSET LENGTH [NEWFILE] */
+    FILE *basis_file, *delta_file, *index_file, *new_file;
+    char const *basis_name, *delta_name, *index_name, *offset, *length;
+    char *end1, *end2, *buf;
+    rs_long_t pos, left;
+    size_t len;
+    rs_result result = RS_DONE;
+
+    if (!(basis_name = poptGetArg(opcon)) || !(delta_name = poptGetArg(opcon))
+        || !(index_name = poptGetArg(opcon)) || !(offset = poptGetArg(opcon))
+        || !(length = poptGetArg(opcon))) {
+        rdiff_usage("Usage for range: rdiff [OPTIONS] range BASIS DELTA INDEX "
+                    "OFFSET LENGTH [NEWFILE]");
+        exit(RS_SYNTAX_ERROR);
+    }
+    pos = (rs_long_t)strtoll(offset, &end1, 10);
+    left = (rs_long_t)strtoll(length, &end2, 10);
+    if (*end1 || *end2 || pos < 0 || left < 0) {
+        rdiff_usage("Invalid range offset or length.");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    basis_file = rs_file_open(basis_name, "rb", file_force);
+    delta_file = rs_file_open(delta_name, "rb", file_force);
+    index_file = rs_file_open(index_name, "rb", file_force);
     new_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
 
     rdiff_no_more_args(opcon);
 
-    result = rs_patch_file(basis_file, delta_file, new_file, &stats);
+    if (!basis_file || !delta_file || !index_file || !new_file) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    if (!(buf = malloc(1 << 20))) {
+        result = RS_MEM_ERROR;
+        goto out;
+    }
+    while (left && result == RS_DONE) {
+        len = left < (1 << 20) ? (size_t)left : (1 << 20);
+        result = rs_patch_range(basis_file, delta_file, index_file, pos, buf,
+                                &len);
+        if (result == RS_DONE && fwrite(buf, 1, len, new_file) != len)
+            result = RS_IO_ERROR;
+        /* Stop at the end of the new file. */
+        left = len ? left - (rs_long_t)len : 0;
+        pos += (rs_long_t)len;
+    }
+    free(buf);
+
+  out:
+    if (new_file)
+        rs_file_close(new_file);
+    if (index_file)
+        rs_file_close(index_file);
+    if (delta_file)
+        rs_file_close(delta_file);
+    if (basis_file)
+        rs_file_close(basis_file);
+    return result;
+}
 
-    rs_file_close(new_file);
-    rs_file_close(delta_file);
-    rs_file_close(basis_file);
+static rs_result rdiff_newsig(poptContext opcon)
+{
+    /* newsig SIGNATURE BASIS DELTA [NEWSIG] */
+    FILE *sig_file, *basis_file, *delta_file, *new_sig_file;
+    char const *sig_name, *basis_name, *delta_name;
+    rs_signature_t *sumset = NULL;
+    rs_stats_t stats;
+    rs_result result;
+
+    if (!(sig_name = poptGetArg(opcon)) || !(basis_name = poptGetArg(opcon))
+        || !(delta_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for newsig: "
+                    "rdiff [OPTIONS] newsig SIGNATURE BASIS DELTA [NEWSIG]");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    sig_file = rs_file_open(sig_name, "rb", file_force);
+    basis_file = rs_file_open(basis_name, "rb", file_force);
+    delta_file = rs_file_open(delta_name, "rb", file_force);
+    new_sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if (!sig_file || !basis_file || !delta_file || !new_sig_file) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    if ((result = rs_loadsig_file(sig_file, &sumset, &stats)) != RS_DONE)
+        goto out;
+    if (show_stats)
+        rs_log_stats(&stats);
+    result = rs_sig_from_delta(sumset, delta_file, rs_file_copy_cb, basis_file,
+                               new_sig_file, &stats);
 
     if (show_stats)
         rs_log_stats(&stats);
 
+  out:
+    if (sumset)
+        rs_free_sumset(sumset);
+    if (new_sig_file)
+        rs_file_close(new_sig_file);
+    if (delta_file)
+        rs_file_close(delta_file);
+    if (basis_file)
+        rs_file_close(basis_file);
+    if (sig_file)
+        rs_file_close(sig_file);
+    return result;
+}
+
+static rs_result rdiff_sigrange(poptContext opcon)
+{
+    /* sigrange BASIS OFFSET LENGTH [RANGESIG] */
+    FILE *basis_file, *sig_file;
+    char const *basis_name, *offset, *length;
+    char *end1, *end2;
+    rs_long_t pos, len;
+    rs_stats_t stats;
+    rs_result result;
+
+    if (!(basis_name = poptGetArg(opcon)) || !(offset = poptGetArg(opcon))
+        || !(length = poptGetArg(opcon))) {
+        rdiff_usage("Usage for sigrange: rdiff [OPTIONS] sigrange BASIS "
+                    "OFFSET LENGTH [RANGESIG]");
+        exit(RS_SYNTAX_ERROR);
+    }
+    pos = (rs_long_t)strtoll(offset, &end1, 10);
+    len = (rs_long_t)strtoll(length, &end2, 10);
+    if (*end1 || *end2 || pos < 0 || len < 0) {
+        rdiff_usage("Invalid range offset or length.");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    basis_file = rs_file_open(basis_name, "rb", file_force);
+    sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if (!basis_file || !sig_file) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    result =
+        rs_sig_range_file(basis_file, sig_file, pos, len, block_len,
+                          strong_len, rdiff_sig_magic(), &stats);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+  out:
+    if (sig_file)
+        rs_file_close(sig_file);
+    if (basis_file)
+        rs_file_close(basis_file);
+    return result;
+}
+
+static rs_result rdiff_sigmerge(poptContext opcon)
+{
+    /* sigmerge SIGNATURE RANGESIG... */
+    FILE *sig_file, *range_files[1024];
+    char const *sig_name, *range_name;
+    rs_stats_t stats;
+    rs_result result = RS_DONE;
+    int count = 0, i;
+
+    if (!(sig_name = poptGetArg(opcon)) || !poptPeekArg(opcon)) {
+        rdiff_usage("Usage for sigmerge: "
+                    "rdiff [OPTIONS] sigmerge SIGNATURE RANGESIG...");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    sig_file = rs_file_open(sig_name, "wb", file_force);
+    while ((range_name = poptGetArg(opcon))) {
+        if (count == sizeof(range_files) / sizeof(*range_files)) {
+            rdiff_usage("Too many range signatures for sigmerge.");
+            exit(RS_SYNTAX_ERROR);
+        }
+        if (!(range_files[count++] = rs_file_open(range_name, "rb", file_force)))
+            result = RS_IO_ERROR;
+    }
+
+    if (!sig_file || result != RS_DONE) {
+        result = RS_IO_ERROR;
+        goto out;
+    }
+    result = rs_signature_merge(range_files, count, sig_file, &stats);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+  out:
+    for (i = 0; i < count; i++)
+        if (range_files[i])
+            rs_file_close(range_files[i]);
+    if (sig_file)
+        rs_file_close(sig_file);
     return result;
 }
 
@@ -324,9 +793,24 @@ static rs_result rdiff_action(poptContext opcon)
         return rdiff_delta(opcon);
     else if (isprefix(action, "patch"))
         return rdiff_patch(opcon);
-
-    rdiff_usage
-        ("You must specify an action: `signature', `delta', or `patch'.");
+    else if (isprefix(action, "merge"))
+        return rdiff_merge(opcon);
+    else if (isprefix(action, "chain"))
+        return rdiff_chain(opcon);
+    else if (isprefix(action, "index"))
+        return rdiff_index(opcon);
+    else if (isprefix(action, "range"))
+        return rdiff_range(opcon);
+    else if (isprefix(action, "newsig"))
+        return rdiff_newsig(opcon);
+    else if (isprefix(action, "sigrange"))
+        return rdiff_sigrange(opcon);
+    else if (isprefix(action, "sigmerge"))
+        return rdiff_sigmerge(opcon);
+
+    rdiff_usage("You must specify an action: `signature', `delta', `patch', "
+                "`merge', `chain', `index', `range', `newsig', `sigrange', "
+                "or `sigmerge'.");
     exit(RS_SYNTAX_ERROR);
 }
 
@@ -349,6 +833,16 @@ int main(const int argc, const char *argv[])
         {"gzip", 'z', POPT_ARG_NONE, 0, OPT_GZIP},
         {"bzip2", 'i', POPT_ARG_NONE, 0, OPT_BZIP2},
         {"force", 'f', POPT_ARG_NONE, &file_force},
+        {"threads", 'j', POPT_ARG_INT, &patch_threads},
+        {"in-place", 0, POPT_ARG_NONE, &in_place},
+        {"checksum", 'c', POPT_ARG_NONE, &delta_checksum},
+        {"window", 'w', POPT_ARG_INT, &self_window},
+        {"compact", 0, POPT_ARG_NONE, &delta_compact},
+        {"no-prime", 0, POPT_ARG_NONE, &no_prime},
+        {"signature", 0, POPT_ARG_STRING, &new_sig_name},
+        {"append", 0, POPT_ARG_NONE, &sig_append},
+        {"digest", 0, POPT_ARG_NONE, &sig_digest},
+        {"cdc", 0, POPT_ARG_NONE, &sig_cdc},
         {0}
     };
 
@@ -24,16 +24,20 @@
  * Load signatures from a file. */
 
 #include "config.h"             /* IWYU pragma: keep */
+#include <string.h>
 #include "librsync.h"
 #include "job.h"
 #include "sumset.h"
+#include "cdc.h"
 #include "scoop.h"
 #include "netint.h"
 #include "trace.h"
 #include "util.h"
 
+static rs_result rs_loadsig_s_sum(rs_job_t *job);
 static rs_result rs_loadsig_s_weak(rs_job_t *job);
 static rs_result rs_loadsig_s_strong(rs_job_t *job);
+static rs_result rs_loadsig_s_digest(rs_job_t *job);
 
 /** Add a just-read-in checksum pair to the signature block. */
 static rs_result rs_loadsig_add_sum(rs_job_t *job, rs_strong_sum_t *strong)
@@ -46,21 +50,60 @@ static rs_result rs_loadsig_add_sum(rs_job_t *job, rs_strong_sum_t *strong)
         rs_trace("got block: weak=" FMT_WEAKSUM ", strong=%s", job->weak_sig,
                  hexbuf);
     }
-    rs_signature_add_block(job->signature, job->weak_sig, strong);
+    if (sig->cdc)
+        rs_signature_add_chunk(sig, job->weak_sig, strong,
+                               (size_t)job->chunk_len);
+    else
+        rs_signature_add_block(sig, job->weak_sig, strong);
     job->stats.sig_blocks++;
     return RS_RUNNING;
 }
 
-static rs_result rs_loadsig_s_weak(rs_job_t *job)
+/** State of reading the start of a block sum, which is the weak sum or the
+ * chunk length. */
+static rs_result rs_loadsig_s_sum(rs_job_t *job)
 {
+    rs_signature_t *sig = job->signature;
     int l;
     rs_result result;
-
+    void *p;
+
+    /* The length and digest follow the last block sum, so a block sum must
+       have all of them after it. */
+    if (job->checksum
+        && (result =
+            rs_scoop_readahead(job,
+                               (sig->cdc ? 8 : 4) + sig->strong_sum_len + 8 +
+                               RS_SIG_DIGEST_LEN, &p)) != RS_DONE) {
+        if (result == RS_INPUT_ENDED)
+            job->statefn = rs_loadsig_s_digest;
+        return result == RS_INPUT_ENDED ? RS_RUNNING : result;
+    }
     if ((result = rs_suck_n4(job, &l)) != RS_DONE) {
         if (result == RS_INPUT_ENDED)   /* ending here is OK */
             return RS_DONE;
         return result;
     }
+    if (!sig->cdc) {
+        job->weak_sig = l;
+        job->statefn = rs_loadsig_s_strong;
+    } else if (l < 1 || (size_t)l > RS_CDC_MAX(sig->block_len)) {
+        rs_error("chunk length %d is bogus", l);
+        return RS_CORRUPT;
+    } else {
+        job->chunk_len = l;
+        job->statefn = rs_loadsig_s_weak;
+    }
+    return RS_RUNNING;
+}
+
+static rs_result rs_loadsig_s_weak(rs_job_t *job)
+{
+    int l;
+    rs_result result;
+
+    if ((result = rs_suck_n4(job, &l)) != RS_DONE)
+        return result;
     job->weak_sig = l;
     job->statefn = rs_loadsig_s_strong;
     return RS_RUNNING;
@@ -75,10 +118,32 @@ static rs_result rs_loadsig_s_strong(rs_job_t *job)
          rs_scoop_read(job, job->signature->strong_sum_len,
                        (void **)&strongsum)) != RS_DONE)
         return result;
-    job->statefn = rs_loadsig_s_weak;
+    job->statefn = rs_loadsig_s_sum;
     return rs_loadsig_add_sum(job, strongsum);
 }
 
+static rs_result rs_loadsig_s_digest(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    rs_result result;
+    rs_long_t len;
+    void *digest;
+
+    if (rs_scoop_avail(job) != 8 + RS_SIG_DIGEST_LEN) {
+        rs_error("signature digest is " FMT_SIZE " bytes, not %d",
+                 rs_scoop_avail(job), 8 + RS_SIG_DIGEST_LEN);
+        return RS_CORRUPT;
+    }
+    if ((result = rs_suck_netint(job, &len, 8)) != RS_DONE
+        || (result = rs_scoop_read(job, RS_SIG_DIGEST_LEN, &digest))
+        != RS_DONE)
+        return result;
+    sig->file_len = len;
+    memcpy(sig->digest, digest, RS_SIG_DIGEST_LEN);
+    rs_trace("got digest of " FMT_LONG " bytes", len);
+    return RS_DONE;
+}
+
 static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
 {
     int l;
@@ -86,6 +151,10 @@ static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
 
     if ((result = rs_suck_n4(job, &l)) != RS_DONE)
         return result;
+    /* The signature has a digest of the file if the flag is set. */
+    job->checksum = !!(l & RS_SIG_DIGEST_FLAG);
+    job->sig_cdc = !!(l & RS_SIG_CDC_FLAG);
+    l &= ~(RS_SIG_DIGEST_FLAG | RS_SIG_CDC_FLAG);
     if (l < 0 || l > RS_MAX_STRONG_SUM_LENGTH) {
         rs_error("strong sum length %d is implausible", l);
         return RS_CORRUPT;
@@ -97,7 +166,8 @@ static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
          rs_signature_init(job->signature, job->sig_magic, job->sig_block_len,
                            job->sig_strong_len, job->sig_fsize)) != RS_DONE)
         return result;
-    job->statefn = rs_loadsig_s_weak;
+    job->signature->cdc = job->sig_cdc;
+    job->statefn = rs_loadsig_s_sum;
     return RS_RUNNING;
 }
 
@@ -134,9 +204,12 @@ static rs_result rs_loadsig_s_magic(rs_job_t *job)
 
 rs_job_t *rs_loadsig_begin(rs_signature_t **signature)
 {
-    rs_job_t *job;
+    return rs_loadsig_reset(NULL, signature);
+}
 
-    job = rs_job_new("loadsig", rs_loadsig_s_magic);
+rs_job_t *rs_loadsig_reset(rs_job_t *job, rs_signature_t **signature)
+{
+    job = rs_job_renew(job, "loadsig", rs_loadsig_s_magic);
     *signature = job->signature = rs_alloc_struct(rs_signature_t);
     return job;
 }
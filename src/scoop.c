@@ -75,11 +75,11 @@ static inline void rs_scoop_input(rs_job_t *job, size_t len)
         rs_byte_t *newbuf;
         size_t newsize;
         for (newsize = 64; newsize < len; newsize <<= 1) ;
-        newbuf = rs_alloc(newsize, "scoop buffer");
+        newbuf = rs_alloc_huge(newsize, "scoop buffer");
         if (job->scoop_avail)
             memcpy(newbuf, job->scoop_next, job->scoop_avail);
         if (job->scoop_buf)
-            free(job->scoop_buf);
+            rs_free(job->scoop_buf);
         job->scoop_buf = job->scoop_next = newbuf;
         rs_trace("resized scoop buffer to " FMT_SIZE " bytes from " FMT_SIZE "",
                  newsize, job->scoop_alloc);
@@ -85,6 +85,7 @@ rs_result rs_tube_catchup(rs_job_t *job);
 int rs_tube_is_idle(rs_job_t const *job);
 void rs_tube_write(rs_job_t *job, void const *buf, size_t len);
 void rs_tube_copy(rs_job_t *job, size_t len);
+void rs_tube_send(rs_job_t *job, void const *buf, size_t len);
 
 void rs_scoop_advance(rs_job_t *job, size_t len);
 rs_result rs_scoop_readahead(rs_job_t *job, size_t len, void **ptr);
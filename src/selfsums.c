@@ -0,0 +1,174 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file selfsums.c
+ * Finding repeats of new file data already output by a delta. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <string.h>
+#include "librsync.h"
+#include "selfsums.h"
+#include "checksum.h"
+#include "trace.h"
+#include "util.h"
+
+/** A block of new file data already output. */
+typedef struct rs_self_block {
+    rs_weak_sum_t weak_sum;
+    rs_long_t pos;              /**< The new file offset of the block. */
+} rs_self_block_t;
+
+/** A search for an earlier block matching some new file data. */
+typedef struct rs_self_match {
+    rs_self_block_t block;      /**< Inherit from rs_self_block_t. */
+    rs_selfsums_t const *sums;
+    void const *buf;
+    size_t len;
+    rs_long_t pos;              /**< The new file offset of the data. */
+} rs_self_match_t;
+
+struct rs_selfsums {
+    weaksum_kind_t kind;
+    size_t block_len;
+    rs_long_t window;
+    hashtable_t *hashtable;
+    rs_self_block_t *blocks;    /**< A ring of the blocks in the window. */
+    size_t size, head, count;
+    rs_long_t next;             /**< The new file offset of the next block. */
+    rs_byte_t const *history;   /**< The history from the last update. */
+    size_t history_len;
+    rs_long_t end;              /**< The new file offset of the history end. */
+};
+
+static inline unsigned rs_self_block_hash(rs_self_block_t const *b)
+{
+    return (unsigned)b->weak_sum;
+}
+
+int rs_selfsums_same(rs_selfsums_t const *s, rs_long_t from, void const *buf,
+                     size_t len)
+{
+    rs_long_t start = s->end - (rs_long_t)s->history_len;
+
+    if (from < start || from + (rs_long_t)len > s->end)
+        return 0;
+    return !memcmp(buf, s->history + (from - start), len);
+}
+
+static inline int rs_self_match_cmp(rs_self_match_t *m,
+                                    rs_self_block_t const *b)
+{
+    /* The patch only keeps the window of output before the data. */
+    if (m->pos - b->pos > m->sums->window)
+        return 1;
+    return !rs_selfsums_same(m->sums, b->pos, m->buf, m->len);
+}
+
+/* The weak sums are already mixed like for signatures. */
+#define HASHTABLE_NMIX32
+#define ENTRY rs_self_block
+#define MATCH rs_self_match
+#include "hashtable.h"
+
+static void rs_self_match_init(rs_self_match_t *m, rs_selfsums_t const *s,
+                               rs_weak_sum_t weak_sum, void const *buf,
+                               size_t len, rs_long_t pos)
+{
+    m->block.weak_sum = weak_sum;
+    m->block.pos = pos;
+    m->sums = s;
+    m->buf = buf;
+    m->len = len;
+    m->pos = pos;
+}
+
+rs_selfsums_t *rs_selfsums_new(weaksum_kind_t kind, size_t block_len,
+                               size_t window)
+{
+    rs_selfsums_t *s = rs_alloc_struct(rs_selfsums_t);
+
+    s->kind = kind;
+    s->block_len = block_len;
+    s->window = (rs_long_t)window;
+    /* The window holds at most window / block_len whole blocks. */
+    s->size = window / block_len + 1;
+    s->blocks = rs_alloc(s->size * sizeof(*s->blocks), "self block sums");
+    s->hashtable = rs_self_block_hashtable_new(16);
+    return s;
+}
+
+void rs_selfsums_free(rs_selfsums_t *s)
+{
+    if (!s)
+        return;
+    rs_self_block_hashtable_free(s->hashtable);
+    rs_free(s->blocks);
+    rs_free(s);
+}
+
+void rs_selfsums_update(rs_selfsums_t *s, rs_byte_t const *history,
+                        size_t history_len, rs_long_t end)
+{
+    rs_long_t start = end - (rs_long_t)history_len;
+    rs_self_block_t *b, *old;
+    rs_self_match_t m;
+    weaksum_t sum;
+
+    s->history = history;
+    s->history_len = history_len;
+    s->end = end;
+    /* Remove the blocks that fall out of the window. Blocks that were
+       replaced by a repeat are already gone from the hashtable. */
+    while (s->count && s->blocks[s->head].pos < end - s->window) {
+        rs_self_block_hashtable_remove(s->hashtable, &s->blocks[s->head]);
+        s->head = (s->head + 1) % s->size;
+        s->count--;
+    }
+    for (; s->next + (rs_long_t)s->block_len <= end;
+         s->next += (rs_long_t)s->block_len) {
+        /* Skip blocks that are already out of the window. */
+        if (s->next < end - s->window || s->next < start)
+            continue;
+        weaksum_init(&sum, s->kind);
+        weaksum_update(&sum, history + (s->next - start), s->block_len);
+        rs_self_match_init(&m, s, weaksum_digest(&sum),
+                           history + (s->next - start), s->block_len, s->next);
+        if ((old = rs_self_block_hashtable_find(s->hashtable, &m)))
+            rs_self_block_hashtable_remove(s->hashtable, old);
+        if (hashtable_full(s->hashtable))
+            s->hashtable =
+                rs_self_block_hashtable_resize(s->hashtable,
+                                               2 * s->hashtable->count + 16);
+        b = &s->blocks[(s->head + s->count++) % s->size];
+        *b = m.block;
+        rs_self_block_hashtable_add(s->hashtable, b);
+    }
+}
+
+rs_long_t rs_selfsums_find(rs_selfsums_t *s, rs_weak_sum_t weak_sum,
+                           void const *buf, size_t len, rs_long_t pos)
+{
+    rs_self_match_t m;
+    rs_self_block_t *b;
+
+    rs_self_match_init(&m, s, weak_sum, buf, len, pos);
+    if ((b = rs_self_block_hashtable_find(s->hashtable, &m)))
+        return b->pos;
+    return -1;
+}
@@ -0,0 +1,72 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file selfsums.h
+ * Block sums of the new file data already output by a delta.
+ *
+ * As a delta job outputs new file data, the weak sum of each block of it is
+ * added to a hashtable, so later data that repeats it can be sent as a SELF
+ * command that copies it from the patch output instead of as literal data.
+ * Matches are checked against the data in the job's history, so no strong
+ * sums are needed.
+ *
+ * The blocks are removed as they fall out of the history window, and the
+ * hashtable grows as blocks are added, so it only holds the blocks in the
+ * window. A block that repeats one already in the table replaces it, which
+ * keeps the newest copy and the hashtable probes short. */
+#ifndef SELFSUMS_H
+#  define SELFSUMS_H
+
+#  include <stddef.h>
+#  include "checksum.h"
+#  include "librsync.h"
+
+/** Max length of the history window for SELF commands.
+ *
+ * This caps the memory a patch uses to keep its output for them. */
+#  define RS_MAX_WINDOW ((size_t)64 << 20)
+
+typedef struct rs_selfsums rs_selfsums_t;
+
+/** Make the block sums for a delta with a weaksum kind, block length, and
+ * history window. */
+rs_selfsums_t *rs_selfsums_new(weaksum_kind_t kind, size_t block_len,
+                               size_t window);
+
+void rs_selfsums_free(rs_selfsums_t *s);
+
+/** Update the blocks for the history.
+ *
+ * This adds the blocks that the history now has all of and removes those out
+ * of the window. The history is history[0..history_len], ending at new file
+ * offset end, and must stay valid until the next update. */
+void rs_selfsums_update(rs_selfsums_t *s, rs_byte_t const *history,
+                        size_t history_len, rs_long_t end);
+
+/** Find an earlier block matching len bytes of buf at new file offset pos.
+ *
+ * \return The new file offset of the block, or -1 if none match. */
+rs_long_t rs_selfsums_find(rs_selfsums_t *s, rs_weak_sum_t weak_sum,
+                           void const *buf, size_t len, rs_long_t pos);
+
+/** Check whether the history has len bytes of buf at new file offset from. */
+int rs_selfsums_same(rs_selfsums_t const *s, rs_long_t from, void const *buf,
+                     size_t len);
+
+#endif                          /* !SELFSUMS_H */
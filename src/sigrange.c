@@ -0,0 +1,207 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file sigrange.c
+ * Signing ranges of a file and merging their signatures.
+ *
+ * A range signature has a header with the signature's arguments and the
+ * range, followed by the block sums of the range, which are the same as the
+ * block sums for it in the signature of the whole file when the range starts
+ * on a block boundary. So the ranges of a file can be signed by separate
+ * processes or machines, and the signature of the file made by checking the
+ * ranges cover it and concatenating their block sums. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "librsync.h"
+#include "largefile.h"
+#include "job.h"
+#include "buf.h"
+#include "whole.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
+
+/** The length of a range signature header. */
+#define RS_RANGE_HEAD_LEN 32
+
+rs_result rs_sig_range_file(FILE *old_file, FILE *sig_file, rs_long_t start,
+                            rs_long_t len, size_t block_len, size_t strong_len,
+                            rs_magic_number sig_magic, rs_stats_t *stats)
+{
+    rs_long_t old_fsize = rs_file_size(old_file);
+    rs_filebuf_t *in_fb, *out_fb;
+    rs_buffers_t buf;
+    rs_job_t *job;
+    rs_result r;
+
+    /* Use the arguments rs_sig_file() would for the whole file. */
+    if ((r = rs_sig_args(old_fsize, &sig_magic, &block_len, &strong_len))
+        != RS_DONE)
+        return r;
+    if (start < 0 || len < 0) {
+        rs_error("invalid range start " FMT_LONG " or len " FMT_LONG, start,
+                 len);
+        return RS_PARAM_ERROR;
+    }
+    if (old_fsize >= 0 && start + len > old_fsize)
+        len = start < old_fsize ? old_fsize - start : 0;
+    if (start && fseek(old_file, start, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    job = rs_sig_range_begin(start, len, block_len, strong_len, sig_magic);
+    /* Size inbuf for 4 blocks, outbuf for header + 4 blocksums. */
+    in_fb = rs_filebuf_new(old_file, rs_inbuflen ? rs_inbuflen :
+                           4 * (int)block_len);
+    out_fb = rs_filebuf_new(sig_file, rs_outbuflen ? rs_outbuflen :
+                            RS_RANGE_HEAD_LEN + 4 * (4 + (int)strong_len));
+    rs_filebuf_limit(in_fb, len);
+    r = rs_job_drive(job, &buf, rs_infilebuf_fill, in_fb, rs_outfilebuf_drain,
+                     out_fb);
+    /* The header has the length, so the file can't end before it. */
+    if (r == RS_DONE && job->stats.in_bytes != len) {
+        rs_error("file ended " FMT_LONG " bytes into a range of " FMT_LONG
+                 " bytes", job->stats.in_bytes, len);
+        r = RS_INPUT_ENDED;
+    }
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    rs_filebuf_free(in_fb);
+    rs_filebuf_free(out_fb);
+    return r;
+}
+
+/** Copy the block sums of a range signature to the merged signature. */
+static rs_result rs_range_copy(FILE *range_file, FILE *sig_file,
+                               rs_long_t sums_len, rs_byte_t *buf,
+                               size_t buf_len, rs_stats_t *stats)
+{
+    size_t len;
+
+    while (sums_len) {
+        len = sums_len < (rs_long_t)buf_len ? (size_t)sums_len : buf_len;
+        if (fread(buf, 1, len, range_file) != len) {
+            rs_error("range signature ended before its block sums");
+            return ferror(range_file) ? RS_IO_ERROR : RS_INPUT_ENDED;
+        }
+        if (fwrite(buf, 1, len, sig_file) != len) {
+            rs_error("error writing signature: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        stats->in_bytes += (rs_long_t)len;
+        stats->out_bytes += (rs_long_t)len;
+        sums_len -= (rs_long_t)len;
+    }
+    if (fread(buf, 1, 1, range_file)) {
+        rs_error("range signature has data after its block sums");
+        return RS_CORRUPT;
+    }
+    return RS_DONE;
+}
+
+rs_result rs_signature_merge(FILE **range_files, int count, FILE *sig_file,
+                             rs_stats_t *stats)
+{
+    rs_byte_t head[RS_RANGE_HEAD_LEN], first[12], *buf;
+    rs_long_t end = 0, start, len, blocks, block_len = 0;
+    const size_t buf_len = 64 << 10;
+    rs_stats_t st;
+    rs_result result = RS_DONE;
+    int i;
+
+    rs_bzero(&st, sizeof(st));
+    st.op = "signature-merge";
+    st.start = time(NULL);
+    if (count < 1) {
+        rs_error("no range signatures to merge");
+        return RS_PARAM_ERROR;
+    }
+    buf = rs_alloc(buf_len, "signature merge buffer");
+    for (i = 0; i < count && result == RS_DONE; i++) {
+        if (fread(head, 1, sizeof(head), range_files[i]) != sizeof(head)) {
+            rs_error("can't read range signature %d header", i);
+            result = ferror(range_files[i]) ? RS_IO_ERROR : RS_INPUT_ENDED;
+            break;
+        }
+        st.in_bytes += (rs_long_t)sizeof(head);
+        if (rs_get_netint(head, 4) != RS_RANGE_SIG_MAGIC) {
+            rs_error("range signature %d has bad magic %#x", i,
+                     (int)rs_get_netint(head, 4));
+            result = RS_BAD_MAGIC;
+            break;
+        }
+        if (i == 0) {
+            /* The signature has the arguments of the first range. */
+            memcpy(first, head + 4, sizeof(first));
+            block_len = rs_get_netint(head + 8, 4);
+            if (block_len <= 0 || rs_get_netint(first + 8, 4)
+                > RS_MAX_STRONG_SUM_LENGTH) {
+                rs_error("range signature has bad block len " FMT_LONG
+                         " or strong sum len " FMT_LONG, block_len,
+                         rs_get_netint(first + 8, 4));
+                result = RS_CORRUPT;
+                break;
+            }
+            if (fwrite(first, 1, sizeof(first), sig_file) != sizeof(first)) {
+                rs_error("error writing signature: %s", strerror(errno));
+                result = RS_IO_ERROR;
+                break;
+            }
+            st.out_bytes += (rs_long_t)sizeof(first);
+            st.block_len = (size_t)block_len;
+        } else if (memcmp(first, head + 4, sizeof(first))) {
+            rs_error("range signature %d has different arguments", i);
+            result = RS_PARAM_ERROR;
+            break;
+        }
+        start = rs_get_netint(head + 16, 8);
+        len = rs_get_netint(head + 24, 8);
+        if (start != end || len < 0) {
+            rs_error("range signature %d is for " FMT_LONG " bytes at "
+                     FMT_LONG ", not at " FMT_LONG, i, len, start, end);
+            result = RS_PARAM_ERROR;
+            break;
+        }
+        /* Only the last range can end in a short block. */
+        if (end % block_len) {
+            rs_error("range signature %d follows a range ending mid block",
+                     i);
+            result = RS_PARAM_ERROR;
+            break;
+        }
+        blocks = (len + block_len - 1) / block_len;
+        rs_trace("merging " FMT_LONG " blocks of range " FMT_LONG "+" FMT_LONG,
+                 blocks, start, len);
+        result = rs_range_copy(range_files[i], sig_file,
+                               blocks * (4 + rs_get_netint(first + 8, 4)),
+                               buf, buf_len, &st);
+        st.sig_blocks += blocks;
+        end += len;
+    }
+    st.end = time(NULL);
+    if (stats)
+        memcpy(stats, &st, sizeof(st));
+    rs_free(buf);
+    return result;
+}
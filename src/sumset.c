@@ -85,23 +85,6 @@ static inline int rs_block_match_cmp(rs_block_match_t *match,
 #define NAME hashtable
 #include "hashtable.h"
 
-/* Get the size of a packed rs_block_sig_t. */
-static inline size_t rs_block_sig_size(const rs_signature_t *sig)
-{
-    /* Round up to multiple of sizeof(weak_sum) to align memory correctly. */
-    const size_t mask = sizeof(rs_weak_sum_t)- 1;
-    return (offsetof(rs_block_sig_t, strong_sum) +
-            (((size_t)sig->strong_sum_len + mask) & ~mask));
-}
-
-/* Get the pointer to the block_sig_t from a block index. */
-static inline rs_block_sig_t *rs_block_sig_ptr(const rs_signature_t *sig,
-                                               int block_idx)
-{
-    return (rs_block_sig_t *)((char *)sig->block_sigs +
-                               block_idx * rs_block_sig_size(sig));
-}
-
 /* Get the index of a block from a block_sig_t pointer. */
 static inline int rs_block_sig_idx(const rs_signature_t *sig,
                                    rs_block_sig_t *block_sig)
@@ -124,10 +107,12 @@ rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
     switch (*magic) {
     case RS_BLAKE2_SIG_MAGIC:
     case RS_RK_BLAKE2_SIG_MAGIC:
+    case RS_BH_BLAKE2_SIG_MAGIC:
         max_strong_len = RS_BLAKE2_SUM_LENGTH;
         break;
     case RS_MD4_SIG_MAGIC:
     case RS_RK_MD4_SIG_MAGIC:
+    case RS_BH_MD4_SIG_MAGIC:
         max_strong_len = RS_MD4_SUM_LENGTH;
         break;
     default:
@@ -200,11 +185,14 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
     sig->size = (int)(sig_fsize < 12 ? 0 : (sig_fsize - 12) / (4 + strong_len));
     if (sig->size)
         sig->block_sigs =
-            rs_alloc(sig->size * rs_block_sig_size(sig),
-                     "signature->block_sigs");
+            rs_alloc_huge(sig->size * rs_block_sig_size(sig),
+                          "signature->block_sigs");
     else
         sig->block_sigs = NULL;
     sig->hashtable = NULL;
+    sig->cdc = 0;
+    sig->chunk_pos = NULL;
+    sig->file_len = -1;
 #ifndef HASHTABLE_NSTATS
     sig->calc_strong_count = 0;
 #endif
@@ -215,7 +203,8 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
 void rs_signature_done(rs_signature_t *sig)
 {
     hashtable_free(sig->hashtable);
-    free(sig->block_sigs);
+    rs_free(sig->block_sigs);
+    rs_free(sig->chunk_pos);
     rs_bzero(sig, sizeof(*sig));
 }
 
@@ -231,14 +220,38 @@ rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig,
     if (sig->count == sig->size) {
         sig->size = sig->size ? sig->size * 2 : 16;
         sig->block_sigs =
-            rs_realloc(sig->block_sigs, sig->size * rs_block_sig_size(sig),
-                       "signature->block_sigs");
+            rs_realloc_huge(sig->block_sigs,
+                            sig->size * rs_block_sig_size(sig),
+                            "signature->block_sigs");
     }
     rs_block_sig_t *b = rs_block_sig_ptr(sig, sig->count++);
     rs_block_sig_init(b, weak_sum, strong_sum, sig->strong_sum_len);
     return b;
 }
 
+rs_block_sig_t *rs_signature_add_chunk(rs_signature_t *sig,
+                                       rs_weak_sum_t weak_sum,
+                                       rs_strong_sum_t *strong_sum,
+                                       size_t len)
+{
+    const int size = sig->chunk_pos ? sig->size : 0;
+    rs_block_sig_t *b = rs_signature_add_block(sig, weak_sum, strong_sum);
+
+    assert(sig->cdc);
+    /* Keep room for the offset after the last chunk too. */
+    if (sig->size != size) {
+        sig->chunk_pos =
+            rs_realloc_huge(sig->chunk_pos,
+                            (sig->size + 1) * sizeof(*sig->chunk_pos),
+                            "signature->chunk_pos");
+        if (!size)
+            sig->chunk_pos[0] = 0;
+    }
+    sig->chunk_pos[sig->count] =
+        sig->chunk_pos[sig->count - 1] + (rs_long_t)len;
+    return b;
+}
+
 rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
                                   void const *buf, size_t len)
 {
@@ -248,6 +261,8 @@ rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
     rs_signature_check(sig);
     rs_block_match_init(&m, sig, weak_sum, NULL, buf, len);
     if ((b = hashtable_find(sig->hashtable, &m))) {
+        if (sig->cdc)
+            return sig->chunk_pos[rs_block_sig_idx(sig, b)];
         return (rs_long_t)rs_block_sig_idx(sig, b) * sig->block_len;
     }
     return -1;
@@ -294,7 +309,7 @@ rs_result rs_build_hash_table(rs_signature_t *sig)
 void rs_free_sumset(rs_signature_t *psums)
 {
     rs_signature_done(psums);
-    free(psums);
+    rs_free(psums);
 }
 
 void rs_sumset_dump(rs_signature_t const *sums)
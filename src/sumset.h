@@ -37,6 +37,18 @@ typedef struct rs_block_sig {
     rs_strong_sum_t strong_sum; /**< Block's strong checksum. */
 } rs_block_sig_t;
 
+/** The flag in a signature header's strong sum length for a digest. */
+#  define RS_SIG_DIGEST_FLAG 0x10000
+
+/** The length of the digest of the whole file at the end of a signature. */
+#  define RS_SIG_DIGEST_LEN 32
+
+/** The flag in a signature header's strong sum length for chunks.
+ *
+ * The blocks are content defined chunks with block_len as their average
+ * length, and each block sum starts with the chunk length. */
+#  define RS_SIG_CDC_FLAG 0x20000
+
 /** Signature of a whole file.
  *
  * This includes the all the block sums generated for a file and datastructures
@@ -49,12 +61,33 @@ struct rs_signature {
     int size;                   /**< Total number of blocks allocated. */
     void *block_sigs;           /**< The packed block_sigs for all blocks. */
     hashtable_t *hashtable;     /**< The hashtable for finding matches. */
+    int cdc;                    /**< Whether blocks are content defined. */
+    rs_long_t *chunk_pos;       /**< The chunk offsets and the file length. */
+    rs_long_t file_len;         /**< The file length, or -1 if no digest. */
+    unsigned char digest[RS_SIG_DIGEST_LEN]; /**< The file's digest. */
     /* The is extra stats not included in the hashtable stats. */
 #  ifndef HASHTABLE_NSTATS
     long calc_strong_count;     /**< The count of strongsum calcs done. */
 #  endif
 };
 
+/* Get the size of a packed rs_block_sig_t. */
+static inline size_t rs_block_sig_size(const rs_signature_t *sig)
+{
+    /* Round up to multiple of sizeof(weak_sum) to align memory correctly. */
+    const size_t mask = sizeof(rs_weak_sum_t)- 1;
+    return (offsetof(rs_block_sig_t, strong_sum) +
+            (((size_t)sig->strong_sum_len + mask) & ~mask));
+}
+
+/* Get the pointer to the block_sig_t from a block index. */
+static inline rs_block_sig_t *rs_block_sig_ptr(const rs_signature_t *sig,
+                                               int block_idx)
+{
+    return (rs_block_sig_t *)((char *)sig->block_sigs +
+                               block_idx * rs_block_sig_size(sig));
+}
+
 /** Initialize an rs_signature instance.
  *
  * \param *sig the signature to initialize.
@@ -81,6 +114,12 @@ rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig,
                                        rs_weak_sum_t weak_sum,
                                        rs_strong_sum_t *strong_sum);
 
+/** Add a content defined chunk of length len to an rs_signature instance. */
+rs_block_sig_t *rs_signature_add_chunk(rs_signature_t *sig,
+                                       rs_weak_sum_t weak_sum,
+                                       rs_strong_sum_t *strong_sum,
+                                       size_t len);
+
 /** Find a matching block offset in a signature. */
 rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
                                   void const *buf, size_t len);
@@ -91,7 +130,8 @@ rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
  * points at where rs_sig_args_check() was called from. */
 #  define rs_sig_args_check(magic, block_len, strong_len) do {\
     assert(((magic) & ~0xff) == (RS_MD4_SIG_MAGIC & ~0xff));\
-    assert(((magic) & 0xf0) == 0x30 || ((magic) & 0xf0) == 0x40);\
+    assert(((magic) & 0xf0) == 0x30 || ((magic) & 0xf0) == 0x40 ||\
+           ((magic) & 0xf0) == 0x50);\
     assert((((magic) & 0x0f) == 0x06 &&\
 	    (int)(strong_len) <= RS_MD4_SUM_LENGTH) ||\
 	   (((magic) & 0x0f) == 0x07 &&\
@@ -114,7 +154,14 @@ rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
 static inline weaksum_kind_t rs_signature_weaksum_kind(rs_signature_t const
                                                        *sig)
 {
-    return (sig->magic & 0xf0) == 0x30 ? RS_ROLLSUM : RS_RABINKARP;
+    switch (sig->magic & 0xf0) {
+    case 0x30:
+        return RS_ROLLSUM;
+    case 0x50:
+        return RS_BUZHASH;
+    default:
+        return RS_RABINKARP;
+    }
 }
 
 /** Get the strongsum kind for a signature. */
@@ -124,6 +171,17 @@ static inline strongsum_kind_t rs_signature_strongsum_kind(rs_signature_t const
     return (sig->magic & 0x0f) == 0x06 ? RS_MD4 : RS_BLAKE2;
 }
 
+/** Get the weak sum of a block as it is in the signature file.
+ *
+ * Rollsums have mix32() applied when they are added to a signature. */
+static inline rs_weak_sum_t rs_block_sig_weak_sum(rs_signature_t const *sig,
+                                                  rs_block_sig_t const *b)
+{
+    if (rs_signature_weaksum_kind(sig) == RS_ROLLSUM)
+        return unmix32(b->weak_sum);
+    return b->weak_sum;
+}
+
 /** Calculate the weak sum of a buffer. */
 static inline rs_weak_sum_t rs_signature_calc_weak_sum(rs_signature_t const
                                                        *sig, void const *buf,
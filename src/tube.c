@@ -39,9 +39,9 @@
  * into a small buffer.
  *
  * A tube can contain some literal data to go out (typically command bytes),
- * and also an instruction to copy data from the stream's input or from some
- * other location. Both literal data and a copy command can be queued at the
- * same time, but only in that order and at most one of each.
+ * and also an instruction to copy data from the stream's input or to send
+ * data from some other buffer. Literal data and then a copy or a send can be
+ * queued at the same time, but only in that order and at most one of each.
  *
  * \todo As an optimization, write it directly to the stream if possible. But
  * for simplicity don't do that yet.
@@ -81,6 +81,22 @@ static void rs_tube_catchup_write(rs_job_t *job)
              len, job->write_len);
 }
 
+static void rs_tube_catchup_send(rs_job_t *job)
+{
+    rs_buffers_t *stream = job->stream;
+    size_t len = job->send_len;
+
+    if (len > stream->avail_out)
+        len = stream->avail_out;
+    memcpy(stream->next_out, job->send_buf, len);
+    stream->next_out += len;
+    stream->avail_out -= len;
+    job->send_buf += len;
+    job->send_len -= len;
+    rs_trace("sent " FMT_SIZE " bytes, " FMT_SIZE " left to send", len,
+             job->send_len);
+}
+
 /** Catch up on an outstanding copy command.
  *
  * Takes data from the scoop and writes as much as will fit to the output, up
@@ -125,6 +141,12 @@ rs_result rs_tube_catchup(rs_job_t *job)
             return RS_BLOCKED;
     }
 
+    if (job->send_len) {
+        rs_tube_catchup_send(job);
+        if (job->send_len)
+            return RS_BLOCKED;
+    }
+
     if (job->copy_len) {
         rs_tube_catchup_copy(job);
         if (job->copy_len) {
@@ -143,7 +165,7 @@ rs_result rs_tube_catchup(rs_job_t *job)
    \return true if the previous command has finished doing all its output. */
 int rs_tube_is_idle(rs_job_t const *job)
 {
-    return job->write_len == 0 && job->copy_len == 0;
+    return job->write_len == 0 && job->send_len == 0 && job->copy_len == 0;
 }
 
 /** Queue up a request to copy through \p len bytes from the input to the
@@ -159,11 +181,24 @@ int rs_tube_is_idle(rs_job_t const *job)
  * out and back in again after flushing the tube. */
 void rs_tube_copy(rs_job_t *job, size_t len)
 {
-    assert(job->copy_len == 0);
+    assert(job->send_len == 0 && job->copy_len == 0);
 
     job->copy_len = len;
 }
 
+/** Queue up sending \p len bytes from \p buf to the output of the stream.
+ *
+ * The data is not copied, so must stay valid until the tube is idle. Like
+ * copies, this can't be queued if there is already a send or copy in the
+ * tube, and any write data already queued comes out first. */
+void rs_tube_send(rs_job_t *job, void const *buf, size_t len)
+{
+    assert(job->send_len == 0 && job->copy_len == 0);
+
+    job->send_buf = buf;
+    job->send_len = len;
+}
+
 /** Push some data into the tube for storage.
  *
  * The tube's never supposed to get very big, so this will just pop loudly if
@@ -173,7 +208,7 @@ void rs_tube_copy(rs_job_t *job, size_t len)
  * because the write data comes out first. */
 void rs_tube_write(rs_job_t *job, const void *buf, size_t len)
 {
-    assert(job->copy_len == 0);
+    assert(job->send_len == 0 && job->copy_len == 0);
     assert(len <= sizeof(job->write_buf) - job->write_len);
 
     memcpy(job->write_buf + job->write_len, buf, len);
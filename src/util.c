@@ -26,20 +26,101 @@
 #include "config.h"             /* IWYU pragma: keep */
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 #include "librsync.h"
 #include "util.h"
 #include "trace.h"
+#include "librsync_export.h"
+
+/** Whether large allocations should try to use huge pages. */
+LIBRSYNC_EXPORT int rs_hugepages = 0;
 
 void rs_bzero(void *buf, size_t size)
 {
     memset(buf, 0, size);
 }
 
+/* Use thread-local storage for the current allocator where supported, so
+   each thread can use its own. */
+#if defined(_MSC_VER)
+#  define RS_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#  define RS_THREAD_LOCAL __thread
+#else
+#  define RS_THREAD_LOCAL
+#endif
+
+/** The allocator used for new allocations, or NULL for the C library heap. */
+static RS_THREAD_LOCAL rs_allocator_t const *rs_allocator = NULL;
+
+/** Header in front of every allocation.
+ *
+ * This records where the memory came from so rs_free() can give it back to
+ * the right allocator, even if the current allocator has since changed. The
+ * union pads it so the memory after it stays suitably aligned. */
+typedef union rs_alloc_hdr {
+    struct {
+        rs_allocator_t const *allocator;
+        size_t size;            /**< Size including this header. */
+    } h;
+    long double align;
+} rs_alloc_hdr_t;
+
+#define rs_alloc_hdr(p) ((rs_alloc_hdr_t *)(p) - 1)
+
+rs_allocator_t const *rs_set_allocator(rs_allocator_t const *allocator)
+{
+    rs_allocator_t const *old = rs_allocator;
+
+    rs_allocator = allocator;
+    return old;
+}
+
+/** Fill in the header of raw memory and return the usable part of it. */
+static void *rs_alloc_init(void *p, rs_allocator_t const *allocator,
+                           size_t size)
+{
+    rs_alloc_hdr_t *hdr = p;
+
+    hdr->h.allocator = allocator;
+    hdr->h.size = size;
+    return hdr + 1;
+}
+
+/** Allocate size bytes including the header, returning NULL on failure. */
+static void *rs_alloc_raw(size_t size)
+{
+    void *p;
+
+    size += sizeof(rs_alloc_hdr_t);
+    if (rs_allocator)
+        p = rs_allocator->alloc(rs_allocator->opaque, size);
+    else
+        p = malloc(size);
+    return p ? rs_alloc_init(p, rs_allocator, size) : NULL;
+}
+
+void rs_free(void *ptr)
+{
+    rs_alloc_hdr_t *hdr;
+
+    if (!ptr)
+        return;
+    hdr = rs_alloc_hdr(ptr);
+    if (hdr->h.allocator)
+        hdr->h.allocator->free(hdr->h.allocator->opaque, hdr, hdr->h.size);
+    else
+        free(hdr);
+}
+
 void *rs_alloc_struct0(size_t size, char const *name)
 {
     void *p;
 
-    if (!(p = malloc(size))) {
+    if (!(p = rs_alloc_raw(size))) {
         rs_fatal("couldn't allocate instance of %s", name);
     }
     rs_bzero(p, size);
@@ -50,7 +131,7 @@ void *rs_alloc(size_t size, char const *name)
 {
     void *p;
 
-    if (!(p = malloc(size))) {
+    if (!(p = rs_alloc_raw(size))) {
         rs_fatal("couldn't allocate instance of %s", name);
     }
 
@@ -58,11 +139,102 @@ void *rs_alloc(size_t size, char const *name)
 }
 
 void *rs_realloc(void *ptr, size_t size, char const *name)
+{
+    rs_alloc_hdr_t *hdr;
+    void *p;
+
+    if (!ptr)
+        return rs_alloc(size, name);
+    hdr = rs_alloc_hdr(ptr);
+    if (!hdr->h.allocator && !rs_allocator) {
+        size += sizeof(rs_alloc_hdr_t);
+        if (!(p = realloc(hdr, size))) {
+            rs_fatal("couldn't reallocate instance of %s", name);
+        }
+        return rs_alloc_init(p, NULL, size);
+    }
+    /* Other allocators can only allocate and free, so move it by copying. */
+    p = rs_alloc(size, name);
+    size = size < hdr->h.size - sizeof(rs_alloc_hdr_t) ?
+        size : hdr->h.size - sizeof(rs_alloc_hdr_t);
+    memcpy(p, ptr, size);
+    rs_free(ptr);
+    return p;
+}
+
+/** Allocate huge page aligned memory and advise the kernel to back it with
+ * huge pages.
+ *
+ * Returns NULL if huge pages are disabled, not supported on this platform,
+ * the size is too small to benefit, or another allocator is in use, and the
+ * caller should fall back to a normal allocation. The returned memory is
+ * released with rs_free(). */
+static void *rs_alloc_hugepages(size_t size)
+{
+#if defined(HAVE_POSIX_MEMALIGN) && defined(MADV_HUGEPAGE)
+    void *p;
+
+    size += sizeof(rs_alloc_hdr_t);
+    if (!rs_hugepages || rs_allocator || size < RS_HUGEPAGE_SIZE)
+        return NULL;
+    /* Round up to whole huge pages so the tail gets one too. */
+    size = (size + RS_HUGEPAGE_SIZE - 1) & ~(RS_HUGEPAGE_SIZE - 1);
+    if (posix_memalign(&p, RS_HUGEPAGE_SIZE, size))
+        return NULL;
+    /* This must be done before the pages are touched. If it fails we just
+       get normal pages. */
+    if (madvise(p, size, MADV_HUGEPAGE))
+        rs_trace("madvise(MADV_HUGEPAGE) failed: %s", strerror(errno));
+    return rs_alloc_init(p, NULL, size);
+#else
+    (void)size;
+    return NULL;
+#endif
+}
+
+/** Allocate memory for a large table or buffer, using huge pages if enabled
+ * with ::rs_hugepages. */
+void *rs_alloc_huge(size_t size, char const *name)
+{
+    void *p;
+
+    if ((p = rs_alloc_hugepages(size)))
+        return p;
+    return rs_alloc(size, name);
+}
+
+/** Allocate zero-filled memory for a large table or buffer, using huge pages
+ * if enabled with ::rs_hugepages. */
+void *rs_alloc_huge0(size_t size, char const *name)
+{
+    void *p;
+
+    if ((p = rs_alloc_hugepages(size))) {
+        rs_bzero(p, size);
+        return p;
+    }
+    if (rs_allocator)
+        return rs_alloc_struct0(size, name);
+    /* Use calloc() so untouched pages of big tables can stay unmapped. */
+    size += sizeof(rs_alloc_hdr_t);
+    if (!(p = calloc(1, size))) {
+        rs_fatal("couldn't allocate instance of %s", name);
+    }
+    return rs_alloc_init(p, NULL, size);
+}
+
+/** Resize memory from rs_alloc_huge(), keeping it in huge pages if enabled. */
+void *rs_realloc_huge(void *ptr, size_t size, char const *name)
 {
     void *p;
+    size_t old_size;
 
-    if (!(p = realloc(ptr, size))) {
-        rs_fatal("couldn't reallocate instance of %s", name);
+    if (!(p = rs_alloc_hugepages(size)))
+        return rs_realloc(ptr, size, name);
+    if (ptr) {
+        old_size = rs_alloc_hdr(ptr)->h.size - sizeof(rs_alloc_hdr_t);
+        memcpy(p, ptr, old_size < size ? old_size : size);
+        rs_free(ptr);
     }
     return p;
 }
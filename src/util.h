@@ -31,6 +31,14 @@
 void *rs_alloc(size_t size, char const *name);
 void *rs_realloc(void *ptr, size_t size, char const *name);
 void *rs_alloc_struct0(size_t size, char const *name);
+void rs_free(void *ptr);
+
+/** Allocation size at or above which huge pages may be used. */
+#  define RS_HUGEPAGE_SIZE ((size_t)2 << 20)
+
+void *rs_alloc_huge(size_t size, char const *name);
+void *rs_alloc_huge0(size_t size, char const *name);
+void *rs_realloc_huge(void *ptr, size_t size, char const *name);
 
 void rs_bzero(void *buf, size_t size);
 
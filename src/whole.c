@@ -30,11 +30,16 @@
 #include "config.h"             /* IWYU pragma: keep */
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include "librsync.h"
+#include "largefile.h"
 #include "whole.h"
 #include "sumset.h"
 #include "job.h"
 #include "buf.h"
+#include "netint.h"
+#include "trace.h"
+#include "util.h"
 #include "librsync_export.h"
 
 /** Whole file IO buffer sizes. */
@@ -67,6 +72,14 @@ rs_result rs_whole_run(rs_job_t *job, FILE *in_file, FILE *out_file,
 rs_result rs_sig_file(FILE *old_file, FILE *sig_file, size_t block_len,
                       size_t strong_len, rs_magic_number sig_magic,
                       rs_stats_t *stats)
+{
+    return rs_sig_file_opts(old_file, sig_file, block_len, strong_len,
+                            sig_magic, NULL, stats);
+}
+
+rs_result rs_sig_file_opts(FILE *old_file, FILE *sig_file, size_t block_len,
+                           size_t strong_len, rs_magic_number sig_magic,
+                           rs_sig_opts_t const *opts, rs_stats_t *stats)
 {
     rs_job_t *job;
     rs_result r;
@@ -76,7 +89,7 @@ rs_result rs_sig_file(FILE *old_file, FILE *sig_file, size_t block_len,
          rs_sig_args(old_fsize, &sig_magic, &block_len,
                      &strong_len)) != RS_DONE)
         return r;
-    job = rs_sig_begin(block_len, strong_len, sig_magic);
+    job = rs_sig_begin_opts(block_len, strong_len, sig_magic, opts);
     /* Size inbuf for 4 blocks, outbuf for header + 4 blocksums. */
     r = rs_whole_run(job, old_file, sig_file, 4 * (int)block_len,
                      12 + 4 * (4 + (int)strong_len));
@@ -87,6 +100,57 @@ rs_result rs_sig_file(FILE *old_file, FILE *sig_file, size_t block_len,
     return r;
 }
 
+rs_result rs_sig_append(FILE *old_file, FILE *sig_file, rs_stats_t *stats)
+{
+    rs_byte_t head[12];
+    rs_long_t sig_fsize = rs_file_size(sig_file), count = 0;
+    rs_magic_number sig_magic;
+    size_t block_len, strong_len, sum_len;
+    rs_job_t *job;
+    rs_result r;
+
+    if (fread(head, 1, sizeof(head), sig_file) != sizeof(head)) {
+        rs_error("can't read signature header");
+        return ferror(sig_file) ? RS_IO_ERROR : RS_INPUT_ENDED;
+    }
+    sig_magic = (rs_magic_number)rs_get_netint(head, 4);
+    block_len = (size_t)rs_get_netint(head + 4, 4);
+    strong_len = (size_t)rs_get_netint(head + 8, 4);
+    sum_len = 4 + strong_len;
+    if (strong_len & RS_SIG_DIGEST_FLAG) {
+        rs_error("can't append to a signature with a digest of the file");
+        return RS_PARAM_ERROR;
+    } else if (strong_len & RS_SIG_CDC_FLAG) {
+        rs_error("can't append to a signature of content defined chunks");
+        return RS_PARAM_ERROR;
+    }
+    if (sig_fsize < 0) {
+        rs_error("can't append to a signature that isn't a regular file");
+        return RS_PARAM_ERROR;
+    }
+    if ((sig_fsize - 12) % (rs_long_t)sum_len) {
+        rs_error("signature length " FMT_LONG " isn't a whole number of "
+                 "block sums", sig_fsize);
+        return RS_CORRUPT;
+    }
+    /* Sum again from the last block, which might have been short. */
+    if ((count = (sig_fsize - 12) / (rs_long_t)sum_len))
+        count--;
+    if (fseek(old_file, count * (rs_long_t)block_len, SEEK_SET)
+        || fseek(sig_file, 12 + count * (rs_long_t)sum_len, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    rs_trace("appending to signature from block " FMT_LONG, count);
+    job = rs_sig_blocks_begin(block_len, strong_len, sig_magic);
+    r = rs_whole_run(job, old_file, sig_file, 4 * (int)block_len,
+                     4 * (4 + (int)strong_len));
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    return r;
+}
+
 rs_result rs_loadsig_file(FILE *sig_file, rs_signature_t **sumset,
                           rs_stats_t *stats)
 {
@@ -105,13 +169,77 @@ rs_result rs_loadsig_file(FILE *sig_file, rs_signature_t **sumset,
     return r;
 }
 
+/** Check if a new file is the same as the file a signature has a digest of.
+ *
+ * The length and first block are checked first, so most changed files are
+ * found without reading all of them. The new file is left at its start. */
+static rs_result rs_delta_file_same(rs_signature_t const *sig, FILE *new_file,
+                                    int *same)
+{
+    /* The first block of a signature of chunks is the first chunk. */
+    const size_t first_len = sig->cdc && sig->count ?
+        (size_t)sig->chunk_pos[1] : (size_t)sig->block_len;
+    const size_t buf_len = first_len > (1 << 16) ? first_len : (1 << 16);
+    rs_byte_t digest[RS_SIG_DIGEST_LEN], *buf;
+    rs_block_sig_t const *b;
+    rs_strong_sum_t strong_sum;
+    blake2b_state state;
+    size_t len;
+
+    *same = 0;
+    if (sig->file_len < 0 || rs_file_size(new_file) != sig->file_len
+        || ftell(new_file) != 0)
+        return RS_DONE;
+    buf = rs_alloc(buf_len, "same file buffer");
+    blake2b_init(&state, RS_SIG_DIGEST_LEN);
+    len = fread(buf, 1, first_len, new_file);
+    if (sig->count) {
+        b = rs_block_sig_ptr(sig, 0);
+        rs_signature_calc_strong_sum(sig, buf, len, &strong_sum);
+        if (rs_signature_calc_weak_sum(sig, buf, len) !=
+            rs_block_sig_weak_sum(sig, b)
+            || memcmp(strong_sum, b->strong_sum, (size_t)sig->strong_sum_len)) {
+            rs_trace("new file's first block differs from the basis");
+            goto out;
+        }
+    }
+    do
+        blake2b_update(&state, buf, len);
+    while ((len = fread(buf, 1, buf_len, new_file)));
+    if (ferror(new_file))
+        goto out;
+    blake2b_final(&state, digest, RS_SIG_DIGEST_LEN);
+    *same = !memcmp(digest, sig->digest, RS_SIG_DIGEST_LEN);
+    rs_trace("new file's digest %s the basis",
+             *same ? "matches" : "differs from");
+  out:
+    rs_free(buf);
+    clearerr(new_file);
+    if (!*same && fseek(new_file, 0, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
 rs_result rs_delta_file(rs_signature_t *sig, FILE *new_file, FILE *delta_file,
                         rs_stats_t *stats)
+{
+    return rs_delta_file_opts(sig, new_file, delta_file, NULL, stats);
+}
+
+rs_result rs_delta_file_opts(rs_signature_t *sig, FILE *new_file,
+                             FILE *delta_file, rs_delta_opts_t const *opts,
+                             rs_stats_t *stats)
 {
     rs_job_t *job;
     rs_result r;
+    int same;
 
-    job = rs_delta_begin(sig);
+    if ((r = rs_delta_file_same(sig, new_file, &same)) != RS_DONE)
+        return r;
+    job = same ? rs_delta_same_begin(sig, opts) :
+        rs_delta_begin_opts(sig, opts);
     /* Size inbuf for 4*(CMD + 1 block), outbuf for 4*CMD. */
     r = rs_whole_run(job, new_file, delta_file,
                      4 * (MAX_DELTA_CMD + sig->block_len), 4 * MAX_DELTA_CMD);
@@ -137,6 +265,211 @@ rs_result rs_patch_file(FILE *basis_file, FILE *delta_file, FILE *new_file,
     return r;
 }
 
+rs_result rs_patch_fd(int basis_fd, FILE *delta_file, FILE *new_file,
+                      rs_stats_t *stats)
+{
+    rs_fd_basis_t *basis;
+    rs_job_t *job;
+    rs_result r;
+
+    basis = rs_fd_basis_new(basis_fd, 0);
+    job = rs_patch_begin(rs_fd_copy_cb, basis);
+    /* Default size inbuf 1*CMD and outbuf 4*CMD. */
+    r = rs_whole_run(job, delta_file, new_file, MAX_DELTA_CMD,
+                     4 * MAX_DELTA_CMD);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    rs_fd_basis_free(basis);
+    return r;
+}
+
+rs_result rs_patch_chain_file(FILE *basis_file, FILE **delta_files, int count,
+                              FILE *new_file, rs_stats_t *stats)
+{
+    int fds[64];
+    rs_job_t *job;
+    rs_result r;
+    int i;
+
+    if (count < 1 || count > (int)(sizeof(fds) / sizeof(*fds)) + 1)
+        return RS_PARAM_ERROR;
+    for (i = 0; i < count - 1; i++)
+        fds[i] = fileno(delta_files[i]);
+    job = rs_patch_chain_begin(fds, count - 1, rs_file_copy_cb, basis_file);
+    /* Default size inbuf 1*CMD and outbuf 4*CMD. */
+    r = rs_whole_run(job, delta_files[count - 1], new_file, MAX_DELTA_CMD,
+                     4 * MAX_DELTA_CMD);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    return r;
+}
+
+/** A signature job fed the new file data as it passes through the buffers
+ * of another job. */
+typedef struct rs_sig_tee {
+    rs_filebuf_t *fb;           /**< The other job's file buffer. */
+    rs_byte_t *out_mark;        /**< The end of the output already signed. */
+    rs_job_t *sig_job;
+    rs_buffers_t sig_buf;
+    rs_filebuf_t *sig_fb;
+} rs_sig_tee_t;
+
+static rs_result rs_sig_tee_init(rs_sig_tee_t *tee, rs_long_t fsize,
+                                 FILE *sig_file, size_t block_len,
+                                 size_t strong_len, rs_magic_number sig_magic,
+                                 rs_sig_opts_t const *opts)
+{
+    rs_result r;
+
+    rs_bzero(tee, sizeof(*tee));
+    if ((r = rs_sig_args(fsize, &sig_magic, &block_len, &strong_len))
+        != RS_DONE)
+        return r;
+    tee->sig_job =
+        rs_sig_begin_opts(block_len, strong_len, sig_magic, opts);
+    /* Size outbuf for header + 4 blocksums, like rs_sig_file(). */
+    tee->sig_fb = rs_filebuf_new(sig_file, rs_outbuflen ? rs_outbuflen :
+                                 12 + 4 * (4 + (int)strong_len));
+    return RS_DONE;
+}
+
+static void rs_sig_tee_free(rs_sig_tee_t *tee)
+{
+    if (tee->sig_job)
+        rs_job_free(tee->sig_job);
+    if (tee->sig_fb)
+        rs_filebuf_free(tee->sig_fb);
+    if (tee->fb)
+        rs_filebuf_free(tee->fb);
+}
+
+/** Feed len bytes of the new file to the signature job. */
+static rs_result rs_sig_tee_feed(rs_sig_tee_t *tee, char const *data,
+                                 size_t len, int eof)
+{
+    rs_buffers_t *buf = &tee->sig_buf;
+    rs_result result, iores;
+
+    buf->next_in = (char *)data;
+    buf->avail_in = len;
+    buf->eof_in = eof;
+    do {
+        result = rs_job_iter(tee->sig_job, buf);
+        if (result != RS_DONE && result != RS_BLOCKED)
+            return result;
+        if ((iores = rs_outfilebuf_drain(tee->sig_job, buf, tee->sig_fb))
+            != RS_DONE)
+            return iores;
+    } while (result == RS_BLOCKED && (buf->avail_in || eof));
+    return RS_DONE;
+}
+
+/** Fill the input of a delta job from the new file, signing what's read. */
+static rs_result rs_sig_tee_fill(rs_job_t *job, rs_buffers_t *buf,
+                                 void *opaque)
+{
+    rs_sig_tee_t *tee = (rs_sig_tee_t *)opaque;
+    size_t old_avail = buf->avail_in;
+    rs_result result;
+
+    /* Any new data is read in after what's left over. */
+    if ((result = rs_infilebuf_fill(job, buf, tee->fb)) != RS_DONE
+        || buf->avail_in <= old_avail)
+        return result;
+    return rs_sig_tee_feed(tee, buf->next_in + old_avail,
+                           buf->avail_in - old_avail, 0);
+}
+
+/** Drain the output of a patch job to the new file, signing what's
+ * written. */
+static rs_result rs_sig_tee_drain(rs_job_t *job, rs_buffers_t *buf,
+                                  void *opaque)
+{
+    rs_sig_tee_t *tee = (rs_sig_tee_t *)opaque;
+    rs_byte_t *out = (rs_byte_t *)buf->next_out;
+    rs_result result;
+
+    if (out && out > tee->out_mark
+        && (result = rs_sig_tee_feed(tee, (char *)tee->out_mark,
+                                     (size_t)(out - tee->out_mark), 0))
+        != RS_DONE)
+        return result;
+    result = rs_outfilebuf_drain(job, buf, tee->fb);
+    tee->out_mark = (rs_byte_t *)buf->next_out;
+    return result;
+}
+
+rs_result rs_delta_sig_file(rs_signature_t *sig, FILE *new_file,
+                            FILE *delta_file, rs_delta_opts_t const *opts,
+                            FILE *sig_file,
+                            size_t block_len, size_t strong_len,
+                            rs_magic_number sig_magic,
+                            rs_sig_opts_t const *sig_opts, rs_stats_t *stats)
+{
+    rs_sig_tee_t tee;
+    rs_buffers_t buf;
+    rs_filebuf_t *out_fb;
+    rs_job_t *job;
+    rs_result r;
+
+    if ((r = rs_sig_tee_init(&tee, rs_file_size(new_file), sig_file,
+                             block_len, strong_len, sig_magic, sig_opts))
+        != RS_DONE)
+        return r;
+    job = rs_delta_begin_opts(sig, opts);
+    /* Size inbuf for 4*(CMD + 1 block), outbuf for 4*CMD. */
+    tee.fb = rs_filebuf_new(new_file, rs_inbuflen ? rs_inbuflen :
+                            4 * (MAX_DELTA_CMD + sig->block_len));
+    out_fb = rs_filebuf_new(delta_file, rs_outbuflen ? rs_outbuflen :
+                            4 * MAX_DELTA_CMD);
+    r = rs_job_drive(job, &buf, rs_sig_tee_fill, &tee, rs_outfilebuf_drain,
+                     out_fb);
+    if (r == RS_DONE)
+        r = rs_sig_tee_feed(&tee, NULL, 0, 1);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    rs_filebuf_free(out_fb);
+    rs_sig_tee_free(&tee);
+    return r;
+}
+
+rs_result rs_patch_sig_file(FILE *basis_file, FILE *delta_file,
+                            FILE *new_file, FILE *sig_file, size_t block_len,
+                            size_t strong_len, rs_magic_number sig_magic,
+                            rs_sig_opts_t const *opts, rs_stats_t *stats)
+{
+    rs_sig_tee_t tee;
+    rs_buffers_t buf;
+    rs_filebuf_t *in_fb;
+    rs_job_t *job;
+    rs_result r;
+
+    /* The new file is usually about the size of the basis. */
+    if ((r = rs_sig_tee_init(&tee, rs_file_size(basis_file), sig_file,
+                             block_len, strong_len, sig_magic, opts))
+        != RS_DONE)
+        return r;
+    job = rs_patch_begin(rs_file_copy_cb, basis_file);
+    /* Default size inbuf 1*CMD and outbuf 4*CMD. */
+    in_fb = rs_filebuf_new(delta_file, rs_inbuflen ? rs_inbuflen :
+                           MAX_DELTA_CMD);
+    tee.fb = rs_filebuf_new(new_file, rs_outbuflen ? rs_outbuflen :
+                            4 * MAX_DELTA_CMD);
+    r = rs_job_drive(job, &buf, rs_infilebuf_fill, in_fb, rs_sig_tee_drain,
+                     &tee);
+    if (r == RS_DONE)
+        r = rs_sig_tee_feed(&tee, NULL, 0, 1);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    rs_filebuf_free(in_fb);
+    rs_sig_tee_free(&tee);
+    return r;
+}
+
 rs_result rs_rdiff_sig(char *basis_name, char *sig_name, size_t block_len)
 {
     FILE *basis_file, *sig_file;
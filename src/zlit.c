@@ -0,0 +1,236 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file zlit.c
+ * Compressing and decompressing LITERAL data with zlib. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdlib.h>
+#ifdef HAVE_ZLIB_H
+#  include <zlib.h>
+#endif
+#include "librsync.h"
+#include "zlit.h"
+#include "trace.h"
+#include "util.h"
+
+#ifdef HAVE_ZLIB_H
+
+/** Raw deflate streams with the max window, without zlib headers. */
+#  define RS_ZLIT_WBITS (-MAX_WBITS)
+
+/** The min length of data worth compressing.
+ *
+ * Each compression resets the deflate state, which clears its hash table,
+ * so this also keeps that from costing much more than compressing. */
+#  define RS_ZLIT_MIN 128
+
+struct rs_zlit {
+    z_stream zs;
+    int deflate;                /**< Whether this compresses. */
+    int level;                  /**< The zlib level for compressing. */
+    rs_byte_t *buf;             /**< The compressed data. */
+    size_t size;                /**< The allocated size of buf. */
+};
+
+rs_zlit_t *rs_zlit_deflater(int level)
+{
+    rs_zlit_t *z = rs_alloc_struct(rs_zlit_t);
+
+    z->deflate = 1;
+    z->level = level;
+    if (deflateInit2(&z->zs, level, Z_DEFLATED, RS_ZLIT_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        rs_error("can't make compressor with level %d", level);
+        rs_free(z);
+        return NULL;
+    }
+    return z;
+}
+
+rs_zlit_t *rs_zlit_inflater(void)
+{
+    rs_zlit_t *z = rs_alloc_struct(rs_zlit_t);
+
+    if (inflateInit2(&z->zs, RS_ZLIT_WBITS) != Z_OK) {
+        rs_error("can't make decompressor");
+        rs_free(z);
+        return NULL;
+    }
+    return z;
+}
+
+rs_zlit_t *rs_zlit_deflater_renew(rs_zlit_t *z, int level)
+{
+    if (!z || !z->deflate) {
+        rs_zlit_free(z);
+        return rs_zlit_deflater(level);
+    }
+    deflateReset(&z->zs);
+    if (level != z->level
+        && deflateParams(&z->zs, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+        rs_error("can't set compressor level %d", level);
+        rs_zlit_free(z);
+        return NULL;
+    }
+    z->level = level;
+    return z;
+}
+
+rs_zlit_t *rs_zlit_inflater_renew(rs_zlit_t *z)
+{
+    if (!z || z->deflate) {
+        rs_zlit_free(z);
+        return rs_zlit_inflater();
+    }
+    inflateReset(&z->zs);
+    return z;
+}
+
+void rs_zlit_free(rs_zlit_t *z)
+{
+    if (!z)
+        return;
+    if (z->deflate)
+        deflateEnd(&z->zs);
+    else
+        inflateEnd(&z->zs);
+    rs_free(z->buf);
+    rs_free(z);
+}
+
+size_t rs_zlit_compress(rs_zlit_t *z, void const *dict, size_t dict_len,
+                        void const *buf, size_t len, rs_byte_t const **out)
+{
+    size_t bound = deflateBound(&z->zs, (uLong)len);
+
+    if (len < RS_ZLIT_MIN)
+        return 0;
+    if (bound > z->size) {
+        z->size = bound;
+        z->buf = rs_realloc(z->buf, z->size, "compressed literal buffer");
+    }
+    deflateReset(&z->zs);
+    if (dict_len)
+        deflateSetDictionary(&z->zs, (Bytef const *)dict, (uInt)dict_len);
+    z->zs.next_in = (Bytef *)buf;
+    z->zs.avail_in = (uInt)len;
+    z->zs.next_out = z->buf;
+    z->zs.avail_out = (uInt)z->size;
+    if (deflate(&z->zs, Z_FINISH) != Z_STREAM_END
+        || z->zs.total_out >= len) {
+        rs_trace("literal of " FMT_SIZE " bytes doesn't compress", len);
+        return 0;
+    }
+    *out = z->buf;
+    return (size_t)z->zs.total_out;
+}
+
+void rs_zlit_start(rs_zlit_t *z, void const *dict, size_t dict_len)
+{
+    inflateReset(&z->zs);
+    if (dict_len)
+        inflateSetDictionary(&z->zs, (Bytef const *)dict, (uInt)dict_len);
+}
+
+rs_result rs_zlit_inflate(rs_zlit_t *z, void const *in, size_t *in_len,
+                          void *out, size_t *out_len)
+{
+    int ret;
+
+    z->zs.next_in = (Bytef *)in;
+    z->zs.avail_in = (uInt)*in_len;
+    z->zs.next_out = (Bytef *)out;
+    z->zs.avail_out = (uInt)*out_len;
+    ret = inflate(&z->zs, Z_NO_FLUSH);
+    *in_len -= z->zs.avail_in;
+    *out_len -= z->zs.avail_out;
+    if (ret == Z_STREAM_END)
+        return RS_DONE;
+    else if (ret == Z_OK)
+        return RS_RUNNING;
+    else if (ret == Z_BUF_ERROR)
+        return RS_BLOCKED;
+    rs_error("bad compressed literal data: %s",
+             z->zs.msg ? z->zs.msg : "unknown error");
+    return RS_CORRUPT;
+}
+
+#else                           /* !HAVE_ZLIB_H */
+
+rs_zlit_t *rs_zlit_deflater(int level)
+{
+    (void)level;
+    return NULL;
+}
+
+rs_zlit_t *rs_zlit_inflater(void)
+{
+    return NULL;
+}
+
+rs_zlit_t *rs_zlit_deflater_renew(rs_zlit_t *z, int level)
+{
+    (void)z;
+    (void)level;
+    return NULL;
+}
+
+rs_zlit_t *rs_zlit_inflater_renew(rs_zlit_t *z)
+{
+    (void)z;
+    return NULL;
+}
+
+void rs_zlit_free(rs_zlit_t *z)
+{
+    (void)z;
+}
+
+size_t rs_zlit_compress(rs_zlit_t *z, void const *dict, size_t dict_len,
+                        void const *buf, size_t len, rs_byte_t const **out)
+{
+    (void)z;
+    (void)dict;
+    (void)dict_len;
+    (void)buf;
+    (void)len;
+    (void)out;
+    return 0;
+}
+
+void rs_zlit_start(rs_zlit_t *z, void const *dict, size_t dict_len)
+{
+    (void)z;
+    (void)dict;
+    (void)dict_len;
+}
+
+rs_result rs_zlit_inflate(rs_zlit_t *z, void const *in, size_t *in_len,
+                          void *out, size_t *out_len)
+{
+    (void)z;
+    (void)in;
+    (void)in_len;
+    (void)out;
+    (void)out_len;
+    return RS_UNIMPLEMENTED;
+}
+
+#endif                          /* !HAVE_ZLIB_H */
@@ -0,0 +1,93 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file zlit.h
+ * Compressed LITERAL data.
+ *
+ * The data of each ZLITERAL command is a separate raw deflate stream, so
+ * every command can be decompressed on its own. Without zlib the
+ * compressors and decompressors can't be made, and deltas are made with
+ * plain LITERAL commands.
+ *
+ * After a PRIME command, each stream is primed with a dictionary of the new
+ * file data before it, like rsync does with the data skipped by matches.
+ * The delta and patch both have that data, so it costs nothing to send. */
+#ifndef ZLIT_H
+#  define ZLIT_H
+
+#  include <stddef.h>
+#  include "librsync.h"
+
+/** The max length of the dictionary, which is the deflate window size. */
+#  define RS_ZLIT_WINDOW ((size_t)32 << 10)
+
+typedef struct rs_zlit rs_zlit_t;
+
+/** Get the dictionary length for a command of len bytes, with history_len
+ * bytes of new file data before it.
+ *
+ * Setting the dictionary costs about as much as compressing it, so it's
+ * limited to a multiple of the data length. */
+static inline size_t rs_zlit_dict_len(size_t len, size_t history_len)
+{
+    size_t dict_len = len < RS_ZLIT_WINDOW / 16 ? 16 * len : RS_ZLIT_WINDOW;
+
+    return dict_len < history_len ? dict_len : history_len;
+}
+
+/** Make a compressor with a zlib level, or return NULL without zlib. */
+rs_zlit_t *rs_zlit_deflater(int level);
+
+/** Make a decompressor, or return NULL without zlib. */
+rs_zlit_t *rs_zlit_inflater(void);
+
+/** Make a compressor like rs_zlit_deflater(), reusing z if it is one.
+ *
+ * z can be NULL, and is freed if it isn't reused. */
+rs_zlit_t *rs_zlit_deflater_renew(rs_zlit_t *z, int level);
+
+/** Make a decompressor like rs_zlit_inflater(), reusing z if it is one.
+ *
+ * z can be NULL, and is freed if it isn't reused. */
+rs_zlit_t *rs_zlit_inflater_renew(rs_zlit_t *z);
+
+void rs_zlit_free(rs_zlit_t *z);
+
+/** Compress len bytes of LITERAL data, primed with dict_len bytes of dict.
+ *
+ * \return The compressed length, with *out set to the compressed data which
+ * is valid until the next call, or 0 if it isn't smaller than len. */
+size_t rs_zlit_compress(rs_zlit_t *z, void const *dict, size_t dict_len,
+                        void const *buf, size_t len, rs_byte_t const **out);
+
+/** Start decompressing the data for a new command, primed with dict_len
+ * bytes of dict. */
+void rs_zlit_start(rs_zlit_t *z, void const *dict, size_t dict_len);
+
+/** Decompress some of the data for a command.
+ *
+ * On return *in_len and *out_len are set to the amounts used and made.
+ *
+ * \return RS_DONE at the end of the command's data, RS_RUNNING if there may
+ * be more, RS_BLOCKED if no progress can be made without more input or
+ * output space, or RS_CORRUPT if the data is bad. */
+rs_result rs_zlit_inflate(rs_zlit_t *z, void const *in, size_t *in_len,
+                          void *out, size_t *out_len);
+
+#endif                          /* !ZLIT_H */
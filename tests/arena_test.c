@@ -0,0 +1,107 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * arena_test -- tests for custom allocators and arenas.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+#include "util.h"
+
+/* Count allocations and frees done by a wrapped allocator. */
+static int allocs, frees;
+
+static void *count_alloc(void *opaque, size_t size)
+{
+    rs_allocator_t const *a = opaque;
+
+    allocs++;
+    return a->alloc(a->opaque, size);
+}
+
+static void count_free(void *opaque, void *ptr, size_t size)
+{
+    rs_allocator_t const *a = opaque;
+
+    frees++;
+    a->free(a->opaque, ptr, size);
+}
+
+int main(int argc, char **argv)
+{
+    rs_arena_t *arena = rs_arena_new(4096);
+    rs_allocator_t counter =
+        { count_alloc, count_free, (void *)rs_arena_allocator(arena) };
+    char *p, *q, *r;
+    int i;
+
+    /* Default heap allocations work with no allocator set. */
+    assert(rs_set_allocator(NULL) == NULL);
+    p = rs_alloc(100, "p");
+    p = rs_realloc(p, 1000, "p");
+    rs_free(p);
+    rs_free(NULL);
+
+    /* Allocations come from the current allocator. */
+    assert(rs_set_allocator(&counter) == NULL);
+    p = rs_alloc(100, "p");
+    memset(p, 'p', 100);
+    assert(allocs == 1);
+    /* Freed memory is reused for the same size class. */
+    rs_free(p);
+    assert(frees == 1);
+    q = rs_alloc(90, "q");
+    assert(q == p);
+    /* Reallocating copies the data to a new block. */
+    memset(q, 'q', 90);
+    r = rs_realloc(q, 10000, "r");
+    assert(r != q);
+    for (i = 0; i < 90; i++)
+        assert(r[i] == 'q');
+    assert(allocs == 3 && frees == 2);
+    /* Zeroed and huge allocations come from the allocator too. */
+    rs_hugepages = 1;
+    p = rs_alloc_huge0(3 << 20, "huge");
+    assert(p[0] == 0 && p[(3 << 20) - 1] == 0);
+    assert(allocs == 4);
+    rs_hugepages = 0;
+
+    /* Memory goes back to its own allocator after switching. */
+    assert(rs_set_allocator(NULL) == &counter);
+    rs_free(p);
+    rs_free(r);
+    assert(frees == 4);
+    q = rs_alloc(100, "q");
+    rs_free(q);
+    assert(allocs == 4 && frees == 4);
+
+    /* After a reset the arena hands out the same memory again. */
+    rs_arena_reset(arena);
+    rs_set_allocator(&counter);
+    p = rs_alloc(1000, "p");
+    rs_arena_reset(arena);
+    q = rs_alloc(1000, "q");
+    assert(q == p);
+    rs_set_allocator(NULL);
+    /* Sizes too big for any size class fail. */
+    assert(!count_alloc(counter.opaque, (size_t)-1));
+    rs_arena_free(arena);
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * buzhash_test -- tests for the buzhash checksum.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <assert.h>
+#include "buzhash.h"
+
+int main(int argc, char **argv)
+{
+    buzhash_t r;
+    int i;
+    unsigned char buf[256];
+    uint32_t sum;
+
+    /* Test buzhash_init() */
+    buzhash_init(&r);
+    assert(r.count == 0);
+    assert(r.hash == 0);
+    assert(buzhash_digest(&r) == 0x00000000);
+
+    /* Test buzhash_rollin() */
+    buzhash_rollin(&r, 0);      /* [0] */
+    assert(r.count == 1);
+    assert(buzhash_digest(&r) == 0xac0761b1);
+    buzhash_rollin(&r, 1);
+    buzhash_rollin(&r, 2);
+    buzhash_rollin(&r, 3);      /* [0,1,2,3] */
+    assert(r.count == 4);
+    assert(buzhash_digest(&r) == 0x63d64beb);
+
+    /* Test buzhash_rotate() */
+    buzhash_rotate(&r, 0, 4);   /* [1,2,3,4] */
+    assert(r.count == 4);
+    assert(buzhash_digest(&r) == 0x41aaef38);
+    buzhash_rotate(&r, 1, 5);
+    buzhash_rotate(&r, 2, 6);
+    buzhash_rotate(&r, 3, 7);   /* [4,5,6,7] */
+    assert(r.count == 4);
+    assert(buzhash_digest(&r) == 0x4556c8ee);
+
+    /* Test buzhash_rollout() */
+    buzhash_rollout(&r, 4);     /* [5,6,7] */
+    assert(r.count == 3);
+    assert(buzhash_digest(&r) == 0x76d5d74c);
+    buzhash_rollout(&r, 5);
+    buzhash_rollout(&r, 6);
+    buzhash_rollout(&r, 7);     /* [] */
+    assert(r.count == 0);
+    assert(buzhash_digest(&r) == 0x00000000);
+
+    /* Test buzhash_update() */
+    for (i = 0; i < 256; i++)
+        buf[i] = (unsigned char)i;
+    buzhash_update(&r, buf, 256);
+    assert(buzhash_digest(&r) == 0xf3de08a0);
+
+    /* Test buzhash_rotate() with more bytes than the 32 bit rotations. */
+    buzhash_init(&r);
+    buzhash_update(&r, buf, 100);
+    for (i = 100; i < 256; i++)
+        buzhash_rotate(&r, buf[i - 100], buf[i]);
+    sum = buzhash_digest(&r);
+    buzhash_init(&r);
+    buzhash_update(&r, buf + 156, 100);
+    assert(buzhash_digest(&r) == sum);
+    return 0;
+}
@@ -133,9 +133,45 @@ int main(int argc, char **argv)
     assert(weaksum_count(&r) == 0);
     assert(weaksum_digest(&r) == 0x00000001);
 
+    /* RS_BUZHASH weaksum tests. */
+
+    /* Test weaksum_init(). */
+    weaksum_init(&r, RS_BUZHASH);
+    assert(r.kind == RS_BUZHASH);
+    assert(weaksum_count(&r) == 0);
+    assert(weaksum_digest(&r) == 0x00000000);
+
+    /* Test weaksum_rollin() */
+    weaksum_rollin(&r, 0);      /* [0] */
+    assert(weaksum_count(&r) == 1);
+    assert(weaksum_digest(&r) == 0xac0761b1);
+    weaksum_rollin(&r, 1);
+    weaksum_rollin(&r, 2);
+    weaksum_rollin(&r, 3);      /* [0,1,2,3] */
+    assert(weaksum_count(&r) == 4);
+    assert(weaksum_digest(&r) == 0x63d64beb);
+
+    /* Test weaksum_rotate() */
+    weaksum_rotate(&r, 0, 4);   /* [1,2,3,4] */
+    assert(weaksum_count(&r) == 4);
+    assert(weaksum_digest(&r) == 0x41aaef38);
+
+    /* Test weaksum_rollout() */
+    weaksum_rollout(&r, 1);     /* [2,3,4] */
+    weaksum_rollout(&r, 2);
+    weaksum_rollout(&r, 3);
+    weaksum_rollout(&r, 4);     /* [] */
+    assert(weaksum_count(&r) == 0);
+    assert(weaksum_digest(&r) == 0x00000000);
+
+    /* Test weaksum_update() */
+    weaksum_update(&r, buf, 256);
+    assert(weaksum_digest(&r) == 0xf3de08a0);
+
     /* Test rs_calc_weaksum() */
     assert(rs_calc_weak_sum(RS_ROLLSUM, buf, 256) == 0x3a009e80);
     assert(rs_calc_weak_sum(RS_RABINKARP, buf, 256) == 0xc1972381);
+    assert(rs_calc_weak_sum(RS_BUZHASH, buf, 256) == 0xf3de08a0);
 
     /* Test rs_calc_strongsum() */
     rs_strong_sum_t sum;
@@ -173,6 +173,51 @@ int main(int argc, char **argv)
         count++;
     }
     assert(count == 258);
+
+    /* Test myhashtable_remove() */
+    assert(myhashtable_remove(t, &e) == &e);
+    assert(myhashtable_remove(t, &e) == NULL);  /* Already removed. */
+    assert(t->count == 257 && t->removed == 1);
+    mymatch_init(&m, 0);
+    assert(myhashtable_find(t, &m) == &entry[0]);       /* Finds the other
+                                                           duplicate. */
+    for (i = 0; i < 256; i += 2)
+        assert(myhashtable_remove(t, &entry[i]) == &entry[i]);
+    /* The duplicated instance of entry[0] is still there. */
+    assert(t->count == 129 && t->removed == 129);
+    for (i = 0; i < 256; i++) {
+        mymatch_init(&m, i);
+        assert(myhashtable_find(t, &m) == (i % 2 || !i ? &entry[i] : NULL));
+    }
+    /* Adding again reuses the removed buckets. */
+    for (i = 0; i < 256; i += 2)
+        assert(myhashtable_add(t, &entry[i]) == &entry[i]);
+    assert(t->count == 257 && t->removed == 1);
+
+    /* Test myhashtable_resize() */
+    assert(!hashtable_full(t));
+    for (i = 0; i < 256; i += 2)
+        assert(myhashtable_remove(t, &entry[i]) == &entry[i]);
+    t = myhashtable_resize(t, 1000);
+    assert(t->size == 2048);
+    assert(t->count == 129 && t->removed == 0);
+    for (i = 0; i < 256; i++) {
+        mymatch_init(&m, i);
+        assert(myhashtable_find(t, &m) == (i % 2 || !i ? &entry[i] : NULL));
+    }
+    /* Grow the table online as entries are added. */
+    t = myhashtable_resize(t, t->count);
+    assert(t->count == 129);
+    for (i = 0; i < 256; i += 2) {
+        if (hashtable_full(t))
+            t = myhashtable_resize(t, 2 * t->count);
+        assert(myhashtable_add(t, &entry[i]) == &entry[i]);
+    }
+    assert(t->count == 257 && !hashtable_full(t));
+    for (i = 0; i < 256; i++) {
+        mymatch_init(&m, i);
+        assert(myhashtable_find(t, &m) == &entry[i]);
+    }
     myhashtable_free(t);
 
     return 0;
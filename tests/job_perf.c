@@ -0,0 +1,175 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * job_perf -- performance tests for reusing jobs on many small files.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Usage: job_perf [FILES [SIZE]]
+ *
+ * Runs signature, loadsig, delta, and patch jobs for FILES (default 100000)
+ * small files of SIZE (default 4096) bytes each, feeding input in small
+ * pieces like a network stream so the jobs need their scoop buffers. This is
+ * done first with new jobs for every file, and then reusing one job of each
+ * kind with the rs_*_reset() functions. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include "librsync.h"
+
+/* Size of the pieces input is fed to jobs in. */
+#define PIECE 1000
+
+static uint32_t rand_state = 0x12345678;
+
+/* A simple xorshift PRNG so results are repeatable. */
+static uint32_t rand32(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+typedef struct {
+    char const *data;
+    size_t len;
+} mem_t;
+
+static rs_result mem_copy(void *opaque, rs_long_t pos, size_t *len, void **buf)
+{
+    mem_t *m = opaque;
+
+    if (pos >= (rs_long_t)m->len)
+        return RS_INPUT_ENDED;
+    if (*len > m->len - pos)
+        *len = m->len - pos;
+    *buf = (void *)(m->data + pos);
+    return RS_DONE;
+}
+
+/* Run a job feeding it input in pieces, and return the output length. */
+static size_t drive(rs_job_t *job, char const *in, size_t in_len, char *out,
+                    size_t out_len)
+{
+    rs_buffers_t buf;
+    rs_result result;
+    size_t piece;
+
+    buf.next_out = out;
+    buf.avail_out = out_len;
+    buf.avail_in = 0;
+    do {
+        if (!buf.avail_in) {
+            piece = in_len < PIECE ? in_len : PIECE;
+            buf.next_in = (char *)in;
+            buf.avail_in = piece;
+            in += piece;
+            in_len -= piece;
+        }
+        buf.eof_in = !in_len;
+        result = rs_job_iter(job, &buf);
+    } while (result == RS_BLOCKED);
+    if (result != RS_DONE) {
+        fprintf(stderr, "job failed: %s\n", rs_strerror(result));
+        exit(1);
+    }
+    return out_len - buf.avail_out;
+}
+
+static double run(int files, size_t size, int reuse)
+{
+    char *old = malloc(size), *new = malloc(size), *sig = malloc(size),
+        *delta = malloc(2 * size), *out = malloc(size);
+    rs_job_t *sig_job = NULL, *load_job = NULL, *delta_job = NULL,
+        *patch_job = NULL;
+    rs_signature_t *sumset;
+    size_t i, sig_len, delta_len;
+    mem_t basis;
+    clock_t start;
+    int f;
+
+    rand_state = 0x12345678;
+    start = clock();
+    for (f = 0; f < files; f++) {
+        for (i = 0; i < size; i += 4)
+            *(uint32_t *)(old + i) = rand32();
+        memcpy(new, old, size);
+        new[rand32() % size] ^= 1;
+        if (reuse && sig_job) {
+            rs_sig_reset(sig_job, 512, 8, RS_RK_BLAKE2_SIG_MAGIC);
+            rs_loadsig_reset(load_job, &sumset);
+        } else {
+            sig_job = rs_sig_begin(512, 8, RS_RK_BLAKE2_SIG_MAGIC);
+            load_job = rs_loadsig_begin(&sumset);
+        }
+        sig_len = drive(sig_job, old, size, sig, size);
+        drive(load_job, sig, sig_len, NULL, 0);
+        rs_build_hash_table(sumset);
+        basis.data = old;
+        basis.len = size;
+        if (reuse && delta_job) {
+            rs_delta_reset(delta_job, sumset);
+            rs_patch_reset(patch_job, mem_copy, &basis);
+        } else {
+            delta_job = rs_delta_begin(sumset);
+            patch_job = rs_patch_begin(mem_copy, &basis);
+        }
+        delta_len = drive(delta_job, new, size, delta, 2 * size);
+        if (drive(patch_job, delta, delta_len, out, size) != size
+            || memcmp(out, new, size)) {
+            fprintf(stderr, "patch output does not match\n");
+            exit(1);
+        }
+        rs_free_sumset(sumset);
+        if (!reuse) {
+            rs_job_free(sig_job);
+            rs_job_free(load_job);
+            rs_job_free(delta_job);
+            rs_job_free(patch_job);
+        }
+    }
+    start = clock() - start;
+    if (reuse) {
+        rs_job_free(sig_job);
+        rs_job_free(load_job);
+        rs_job_free(delta_job);
+        rs_job_free(patch_job);
+    }
+    free(old);
+    free(new);
+    free(sig);
+    free(delta);
+    free(out);
+    return (double)start / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+    int files = argc > 1 ? atoi(argv[1]) : 100000;
+    size_t size = argc > 2 ? (size_t)atol(argv[2]) : 4096;
+    double t;
+
+    size &= ~(size_t)3;
+    printf("%d files of %lu bytes:\n", files, (unsigned long)size);
+    t = run(files, size, 0);
+    printf("new jobs:    %.3fs, %.0f files/s\n", t, files / t);
+    t = run(files, size, 1);
+    printf("reused jobs: %.3fs, %.0f files/s\n", t, files / t);
+    return 0;
+}
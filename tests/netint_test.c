@@ -22,12 +22,17 @@
 #undef NDEBUG
 #include <assert.h>
 #include <stdint.h>
+#include <string.h>
 #include "librsync.h"
 #include "netint.h"
 
 /* Test driver for netint. */
 int main(int argc, char **argv)
 {
+    rs_byte_t buf[RS_MAX_VARINT_BYTES + 1];
+    rs_long_t val, got;
+    int i, len;
+
     assert(rs_int_len((rs_long_t)0) == 1);
     assert(rs_int_len((rs_long_t)1) == 1);
     assert(rs_int_len((rs_long_t)INT8_MAX) == 1);
@@ -44,5 +49,29 @@ int main(int argc, char **argv)
     assert(rs_int_len((rs_long_t)1 << 32) == 8);
     assert(rs_int_len((rs_long_t)INT64_MAX) == 8);
 #endif
+    assert(rs_varint_len((rs_long_t)0) == 1);
+    assert(rs_varint_len((rs_long_t)127) == 1);
+    assert(rs_varint_len((rs_long_t)128) == 2);
+    assert(rs_varint_len((rs_long_t)16383) == 2);
+    assert(rs_varint_len((rs_long_t)16384) == 3);
+    for (i = 0; i < 2 * 63; i++) {
+        val = ((rs_long_t)1 << i / 2) - i % 2;
+        len = rs_varint_put(buf, val);
+        assert(len == rs_varint_len(val));
+        assert(len <= RS_MAX_VARINT_BYTES);
+        assert(rs_varint_get(buf, (size_t)len, &got) == len && got == val);
+        assert(rs_varint_get(buf, (size_t)len - 1, &got) == 0);
+    }
+    buf[0] = 0x96;
+    buf[1] = 0x01;
+    assert(rs_varint_get(buf, 2, &got) == 2 && got == 150);
+    memset(buf, 0xff, sizeof(buf));
+    assert(rs_varint_get(buf, sizeof(buf), &got) == -1);
+    assert(rs_zigzag(0) == 0);
+    assert(rs_zigzag(-1) == 1);
+    assert(rs_zigzag(1) == 2);
+    assert(rs_zigzag(-2) == 3);
+    assert(rs_unzigzag(rs_zigzag(-123456789)) == -123456789);
+    assert(rs_unzigzag(rs_zigzag(123456789)) == 123456789);
     return 0;
 }
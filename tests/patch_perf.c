@@ -0,0 +1,203 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * patch_perf -- performance tests for applying deltas with many COPYs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Usage: patch_perf [COPIES [LEN [cold]]]
+ *
+ * Writes a delta of COPIES (default 200000) COPY commands of LEN (default
+ * 200) bytes each against a random basis, and times applying it with
+ * rs_patch_file(), rs_patch_fd(), rs_patch_mmap(), rs_patch_fds(),
+ * rs_patch_ahead() with io_uring and with threads, and rs_patch_parallel()
+ * with 4 threads. This is done for a delta
+ * where the COPYs are close together in order, like an old file with small
+ * scattered edits, and for one where they are spread randomly across the
+ * basis. The output of each is checked against rs_patch_file().
+ *
+ * With "cold" the basis is dropped from the page cache before each run where
+ * the platform supports it, and the elapsed time is measured instead of the
+ * CPU time. This needs the basis in a real filesystem, so set TMPDIR to
+ * somewhere that isn't tmpfs. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#  include <fcntl.h>
+#endif
+#include "librsync.h"
+
+/* Opcodes from prototab.h for the delta commands we write. */
+#define OP_COPY_N4_N2 0x4e
+#define OP_END 0
+
+static char const *mode_names[] = {
+    "rs_patch_file", "rs_patch_fd", "rs_patch_mmap", "rs_patch_fds",
+    "rs_patch_ahead (io_uring)", "rs_patch_ahead (threads)",
+    "rs_patch_parallel (4 threads)"
+};
+
+#define MODES (int)(sizeof(mode_names) / sizeof(*mode_names))
+
+static int cold = 0;
+
+static uint32_t rand_state = 0x12345678;
+
+/* A simple xorshift PRNG so results are repeatable. */
+static uint32_t rand32(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static void put_netint(FILE *f, uint32_t v, int len)
+{
+    while (len--)
+        putc((v >> (8 * len)) & 0xff, f);
+}
+
+/* Write a delta of COPY commands, either sequential or random. */
+static void write_delta(FILE *delta, long copies, int len, uint32_t basis_len,
+                        int random)
+{
+    uint32_t pos = 0;
+    long i;
+
+    rewind(delta);
+    put_netint(delta, RS_DELTA_MAGIC, 4);
+    for (i = 0; i < copies; i++) {
+        if (random)
+            pos = rand32() % (basis_len - len);
+        putc(OP_COPY_N4_N2, delta);
+        put_netint(delta, pos, 4);
+        put_netint(delta, len, 2);
+        /* Skip a few bytes as if they had been edited. */
+        pos += len + rand32() % 16;
+    }
+    putc(OP_END, delta);
+    fflush(delta);
+}
+
+/* Get the time in seconds, elapsed for cold runs or else CPU time. */
+static double now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (cold && !clock_gettime(CLOCK_MONOTONIC, &ts))
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/* Check the whole output matches the reference output. */
+static void check(FILE *out, FILE *ref)
+{
+    static char out_buf[65536], ref_buf[65536];
+    size_t out_len, ref_len;
+
+    rewind(out);
+    rewind(ref);
+    do {
+        out_len = fread(out_buf, 1, sizeof(out_buf), out);
+        ref_len = fread(ref_buf, 1, sizeof(ref_buf), ref);
+        if (out_len != ref_len || memcmp(out_buf, ref_buf, ref_len)) {
+            fprintf(stderr, "patch output does not match\n");
+            exit(1);
+        }
+    } while (ref_len);
+}
+
+static double run(FILE *basis, FILE *delta, FILE *out, int mode)
+{
+    rs_stats_t stats;
+    rs_result result;
+    double start;
+
+    rewind(basis);
+    rewind(delta);
+    rewind(out);
+#if defined(HAVE_UNISTD_H) && defined(POSIX_FADV_DONTNEED)
+    if (cold) {
+        fsync(fileno(basis));
+        posix_fadvise(fileno(basis), 0, 0, POSIX_FADV_DONTNEED);
+    }
+#endif
+    start = now();
+    if (mode == 6) {
+        result = rs_patch_parallel(basis, delta, out, 4, &stats);
+    } else if (mode >= 4) {
+        rs_patch_uring = mode == 4;
+        result = rs_patch_ahead(fileno(basis), delta, out, 0, &stats);
+    } else if (mode == 3)
+        result = rs_patch_fds(fileno(basis), delta, fileno(out), &stats);
+    else if (mode == 2)
+        result = rs_patch_mmap(fileno(basis), delta, fileno(out), &stats);
+    else if (mode == 1)
+        result = rs_patch_fd(fileno(basis), delta, out, &stats);
+    else
+        result = rs_patch_file(basis, delta, out, &stats);
+    fflush(out);
+    start = now() - start;
+    if (result != RS_DONE) {
+        fprintf(stderr, "patch failed: %s\n", rs_strerror(result));
+        exit(1);
+    }
+    return start;
+}
+
+int main(int argc, char **argv)
+{
+    long copies = argc > 1 ? atol(argv[1]) : 200000;
+    int len = argc > 2 ? atoi(argv[2]) : 200;
+    uint32_t basis_len = (uint32_t)copies * (len + 16);
+    FILE *basis = tmpfile(), *delta = tmpfile(), *out = tmpfile(),
+        *ref = tmpfile();
+    double t;
+    uint32_t i;
+    int random, mode;
+
+    cold = argc > 3 && !strcmp(argv[3], "cold");
+    for (i = 0; i < basis_len; i += 4)
+        put_netint(basis, rand32(), 4);
+    fflush(basis);
+    for (random = 0; random < 2; random++) {
+        write_delta(delta, copies, len, basis_len, random);
+        printf("%ld %s COPY commands of %d bytes:\n", copies,
+               random ? "random" : "sequential", len);
+        for (mode = 0; mode < MODES; mode++) {
+            t = run(basis, delta, mode ? out : ref, mode);
+            if (mode)
+                check(out, ref);
+            printf("  %-30s %.3fs, %.0f copies/s\n", mode_names[mode], t,
+                   copies / t);
+        }
+    }
+    fclose(ref);
+    fclose(out);
+    fclose(delta);
+    fclose(basis);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * sumset_perf -- performance tests for signature match lookups.
+ *
+ * Copyright (C) 2003 by Donovan Baarda <abo@minkirri.apana.org.au>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Usage: sumset_perf [BLOCKS [LOOKUPS]]
+ *
+ * Builds a signature with BLOCKS (default 4M) random block sums and times
+ * LOOKUPS (default 16M) random rs_signature_find_match() calls against it,
+ * first using normal allocations and then with rs_hugepages enabled. One in 16
+ * lookups uses the weak sum of an existing block, so they also probe the
+ * entry table and block sums like a delta scan with some weak sum hits.
+ *
+ * Huge pages only make a difference when the tables are much bigger than what
+ * the TLB can cover, so try BLOCKS=16777216 (about 600MB) for a big file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include "librsync.h"
+#include "sumset.h"
+
+static uint32_t rand_state = 0x12345678;
+
+/* A simple xorshift PRNG so results are repeatable. */
+static uint32_t rand32(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static double run(int blocks, long lookups)
+{
+    rs_signature_t sig;
+    rs_strong_sum_t strong = { 0 };
+    rs_weak_sum_t *weaks;
+    unsigned char buf[16] = { 0 };
+    clock_t start;
+    long i, matches = 0;
+    int j;
+
+    rand_state = 0x12345678;
+    weaks = malloc(blocks * sizeof(*weaks));
+    rs_signature_init(&sig, RS_RK_BLAKE2_SIG_MAGIC, 16, 8, -1);
+    for (j = 0; j < blocks; j++) {
+        weaks[j] = rand32();
+        *(uint32_t *)strong = rand32();
+        rs_signature_add_block(&sig, weaks[j], &strong);
+    }
+    rs_build_hash_table(&sig);
+    start = clock();
+    for (i = 0; i < lookups; i++) {
+        rs_weak_sum_t weak = rand32();
+        if (!(weak & 15))
+            weak = weaks[weak % blocks];
+        if (rs_signature_find_match(&sig, weak, buf, sizeof(buf)) >= 0)
+            matches++;
+    }
+    start = clock() - start;
+    rs_signature_done(&sig);
+    free(weaks);
+    printf("  %ld lookups, %ld matches\n", lookups, matches);
+    return (double)start / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+    int blocks = argc > 1 ? atoi(argv[1]) : 4 << 20;
+    long lookups = argc > 2 ? atol(argv[2]) : 16L << 20;
+    double t;
+
+    printf("signature with %d blocks:\n", blocks);
+    rs_hugepages = 0;
+    t = run(blocks, lookups);
+    printf("normal pages: %.3fs, %.2f Mlookups/s\n", t, lookups / t / 1e6);
+    rs_hugepages = 1;
+    t = run(blocks, lookups);
+    printf("huge pages:   %.3fs, %.2f Mlookups/s\n", t, lookups / t / 1e6);
+    return 0;
+}
@@ -86,6 +86,89 @@ triple_test () {
     run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta $tmpdir/sig $new $tmpdir/delta
     run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
     check_compare $new $tmpdir/new "triple -f -I$buf -O$buf $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -j4 $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple -f -j4 $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats --block-size=$block_len --signature=$tmpdir/newsig \
+             patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --signature -I$buf -O$buf $old $new"
+    run_test ${RDIFF} $debug $hashopt -f signature --block-size=$block_len $new $tmpdir/sig2
+    check_compare $tmpdir/sig2 $tmpdir/newsig "triple --signature sig $old $new"
+    run_test ${RDIFF} $debug $hashopt -f $stats newsig $tmpdir/sig $old $tmpdir/delta $tmpdir/newsig
+    check_compare $tmpdir/sig2 $tmpdir/newsig "triple newsig $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats --block-size=$block_len --signature=$tmpdir/newsig \
+             delta $tmpdir/sig $new $tmpdir/delta
+    check_compare $tmpdir/sig2 $tmpdir/newsig "triple delta --signature -I$buf -O$buf $old $new"
+    cat $old $new >$tmpdir/appended
+    cp $tmpdir/sig $tmpdir/newsig
+    run_test ${RDIFF} $debug -I$buf -O$buf $stats signature --append $tmpdir/appended $tmpdir/newsig
+    run_test ${RDIFF} $debug $hashopt -f signature --block-size=$block_len $tmpdir/appended $tmpdir/sig2
+    check_compare $tmpdir/sig2 $tmpdir/newsig "triple signature --append -I$buf -O$buf $old $new"
+    size=`wc -c <$new`
+    mid=$(( size / 2 / block_len * block_len ))
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf --block-size=$block_len sigrange $new 0 $mid $tmpdir/range1
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf --block-size=$block_len sigrange $new $mid $size $tmpdir/range2
+    run_test ${RDIFF} $debug -f $stats sigmerge $tmpdir/newsig $tmpdir/range1 $tmpdir/range2
+    run_test ${RDIFF} $debug $hashopt -f signature --block-size=$block_len $new $tmpdir/sig2
+    check_compare $tmpdir/sig2 $tmpdir/newsig "triple sigrange -I$buf -O$buf $new"
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats --digest signature --block-size=$block_len $old $tmpdir/sig2
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta --checksum $tmpdir/sig2 $old $tmpdir/delta
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $old $tmpdir/new "triple --digest same -I$buf -O$buf $old"
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta --checksum $tmpdir/sig2 $new $tmpdir/delta
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --digest -I$buf -O$buf $old $new"
+    for strong_len in 1 2 4; do
+        run_test ${RDIFF} $debug $hashopt -f --digest signature --block-size=$block_len --sum-size=$strong_len $old $tmpdir/sig2
+        run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta $tmpdir/sig2 $new $tmpdir/delta
+        run_test ${RDIFF} $debug $hashopt -f $stats patch $old $tmpdir/delta $tmpdir/new
+        check_compare $new $tmpdir/new "triple --digest --sum-size=$strong_len -I$buf -O$buf $old $new"
+    done
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats --cdc --digest signature --block-size=$block_len $old $tmpdir/sig2
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta --checksum $tmpdir/sig2 $new $tmpdir/delta
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --cdc -I$buf -O$buf $old $new"
+    cp $old $tmpdir/new
+    run_test ${RDIFF} $debug $hashopt $stats --in-place patch $tmpdir/new $tmpdir/delta
+    check_compare $new $tmpdir/new "triple --in-place patch $old $new"
+    run_test ${RDIFF} $debug $hashopt -f $stats --in-place delta $tmpdir/sig $new $tmpdir/delta
+    cp $old $tmpdir/new
+    run_test ${RDIFF} $debug $hashopt $stats --in-place patch $tmpdir/new $tmpdir/delta
+    check_compare $new $tmpdir/new "triple --in-place delta $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta --checksum $tmpdir/sig $new $tmpdir/delta
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --checksum -I$buf -O$buf $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -j4 $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --checksum -j4 $old $new"
+    cp $old $tmpdir/new
+    run_test ${RDIFF} $debug $hashopt $stats --in-place patch $tmpdir/new $tmpdir/delta
+    check_compare $new $tmpdir/new "triple --checksum --in-place $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta --window=65536 --checksum $tmpdir/sig $new $tmpdir/delta
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --window -I$buf -O$buf $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -j4 $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --window -j4 $old $new"
+    cp $old $tmpdir/new
+    run_test ${RDIFF} $debug $hashopt $stats --in-place patch $tmpdir/new $tmpdir/delta
+    check_compare $new $tmpdir/new "triple --window --in-place $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta --compact --checksum $tmpdir/sig $new $tmpdir/delta
+    run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --compact -I$buf -O$buf $old $new"
+    run_test ${RDIFF} $debug $hashopt -f -j4 $stats patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --compact -j4 $old $new"
+    cp $old $tmpdir/new
+    run_test ${RDIFF} $debug $hashopt $stats --in-place patch $tmpdir/new $tmpdir/delta
+    check_compare $new $tmpdir/new "triple --compact --in-place $old $new"
+    if ${RDIFF} --version | grep -q gzip; then
+        run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats delta --gzip $tmpdir/sig $new $tmpdir/delta
+        run_test ${RDIFF} $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
+        check_compare $new $tmpdir/new "triple --gzip -I$buf -O$buf $old $new"
+        run_test ${RDIFF} $debug $hashopt -f -j4 $stats patch $old $tmpdir/delta $tmpdir/new
+        check_compare $new $tmpdir/new "triple --gzip -j4 $old $new"
+        run_test ${RDIFF} $debug $hashopt -f --gzip --checksum delta $tmpdir/sig $new $tmpdir/delta
+        cp $old $tmpdir/new
+        run_test ${RDIFF} $debug $hashopt $stats --in-place patch $tmpdir/new $tmpdir/delta
+        check_compare $new $tmpdir/new "triple --gzip --in-place $old $new"
+    fi
 }
 
 make_input () {